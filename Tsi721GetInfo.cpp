@@ -28,32 +28,21 @@ device driver.
 #include <conio.h> // for _getch()
 
 #include "tsi721api.h"
+#include "tsi721dev.h"
 #include "Tsi721GetInfo.h"
+#include "tsi721csr.h"
+#include "tsi721trace.h"
+#include "tsi721stat.h"
+#include "tsi721dma.h"
+#include "tsi721msg.h"
 
 #pragma comment(lib,"tsi721_api.lib")
 
 #define DMA_BUF_SIZE (2 * 1024 * 1024)
+#define DMA_CHUNK_SIZE  (64 * 1024) // size of a single BDMA request issued by the transfer engine
 
-#define RIO_DEV_ID_CAR              (0x000000)
-#define RIO_BASE_ID_CSR             (0x000060)
-#define RIO_COMPONENT_TAG_CSR       (0x00006C)
-
-#define RIO_PORT_GEN_CTRL_CSR       (0x00013C)
-#define RIO_PORT_N_ERR_STAT_CSR     (0x000158)
-
-
-#define RIO_PE_FEAT                 (0x000010)
-#define RIO_SR_XADDR                (0x00004c)
-#define RIO_HOST_BASE_ID_LOCK       (0x000068)
-#define RIO_SP_LM_REQ               (0x000140)
-#define RIO_SP_LM_RESP              (0x000144)
-#define RIO_SP_ACKID_STAT           (0x000148)
-#define RIO_SP_CTL2                 (0x000154)
-
-
-#define RIO_SP_ERR_DET              (0x001040)
-#define RIO_SP_RATE_EN              (0x001044)
-
+#define SWEEP_MSG_COUNT     2000    // MSG_MAX_SIZE messages sent to MBOX0 at every link rate
+#define SWEEP_TRAIN_TIMEOUT 2000    // ms allowed for the port to report PORT_OK after retraining
 
 #define TSI721_DEV_ID                0x80ab0038
 
@@ -81,6 +70,41 @@ HANDLE hEvent = NULL;
 EVB_THREAD_PARAM evbThreadParam[MAINT_THR_NUM + DATA_THR_NUM];
 volatile BOOL bQuitThread = FALSE;
 
+//
+// Local CSRs reported by this program, read with one snapshot
+//
+static const DWORD g_infoReg[] = {
+	RIO_PE_FEAT, RIO_SR_XADDR, RIO_HOST_BASE_ID_LOCK, RIO_SP_LM_REQ, RIO_SP_LM_RESP,
+	RIO_SP_ACKID_STAT, RIO_SP_CTL2, RIO_PORT_N_ERR_STAT_CSR, RIO_SP_ERR_DET, RIO_SP_RATE_EN
+};
+
+#define INFO_REG_NUM (sizeof(g_infoReg) / sizeof(g_infoReg[0]))
+
+// RIO_SP_CTL2 baud rate enables selected by 'repeat' in MODE 1
+static const DWORD g_infoCtl2[] = {
+	RIO_SP_CTL2_GB_1P25_EN, RIO_SP_CTL2_GB_2P5_EN, RIO_SP_CTL2_GB_3P125_EN, RIO_SP_CTL2_GB_5P0_EN
+};
+
+// Lane rates stepped through by the MODE 2 sweep
+typedef struct _INFO_RATE {
+	PCSTR Name;	// Gbaud
+	DWORD Ctl2En;	// RIO_SP_CTL2 enable bit
+} INFO_RATE, *PINFO_RATE;
+
+static const INFO_RATE g_infoRate[] = {
+	{ "1.25",  RIO_SP_CTL2_GB_1P25_EN },
+	{ "2.5",   RIO_SP_CTL2_GB_2P5_EN },
+	{ "3.125", RIO_SP_CTL2_GB_3P125_EN },
+	{ "5.0",   RIO_SP_CTL2_GB_5P0_EN },
+	{ "6.25",  RIO_SP_CTL2_GB_6P25_EN },
+};
+
+#define INFO_RATE_NUM (sizeof(g_infoRate) / sizeof(g_infoRate[0]))
+
+static DWORD info_csr_monitor(HANDLE hDev, PCSR_SNAP pSnap, DWORD count, DWORD intervalMs);
+static DWORD info_link_retrain(HANDLE hDev, DWORD ctl2, PDWORD pErrStat, PULONGLONG pNs);
+static DWORD info_speed_sweep(HANDLE hDev, DWORD devNum, DWORD destId, PVOID pBuf, DWORD passes);
+
 int main(int argc, char* argv[])
 {
 	PVOID  obBuf = NULL; // outbound data buffer
@@ -89,15 +113,20 @@ int main(int argc, char* argv[])
 	DWORD  devNum = 0;
 	DWORD  destId = 0; // arbitrary value (different from one assigned to the target)
 	DWORD  partnDestId, dwRegVal;
-	DWORD  dwDataSize;
-	DMA_REQ_CTRL dmaCtrl;
-	int rnum;
-	DWORD  i, dwErr, pass, MODE, repeat = 1;
+	DWORD  i, dwErr, MODE = 0, repeat = 1;
+	DWORD  intervalMs = 1000;
+	DWORD  regVal[INFO_REG_NUM];
+	PCSR_SNAP pSnap = NULL;
+	ULONGLONG t0;
+	char  *tracePath;
 
 	if (argc == 1) {
 		printf_s("Missing Tsi721 device index\n");
 		printf_s("Usage:\n");
-		printf_s("   master <dev_idx> [local_destID [repeat]]\n");
+		printf_s("   master <dev_idx> [local_destID [repeat [mode [interval_ms]]]]\n");
+		printf_s("   mode 1: set port baud rate enable selected by repeat (1-4)\n");
+		printf_s("   mode 2: measure throughput at every supported lane rate (repeat = DMA passes)\n");
+		printf_s("   mode 3: take repeat CSR snapshots every interval_ms\n");
 		return 0;
 	}
 
@@ -109,6 +138,21 @@ int main(int argc, char* argv[])
 		repeat = atoi(argv[3]);
 	if (argc > 4)
 		MODE = atoi(argv[4]);
+	if (argc > 5)
+		intervalMs = atoi(argv[5]);
+
+	//
+	// Device backend is selected by TSI721_DEV ("hw" or "emu[:options]")
+	//
+	if (tsi721_dev_select(NULL) != ERROR_SUCCESS)
+		return 0;
+
+	//
+	// Event tracing is enabled by naming the trace file in TSI721_TRACE
+	//
+	tracePath = getenv("TSI721_TRACE");
+	if (tracePath != NULL && tsi721_trace_open(tracePath, 0) == ERROR_SUCCESS)
+		printf_s("Tracing to %s\n", tracePath);
 	//
 	// Pause to allow user to start the target.
 	//
@@ -117,7 +161,7 @@ int main(int argc, char* argv[])
 #pragma warning(suppress: 6031)
 	_getch();
 
-	if (!TSI721DeviceOpen(&hDev, devNum, NULL)) {
+	if (!g_devOps->DeviceOpen(&hDev, devNum, NULL)) {
 		printf_s("(%d) Unable to open device Tsi721_%d\n", __LINE__, devNum);
 		return 0;
 	}
@@ -130,7 +174,7 @@ int main(int argc, char* argv[])
 		goto exit;
 	}
 
-	TSI721PciCfgRead(hDev, 0x10, &dwRegVal);
+	g_devOps->PciCfgRead(hDev, 0x10, &dwRegVal);
 	printf_s("Opened Tsi721_%d (BAR0=0x%08x)\n", devNum, dwRegVal);
 
 	ZeroMemory(obBuf, DMA_BUF_SIZE);
@@ -140,140 +184,47 @@ int main(int argc, char* argv[])
 	destId = destId & 0xff;
 	destId = 22;
 	// Set SRIO destID assigned to Tsi721
-	dwErr = TSI721SetLocalHostId(hDev, destId);
+	dwErr = g_devOps->SetLocalHostId(hDev, destId);
 	if (dwErr != ERROR_SUCCESS) {
 		printf_s("(%d) Set Local Host ID failed, err = 0x%x\n", __LINE__, dwErr);
 		goto exit;
 	}
-	//for (int i = 0; i < 2; i++) {
-		/*******************************************************************/
-		dwErr = TSI721RegisterRead(hDev, RIO_PE_FEAT, 1, &dwRegVal);
-
-		if (dwErr != ERROR_SUCCESS) {
-			printf_s("(%d) Read port status failed, err = 0x%x\n", __LINE__, dwErr);
-			goto exit;
-		}
-		printf_s("LB: Register RIO_PE_FEAT status = 0x%08x\n", dwRegVal);
-
-		dwErr = TSI721RegisterRead(hDev, RIO_SR_XADDR, 1, &dwRegVal);
-
-		if (dwErr != ERROR_SUCCESS) {
-			printf_s("(%d) Read port status failed, err = 0x%x\n", __LINE__, dwErr);
-			goto exit;
-		}
-		printf_s("LB: Register RIO_SR_XADDR status = 0x%08x\n", dwRegVal);
-
-		dwErr = TSI721RegisterRead(hDev, RIO_HOST_BASE_ID_LOCK, 1, &dwRegVal);
-
-		if (dwErr != ERROR_SUCCESS) {
-			printf_s("(%d) Read port status failed, err = 0x%x\n", __LINE__, dwErr);
-			goto exit;
-		}
-		printf_s("LB: Register RIO_HOST_BASE_ID_LOCK status = 0x%08x\n", dwRegVal);
-
-		dwErr = TSI721RegisterRead(hDev, RIO_SP_LM_REQ, 1, &dwRegVal);
-
+	if (MODE == 1 && repeat >= 1 && repeat <= 4) {
+		dwErr = g_devOps->RegisterWrite(hDev, RIO_SP_CTL2, g_infoCtl2[repeat - 1]);
 		if (dwErr != ERROR_SUCCESS) {
-			printf_s("(%d) Read port status failed, err = 0x%x\n", __LINE__, dwErr);
+			printf_s("(%d) write port status failed, err = 0x%x\n", __LINE__, dwErr);
 			goto exit;
 		}
-		printf_s("LB: Register RIO_SP_LM_REQ status = 0x%08x\n", dwRegVal);
-
-		dwErr = TSI721RegisterRead(hDev, RIO_SP_LM_RESP, 1, &dwRegVal);
-
-		if (dwErr != ERROR_SUCCESS) {
-			printf_s("(%d) Read port status failed, err = 0x%x\n", __LINE__, dwErr);
-			goto exit;
-		}
-		printf_s("LB: Register RIO_SP_LM_RESP status = 0x%08x\n", dwRegVal);
-
-		dwErr = TSI721RegisterRead(hDev, RIO_SP_ACKID_STAT, 1, &dwRegVal);
-
-		if (dwErr != ERROR_SUCCESS) {
-			printf_s("(%d) Read port status failed, err = 0x%x\n", __LINE__, dwErr);
-			goto exit;
-		}
-		printf_s("LB: Register RIO_SP_ACKID_STAT status = 0x%08x\n", dwRegVal);
-
-		if (MODE == 1) {
-
-			if (repeat == 1) {
-				dwErr = TSI721RegisterWrite(hDev, RIO_SP_CTL2, 0x01000000);
-				if (dwErr != ERROR_SUCCESS) {
-					printf_s("(%d) write port status failed, err = 0x%x\n", __LINE__, dwErr);
-					goto exit;
-				}
-			}
-			if (repeat == 2) {
-				dwErr = TSI721RegisterWrite(hDev, RIO_SP_CTL2, 0x00400000);
-				if (dwErr != ERROR_SUCCESS) {
-					printf_s("(%d) write port status failed, err = 0x%x\n", __LINE__, dwErr);
-					goto exit;
-				}
-			}
-
-			if (repeat == 3) {
-				dwErr = TSI721RegisterWrite(hDev, RIO_SP_CTL2, 0x00100000);
-				if (dwErr != ERROR_SUCCESS) {
-					printf_s("(%d) write port status failed, err = 0x%x\n", __LINE__, dwErr);
-					goto exit;
-				}
-			}
-			if (repeat == 4) {
-				dwErr = TSI721RegisterWrite(hDev, RIO_SP_CTL2, 0x00040000);
-				if (dwErr != ERROR_SUCCESS) {
-					printf_s("(%d) write port status failed, err = 0x%x\n", __LINE__, dwErr);
-					goto exit;
-				}
-			}
-		}
-		dwErr = TSI721RegisterRead(hDev, RIO_SP_CTL2, 1, &dwRegVal);
-
-		if (dwErr != ERROR_SUCCESS) {
-			printf_s("(%d) Read port status failed, err = 0x%x\n", __LINE__, dwErr);
-			goto exit;
-		}
-		printf_s("LB: Register RIO_SP_CTL2 status = 0x%08x\n", dwRegVal);
-
-		dwErr = TSI721RegisterRead(hDev, RIO_PORT_N_ERR_STAT_CSR, 1, &dwRegVal);
-
-		if (dwErr != ERROR_SUCCESS) {
-			printf_s("(%d) Read port status failed, err = 0x%x\n", __LINE__, dwErr);
-			goto exit;
-		}
-		printf_s("LB: Register RIO_PORT_N_ERR_STAT_CSR status = 0x%08x\n", dwRegVal);
-
-
-		/**********************************************************************/
-
-		dwErr = TSI721RegisterRead(hDev, RIO_SP_ERR_DET, 1, &dwRegVal);
+	}
 
-		if (dwErr != ERROR_SUCCESS) {
-			printf_s("(%d) Read port status failed, err = 0x%x\n", __LINE__, dwErr);
-			goto exit;
-		}
-		printf_s("LB: ERROR Register RIO_SP_ERR_DET status = 0x%08x\n", dwRegVal);
+	//
+	// Read all reported CSRs in as few block reads as possible
+	//
+	dwErr = tsi721_csr_snap_create(g_infoReg, INFO_REG_NUM, CSR_DEF_GAP, &pSnap);
+	if (dwErr != ERROR_SUCCESS) {
+		printf_s("(%d) Failed to create CSR snapshot, err = 0x%x\n", __LINE__, dwErr);
+		goto exit;
+	}
 
-		dwErr = TSI721RegisterRead(hDev, RIO_SP_RATE_EN, 1, &dwRegVal);
+	if (MODE == 3) {
+		info_csr_monitor(hDev, pSnap, repeat, intervalMs);
+		goto exit;
+	}
 
-		if (dwErr != ERROR_SUCCESS) {
-			printf_s("(%d) Read port status failed, err = 0x%x\n", __LINE__, dwErr);
-			goto exit;
-		}
-		printf_s("LB: ERROR Register RIO_SP_RATE_EN status = 0x%08x\n", dwRegVal);
+	dwErr = tsi721_csr_snap_read(hDev, pSnap, regVal);
+	if (dwErr != ERROR_SUCCESS) {
+		printf_s("(%d) Read port status failed, err = 0x%x\n", __LINE__, dwErr);
+		goto exit;
+	}
 
-	//	dwErr = TSI721RegisterWrite(hDev, RIO_SP_LM_REQ, 0x00000003);
-	//	if (dwErr != ERROR_SUCCESS) {
-	//		printf_s("(%d) write port status failed, err = 0x%x\n", __LINE__, dwErr);
-	//		goto exit;
-	//	}
-	//}
+	for (i = 0; i < INFO_REG_NUM; i++)
+		tsi721_csr_print("LB: ", g_infoReg[i], regVal[i]);
 
 	/**********************************************************************/
 	//
 	// Check if SRIO port link is OK
 	//
-	dwErr = TSI721RegisterRead(hDev, RIO_PORT_N_ERR_STAT_CSR, 1, &dwRegVal);
+	dwErr = tsi721_csr_read(hDev, RIO_PORT_N_ERR_STAT_CSR, &dwRegVal);
 
 	if (dwErr != ERROR_SUCCESS) {
 		printf_s("(%d) Read port status failed, err = 0x%x\n", __LINE__, dwErr);
@@ -299,13 +250,15 @@ int main(int argc, char* argv[])
 
 	// Read device ID register
 
-	dwErr = TSI721SrioMaintRead(hDev, 0, 0, RIO_DEV_ID_CAR, &dwRegVal);
+	t0 = lat_ticks();
+	dwErr = g_devOps->SrioMaintRead(hDev, 0, 0, RIO_DEV_ID_CAR, &dwRegVal);
+	tsi721_trace(TRACE_EV_MAINT_READ, dwErr, 0, RIO_DEV_ID_CAR, dwRegVal, t0);
 
 	if (dwErr != ERROR_SUCCESS) {
 		printf_s("(%d) Failed to read partner device ID, err = 0x%x\n", __LINE__, dwErr);
 
 		// Check if SRIO port link is OK
-		dwErr = TSI721RegisterRead(hDev, RIO_PORT_N_ERR_STAT_CSR, 1, &dwRegVal);
+		dwErr = tsi721_csr_read(hDev, RIO_PORT_N_ERR_STAT_CSR, &dwRegVal);
 
 		if (dwErr != ERROR_SUCCESS) {
 			printf_s("(%d) Read port status failed, err = 0x%x\n", __LINE__, dwErr);
@@ -319,21 +272,303 @@ int main(int argc, char* argv[])
 
 	// Read partner device destID register
 
-	dwErr = TSI721SrioMaintRead(hDev, 0, 0, RIO_BASE_ID_CSR, &partnDestId);
+	t0 = lat_ticks();
+	dwErr = g_devOps->SrioMaintRead(hDev, 0, 0, RIO_BASE_ID_CSR, &partnDestId);
+	tsi721_trace(TRACE_EV_MAINT_READ, dwErr, 0, RIO_BASE_ID_CSR, partnDestId, t0);
 
 	if (dwErr != ERROR_SUCCESS) {
 		printf_s("(%d) Failed to read partner destID, err = 0x%x\n", __LINE__, dwErr);
 		goto exit;
 	}
-	 
-	
+
+	partnDestId = (partnDestId >> 16) & 0xff;
+
+	printf_s("Tsi721 attached to device 0x%08x (destID=%d)\n", dwRegVal, partnDestId);
+
+	if (MODE == 2)
+		info_speed_sweep(hDev, devNum, partnDestId, obBuf, repeat);
+
 
 exit:
 
-	TSI721DeviceClose(hDev, NULL);
+	tsi721_csr_snap_free(pSnap);
+
+	g_devOps->DeviceClose(hDev, NULL);
+
+	if (tracePath != NULL)
+		tsi721_trace_close();
 
 	free(obBuf);
 	free(ibBuf);
 
 	return 0;
 }
+
+static DWORD info_csr_monitor(HANDLE hDev, PCSR_SNAP pSnap, DWORD count, DWORD intervalMs)
+/*++
+
+Routine Description:
+
+	Takes a series of CSR snapshots at a fixed interval and prints the
+	first one in full and then only the registers that changed. Sampling
+	runs to completion before anything is printed.
+
+Arguments:
+
+	hDev       - device handle
+	pSnap      - snapshot plan for g_infoReg[]
+	count      - number of snapshots
+	intervalMs - interval between snapshots
+
+Return Value:
+
+	ERROR_SUCCESS or an error code.
+
+--*/
+{
+	PDWORD     pVal;
+	PULONGLONG pTicks;
+	PDWORD     pCur, pPrev;
+	DWORD      i, r, dwErr;
+
+	if (count == 0)
+		count = 1;
+
+	pVal = (PDWORD)malloc((SIZE_T)count * INFO_REG_NUM * sizeof(DWORD));
+	pTicks = (PULONGLONG)malloc((SIZE_T)count * sizeof(ULONGLONG));
+	if (pVal == NULL || pTicks == NULL) {
+		printf_s("(%d) Unable to allocate snapshot buffer\n", __LINE__);
+		dwErr = ERROR_NOT_ENOUGH_MEMORY;
+		goto err_exit;
+	}
+
+	printf_s("Monitoring %d CSRs with %d block reads per snapshot, %d snapshots every %d ms\n",
+		 (int)INFO_REG_NUM, tsi721_csr_snap_reads(pSnap), count, intervalMs);
+
+	dwErr = tsi721_csr_snap_sample(hDev, pSnap, count, intervalMs * 1000, pVal, pTicks);
+	if (dwErr != ERROR_SUCCESS) {
+		printf_s("(%d) CSR sampling failed, err = 0x%x\n", __LINE__, dwErr);
+		goto err_exit;
+	}
+
+	for (i = 0; i < count; i++) {
+		pCur = pVal + (SIZE_T)i * INFO_REG_NUM;
+		pPrev = pCur - INFO_REG_NUM;
+
+		for (r = 0; r < INFO_REG_NUM; r++) {
+			if (i == 0 || pCur[r] != pPrev[r]) {
+				printf_s("%10.3f ms ", (double)lat_ticks_to_ns(pTicks[i] - pTicks[0]) / 1e6);
+				tsi721_csr_print("", g_infoReg[r], pCur[r]);
+			}
+		}
+	}
+
+err_exit:
+	free(pVal);
+	free(pTicks);
+
+	return dwErr;
+}
+
+static DWORD info_link_retrain(HANDLE hDev, DWORD ctl2, PDWORD pErrStat, PULONGLONG pNs)
+/*++
+
+Routine Description:
+
+	Writes the baud rate enables into RIO_SP_CTL2 and forces the link to
+	retrain by toggling PORT_DIS in RIO_SP_CTL, then polls the port status
+	until it reports PORT_OK.
+
+Arguments:
+
+	hDev     - device handle
+	ctl2     - new RIO_SP_CTL2 value
+	pErrStat - last RIO_PORT_N_ERR_STAT_CSR value read
+	pNs      - time from re-enabling the port to PORT_OK
+
+Return Value:
+
+	ERROR_SUCCESS, ERROR_TIMEOUT if the link did not come up or an error code.
+
+--*/
+{
+	DWORD     spCtl, dwErr;
+	ULONGLONG t0;
+
+	*pErrStat = 0;
+	*pNs = 0;
+
+	dwErr = g_devOps->RegisterWrite(hDev, RIO_SP_CTL2, ctl2);
+	if (dwErr != ERROR_SUCCESS)
+		return dwErr;
+
+	dwErr = tsi721_csr_read(hDev, RIO_SP_CTL, &spCtl);
+	if (dwErr != ERROR_SUCCESS)
+		return dwErr;
+
+	dwErr = g_devOps->RegisterWrite(hDev, RIO_SP_CTL, spCtl | RIO_SP_CTL_PORT_DIS);
+	if (dwErr != ERROR_SUCCESS)
+		return dwErr;
+
+	Sleep(10);
+
+	dwErr = g_devOps->RegisterWrite(hDev, RIO_SP_CTL, spCtl & ~RIO_SP_CTL_PORT_DIS);
+	if (dwErr != ERROR_SUCCESS)
+		return dwErr;
+
+	t0 = lat_ticks();
+
+	for (;;) {
+		dwErr = tsi721_csr_read(hDev, RIO_PORT_N_ERR_STAT_CSR, pErrStat);
+		if (dwErr != ERROR_SUCCESS)
+			return dwErr;
+
+		*pNs = lat_ticks_to_ns(lat_ticks() - t0);
+
+		if ((*pErrStat & RIO_PORT_N_ERR_STAT_PORT_OK) &&
+		    !(*pErrStat & RIO_PORT_N_ERR_STAT_STOPPED))
+			return ERROR_SUCCESS;
+
+		if (*pNs > (ULONGLONG)SWEEP_TRAIN_TIMEOUT * 1000000)
+			return ERROR_TIMEOUT;
+
+		Sleep(1);
+	}
+}
+
+static DWORD info_speed_sweep(HANDLE hDev, DWORD devNum, DWORD destId, PVOID pBuf, DWORD passes)
+/*++
+
+Routine Description:
+
+	Steps the port through every lane rate it supports. At each rate the
+	link is retrained, RIO_SP_ERR_DET and the error rate counter are
+	cleared, a fixed workload of BDMA writes and MBOX0 messages is run and
+	the measured throughput is tabulated with the number and kinds of
+	errors detected during the workload. The original RIO_SP_CTL2,
+	RIO_SP_RATE_EN and RIO_SP_ERR_RATE settings are restored at the end.
+
+Arguments:
+
+	hDev    - device handle
+	devNum  - device index (the message sender opens its own handle)
+	destId  - destID of the link partner
+	pBuf    - DMA_BUF_SIZE data buffer
+	passes  - DMA_BUF_SIZE writes per rate
+
+Return Value:
+
+	ERROR_SUCCESS or an error code.
+
+--*/
+{
+	PDMA_ENGINE    pEng = NULL;
+	DMA_REQ_CTRL   dmaCtrl;
+	MSG_SEND_CFG   msgCfg;
+	MSG_SEND_STATS msgStats;
+	DWORD          ctl2Orig, ctl2, errStat, errDet, dmaErr, msgErr;
+	DWORD          rateEnOrig = 0, errRateOrig = 0, errRate;
+	DWORD          r, p, dwErr;
+	ULONGLONG      t0, dmaNs, trainNs;
+	double         dmaMBps, msgMBps;
+
+	if (passes == 0)
+		passes = 1;
+
+	dwErr = tsi721_csr_read(hDev, RIO_SP_CTL2, &ctl2Orig);
+	if (dwErr != ERROR_SUCCESS) {
+		printf_s("(%d) Read port control 2 failed, err = 0x%x\n", __LINE__, dwErr);
+		return dwErr;
+	}
+
+	dwErr = tsi721_dma_create(hDev, NULL, 0, NULL, &pEng);
+	if (dwErr != ERROR_SUCCESS) {
+		printf_s("(%d) Failed to create DMA transfer engine, err = 0x%x\n", __LINE__, dwErr);
+		return dwErr;
+	}
+
+	// Count every error type, without decrementing the count over time
+	tsi721_csr_read(hDev, RIO_SP_RATE_EN, &rateEnOrig);
+	tsi721_csr_read(hDev, RIO_SP_ERR_RATE, &errRateOrig);
+	g_devOps->RegisterWrite(hDev, RIO_SP_RATE_EN, 0xffffffff);
+
+	dmaCtrl.bits.Iof = 0;
+	dmaCtrl.bits.Crf = 0;
+	dmaCtrl.bits.Prio = 0;
+	dmaCtrl.bits.Rtype = LAST_NWRITE_R;
+	dmaCtrl.bits.XAddr = 0;
+
+	ZeroMemory(&msgCfg, sizeof(msgCfg));
+	msgCfg.DestId = destId;
+	msgCfg.MsgSize = MSG_MAX_SIZE;
+	msgCfg.MsgCount = SWEEP_MSG_COUNT;
+	msgCfg.Seed = GetTickCount();
+
+	printf_s("\nLink rate sweep: %d x %d bytes BDMA write, %d x %d bytes MBOX0 messages per rate\n",
+		 passes, DMA_BUF_SIZE, SWEEP_MSG_COUNT, MSG_MAX_SIZE);
+	printf_s("%-8s %8s %9s %10s %10s %8s %8s %8s %10s %10s\n", "gbaud", "sel_baud", "train_ms",
+		 "dma_MBps", "msg_MBps", "dma_err", "msg_err", "link_err", "err_det", "err_stat");
+
+	for (r = 0; r < INFO_RATE_NUM; r++) {
+		if (!(ctl2Orig & (g_infoRate[r].Ctl2En << 1))) {
+			printf_s("%-8s not supported by the port\n", g_infoRate[r].Name);
+			continue;
+		}
+
+		dwErr = info_link_retrain(hDev, (ctl2Orig & ~RIO_SP_CTL2_GB_EN_MASK) | g_infoRate[r].Ctl2En,
+					  &errStat, &trainNs);
+		if (dwErr != ERROR_SUCCESS) {
+			printf_s("%-8s link not up after retraining, err = 0x%x, status = 0x%08x\n",
+				 g_infoRate[r].Name, dwErr, errStat);
+			continue;
+		}
+
+		tsi721_csr_read(hDev, RIO_SP_CTL2, &ctl2);
+
+		// Count only errors detected while the workload runs
+		g_devOps->RegisterWrite(hDev, RIO_SP_ERR_DET, 0);
+		g_devOps->RegisterWrite(hDev, RIO_SP_ERR_RATE, 0);
+
+		dmaErr = 0;
+		t0 = lat_ticks();
+		for (p = 0; p < passes; p++) {
+			dwErr = tsi721_dma_xfer(pEng, DMA_DIR_WRITE, destId, 0, 0, pBuf, DMA_BUF_SIZE,
+						DMA_CHUNK_SIZE, dmaCtrl);
+			if (dwErr != ERROR_SUCCESS)
+				dmaErr++;
+		}
+		dmaNs = lat_ticks_to_ns(lat_ticks() - t0);
+		dmaMBps = (double)(passes - dmaErr) * DMA_BUF_SIZE / (1024.0 * 1024.0) /
+			  ((double)max(dmaNs, 1ULL) / 1e9);
+
+		ZeroMemory(&msgStats, sizeof(msgStats));
+		tsi721_msg_send_run(devNum, &msgCfg, &msgStats);
+		msgMBps = msgStats.Mbox[0].MBps;
+		msgErr = (DWORD)msgStats.Mbox[0].Errors;
+
+		tsi721_csr_read(hDev, RIO_SP_ERR_RATE, &errRate);
+		tsi721_csr_read(hDev, RIO_SP_ERR_DET, &errDet);
+		tsi721_csr_read(hDev, RIO_PORT_N_ERR_STAT_CSR, &errStat);
+
+		// link_err: errors counted (saturates at 255), err_det: their kinds
+		printf_s("%-8s %8d %9.1f %10.1f %10.1f %8d %8d %7d%s 0x%08x 0x%08x\n", g_infoRate[r].Name,
+			 RIO_SP_CTL2_SEL_BAUD(ctl2), (double)trainNs / 1e6, dmaMBps, msgMBps,
+			 dmaErr, msgErr, RIO_SP_ERR_RATE_CNT(errRate),
+			 (RIO_SP_ERR_RATE_CNT(errRate) == 0xff) ? "+" : " ", errDet, errStat);
+
+		if (errDet)
+			tsi721_csr_print("         ", RIO_SP_ERR_DET, errDet);
+	}
+
+	dwErr = info_link_retrain(hDev, ctl2Orig, &errStat, &trainNs);
+	if (dwErr != ERROR_SUCCESS)
+		printf_s("(%d) Link not up after restoring RIO_SP_CTL2 = 0x%08x, err = 0x%x\n",
+			 __LINE__, ctl2Orig, dwErr);
+
+	g_devOps->RegisterWrite(hDev, RIO_SP_RATE_EN, rateEnOrig);
+	g_devOps->RegisterWrite(hDev, RIO_SP_ERR_RATE, errRateOrig);
+
+	tsi721_dma_destroy(pEng);
+
+	return dwErr;
+}
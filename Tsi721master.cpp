@@ -52,9 +52,9 @@ data transfers between two TSI721 devices directly connected via SRIO link.
 This program demonstrates how to use IDT TSI721 API routines for provided Windows
 device driver.
 
-NOTE: If inbound window initialization (TSI721CfgR2pWin) fails on a test system, DMA_BUF_SIZE
-has to be reduced. Normally this failure is caused by system's inability to allocate a common
-buffer of the specified size and alignment.
+NOTE: If inbound window initialization (TSI721CfgR2pWin) fails on a test system, the window
+is mapped with a smaller size. Normally this failure is caused by system's inability to allocate
+a common buffer of the specified size and alignment.
 
 --*/
 
@@ -66,6 +66,16 @@ buffer of the specified size and alignment.
 #include <conio.h> // for _getch()
 
 #include "tsi721api.h"
+#include "tsi721dev.h"
+#include "tsi721crc.h"
+#include "tsi721db.h"
+#include "tsi721dbdisp.h"
+#include "tsi721ibwin.h"
+#include "tsi721msgrx.h"
+#include "tsi721pattern.h"
+#include "tsi721ring.h"
+#include "tsi721seg.h"
+#include "tsi721trace.h"
 #include "target.h"
 
 #ifdef _DEBUG
@@ -89,8 +99,6 @@ buffer of the specified size and alignment.
 #define DATA_THR_NUM    5   // number of threads doing Data Rd/Wr requests
 #define DATA_THR_LOOP   10  // loop counter for Data Rd/Wr threads
 
-#define IMSG_BUF_NUM 32     // Number of pending Inbound message buffers (per MBOX)
-
 typedef struct _EVB_THREAD_PARAM {
 	HANDLE hDev;
 	DWORD  DestId;  // Destination ID of the SRIO target device
@@ -99,58 +107,115 @@ typedef struct _EVB_THREAD_PARAM {
 	DWORD  Id;      // ID assigned to a new thread
 } EVB_THREAD_PARAM, *PEVB_THREAD_PARAM;
 
-typedef struct _MSG_CONTEXT {
-	OVERLAPPED  Ovl;
-	PUCHAR      BufPtr;
-	ULONG       Id;
-} MSG_CONTEXT, *PMSG_CONTEXT;
-
-static VOID tsi721_db_print(PVOID pDbData, ULONG DbCount);
-static VOID tsi721_msg_print(DWORD dwMbox, DWORD dwSrc, PVOID MsgBuf);
-static VOID tsi721_db_thread(PVOID params);
-static VOID tsi721_msgrcv_thread(PVOID params);
-static VOID tsi721_db_start_thread(HANDLE hDev);
+static VOID tsi721_db_print(PVOID pCtx, PIB_DB_ENTRY pDb);
+static VOID tsi721_msg_print(PVOID pCtx, DWORD dwMbox, DWORD dwSrc, PVOID MsgBuf, DWORD dwSize);
+static VOID tsi721_seg_check(PVOID pCtx, DWORD dwSrc, USHORT wStreamId, DWORD dwSeq, PVOID pData, DWORD dwSize);
+static VOID tsi721_db_ping_echo(PVOID pCtx, PIB_DB_ENTRY pDb);
+static VOID tsi721_db_start_thread(HANDLE hDev, DWORD dwSpinUs, BOOL bVerbose);
 static VOID tsi721_db_stop_thread(VOID);
-static VOID tsi721_msgrcv_start_thread(DWORD dwMbox);
-static VOID tsi721_msgrcv_stop_thread(VOID);
+static VOID tsi721_db_report(VOID);
+static VOID tsi721_msgrx_report(VOID);
+static VOID tsi721_seg_report(VOID);
+static VOID tsi721_ring_report(VOID);
 
 DWORD devNum = 0;
 
-HANDLE g_hDbThread = INVALID_HANDLE_VALUE;
-HANDLE g_hDbEvent = NULL;
-volatile BOOL g_bRunDbThread = FALSE;
+PDB_RX_ENGINE g_pDbRx = NULL;
+PDB_DISP g_pDbDisp = NULL;
+DWORD g_dbRouteNum = 0;
+
+PMSGRX_ENGINE g_pMsgRx = NULL;
+PSEG_RX g_pSegRx = NULL;
+volatile LONG g_segBad = 0;
 
-HANDLE g_hMsgThread = INVALID_HANDLE_VALUE;
-HANDLE g_hCompletionPort = NULL;
-volatile BOOL g_bRunMsgThread = FALSE;
+PIBW_MGR g_pIbwMgr = NULL;
+PRING_CONS g_pRing[IBWIN_MAX_CHNUM];
+DWORD g_ringNum = 0;
 
 int main(int argc, char* argv[])
 {
 	HANDLE hDev;
 	DWORD  destId = 55; // arbitrary value (different from one assigned to the master)
 	DWORD  dwRegVal;
-	R2P_WINCFG r2pWinCfg;
-	DWORD  dwErr;
+	IBW_WIN ibWin;
+	MSGRX_CFG msgRxCfg;
+	SEG_RX_CFG segRxCfg;
+	RING_RX_CFG ringCfg;
+	DWORD  dwErr, i;
+	DWORD  dbSpinUs = DB_RX_DEF_SPIN_MAX_US;
+	DWORD  ringWins = 1;
+	BOOL   bVerbose = FALSE;
+	char  *tracePath;
+	char  *pCrc;
+	int    ch;
 
 	if (argc == 1) {
 		printf_s("Missing Tsi721 device index\n");
 		printf_s("Usage:\n");
-		printf_s("   target <dev_idx> [local_destID]\n");
+		printf_s("   target <dev_idx> [local_destID [rx_bufs [rx_workers [verbose [db_spin_us [ring_wins]]]]]]\n");
+		printf_s("   rx_bufs:    receive buffers per MBOX (default %d), returned to the senders by credit\n", MSGRX_DEF_BUFS);
+		printf_s("               doorbells; a master with as many credits never overruns them\n");
+		printf_s("   db_spin_us: longest doorbell poll before blocking (0 = always block)\n");
+		printf_s("   ring_wins:  inbound windows served as rings, one per producer (1 - %d)\n", IBWIN_MAX_CHNUM);
+		printf_s("   TSI721_CRC=1: messages and segments are sealed with a CRC32C by the master\n");
 		return 0;
 	}
 
+	ZeroMemory(&msgRxCfg, sizeof(msgRxCfg));
+	ZeroMemory(&segRxCfg, sizeof(segRxCfg));
+
 	if (argc > 1)
 		devNum = atoi(argv[1]);
 
 	if (argc > 2)
 		destId = atoi(argv[2]);
 
-	if (!TSI721DeviceOpen(&hDev, devNum, NULL)) {
+	if (argc > 3)
+		msgRxCfg.BufNum = atoi(argv[3]);	// posted buffers per MBOX
+
+	if (argc > 4)
+		msgRxCfg.WorkerNum = atoi(argv[4]);	// receive worker threads
+
+	if (argc > 5 && atoi(argv[5])) {
+		bVerbose = TRUE;
+		segRxCfg.RawHandler = tsi721_msg_print;	// print every unsegmented message (slow)
+	}
+
+	if (argc > 6)
+		dbSpinUs = atoi(argv[6]);	// doorbell receiver spin budget
+
+	if (argc > 7)
+		ringWins = max(1, min(atoi(argv[7]), IBWIN_MAX_CHNUM));	// ring windows
+
+	//
+	// Device backend is selected by TSI721_DEV ("hw" or "emu[:options]")
+	//
+	if (tsi721_dev_select(NULL) != ERROR_SUCCESS)
+		return 0;
+
+	//
+	// Event tracing is enabled by naming the trace file in TSI721_TRACE
+	//
+	tracePath = getenv("TSI721_TRACE");
+	if (tracePath != NULL && tsi721_trace_open(tracePath, 0) == ERROR_SUCCESS)
+		printf_s("Tracing to %s (press T to write the trace file)\n", tracePath);
+
+	//
+	// TSI721_CRC=1 checks the CRC trailer of every message (ring records
+	// carry their own flag)
+	//
+	pCrc = getenv("TSI721_CRC");
+	if (pCrc != NULL && atoi(pCrc)) {
+		msgRxCfg.bCrc = TRUE;
+		printf_s("CRC32C integrity mode (%s)\n", tsi721_crc_isa());
+	}
+
+	if (!g_devOps->DeviceOpen(&hDev, devNum, NULL)) {
 		printf_s("(%d) Unable to open device #%d\n", __LINE__, devNum);
 		return 0;
 	}
 
-	TSI721PciCfgRead(hDev, 0x10, &dwRegVal);
+	g_devOps->PciCfgRead(hDev, 0x10, &dwRegVal);
 	printf_s("Opened Tsi721_%d (BAR0=0x%08x)\n", devNum, dwRegVal);
 
 	// Set SRIO destID assigned to Tsi721
@@ -158,7 +223,7 @@ int main(int argc, char* argv[])
 	// Assuming small SRIO system size (address) configuration)
 	destId = destId & 0xff;
 
-	dwErr = TSI721SetLocalHostId(hDev, destId);
+	dwErr = g_devOps->SetLocalHostId(hDev, destId);
 	if (dwErr != ERROR_SUCCESS) {
 		printf_s("(%d) Set Local Host ID failed, err = 0x%x\n", __LINE__, dwErr);
 		goto exit;
@@ -167,7 +232,7 @@ int main(int argc, char* argv[])
 	//
 	// Check if SRIO port link is OK
 	//
-	dwErr = TSI721RegisterRead(hDev, RIO_PORT_N_ERR_STAT_CSR, 1, &dwRegVal);
+	dwErr = g_devOps->RegisterRead(hDev, RIO_PORT_N_ERR_STAT_CSR, 1, &dwRegVal);
 
 	if (dwErr != ERROR_SUCCESS) {
 		printf_s("(%d) Read port status failed, err = 0x%x\n", __LINE__, dwErr);
@@ -193,13 +258,13 @@ int main(int argc, char* argv[])
 
 	// Read device ID register
 
-	dwErr = TSI721SrioMaintRead(hDev, 0, 0, RIO_DEV_ID_CAR, &dwRegVal);
+	dwErr = g_devOps->SrioMaintRead(hDev, 0, 0, RIO_DEV_ID_CAR, &dwRegVal);
 
 	if (dwErr != ERROR_SUCCESS) {
 		printf_s("(%d) Failed to read partner device ID, err = 0x%x\n", __LINE__, dwErr);
 
 		// Check if SRIO port link is OK
-		dwErr = TSI721RegisterRead(hDev, RIO_PORT_N_ERR_STAT_CSR, 1, &dwRegVal);
+		dwErr = g_devOps->RegisterRead(hDev, RIO_PORT_N_ERR_STAT_CSR, 1, &dwRegVal);
 
 		if (dwErr != ERROR_SUCCESS) {
 			printf_s("(%d) Read port status failed, err = 0x%x\n", __LINE__, dwErr);
@@ -213,34 +278,77 @@ int main(int argc, char* argv[])
 
 	printf_s("Tsi721 attached to device 0x%08x\n", dwRegVal);
 
-	dwErr = TSI721RegisterWrite(hDev, RIO_PORT_GEN_CTRL_CSR, 0xe0000000); // set HOST, MAST_EN and DISC bits
-
-																		  //
-																		  // Initialize inbound SRIO-to-PCIe window (uses IB_WIN number 0)
-																		  //
+	dwErr = g_devOps->RegisterWrite(hDev, RIO_PORT_GEN_CTRL_CSR, 0xe0000000); // set HOST, MAST_EN and DISC bits
 
-	r2pWinCfg.BAddrHi = 0;   // Upper part of base address of R2P window
-	r2pWinCfg.BAddrLo = 0;   // Lower part of base address of R2P window
-	r2pWinCfg.BAddrEx = 0;   // Bits [65:64] of 66-bit base address
-	r2pWinCfg.Size = DMA_BUF_SIZE;  // Size of window in bytes (32KB - 16GB)
-
-	dwErr = TSI721CfgR2pWin(hDev, 0, &r2pWinCfg);
+	//
+	// Initialize inbound SRIO-to-PCIe windows, DMA_BUF_SIZE each from SRIO address 0
+	// (IB_WIN_0 receives the data of the basic test)
+	//
+	dwErr = tsi721_ibw_create(hDev, 0, 0, &g_pIbwMgr);
 	if (dwErr != ERROR_SUCCESS) {
-		printf_s("(%d) Failed to initialize IB_WIN_0, err = 0x%x\n", __LINE__, dwErr);
+		printf_s("(%d) Failed to create inbound window manager, err = 0x%x\n", __LINE__, dwErr);
 		goto exit;
 	}
 
+	for (i = 0; i < ringWins; i++) {
+		dwErr = tsi721_ibw_alloc(g_pIbwMgr, DMA_BUF_SIZE, 0, &ibWin);
+		if (dwErr != ERROR_SUCCESS) {
+			printf_s("(%d) Failed to initialize IB_WIN_%d, err = 0x%x\n", __LINE__, i, dwErr);
+			if (i == 0)
+				goto exit;
+			break;
+		}
+
+		if (ibWin.Size != DMA_BUF_SIZE)
+			printf_s("IB_WIN_%d mapped with %d KB only\n", ibWin.WinNum, ibWin.Size >> 10);
+	}
+
+	tsi721_ibw_print(g_pIbwMgr);
+
 	// Start doorbell notification receive thread
-	tsi721_db_start_thread(hDev);
+	tsi721_db_start_thread(hDev, dbSpinUs, bVerbose);
+
+	// Serve ring streams written by the master(s), one per inbound window
+	for (i = 0; i < IBWIN_MAX_CHNUM; i++) {
+		if (tsi721_ibw_query(g_pIbwMgr, i, &ibWin) != ERROR_SUCCESS)
+			continue;
+
+		ZeroMemory(&ringCfg, sizeof(ringCfg));
+		ringCfg.WinNum = ibWin.WinNum;
+		ringCfg.WinSize = ibWin.Size;
+
+		dwErr = tsi721_ring_cons_start(hDev, &ringCfg, &g_pRing[g_ringNum]);
+		if (dwErr != ERROR_SUCCESS)
+			printf_s("ERR: Failed to start ring consumer on IB_WIN_%d: err=0x%x (%d)\n", i, dwErr, dwErr);
+		else
+			g_ringNum++;
+	}
+	printf_s("Ring consumers started on %d inbound windows\n", g_ringNum);
 
 	// make sure that inbound messaging destID matches assigned local destID.
-	TSI721SrioIbMsgDevIdSet(hDev, destId);
-
-	// Start inbound message receive thread (MBOX0)
-	tsi721_msgrcv_start_thread(0);
-	tsi721_msgrcv_start_thread(1);
-	tsi721_msgrcv_start_thread(2);
-	tsi721_msgrcv_start_thread(3);
+	g_devOps->SrioIbMsgDevIdSet(hDev, destId);
+
+	// Reassemble segmented payloads, other messages go to the raw handler
+	segRxCfg.Handler = tsi721_seg_check;
+	segRxCfg.HandlerCtx = (PVOID)(ULONG_PTR)bVerbose;
+
+	dwErr = tsi721_seg_rx_create(&segRxCfg, &g_pSegRx);
+	if (dwErr == ERROR_SUCCESS) {
+		msgRxCfg.Handler = tsi721_seg_rx_msg;
+		msgRxCfg.HandlerCtx = g_pSegRx;
+	} else
+		printf_s("ERR: Failed to create segment reassembler: err=0x%x (%d)\n", dwErr, dwErr);
+
+	// Return reposted buffers to the senders as credits
+	msgRxCfg.CreditBatch = min(MSGRX_DEF_CREDIT_BATCH,
+		max(1, (msgRxCfg.BufNum ? msgRxCfg.BufNum : MSGRX_DEF_BUFS) / 2));
+
+	// Start inbound message receive engine (MBOX0-3)
+	dwErr = tsi721_msgrx_start(devNum, &msgRxCfg, &g_pMsgRx);
+	if (dwErr != ERROR_SUCCESS)
+		printf_s("ERR: Failed to start Message Receive Engine: err=0x%x (%d)\n", dwErr, dwErr);
+	else
+		printf_s("Message Receive Engine started\n");
 
 	fflush(stdout);
 
@@ -252,377 +360,260 @@ int main(int argc, char* argv[])
 	// generated by external sources (Port-Writes, inbound doorbells and messages to MBOX0) 
 	//
 	printf_s("\nPress any key to exit ....\n");
-#pragma warning(suppress: 6031)
-	_getch();
+	for (;;) {
+		ch = _getch();
+		if (tracePath == NULL || (ch != 't' && ch != 'T'))
+			break;
+
+		// Snapshot the trace rings without stopping the test
+		dwErr = tsi721_trace_flush();
+		if (dwErr == ERROR_SUCCESS)
+			printf_s("Trace written to %s\n", tracePath);
+		else
+			printf_s("ERR: Failed to write trace: err=0x%x\n", dwErr);
+	}
 
-	// Free an inbound window mapping before exit
-	dwErr = TSI721FreeR2pWin(hDev, 0);
+	tsi721_ring_report();
+
+	for (i = 0; i < g_ringNum; i++)
+		tsi721_ring_cons_stop(g_pRing[i]);
+	g_ringNum = 0;
 
 exit:
 
-	if (g_bRunMsgThread)
-		tsi721_msgrcv_stop_thread();
+	// Free the inbound window mappings before exit
+	if (g_pIbwMgr) {
+		tsi721_ibw_destroy(g_pIbwMgr);
+		g_pIbwMgr = NULL;
+	}
 
-	if (g_bRunDbThread)
+	if (g_pMsgRx) {
+		tsi721_msgrx_report();
+		tsi721_msgrx_stop(g_pMsgRx);
+		g_pMsgRx = NULL;
+	}
+
+	if (g_pSegRx) {
+		tsi721_seg_report();
+		tsi721_seg_rx_destroy(g_pSegRx);
+		g_pSegRx = NULL;
+	}
+
+	if (g_pDbDisp) {
+		tsi721_db_report();
 		tsi721_db_stop_thread();
+	}
+
+	g_devOps->DeviceClose(hDev, NULL);
 
-	TSI721DeviceClose(hDev, NULL);
+	if (tracePath != NULL)
+		tsi721_trace_close();
 
 	return 0;
 }
 
-static VOID tsi721_db_start_thread(HANDLE hDev)
+static VOID tsi721_db_start_thread(HANDLE hDev, DWORD dwSpinUs, BOOL bVerbose)
 {
+	DB_RX_CFG dbRxCfg;
+	DB_ROUTE route;
 	DWORD dwErr;
 
-	g_bRunDbThread = TRUE;
-	g_hDbThread = (HANDLE)_beginthread(tsi721_db_thread, 0, (PVOID)hDev);
-	if ((HANDLE)-1L == g_hDbThread) {
-		g_bRunDbThread = FALSE;
-		dwErr = GetLastError();
-		printf_s("ERR: Failed to start Doorbell Notification Thread: err=0x%x (%d)\n", dwErr, dwErr);
+	dwErr = tsi721_db_disp_create(&g_pDbDisp);
+	if (dwErr != ERROR_SUCCESS)
+		goto err_exit;
+
+	//
+	// Route 0: master's round-trip test, answered inline by the receiver thread
+	//
+	ZeroMemory(&route, sizeof(route));
+	route.InfoMin = DB_PING_TAG;
+	route.InfoMax = DB_PING_TAG | DB_PING_SEQ_MASK;
+	route.SrcId = DB_SRC_ANY;
+	route.Flags = DB_ROUTE_INLINE;
+	route.Handler = tsi721_db_ping_echo;
+	route.HandlerCtx = hDev;
+
+	dwErr = tsi721_db_disp_add(g_pDbDisp, &route, NULL);
+	if (dwErr != ERROR_SUCCESS)
+		goto err_exit;
+	g_dbRouteNum++;
+
+	//
+	// Route 1: print all other doorbells from a worker thread (verbose only)
+	//
+	if (bVerbose) {
+		route.InfoMin = 0;
+		route.InfoMax = 0xffff;
+		route.Flags = DB_ROUTE_DEFERRED;
+		route.Handler = tsi721_db_print;
+		route.HandlerCtx = NULL;
+
+		dwErr = tsi721_db_disp_add(g_pDbDisp, &route, NULL);
+		if (dwErr != ERROR_SUCCESS)
+			goto err_exit;
+		g_dbRouteNum++;
 	}
-	else
-		printf_s("Doorbell Notification Thread started\n");
+
+	ZeroMemory(&dbRxCfg, sizeof(dbRxCfg));
+	dbRxCfg.SpinMinUs = min(DB_RX_DEF_SPIN_MIN_US, dwSpinUs);
+	dbRxCfg.SpinMaxUs = dwSpinUs;
+	dbRxCfg.Handler = tsi721_db_dispatch;
+	dbRxCfg.HandlerCtx = g_pDbDisp;
+
+	dwErr = tsi721_db_rx_start(hDev, &dbRxCfg, &g_pDbRx);
+	if (dwErr != ERROR_SUCCESS)
+		goto err_exit;
+
+	printf_s("Doorbell Notification Thread started (spin %d us)\n", dwSpinUs);
+	return;
+
+err_exit:
+
+	tsi721_db_disp_destroy(g_pDbDisp);
+	g_pDbDisp = NULL;
+	g_pDbRx = NULL;
+	printf_s("ERR: Failed to start Doorbell Notification Thread: err=0x%x (%d)\n", dwErr, dwErr);
 }
 
 static VOID tsi721_db_stop_thread(VOID)
 {
-	DWORD dwRet;
-
-	g_bRunDbThread = FALSE;
-	SetEvent(g_hDbEvent);
+	tsi721_db_rx_stop(g_pDbRx);
+	g_pDbRx = NULL;
 
-	//
-	// Wait for termination of the DB notification thread.
-	//
+	tsi721_db_disp_destroy(g_pDbDisp);
+	g_pDbDisp = NULL;
+	printf_s("DB_WAIT: Exit notification thread\n");
+}
 
-	dwRet = WaitForSingleObject(g_hDbThread, 1000);
-	if (WAIT_OBJECT_0 == dwRet) {
-		g_hDbThread = (HANDLE)-1L;
+static VOID tsi721_db_report(VOID)
+{
+	DB_RX_STATS stats;
+	DB_ROUTE_STATS routeStats;
+	ULONGLONG fetches, unrouted;
+	DWORD r;
+
+	tsi721_db_rx_stats(g_pDbRx, &stats);
+
+	fetches = stats.Wakeups + stats.Polls;
+	printf_s("DB: %llu doorbells, %llu wakeups (%llu doorbells), %llu polls (%llu doorbells), "
+		"%.1f per fetch, max %llu, spin %.3f ms (budget %d us), %llu errors\n",
+		stats.Doorbells, stats.Wakeups, stats.WaitDoorbells, stats.Polls, stats.PollDoorbells,
+		fetches ? (double)stats.Doorbells / fetches : 0.0, stats.MaxBatch,
+		(double)stats.SpinNs / 1e6, stats.SpinUs, stats.Errors);
+
+	tsi721_db_disp_stats(g_pDbDisp, 0, &routeStats, &unrouted);
+	printf_s("DB: %llu unrouted\n", unrouted);
+
+	for (r = 0; r < g_dbRouteNum; r++) {
+		tsi721_db_disp_stats(g_pDbDisp, r, &routeStats, NULL);
+		printf_s("DB route %d: %llu matched, %llu handled, %llu dropped, %llu wakeups\n",
+			r, routeStats.Matched, routeStats.Handled, routeStats.Dropped, routeStats.Wakeups);
 	}
-	else
-		printf_s("Error while terminating DB thread: 0x%x (%d)\n", dwRet, dwRet);
 }
 
-static VOID tsi721_msgrcv_start_thread(DWORD dwMbox)
+static VOID tsi721_msgrx_report(VOID)
 {
-	DWORD dwErr;
+	MSGRX_STATS stats;
+	DWORD mbox;
 
-	g_bRunMsgThread = TRUE;
-	g_hMsgThread = (HANDLE)_beginthread(tsi721_msgrcv_thread, 0, (PVOID)dwMbox);
-	if ((HANDLE)-1L == g_hMsgThread) {
-		g_bRunMsgThread = FALSE;
-		dwErr = GetLastError();
-		printf_s("ERR: Failed to start Port-Write Notification Thread: err=0x%x (%d)\n", dwErr, dwErr);
-	}
-	else
-		printf_s("Port-Write Notification Thread started\n");
+	tsi721_msgrx_stats(g_pMsgRx, &stats);
+
+	for (mbox = 0; mbox < RIO_MSG_MAX_MBOX; mbox++)
+		printf_s("MBOX%d: %llu messages, %llu bytes, %llu credit doorbells, %llu CRC checked, %llu CRC errors, %llu errors\n",
+			mbox, stats.Msgs[mbox], stats.Bytes[mbox], stats.Credits[mbox], stats.Sealed[mbox],
+			stats.CrcErrors[mbox], stats.Errors[mbox]);
 }
 
-static VOID tsi721_msgrcv_stop_thread(VOID)
+static VOID tsi721_seg_report(VOID)
 {
-	DWORD dwRet;
+	SEG_RX_STATS stats;
 
-	if (!g_bRunMsgThread) {
-		printf_s("ERR: Unable to stop - MSGRCV thread is not running\n");
-		return;
-	}
+	tsi721_seg_rx_stats(g_pSegRx, &stats);
 
-	g_bRunMsgThread = FALSE;
-	if (g_hCompletionPort)
-		CloseHandle(g_hCompletionPort);
-	g_hCompletionPort = NULL;
+	printf_s("SEG: %llu payloads, %llu bytes, %llu segments, %llu duplicates, %llu dropped, %llu bad, %llu other messages\n",
+		stats.Payloads, stats.Bytes, stats.Segments, stats.Duplicates, stats.Dropped, stats.Bad, stats.Foreign);
+	printf_s("SEG: %d incomplete, %d payloads failed the pattern check\n", stats.Active, g_segBad);
+}
 
-	//
-	// Wait for termination of the DB notification thread.
-	//
+static VOID tsi721_ring_report(VOID)
+{
+	RING_CONS_STATS stats;
+	DWORD i;
+
+	for (i = 0; i < g_ringNum; i++) {
+		tsi721_ring_cons_stats(g_pRing[i], &stats);
 
-	dwRet = WaitForSingleObject(g_hMsgThread, 1000);
-	if (WAIT_OBJECT_0 == dwRet) {
-		g_hMsgThread = (HANDLE)-1L;
+		printf_s("RING %d: %llu streams, %llu records, %llu bytes, %llu credits, %llu sequence errors, %llu errors\n",
+			i, stats.Streams, stats.Records, stats.Bytes, stats.Credits, stats.SeqErrors, stats.Errors);
+		printf_s("RING %d: window read %s, %llu bytes in place, %llu bytes copied\n",
+			i, stats.bZeroCopy ? "in place" : "by copies", stats.ZeroCopyBytes, stats.CopiedBytes);
+		printf_s("RING %d: %llu records CRC checked, %llu CRC errors\n", i, stats.Sealed, stats.CrcErrors);
 	}
-	else
-		printf_s("Error while stopping MSGRCV thread: 0x%x (%d)\n", dwRet, dwRet);
 }
 
 static VOID tsi721_db_print(
-	PVOID pDbData,
-	ULONG DbCount
+	PVOID pCtx,
+	PIB_DB_ENTRY pDb
 )
 {
-	PIB_DB_ENTRY dbE = (PIB_DB_ENTRY)pDbData;
-	DWORD i;
-	static DWORD count = 0;
-
-	/*for (i = 0; i < DbCount; i++) {
-		count++;
-		printf_s("DB[%d]: sID=%04x dID=%04x info=%04x\n",
-			count, dbE->db.SrcId, dbE->db.DstId, dbE->db.Info);
-		dbE++;
-	}*/
+	static DWORD count = 0;	// single worker thread
+
+	UNREFERENCED_PARAMETER(pCtx);
+
+	count++;
+	printf_s("DB[%d]: sID=%04x dID=%04x info=%04x\n",
+		count, pDb->db.SrcId, pDb->db.DstId, pDb->db.Info);
 }
 
 static VOID tsi721_msg_print(
+	PVOID pCtx,
 	DWORD dwMbox,
 	DWORD dwSrc,
-	PVOID MsgBuf
+	PVOID MsgBuf,
+	DWORD dwSize
 )
 {
 	PUCHAR msgBuf = (PUCHAR)MsgBuf;
-	static DWORD count = 0;
+	static volatile LONG count = 0;
+
+	UNREFERENCED_PARAMETER(pCtx);
 
-	printf_s("MSG[%d] from %d mbox%d sz=%d: 0x%02x %02x %02x %02x %02x %02x %02x %02x\n", ++count, dwSrc & 0xffff,
-		dwMbox, (dwSrc >> 16) & 0xffff,
+	printf_s("MSG[%d] from %d mbox%d sz=%d: 0x%02x %02x %02x %02x %02x %02x %02x %02x\n",
+		InterlockedIncrement(&count), dwSrc, dwMbox, dwSize,
 		msgBuf[0], msgBuf[1], msgBuf[2], msgBuf[3], msgBuf[4], msgBuf[5], msgBuf[6], msgBuf[7]);
 }
 
-VOID
-tsi721_db_thread(
-	PVOID params
+static VOID tsi721_seg_check(
+	PVOID pCtx,
+	DWORD dwSrc,
+	USHORT wStreamId,
+	DWORD dwSeq,
+	PVOID pData,
+	DWORD dwSize
 )
-/*++
-
-Routine Description:
-
-Thread waiting for inbound doorbell event and doing callback into an app.
-
-Arguments:
-
-params - pointer to tread parameters
-
-Return Value:
-
-NONE
-
---*/
 {
-	HANDLE hDev = (HANDLE)params;
-	ULONG ulRetSize;
-	ULONG ulDbNum;
-	OVERLAPPED ovl;
-	HANDLE hWait[2];
-	DWORD dwWaitRet;
-	IB_DB_ENTRY ibDbBuf[16];
-	DWORD dwError;
-
-	memset(&ovl, 0, sizeof(ovl));
-
-	//
-	// Create thread control event
-	//
-	g_hDbEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-	if (g_hDbEvent == NULL) {
-		g_bRunDbThread = FALSE;
-		_endthread();
-		return;
-	}
-
-	//
-	// Create request completion event
-	//
-	ovl.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-	if (ovl.hEvent == NULL) {
-		g_bRunDbThread = FALSE;
-		CloseHandle(g_hDbEvent);
-		_endthread();
-		return;
-	}
-
-	hWait[0] = ovl.hEvent;
-	hWait[1] = g_hDbEvent;
-
-	while (g_bRunDbThread) {
-		ulDbNum = 0;
-
-		dwError = TSI721SrioIbDoorbellWait(hDev, ibDbBuf, sizeof(ibDbBuf), &ulRetSize, &ovl);
-
-		if (ERROR_IO_PENDING == dwError) {
-			BOOL bResult = FALSE;
-
-			dwWaitRet = WaitForMultipleObjects(2, hWait, FALSE, INFINITE);
-			if (WAIT_OBJECT_0 == dwWaitRet) {
-				//
-				// Request completed 
-				//
-				bResult = GetOverlappedResult(hDev, &ovl, &ulRetSize, FALSE);
-				if (!bResult) {
-					printf_s("DB_WAIT: Pending request failed with 0x%08x\n", GetLastError());
-					break;
-				}
-			}
-			else {
-				// Thread termination event was signaled
-				printf_s("DB_WAIT: thread termination requested\n");
-				CancelIo(hDev);
-				break;
-			}
-		}
-		else if (ERROR_SUCCESS == dwError) {
-			printf_s("DB_WAIT: Received DB without wait\n");
-		}
-		else {
-			printf_s("DB_WAIT: IOCTL error in notification thread: \n");
-			break;
-		}
+	BOOL bVerbose = (BOOL)(ULONG_PTR)pCtx;
+	DWORD dwErr;
 
-		ulDbNum = ulRetSize / sizeof(IB_DB_ENTRY);
-		if (ulDbNum)
-			tsi721_db_print(ibDbBuf, ulDbNum);
-	}
+	// Payloads of the master's seg mode carry a pattern derived from their ID
+	dwErr = tsi721_pattern_verify(pData, dwSize, SEG_TEST_SEED(wStreamId, dwSeq), 0, NULL);
+	if (dwErr != ERROR_SUCCESS)
+		InterlockedIncrement(&g_segBad);
 
-	CloseHandle(g_hDbEvent);
-	CloseHandle(ovl.hEvent);
-	g_bRunDbThread = FALSE;
-	printf_s("DB_WAIT: Exit notification thread\n");
-	_endthread();
+	if (bVerbose)
+		printf_s("SEG from %d stream %04x seq %d sz=%d: %s\n",
+			dwSrc, wStreamId, dwSeq, dwSize, dwErr == ERROR_SUCCESS ? "OK" : "pattern mismatch");
 }
 
-VOID
-tsi721_msgrcv_thread(
-	PVOID params
+static VOID
+tsi721_db_ping_echo(
+	PVOID pCtx,
+	PIB_DB_ENTRY pDb
 )
-/*++
-
-Routine Description:
-
-Thread waiting for inbound Port-Write event and doing callback into an app.
-
-Arguments:
-
-params - pointer to tread parameter structure
-
-Return Value:
-
-NONE
-
---*/
 {
-	HANDLE hDev = INVALID_HANDLE_VALUE;
-	DWORD dwMbox = (DWORD)params;
-	PMSG_CONTEXT pContext = NULL;
-	DWORD dwBufSize[IMSG_BUF_NUM];
-	DWORD dwError;
-	DWORD i;
-	PUCHAR msgBufPtr = NULL;
-
-	//
-	// Open device from the thread to obtain new device handle
-	// that will be associated with I/O completion port specific to this thread.
-	// This way only completions of requests issued from this thread will be
-	// reported to the IOCP.
-	//
-	if (!TSI721DeviceOpen(&hDev, devNum, NULL)) {
-		printf_s("ERR: failed to open Tsi721_%d (err=%x)\n", devNum, GetLastError());
-		_endthread();
-	}
-
-	//
-	// Messaging buffers have to be aligned to the page boundary
-	//
-	msgBufPtr = (PUCHAR)_aligned_malloc(0x1000 * IMSG_BUF_NUM, PAGE_SIZE);
-	if (msgBufPtr == NULL) {
-		printf_s("ERR: Unable to allocate aligned buffer for IB_MSG\n");
-		goto err_exit;
-	}
-
-	//
-	// Allocate set of context data structures associated with each pending
-	// inbound message buffer.
-	//
-	pContext = (PMSG_CONTEXT)malloc(IMSG_BUF_NUM * sizeof(MSG_CONTEXT));
-	if (pContext == NULL) {
-		printf_s("ERR: Cannot allocate context array\n");
-		goto err_exit;
-	}
-
-	ZeroMemory(pContext, IMSG_BUF_NUM * sizeof(MSG_CONTEXT));
-
-	//
-	// Create IO Completion Port. 
-	// We use a global variable to store IOCP handle to provide UI with ability
-	// to signal thread termination by closing IOCP handle.
-	//
-
-	g_hCompletionPort = CreateIoCompletionPort(hDev, NULL, 1, 0);
-	if (g_hCompletionPort == NULL) {
-		printf_s("ERR: Cannot create completion port err=%d \n", GetLastError());
-		goto err_exit;
-	}
-
-	//
-	// Send initial set of buffers to the driver
-	//
-	for (i = 0; i < IMSG_BUF_NUM; i++) {
-		dwBufSize[i] = 0x1000;
-		pContext[i].BufPtr = (msgBufPtr + i * 0x1000);
-		pContext[i].Id = i;
-		dwError = TSI721SrioMsgAddRcvBuffer(hDev, dwMbox, (msgBufPtr + i * 0x1000), &dwBufSize[i], &pContext[i].Ovl);
-
-		if (ERROR_IO_PENDING != dwError) {
-			printf_s("MSG_WAIT: IOCTL error 0x%x (%d)\n", dwError, dwError);
-			goto err_exit;
-		}
-	}
-
-	while (TRUE) {
-		printf_s("Im in loop waitin for msg\n");
-		LPOVERLAPPED lpOvl;
-		ULONG_PTR    key;
-		ULONG        retSize;
-		PMSG_CONTEXT pMsg;
-
-		if (GetQueuedCompletionStatus(g_hCompletionPort, &retSize, &key, &lpOvl, INFINITE) == 0) {
-			dwError = GetLastError();
-			if (dwError == ERROR_ABANDONED_WAIT_0) {
-				printf_s("MSG_WAIT_%d: thread termination requested\n", dwMbox);
-			}
-			else {
-				printf("MSG_WAIT: GetQueuedCompletionStatus failed %d\n", dwError);
-			}
-			CancelIo(hDev);
-			break;
-		}
-		printf_s("Before print\n");
-		pMsg = CONTAINING_RECORD(lpOvl, MSG_CONTEXT, Ovl);
-
-		tsi721_msg_print(dwMbox, retSize, pMsg->BufPtr);
-
-		//
-		// Return processed message buffer to the driver receive queue
-		//
-		dwBufSize[pMsg->Id] = 0x1000;
-		dwError = TSI721SrioMsgAddRcvBuffer(hDev, dwMbox, pMsg->BufPtr,
-			&dwBufSize[pMsg->Id], lpOvl);
-		if (ERROR_IO_PENDING != dwError) {
-			printf_s("MSG_WAIT: IOCTL error 0x%x (%d)\n", dwError, dwError);
-			break;
-		}
-	}
-
-err_exit:
-
-	if (hDev != INVALID_HANDLE_VALUE)
-		CloseHandle(hDev);
-
-	if (g_hCompletionPort) {
-		CloseHandle(g_hCompletionPort);
-		g_hCompletionPort = NULL;
-	}
-
-	if (pContext)
-		free(pContext);
-
-	if (msgBufPtr)
-		_aligned_free(msgBufPtr);
-
-	g_bRunMsgThread = FALSE;
-	printf_s("MSG_WAIT_%d: Exit receive thread\n", dwMbox);
-	_endthread();
+	tsi721_db_echo((HANDLE)pCtx, pDb, 1);
 }
 
-
-
 //#define DMA_BUF_SIZE 256 //(2 * 1024 * 1024)
 //
 //#define RIO_DEV_ID_CAR              (0x000000)
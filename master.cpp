@@ -28,6 +28,25 @@ Description:
 #include <conio.h> // for _getch()
 
 #include "tsi721api.h"
+#include "tsi721dev.h"
+#include "tsi721dma.h"
+#include "tsi721stream.h"
+#include "tsi721bench.h"
+#include "tsi721pattern.h"
+#include "tsi721crc.h"
+#include "tsi721msg.h"
+#include "tsi721msgrx.h"
+#include "tsi721seg.h"
+#include "tsi721db.h"
+#include "tsi721csr.h"
+#include "tsi721enum.h"
+#include "tsi721shadow.h"
+#include "tsi721ring.h"
+#include "tsi721ibwin.h"
+#include "tsi721pio.h"
+#include "tsi721pool.h"
+#include "tsi721trace.h"
+#include "tsi721stat.h"
 #include "master.h"
 
 
@@ -52,39 +71,75 @@ Description:
 
 #define IMSG_BUF_NUM 32     // Number of pending Inbound message buffers (per MBOX)
 
+#define DMA_CHUNK_SIZE  (64 * 1024) // size of a single BDMA request issued by the transfer engine
+#define DMA_QUEUE_DEPTH 4           // number of requests queued per BDMA channel
+#define PIO_CHECK_SIZE  64          // size of the small transfer checked by the basic test
+
+//
+// Basic test payloads are random streams of one run seed (TSI721_SEED, or
+// picked at start): each data thread and the main thread generate their own
+// stream per pass, so any payload can be regenerated from the printed seed.
+//
+#define DATA_STREAM(pass, id)   (((DWORD)(pass) << 8) | (DWORD)(id))
+#define MAIN_STREAM_ID          (MAINT_THR_NUM + DATA_THR_NUM)
+
 typedef struct _EVB_THREAD_PARAM {
     HANDLE hDev;
+    PCSR_SHADOW pShadow;
     DWORD  DestId;  // Destination ID of the SRIO target device
     PVOID  DataBuf;
     DWORD  DataSize;
     DWORD  Id;      // ID assigned to a new thread
+    DWORD  Stream;  // payload stream of a data thread
+    ULONGLONG Seed; // run seed
 } EVB_THREAD_PARAM, *PEVB_THREAD_PARAM;
 
 static VOID maint_rd_thread(PVOID Params);
 static VOID data_rw_thread(PVOID Params);
-static VOID tsi721_msg_send(HANDLE hDev, DWORD  dwDestId, DWORD  dwMbox, DWORD  msgCount);
+static VOID tsi721_msg_send(DWORD dwDevNum, DWORD dwDestId, DWORD dwMbox, DWORD msgCount);
+static VOID master_usage(VOID);
+static DWORD master_stream(PDMA_ENGINE pDmaEng, DWORD dwDestId, int argc, char* argv[]);
+static DWORD master_sweep(HANDLE hDev, PDMA_ENGINE pDmaEng, DWORD dwDestId, int argc, char* argv[]);
+static DWORD master_msg(DWORD dwDevNum, DWORD dwDestId, int argc, char* argv[]);
+static DWORD master_dbping(DWORD dwDevNum, DWORD dwDestId, int argc, char* argv[]);
+static DWORD master_maint(HANDLE hDev, DWORD dwDestId, int argc, char* argv[]);
+static DWORD master_enum(HANDLE hDev, int argc, char* argv[]);
+static DWORD master_ring(HANDLE hDev, DWORD dwHostId, DWORD dwDestId, int argc, char* argv[]);
+static DWORD master_seg(DWORD dwDevNum, DWORD dwDestId, int argc, char* argv[]);
 
 HANDLE hEvent = NULL;
 EVB_THREAD_PARAM evbThreadParam[MAINT_THR_NUM + DATA_THR_NUM];
 volatile BOOL bQuitThread = FALSE;
+BOOL bCrc = FALSE;  // seal messages, segments and ring records with a CRC32C
 
 int main(int argc, char* argv[])
 {
     PVOID  obBuf = NULL; // outbound data buffer
     PVOID  ibBuf = NULL; // inbound data buffer
     HANDLE hDev;
+    PDMA_ENGINE pDmaEng = NULL;
+    PPIO_MAP    pPio = NULL;
+    PIO_STATS   pioStats;
+    POOL_CFG    poolCfg;
+    PCSR_SHADOW pShadow = NULL;
+    SHADOW_STATS shadowStats;
     DWORD  devNum = 0;
     DWORD  destId = 0; // arbitrary value (different from one assigned to the target)
     DWORD  partnDestId, dwRegVal;
     DWORD  dwDataSize;
     DMA_REQ_CTRL dmaCtrl;
-    int rnum;
+    PATTERN_ERR patErr;
+    RNG_STREAM  rng;
+    ULONGLONG   runSeed;
     DWORD  i, dwErr, pass, repeat = 1;
+    char  *mode = NULL;
+    char  *tracePath;
+    char  *pSeed;
+    char  *pCrc;
 
     if (argc == 1) {
         printf_s("Missing Tsi721 device index\n");
-        printf_s("Usage:\n");
-        printf_s("   master <dev_idx> [local_destID [repeat]]\n");
+        master_usage();
         return 0;
     }
 
@@ -94,6 +149,30 @@ int main(int argc, char* argv[])
         destId = atoi(argv[2]);
     if (argc > 3)
         repeat = atoi(argv[3]);
+    if (argc > 4)
+        mode = argv[4];
+
+    //
+    // Device backend is selected by TSI721_DEV ("hw" or "emu[:options]")
+    //
+    if (tsi721_dev_select(NULL) != ERROR_SUCCESS)
+        return 0;
+
+    //
+    // Event tracing is enabled by naming the trace file in TSI721_TRACE
+    //
+    tracePath = getenv("TSI721_TRACE");
+    if (tracePath != NULL && tsi721_trace_open(tracePath, 0) == ERROR_SUCCESS)
+        printf_s("Tracing to %s\n", tracePath);
+
+    //
+    // TSI721_CRC=1 selects the integrity mode of the msg, seg and ring modes
+    //
+    pCrc = getenv("TSI721_CRC");
+    if (pCrc != NULL && atoi(pCrc)) {
+        bCrc = TRUE;
+        printf_s("CRC32C integrity mode (%s)\n", tsi721_crc_isa());
+    }
 
     //
     // Pause to allow user to start the target.
@@ -103,20 +182,28 @@ int main(int argc, char* argv[])
 #pragma warning(suppress: 6031)
     _getch();
 
-    if (!TSI721DeviceOpen(&hDev, devNum, NULL)) {
+    if (!g_devOps->DeviceOpen(&hDev, devNum, NULL)) {
         printf_s("(%d) Unable to open device Tsi721_%d\n", __LINE__, devNum);
         return 0;
     }
 
-    obBuf = malloc(DMA_BUF_SIZE);
-    ibBuf = malloc(DMA_BUF_SIZE);
+    //
+    // Data buffers come from the pool: pre-faulted, and on large pages when
+    // the account may lock memory
+    //
+    ZeroMemory(&poolCfg, sizeof(poolCfg));
+    poolCfg.Flags = POOL_F_PREFAULT | POOL_F_LARGE_PAGES;
+    tsi721_pool_config(&poolCfg);
+
+    obBuf = tsi721_pool_alloc(DMA_BUF_SIZE);
+    ibBuf = tsi721_pool_alloc(DMA_BUF_SIZE);
 
     if ((obBuf == NULL) || (ibBuf == NULL)) {
         printf_s("(%d) Unable to allocate test data buffer(s)\n", __LINE__);
         goto exit;
     }
 
-    TSI721PciCfgRead(hDev, 0x10, &dwRegVal);
+    g_devOps->PciCfgRead(hDev, 0x10, &dwRegVal);
     printf_s("Opened Tsi721_%d (BAR0=0x%08x)\n", devNum, dwRegVal);
 
     ZeroMemory(obBuf, DMA_BUF_SIZE);
@@ -126,7 +213,7 @@ int main(int argc, char* argv[])
     destId = destId & 0xff;
 
     // Set SRIO destID assigned to Tsi721
-    dwErr = TSI721SetLocalHostId(hDev, destId);
+    dwErr = g_devOps->SetLocalHostId(hDev, destId);
     if (dwErr != ERROR_SUCCESS) {
         printf_s("(%d) Set Local Host ID failed, err = 0x%x\n", __LINE__, dwErr);
         goto exit;
@@ -135,7 +222,7 @@ int main(int argc, char* argv[])
     //
     // Check if SRIO port link is OK
     //
-    dwErr = TSI721RegisterRead(hDev, RIO_PORT_N_ERR_STAT_CSR, 1, &dwRegVal);
+    dwErr = g_devOps->RegisterRead(hDev, RIO_PORT_N_ERR_STAT_CSR, 1, &dwRegVal);
 
     if (dwErr != ERROR_SUCCESS) {
         printf_s("(%d) Read port status failed, err = 0x%x\n", __LINE__, dwErr);
@@ -159,15 +246,27 @@ int main(int argc, char* argv[])
     // Check attached link partner device
     //
 
+    //
+    // Registers that do not change are read once and then served by the
+    // CSR shadow
+    //
+    dwErr = tsi721_shadow_create(hDev, &pShadow);
+    if (dwErr != ERROR_SUCCESS) {
+        printf_s("(%d) Failed to create CSR shadow, err = 0x%x\n", __LINE__, dwErr);
+        goto exit;
+    }
+
+    tsi721_shadow_link_check(pShadow);
+
     // Read device ID register
 
-    dwErr = TSI721SrioMaintRead(hDev, 0, 0, RIO_DEV_ID_CAR, &dwRegVal);
+    dwErr = tsi721_shadow_maint_read(pShadow, 0, 0, RIO_DEV_ID_CAR, &dwRegVal);
 
     if (dwErr != ERROR_SUCCESS) {
         printf_s("(%d) Failed to read partner device ID, err = 0x%x\n", __LINE__, dwErr);
 
         // Check if SRIO port link is OK
-        dwErr = TSI721RegisterRead(hDev, RIO_PORT_N_ERR_STAT_CSR, 1, &dwRegVal);
+        dwErr = g_devOps->RegisterRead(hDev, RIO_PORT_N_ERR_STAT_CSR, 1, &dwRegVal);
 
         if (dwErr != ERROR_SUCCESS) {
             printf_s("(%d) Read port status failed, err = 0x%x\n", __LINE__, dwErr);
@@ -180,7 +279,7 @@ int main(int argc, char* argv[])
 
     // Read partner device destID register
 
-    dwErr = TSI721SrioMaintRead(hDev, 0, 0, RIO_BASE_ID_CSR, &partnDestId);
+    dwErr = tsi721_shadow_maint_read(pShadow, 0, 0, RIO_BASE_ID_CSR, &partnDestId);
 
     if (dwErr != ERROR_SUCCESS) {
         printf_s("(%d) Failed to read partner destID, err = 0x%x\n", __LINE__, dwErr);
@@ -192,7 +291,72 @@ int main(int argc, char* argv[])
 
     printf_s("Tsi721 attached to device 0x%08x (destID=%d)\n", dwRegVal, partnDestId);
 
-    dwErr = TSI721RegisterWrite(hDev, RIO_PORT_GEN_CTRL_CSR, 0xe0000000); // set HOST, MAST_EN and DISC bits
+    dwErr = g_devOps->RegisterWrite(hDev, RIO_PORT_GEN_CTRL_CSR, 0xe0000000); // set HOST, MAST_EN and DISC bits
+
+    //
+    // Start asynchronous BDMA transfer engine (all channels except maintenance one)
+    //
+    dwErr = tsi721_dma_create(hDev, NULL, DMA_QUEUE_DEPTH, NULL, &pDmaEng);
+    if (dwErr != ERROR_SUCCESS) {
+        printf_s("(%d) Failed to start BDMA transfer engine, err = 0x%x\n", __LINE__, dwErr);
+        goto exit;
+    }
+
+    printf_s("BDMA transfer engine: %d channels, queue depth %d\n",
+             tsi721_dma_channels(pDmaEng), tsi721_dma_depth(pDmaEng));
+
+    //
+    // Small transfers of the basic test go through an outbound window where
+    // that is faster (the calibration overwrites the start of IB_WIN_0 of
+    // the target, which the test modes may be using)
+    //
+    if (mode == NULL) {
+        dwErr = tsi721_pio_open(hDev, 0, partnDestId, 0, 0, DMA_BUF_SIZE, &pPio);
+        if (dwErr == ERROR_SUCCESS)
+            dwErr = tsi721_pio_calibrate(pPio, 0, TRUE);
+
+        if (dwErr == ERROR_SUCCESS)
+            tsi721_dma_set_pio(pDmaEng, pPio);
+        else {
+            printf_s("PIO not available (err = 0x%x), BDMA only\n", dwErr);
+            tsi721_pio_close(pPio);
+            pPio = NULL;
+        }
+    }
+
+    //
+    // Run selected test mode instead of the basic test
+    //
+    if (mode != NULL) {
+        if (_stricmp(mode, "stream") == 0)
+            master_stream(pDmaEng, partnDestId, argc - 5, argv + 5);
+        else if (_stricmp(mode, "sweep") == 0)
+            master_sweep(hDev, pDmaEng, partnDestId, argc - 5, argv + 5);
+        else if (_stricmp(mode, "msg") == 0)
+            master_msg(devNum, partnDestId, argc - 5, argv + 5);
+        else if (_stricmp(mode, "dbping") == 0)
+            master_dbping(devNum, partnDestId, argc - 5, argv + 5);
+        else if (_stricmp(mode, "maint") == 0)
+            master_maint(hDev, partnDestId, argc - 5, argv + 5);
+        else if (_stricmp(mode, "enum") == 0)
+            master_enum(hDev, argc - 5, argv + 5);
+        else if (_stricmp(mode, "ring") == 0)
+            master_ring(hDev, destId, partnDestId, argc - 5, argv + 5);
+        else if (_stricmp(mode, "seg") == 0)
+            master_seg(devNum, partnDestId, argc - 5, argv + 5);
+        else {
+            printf_s("Unknown test mode '%s'\n", mode);
+            master_usage();
+        }
+        goto exit;
+    }
+
+    pSeed = getenv("TSI721_SEED");
+    if (pSeed != NULL)
+        runSeed = _strtoui64(pSeed, NULL, 0);
+    else
+        runSeed = ((ULONGLONG)_getpid() << 32) ^ GetTickCount64();
+    printf_s("Data seed 0x%llx (set TSI721_SEED to repeat)\n", runSeed);
 
     for (pass = 1; pass <= repeat || repeat == 0; pass++) {
 
@@ -201,14 +365,14 @@ int main(int argc, char* argv[])
             printf_s("Press Q to stop cyclic test\n");
         }
 
+        // A link drop since the last pass may have replaced the partner
+        tsi721_shadow_link_check(pShadow);
+
         //
         // Initialize write data
         //
-        srand(_getpid() + pass);
-        rnum = rand();
-
-        for (i = 0; i < DMA_BUF_SIZE; i++)
-            ((PUCHAR)obBuf)[i] = (UCHAR)(rnum + i);
+        tsi721_rng_init(&rng, runSeed, DATA_STREAM(pass, MAIN_STREAM_ID));
+        tsi721_rng_fill(&rng, obBuf, DMA_BUF_SIZE, 0);
 
         //
         // Perform data write operation (data will be written into inbound memory)
@@ -225,7 +389,8 @@ int main(int argc, char* argv[])
         printf_s("Writing %d bytes of data. Please wait ....\n", dwDataSize);
         fflush(stdout);
 
-        dwErr = TSI721SrioWrite(hDev, partnDestId, 0, 0, obBuf, &dwDataSize, dmaCtrl);
+        dwErr = tsi721_dma_xfer(pDmaEng, DMA_DIR_WRITE, partnDestId, 0, 0, obBuf, dwDataSize,
+                                DMA_CHUNK_SIZE, dmaCtrl);
         if (dwErr != ERROR_SUCCESS) {
             printf_s("(%d) SRIO_WR Failed, err = 0x%x\n", __LINE__, dwErr);
             goto exit;
@@ -239,18 +404,42 @@ int main(int argc, char* argv[])
         printf_s("Reading %d bytes of data. Please wait ....\n", dwDataSize);
         fflush(stdout);
 
-        dwErr = TSI721SrioRead(hDev, partnDestId, 0, 0, ibBuf, &dwDataSize, dmaCtrl);
+        dwErr = tsi721_dma_xfer(pDmaEng, DMA_DIR_READ, partnDestId, 0, 0, ibBuf, dwDataSize,
+                                DMA_CHUNK_SIZE, dmaCtrl);
         if (dwErr != ERROR_SUCCESS) {
             printf_s("(%d) SRIO_RD Failed, err = 0x%x\n", __LINE__, dwErr);
             goto exit;
         }
 
-        rnum = memcmp(obBuf, ibBuf, DMA_BUF_SIZE/2);
+        dwErr = tsi721_rng_verify(&rng, ibBuf, DMA_BUF_SIZE/2, 0, &patErr);
 
-        if (rnum == 0)
+        if (dwErr == ERROR_SUCCESS)
             printf_s("Data transfer test completed successfully\n");
         else {
-            printf_s("ERROR: Data transfer test failed\n");
+            printf_s("ERROR: Data transfer test failed: %llu bad bytes, first at offset 0x%llx (exp 0x%02x, got 0x%02x)\n",
+                     patErr.BadCount, patErr.FirstBad, patErr.Expected, patErr.Actual);
+            goto exit;
+        }
+
+        //
+        // Small write/read pair, done by PIO if it is below the thresholds
+        //
+        tsi721_rng_fill(&rng, obBuf, PIO_CHECK_SIZE, DMA_BUF_SIZE/2);
+        dmaCtrl.bits.Prio = 0;
+        dmaCtrl.bits.Rtype = LAST_NWRITE_R;
+
+        dwErr = tsi721_dma_xfer(pDmaEng, DMA_DIR_WRITE, partnDestId, 0, DMA_BUF_SIZE/2, obBuf,
+                                PIO_CHECK_SIZE, 0, dmaCtrl);
+        if (dwErr == ERROR_SUCCESS)
+            dwErr = tsi721_dma_xfer(pDmaEng, DMA_DIR_READ, partnDestId, 0, DMA_BUF_SIZE/2, ibBuf,
+                                    PIO_CHECK_SIZE, 0, dmaCtrl);
+        if (dwErr == ERROR_SUCCESS)
+            dwErr = tsi721_rng_verify(&rng, ibBuf, PIO_CHECK_SIZE, DMA_BUF_SIZE/2, &patErr);
+
+        if (dwErr == ERROR_SUCCESS)
+            printf_s("Small transfer test (%d bytes) completed successfully\n", PIO_CHECK_SIZE);
+        else {
+            printf_s("ERROR: Small transfer test failed, err = 0x%x\n", dwErr);
             goto exit;
         }
 
@@ -275,6 +464,7 @@ int main(int argc, char* argv[])
 
             for (i = 0; i < MAINT_THR_NUM; i++) {
                 evbThreadParam[i].hDev = hDev;
+                evbThreadParam[i].pShadow = pShadow;
                 evbThreadParam[i].Id = i;
                 evbThreadParam[i].DestId = partnDestId; 
                 hThread[i] = (HANDLE)_beginthread(maint_rd_thread, 0, &evbThreadParam[i]);
@@ -292,6 +482,8 @@ int main(int argc, char* argv[])
                 evbThreadParam[i].DestId = partnDestId; 
                 evbThreadParam[i].DataBuf = obBuf;
                 evbThreadParam[i].DataSize = 0x4000;
+                evbThreadParam[i].Stream = DATA_STREAM(pass, i);
+                evbThreadParam[i].Seed = runSeed;
 
                 hThread[i] = (HANDLE)_beginthread(data_rw_thread, 0, &evbThreadParam[i]);
                 if ((HANDLE)-1L == hThread[i]) {
@@ -318,7 +510,7 @@ int main(int argc, char* argv[])
         //
 
         printf_s("Sending  messages to MBOX0 ...\n");
-        tsi721_msg_send(hDev, partnDestId, 0, 10);
+        tsi721_msg_send(devNum, partnDestId, 0, 10);
 
         Sleep(200);
 
@@ -345,10 +537,34 @@ int main(int argc, char* argv[])
 
 exit:
 
-    TSI721DeviceClose(hDev, NULL);
+    if (pDmaEng)
+        tsi721_dma_destroy(pDmaEng);
+
+    if (pPio) {
+        tsi721_pio_stats(pPio, &pioStats);
+        printf_s("PIO: %llu writes, %llu reads, %llu bytes, %llu left to BDMA\n",
+                 pioStats.Writes, pioStats.Reads, pioStats.Bytes, pioStats.Declined);
+        tsi721_pio_close(pPio);
+    }
+
+    if (pShadow) {
+        tsi721_shadow_stats(pShadow, &shadowStats);
+        printf_s("CSR shadow: %llu hits, %llu misses, %llu volatile reads, %llu invalidated\n",
+                 shadowStats.Hits, shadowStats.Misses, shadowStats.Volatile, shadowStats.Invalidated);
+        tsi721_shadow_destroy(pShadow);
+    }
+
+    g_devOps->DeviceClose(hDev, NULL);
+
+    if (tracePath != NULL) {
+        dwErr = tsi721_trace_close();
+        if (dwErr != ERROR_SUCCESS)
+            printf_s("Failed to write trace file %s, err = 0x%x\n", tracePath, dwErr);
+    }
 
-    free(obBuf);
-    free(ibBuf);
+    tsi721_pool_free(obBuf);
+    tsi721_pool_free(ibBuf);
+    tsi721_pool_print();
 
     return 0;
 }
@@ -374,10 +590,12 @@ Return Value:
 --*/
 {
     HANDLE hDev = ((PEVB_THREAD_PARAM)Params)->hDev;
+    PCSR_SHADOW pShadow = ((PEVB_THREAD_PARAM)Params)->pShadow;
     DWORD  i, dwErr;
     DWORD  dwRegVal;
     DWORD  id = ((PEVB_THREAD_PARAM)Params)->Id;
     DWORD destId = ((PEVB_THREAD_PARAM)Params)->DestId;
+    ULONGLONG t0;
 
     // Wait until start signal is given
     WaitForSingleObject(hEvent, INFINITE);
@@ -387,7 +605,8 @@ Return Value:
         dwRegVal = 0;
 
         // Read from device ID register of the attached CPS1432 switch
-        dwErr = TSI721SrioMaintRead(hDev, 0, 0, RIO_DEV_ID_CAR, &dwRegVal);
+        // (immutable, served by the CSR shadow after the first read)
+        dwErr = tsi721_shadow_maint_read(pShadow, 0, 0, RIO_DEV_ID_CAR, &dwRegVal);
         if (dwErr != ERROR_SUCCESS) {
             printf_s("MNT_THR_%d: Maint Read request %d failed with err=0x%08x\n", id, i, dwErr);
             break;
@@ -405,14 +624,16 @@ Return Value:
         }
 
         // Write to Component Tag register 
-        dwErr = TSI721SrioMaintWrite(hDev, 0, 0, RIO_COMPONENT_TAG_CSR, 0xaabbccdd);
+        dwErr = tsi721_shadow_maint_write(pShadow, 0, 0, RIO_COMPONENT_TAG_CSR, 0xaabbccdd);
         if (dwErr != ERROR_SUCCESS) {
             printf_s("MNT_THR_%d: Maint Write request %d failed with err=0x%08x\n", id, i, dwErr);
             break;
         }
     }
 
-    dwErr = TSI721SrioDoorbellSend(hDev, destId, 0xffff & id);
+    t0 = lat_ticks();
+    dwErr = g_devOps->SrioDoorbellSend(hDev, destId, 0xffff & id);
+    tsi721_trace(TRACE_EV_DB_SEND, dwErr, destId, 0xffff & id, 0, t0);
     if (dwErr) {
         printf_s( "MNT_THR_%d: Error TSI721SrioDoorbellSend(): 0x%x (%d)\n", id, dwErr, dwErr);
     }
@@ -441,20 +662,22 @@ Return Value:
 --*/
 {
     HANDLE hDev = ((PEVB_THREAD_PARAM)Params)->hDev;
-    DWORD  i, loop, dwErr;
+    DWORD  loop, dwErr;
     PEVB_THREAD_PARAM thrParams = (PEVB_THREAD_PARAM)Params;
     DWORD id = ((PEVB_THREAD_PARAM)Params)->Id;
     DWORD destId = ((PEVB_THREAD_PARAM)Params)->DestId;
     DWORD dwDataSize;
     DMA_REQ_CTRL dmaCtrl;
-    int rnum;
+    RNG_STREAM rng;
+    ULONGLONG t0;
     PVOID  obBuf = NULL; // outbound data buffer
-    PVOID  ibBuf = NULL; // inbound data buffer
 
-    obBuf = malloc(((PEVB_THREAD_PARAM)Params)->DataSize);
-    ibBuf = malloc(((PEVB_THREAD_PARAM)Params)->DataSize);
+    // The thread's own generator, no state is shared with other threads
+    tsi721_rng_init(&rng, thrParams->Seed, thrParams->Stream);
 
-    if ((obBuf == NULL) || (ibBuf == NULL)) {
+    obBuf = tsi721_pool_alloc(((PEVB_THREAD_PARAM)Params)->DataSize);
+
+    if (obBuf == NULL) {
        printf_s("DATA_THR_%d: Failed to allocate data buffers\n", id);
        goto exit_err;
     }
@@ -464,12 +687,10 @@ Return Value:
 
     for (loop = 0; loop < DATA_THR_LOOP && !bQuitThread; loop++) {
 
-        // Initialize write data
-        rnum = rand();
+        // Initialize write data: the next part of the thread's stream
         dwDataSize = ((PEVB_THREAD_PARAM)Params)->DataSize;
 
-        for (i = 0; i < dwDataSize; i++)
-            ((PUCHAR)obBuf)[i] = (UCHAR)(rnum + i);
+        tsi721_rng_fill(&rng, obBuf, dwDataSize, (ULONGLONG)loop * dwDataSize);
 
         dmaCtrl.bits.Iof = 0;
         dmaCtrl.bits.Crf = 0;
@@ -477,7 +698,9 @@ Return Value:
         dmaCtrl.bits.Rtype = 1; // Last packet NWRITE_R, all other NWRITE or SWRITE
         dmaCtrl.bits.XAddr = 0; // bits 65:64 of SRIO address
 
-        dwErr = TSI721SrioWrite(hDev, destId, 0, 0, obBuf, &dwDataSize, dmaCtrl);
+        t0 = lat_ticks();
+        dwErr = g_devOps->SrioWrite(hDev, destId, 0, 0, obBuf, &dwDataSize, dmaCtrl);
+        tsi721_trace(TRACE_EV_DMA_COMPLETE, dwErr, (DWORD)-1, dwDataSize, 0, t0);
         if (dwErr != ERROR_SUCCESS) {
             printf_s("DATA_THR_%d: Data Write request %d failed with err=0x%08x\n", id, loop, dwErr);
             break;
@@ -486,12 +709,12 @@ Return Value:
 
 exit_err:
 
-    if (obBuf)
-        free(obBuf);
-    if (ibBuf)
-        free(ibBuf);
+    tsi721_pool_free(obBuf);
+    tsi721_pool_thread_flush();
 
-    dwErr = TSI721SrioDoorbellSend(hDev, destId, 0xffff & id);
+    t0 = lat_ticks();
+    dwErr = g_devOps->SrioDoorbellSend(hDev, destId, 0xffff & id);
+    tsi721_trace(TRACE_EV_DB_SEND, dwErr, destId, 0xffff & id, 0, t0);
     if (dwErr) {
         printf_s( "DATA_THR_%d: Error TSI721SrioDoorbellSend(): 0x%x (%d)\n", id, dwErr, dwErr);
     }
@@ -501,66 +724,934 @@ exit_err:
 
 VOID
 tsi721_msg_send(
-    HANDLE hDev,
+    DWORD  dwDevNum,
     DWORD  dwDestId,
     DWORD  dwMbox,
     DWORD  msgCount
     )
 {
-    OVERLAPPED ovl;
+    MSG_SEND_CFG cfg;
     DWORD dwError;
-    PUCHAR msgBuf = NULL;
-    DWORD dwBufLen;
 
-    memset(&ovl, 0, sizeof(ovl));
+    ZeroMemory(&cfg, sizeof(cfg));
+    cfg.DestId = dwDestId;
+    cfg.MboxMask = 1 << dwMbox;
+    cfg.MsgSize = 128;
+    cfg.MsgCount = msgCount;
+    cfg.Seed = (DWORD)_getpid();
 
-    //
-    // Create request completion event
-    //
-    ovl.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-    if (ovl.hEvent == NULL) {
-        printf_s( "ERR: failed to create request completion event\n");
-        return;
+    dwError = tsi721_msg_send_run(dwDevNum, &cfg, NULL);
+    if (ERROR_SUCCESS != dwError)
+        printf_s("MSG_SEND: error: 0x%x (%d) \n", dwError, dwError);
+}
+
+VOID
+master_usage(
+    VOID
+    )
+{
+    printf_s("Usage:\n");
+    printf_s("   master <dev_idx> [local_destID [repeat [mode [mode_args]]]]\n");
+    printf_s("Modes:\n");
+    printf_s("   stream <total_MB> [chunk_KB [verify]]  - pipelined large transfer, reports MB/s\n");
+    printf_s("   sweep [iterations [max_size [csv [json]]]] - size sweep of NWRITE/NWRITE_R/SWRITE/NREAD\n");
+    printf_s("   msg <count> [size [depth [mbox_mask [credits [consumer_dev]]]]] - pipelined message send,\n");
+    printf_s("      reports msgs/s per MBOX; credits: the receiver's buffers per MBOX (its rx_bufs),\n");
+    printf_s("      enables flow control by credit doorbells (0 = none)\n");
+    printf_s("      consumer_dev: receive with a local Tsi721 instead of the target\n");
+    printf_s("   dbping <count> [wait|poll|both [echo_dev]] - doorbell round trips, reports RTT percentiles\n");
+    printf_s("      echo_dev: answer the doorbells with a local Tsi721 instead of the target\n");
+    printf_s("   maint [max_threads [ops [read_pct [max_hop [csv]]]]] - maintenance request scaling,\n");
+    printf_s("      reports ops/s and latency percentiles for 1...max_threads threads per hop count\n");
+    printf_s("   enum [topo_file [threads [max_hops]]] - breadth-first fabric enumeration; a saved\n");
+    printf_s("      topology still matching the fabric is reused instead of enumerating again\n");
+    printf_s("   ring <total_MB> [slot_KB [slots [consumer_dev [window]]]] - record stream through a\n");
+    printf_s("      target window ring with doorbell credits, reports MB/s; window selects the target's\n");
+    printf_s("      IB window (at SRIO address window * 2 MB), one per concurrent producer\n");
+    printf_s("      consumer_dev: consume and verify with a local Tsi721 instead of the target\n");
+    printf_s("   seg <count> [size_KB [mbox_mask [consumer_dev [credits]]]] - payloads of up to 1 MB split\n");
+    printf_s("      into messages over several MBOXes and reassembled by the target, reports MB/s\n");
+    printf_s("      consumer_dev: reassemble and verify with a local Tsi721 instead of the target\n");
+    printf_s("      credits: as for msg, a MBOX out of credits is skipped\n");
+    printf_s("Environment:\n");
+    printf_s("   TSI721_CRC=1 - msg, seg and ring seal their messages and records with a CRC32C,\n");
+    printf_s("      checked by the receiver without reading the data back; the target must be\n");
+    printf_s("      started with TSI721_CRC=1 as well to check messages and segments\n");
+    printf_s("   TSI721_SEED=<n> - seed of the basic test payloads, printed by every run\n");
+}
+
+DWORD
+master_stream(
+    PDMA_ENGINE pDmaEng,
+    DWORD       dwDestId,
+    int         argc,
+    char*       argv[]
+    )
+/*++
+
+Routine Description:
+
+    Streaming transfer mode. Moves an arbitrarily large payload through the
+    target inbound window in chunks and reports sustained throughput.
+
+Arguments:
+
+    pDmaEng  - BDMA transfer engine
+    dwDestId - destID of the target device
+    argc     - number of mode arguments
+    argv     - mode arguments: <total_MB> [chunk_KB [verify]]
+
+Return Value:
+
+    Status returned by tsi721_stream_run().
+
+--*/
+{
+    STREAM_CFG   cfg;
+    STREAM_STATS stats;
+    DWORD        dwErr;
+
+    ZeroMemory(&cfg, sizeof(cfg));
+    cfg.DestId = dwDestId;
+    cfg.WinSize = DMA_BUF_SIZE;     // inbound window mapped by the target
+    cfg.TotalBytes = 1024ULL * 1024 * 1024;
+    cfg.bVerify = TRUE;
+    cfg.bProgress = TRUE;
+    cfg.Seed = (DWORD)_getpid();
+
+    if (argc > 0)
+        cfg.TotalBytes = (ULONGLONG)atoi(argv[0]) * 1024 * 1024;
+    if (argc > 1)
+        cfg.ChunkSize = atoi(argv[1]) * 1024;
+    if (argc > 2)
+        cfg.bVerify = atoi(argv[2]);
+
+    printf_s("Streaming %llu MB (verify %s). Please wait ....\n",
+             cfg.TotalBytes >> 20, cfg.bVerify ? "on" : "off");
+    fflush(stdout);
+
+    dwErr = tsi721_stream_run(pDmaEng, &cfg, &stats);
+
+    printf_s("STREAM: %llu bytes in %llu chunks, %.3f s, %.1f MB/s sustained\n",
+             stats.Bytes, stats.Chunks, stats.Seconds, stats.MBps);
+    printf_s("STREAM: generate %.3f s, verify %.3f s, bad chunks %llu\n",
+             stats.GenSeconds, stats.VerifySeconds, stats.BadChunks);
+
+    if (dwErr == ERROR_SUCCESS)
+        printf_s("Streaming test completed successfully\n");
+    else
+        printf_s("ERROR: Streaming test failed, err = 0x%x\n", dwErr);
+
+    return dwErr;
+}
+
+DWORD
+master_sweep(
+    HANDLE      hDev,
+    PDMA_ENGINE pDmaEng,
+    DWORD       dwDestId,
+    int         argc,
+    char*       argv[]
+    )
+/*++
+
+Routine Description:
+
+    Transfer-size sweep benchmark mode.
+
+Arguments:
+
+    hDev     - device handle
+    pDmaEng  - BDMA transfer engine
+    dwDestId - destID of the target device
+    argc     - number of mode arguments
+    argv     - mode arguments: [iterations [max_size [csv [json]]]]
+
+Return Value:
+
+    Status returned by tsi721_bench_sweep().
+
+--*/
+{
+    BENCH_CFG cfg;
+    DWORD     dwErr;
+
+    ZeroMemory(&cfg, sizeof(cfg));
+    cfg.DestId = dwDestId;
+    cfg.MaxSize = DMA_BUF_SIZE;     // inbound window mapped by the target
+    cfg.Warmup = 10;
+    cfg.CsvPath = "sweep.csv";
+    cfg.JsonPath = "sweep.json";
+
+    if (argc > 0)
+        cfg.Iterations = atoi(argv[0]);
+    if (argc > 1)
+        cfg.MaxSize = atoi(argv[1]);
+    if (argc > 2)
+        cfg.CsvPath = argv[2];
+    if (argc > 3)
+        cfg.JsonPath = argv[3];
+
+    dwErr = tsi721_bench_sweep(hDev, pDmaEng, &cfg);
+    if (dwErr == ERROR_SUCCESS)
+        printf_s("Sweep results written to %s and %s\n", cfg.CsvPath, cfg.JsonPath);
+    else
+        printf_s("ERROR: Sweep benchmark failed, err = 0x%x\n", dwErr);
+
+    return dwErr;
+}
+
+DWORD
+master_msg(
+    DWORD dwDevNum,
+    DWORD dwDestId,
+    int   argc,
+    char* argv[]
+    )
+/*++
+
+Routine Description:
+
+    Pipelined message send mode. Keeps several messages in flight per MBOX
+    and reports message and byte rates. The messages are received by the
+    target or, for a loopback test, by a local Tsi721 posting as many
+    buffers per MBOX as the sender has credits.
+
+Arguments:
+
+    dwDevNum - Tsi721 device index
+    dwDestId - destID of the target device
+    argc     - number of mode arguments
+    argv     - mode arguments: <count> [size [depth [mbox_mask [credits [consumer_dev]]]]]
+
+Return Value:
+
+    Status returned by tsi721_msg_send_run().
+
+--*/
+{
+    MSG_SEND_CFG  cfg;
+    MSGRX_CFG     rxCfg;
+    MSGRX_STATS   rxStats;
+    PMSGRX_ENGINE pMsgRx = NULL;
+    DWORD         dwErr, consDev, mbox;
+
+    if (argc < 1) {
+        master_usage();
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    ZeroMemory(&cfg, sizeof(cfg));
+    cfg.DestId = dwDestId;
+    cfg.MsgCount = atoi(argv[0]);
+    cfg.Seed = (DWORD)_getpid();
+    cfg.bCrc = bCrc;
+    cfg.bReport = TRUE;
+
+    if (argc > 1)
+        cfg.MsgSize = atoi(argv[1]);
+    if (argc > 2)
+        cfg.Depth = atoi(argv[2]);
+    if (argc > 3)
+        cfg.MboxMask = strtoul(argv[3], NULL, 0);
+    if (argc > 4)
+        cfg.Credits = atoi(argv[4]);
+
+    if (argc > 5) {
+        consDev = atoi(argv[5]);
+
+        ZeroMemory(&rxCfg, sizeof(rxCfg));
+        rxCfg.MboxMask = cfg.MboxMask ? cfg.MboxMask : 1;
+        rxCfg.bCrc = bCrc;
+        if (cfg.Credits) {
+            rxCfg.BufNum = cfg.Credits;
+            rxCfg.CreditBatch = max(1, min(MSGRX_DEF_CREDIT_BATCH, cfg.Credits / 2));
+        }
+
+        dwErr = tsi721_msgrx_start(consDev, &rxCfg, &pMsgRx);
+        if (dwErr != ERROR_SUCCESS) {
+            printf_s("ERROR: Failed to start message receiver on Tsi721_%d, err = 0x%x\n", consDev, dwErr);
+            return dwErr;
+        }
+        printf_s("Messages received by Tsi721_%d\n", consDev);
+    }
+
+    printf_s("Sending %d messages per MBOX ...\n", cfg.MsgCount);
+    fflush(stdout);
+
+    dwErr = tsi721_msg_send_run(dwDevNum, &cfg, NULL);
+    if (dwErr != ERROR_SUCCESS)
+        printf_s("ERROR: Message send test failed, err = 0x%x\n", dwErr);
+
+    if (pMsgRx) {
+        tsi721_msgrx_stats(pMsgRx, &rxStats);
+        tsi721_msgrx_stop(pMsgRx);
+
+        for (mbox = 0; mbox < RIO_MSG_MAX_MBOX; mbox++)
+            if (rxCfg.MboxMask & (1 << mbox))
+                printf_s("Receiver MBOX%d: %llu messages, %llu credit doorbells, %llu CRC checked, "
+                         "%llu CRC errors, %llu errors\n", mbox, rxStats.Msgs[mbox], rxStats.Credits[mbox],
+                         rxStats.Sealed[mbox], rxStats.CrcErrors[mbox], rxStats.Errors[mbox]);
+    }
+
+    return dwErr;
+}
+
+static DWORD
+master_dbping(
+    DWORD dwDevNum,
+    DWORD dwDestId,
+    int   argc,
+    char* argv[]
+    )
+/*++
+
+Routine Description:
+
+    Doorbell ping-pong mode. Measures doorbell round trips to the target,
+    which echoes them from its doorbell notification thread, receiving
+    the echo by waiting, by polling or both.
+
+Arguments:
+
+    dwDevNum - Tsi721 device index
+    dwDestId - destID of the target device
+    argc     - number of mode arguments
+    argv     - mode arguments: <count> [wait|poll|both [echo_dev]]
+
+Return Value:
+
+    Status returned by tsi721_db_ping_run().
+
+--*/
+{
+    DB_PING_CFG cfg;
+    PDB_ECHO    pEcho = NULL;
+    DWORD       dwErr, echoDev;
+
+    if (argc < 1) {
+        master_usage();
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    ZeroMemory(&cfg, sizeof(cfg));
+    cfg.DestId = dwDestId;
+    cfg.Count = atoi(argv[0]);
+    cfg.bReport = TRUE;
+
+    if (argc > 1) {
+        if (_stricmp(argv[1], "wait") == 0)
+            cfg.ModeMask = 1 << DB_RX_WAIT;
+        else if (_stricmp(argv[1], "poll") == 0)
+            cfg.ModeMask = 1 << DB_RX_POLL;
+        else if (_stricmp(argv[1], "both") != 0) {
+            master_usage();
+            return ERROR_INVALID_PARAMETER;
+        }
+    }
+
+    if (argc > 2) {
+        echoDev = atoi(argv[2]);
+        dwErr = tsi721_db_echo_start(echoDev, &pEcho);
+        if (dwErr != ERROR_SUCCESS) {
+            printf_s("ERROR: Failed to start doorbell echo on Tsi721_%d, err = 0x%x\n", echoDev, dwErr);
+            return dwErr;
+        }
+        printf_s("Doorbells echoed by Tsi721_%d\n", echoDev);
+    }
+
+    printf_s("Measuring %d doorbell round trips per reception mode ...\n", cfg.Count);
+    fflush(stdout);
+
+    dwErr = tsi721_db_ping_run(dwDevNum, &cfg, NULL);
+    if (dwErr != ERROR_SUCCESS)
+        printf_s("ERROR: Doorbell round-trip test failed, err = 0x%x\n", dwErr);
+
+    if (pEcho)
+        printf_s("%llu doorbells echoed\n", tsi721_db_echo_stop(pEcho));
+
+    return dwErr;
+}
+
+static DWORD
+master_maint(
+    HANDLE hDev,
+    DWORD  dwDestId,
+    int    argc,
+    char*  argv[]
+    )
+/*++
+
+Routine Description:
+
+    Maintenance request scaling mode. Runs a read/write mix of maintenance
+    requests from 1 to max_threads threads for hop counts 0...max_hop.
+
+Arguments:
+
+    hDev     - device handle
+    dwDestId - destID of the target device
+    argc     - number of mode arguments
+    argv     - mode arguments: [max_threads [ops [read_pct [max_hop [csv]]]]]
+
+Return Value:
+
+    Status returned by tsi721_bench_maint().
+
+--*/
+{
+    MAINT_BENCH_CFG cfg;
+    DWORD           dwErr;
+
+    ZeroMemory(&cfg, sizeof(cfg));
+    cfg.DestId = dwDestId;
+    cfg.ReadPct = 50;
+    cfg.CsvPath = "maint.csv";
+
+    if (argc > 0)
+        cfg.MaxThreads = atoi(argv[0]);
+    if (argc > 1)
+        cfg.Ops = atoi(argv[1]);
+    if (argc > 2)
+        cfg.ReadPct = atoi(argv[2]);
+    if (argc > 3)
+        cfg.HopMax = atoi(argv[3]);
+    if (argc > 4)
+        cfg.CsvPath = argv[4];
+
+    dwErr = tsi721_bench_maint(hDev, &cfg);
+    if (dwErr == ERROR_SUCCESS)
+        printf_s("Maintenance results written to %s\n", cfg.CsvPath);
+    else
+        printf_s("ERROR: Maintenance benchmark failed, err = 0x%x\n", dwErr);
+
+    return dwErr;
+}
+
+static DWORD
+master_enum(
+    HANDLE hDev,
+    int    argc,
+    char*  argv[]
+    )
+/*++
+
+Routine Description:
+
+    Fabric enumeration mode. A topology saved by an earlier run is verified
+    and reused (warm start); the fabric is enumerated and the topology saved
+    when there is none or the fabric has changed (cold start). A topology
+    just saved is loaded and verified again, so every cold start also runs
+    the warm start path.
+
+Arguments:
+
+    hDev - device handle
+    argc - number of mode arguments
+    argv - mode arguments: [topo_file [threads [max_hops]]]
+
+Return Value:
+
+    Status returned by tsi721_enum_run() or tsi721_enum_verify().
+
+--*/
+{
+    ENUM_CFG   cfg;
+    PENUM_TOPO pTopo;
+    PCSTR      path = "topology.txt";
+    DWORD      dwErr;
+
+    ZeroMemory(&cfg, sizeof(cfg));
+    cfg.FirstDestId = 1;
+
+    if (argc > 0)
+        path = argv[0];
+    if (argc > 1)
+        cfg.Threads = atoi(argv[1]);
+    if (argc > 2)
+        cfg.MaxHops = atoi(argv[2]);
+
+    pTopo = (PENUM_TOPO)malloc(sizeof(ENUM_TOPO));
+    if (pTopo == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    dwErr = tsi721_enum_load(path, pTopo);
+    if (dwErr == ERROR_SUCCESS) {
+        dwErr = tsi721_enum_verify(hDev, pTopo, cfg.Threads);
+        if (dwErr == ERROR_SUCCESS) {
+            printf_s("Warm start: %u devices of %s verified in %llu us (%u maintenance requests)\n",
+                     pTopo->NodeNum, path, pTopo->ElapsedNs / 1000, pTopo->MaintOps);
+            tsi721_enum_print(pTopo);
+            goto exit;
+        }
+        printf_s("Saved topology %s does not match the fabric (err = 0x%x), enumerating\n", path, dwErr);
     }
 
+    dwErr = tsi721_enum_run(hDev, &cfg, pTopo);
+    if (dwErr != ERROR_SUCCESS) {
+        printf_s("ERROR: Fabric enumeration failed, err = 0x%x\n", dwErr);
+        goto exit;
+    }
+
+    printf_s("Cold start: %u devices, %u hop levels enumerated in %llu us (%u maintenance requests)\n",
+             pTopo->NodeNum, pTopo->MaxHop + 1, pTopo->ElapsedNs / 1000, pTopo->MaintOps);
+    tsi721_enum_print(pTopo);
+
+    dwErr = tsi721_enum_save(pTopo, path);
+    if (dwErr != ERROR_SUCCESS) {
+        printf_s("ERROR: Unable to save topology to %s\n", path);
+        goto exit;
+    }
+    printf_s("Topology saved to %s\n", path);
+
     //
-    // Allocate single message buffer 4KB (has to be aligned to the page boundary)
-    // NOTE: we will send messages shorter than allocated buffer but size can be increased
-    // up to 4KB if required.
+    // Take the warm start path on the saved file while the fabric is known
+    // to match it. The emulated fabric is rebuilt with new component tags
+    // by every run, so a later run cannot exercise it there.
     //
-    msgBuf = (PUCHAR)_aligned_malloc(0x1000, PAGE_SIZE);
-    if (msgBuf == NULL) {
-        printf_s("ERR: Unable to allocate aligned buffer for IB_MSG\n");
-        goto err_exit;
+    dwErr = tsi721_enum_load(path, pTopo);
+    if (dwErr == ERROR_SUCCESS)
+        dwErr = tsi721_enum_verify(hDev, pTopo, cfg.Threads);
+    if (dwErr == ERROR_SUCCESS)
+        printf_s("Saved topology verified: %u devices in %llu us (%u maintenance requests)\n",
+                 pTopo->NodeNum, pTopo->ElapsedNs / 1000, pTopo->MaintOps);
+    else
+        printf_s("ERROR: Saved topology %s fails verification, err = 0x%x\n", path, dwErr);
+
+exit:
+
+    free(pTopo);
+    return dwErr;
+}
+
+typedef struct _RING_VERIFY {
+    DWORD     Seed;
+    ULONGLONG Offset;       // stream offset of the next record
+    ULONGLONG BadRecords;
+} RING_VERIFY, *PRING_VERIFY;
+
+static VOID
+ring_verify_handler(
+    PVOID pCtx,
+    PVOID pData,
+    DWORD dwSize
+    )
+{
+    PRING_VERIFY pVerify = (PRING_VERIFY)pCtx;
+
+    if (tsi721_pattern_verify(pData, dwSize, pVerify->Seed, pVerify->Offset, NULL) != ERROR_SUCCESS)
+        pVerify->BadRecords++;
+    pVerify->Offset += dwSize;
+}
+
+static DWORD
+master_ring(
+    HANDLE hDev,
+    DWORD  dwHostId,
+    DWORD  dwDestId,
+    int    argc,
+    char*  argv[]
+    )
+/*++
+
+Routine Description:
+
+    Ring stream mode. Streams pattern records through the ring in the
+    target inbound window and reports the sustained rate. The records are
+    consumed by the target or, for a loopback test, by a local Tsi721 that
+    also checks the pattern.
+
+Arguments:
+
+    hDev     - device handle
+    dwHostId - local destID (receives the credits)
+    dwDestId - destID of the target device
+    argc     - number of mode arguments
+    argv     - mode arguments: <total_MB> [slot_KB [slots [consumer_dev [window]]]]
+
+Return Value:
+
+    Status returned by tsi721_ring_send() or tsi721_ring_flush().
+
+--*/
+{
+    RING_CFG        cfg;
+    RING_RX_CFG     rxCfg;
+    RING_PROD_STATS stats;
+    RING_CONS_STATS rxStats;
+    RING_VERIFY     verify;
+    IBW_WIN         ibWin;
+    PIBW_MGR        pIbwMgr = NULL;
+    PRING_PROD      pProd = NULL;
+    PRING_CONS      pCons = NULL;
+    HANDLE          hCons = INVALID_HANDLE_VALUE;
+    PUCHAR          pBuf = NULL;
+    ULONGLONG       total, offset, t0;
+    DWORD           dwErr, dwSize, consDev, win = 0, i;
+    double          secs;
+
+    if (argc < 1) {
+        master_usage();
+        return ERROR_INVALID_PARAMETER;
     }
 
-    while (msgCount--) {
-        dwBufLen = 128;
+    ZeroMemory(&cfg, sizeof(cfg));
+    cfg.DestId = dwDestId;
+    cfg.ProducerId = dwHostId;
+    cfg.WinSize = DMA_BUF_SIZE;     // inbound window mapped by the target
+    cfg.bCrc = bCrc;
+
+    total = (ULONGLONG)atoi(argv[0]) * 1024 * 1024;
+    if (argc > 1)
+        cfg.SlotSize = atoi(argv[1]) * 1024;
+    if (argc > 2)
+        cfg.SlotNum = atoi(argv[2]);
+    if (argc > 4)
+        win = atoi(argv[4]);
+
+    // The target maps its ring windows DMA_BUF_SIZE apart from address 0
+    if (win >= IBWIN_MAX_CHNUM) {
+        master_usage();
+        return ERROR_INVALID_PARAMETER;
+    }
+    cfg.WinAddrLo = win * DMA_BUF_SIZE;
 
-        memset(msgBuf, msgCount, dwBufLen);
-        dwError = TSI721SrioMsgSend(hDev, 0, dwDestId, msgBuf, &dwBufLen, &ovl);
+    ZeroMemory(&verify, sizeof(verify));
+    verify.Seed = (DWORD)_getpid();
 
-        if (ERROR_IO_PENDING == dwError) {
-            BOOL bResult = FALSE;
+    if (argc > 3) {
+        consDev = atoi(argv[3]);
+        if (!g_devOps->DeviceOpen(&hCons, consDev, NULL)) {
+            dwErr = GetLastError();
+            printf_s("ERROR: Unable to open consumer device Tsi721_%d, err = 0x%x\n", consDev, dwErr);
+            return dwErr;
+        }
 
-            WaitForSingleObject(ovl.hEvent, INFINITE);
-            bResult = GetOverlappedResult(hDev, &ovl, &dwBufLen, FALSE);
-            if (!bResult)
-                dwError = GetLastError();
-            else
-                dwError = ERROR_SUCCESS;
+        // Same window layout as the target
+        dwErr = tsi721_ibw_create(hCons, 0, 0, &pIbwMgr);
+        for (i = 0; i <= win && dwErr == ERROR_SUCCESS; i++)
+            dwErr = tsi721_ibw_alloc(pIbwMgr, DMA_BUF_SIZE, DMA_BUF_SIZE, &ibWin);
+        if (dwErr != ERROR_SUCCESS) {
+            printf_s("ERROR: Failed to map IB_WIN_%d on Tsi721_%d, err = 0x%x\n", win, consDev, dwErr);
+            goto exit;
         }
-                    
-        if (ERROR_SUCCESS != dwError) {
-            printf_s("MSG_SEND: IOCTL error: 0x%x (%d) \n", dwError, dwError);
-            break;
+
+        ZeroMemory(&rxCfg, sizeof(rxCfg));
+        rxCfg.WinNum = ibWin.WinNum;
+        rxCfg.WinSize = ibWin.Size;
+        rxCfg.Handler = ring_verify_handler;
+        rxCfg.HandlerCtx = &verify;
+
+        dwErr = tsi721_ring_cons_start(hCons, &rxCfg, &pCons);
+        if (dwErr != ERROR_SUCCESS) {
+            printf_s("ERROR: Failed to start ring consumer on Tsi721_%d, err = 0x%x\n", consDev, dwErr);
+            goto exit;
         }
+        printf_s("Ring consumed by Tsi721_%d IB_WIN_%d\n", consDev, ibWin.WinNum);
+    }
+
+    dwErr = tsi721_ring_prod_create(hDev, &cfg, &pProd);
+    if (dwErr != ERROR_SUCCESS) {
+        printf_s("ERROR: Failed to create ring, err = 0x%x\n", dwErr);
+        goto exit;
+    }
+
+    // Largest record that fits a slot
+    dwSize = (cfg.SlotSize ? cfg.SlotSize : RING_DEF_SLOT_SIZE) - sizeof(RING_SLOT_HDR);
+    pBuf = (PUCHAR)tsi721_pool_alloc(dwSize);
+    if (pBuf == NULL) {
+        dwErr = ERROR_NOT_ENOUGH_MEMORY;
+        goto exit;
+    }
+
+    printf_s("Streaming %llu MB through the ring in %d byte records. Please wait ....\n",
+             total >> 20, dwSize);
+    fflush(stdout);
+
+    t0 = lat_ticks();
+
+    for (offset = 0; offset < total; offset += dwSize) {
+        dwSize = (DWORD)min((ULONGLONG)dwSize, total - offset);
+        tsi721_pattern_fill(pBuf, dwSize, verify.Seed, offset);
+
+        dwErr = tsi721_ring_send(pProd, pBuf, dwSize);
+        if (dwErr != ERROR_SUCCESS) {
+            printf_s("ERROR: Ring send failed at offset %llu, err = 0x%x\n", offset, dwErr);
+            goto exit;
+        }
+    }
+
+    dwErr = tsi721_ring_flush(pProd, RING_SEND_TIMEOUT);
+    if (dwErr != ERROR_SUCCESS) {
+        printf_s("ERROR: Ring flush failed, err = 0x%x\n", dwErr);
+        goto exit;
+    }
+
+    secs = (double)lat_ticks_to_ns(lat_ticks() - t0) / 1e9;
+
+    tsi721_ring_prod_stats(pProd, &stats);
+    printf_s("RING: %llu bytes in %llu records, %.3f s, %.1f MB/s\n",
+             stats.Bytes, stats.Records, secs, secs > 0 ? (double)stats.Bytes / secs / (1024 * 1024) : 0.0);
+    printf_s("RING: %llu tail updates, %llu credits, %llu full waits, %llu head reads\n",
+             stats.Publishes, stats.Credits, stats.CreditWaits, stats.HeadReads);
+
+exit:
+
+    if (pProd)
+        tsi721_ring_prod_destroy(pProd);
+
+    if (pCons) {
+        tsi721_ring_cons_stats(pCons, &rxStats);
+        tsi721_ring_cons_stop(pCons);
+
+        printf_s("RING consumer: %llu records, %llu bytes, %llu credits, %llu sequence errors, %llu bad records\n",
+                 rxStats.Records, rxStats.Bytes, rxStats.Credits, rxStats.SeqErrors, verify.BadRecords);
+        printf_s("RING consumer: window read %s, %llu bytes in place, %llu bytes copied\n",
+                 rxStats.bZeroCopy ? "in place" : "by copies", rxStats.ZeroCopyBytes, rxStats.CopiedBytes);
+        printf_s("RING consumer: %llu records CRC checked, %llu CRC errors\n", rxStats.Sealed, rxStats.CrcErrors);
+        if (dwErr == ERROR_SUCCESS &&
+            (verify.BadRecords || rxStats.SeqErrors || rxStats.CrcErrors || rxStats.Bytes != total))
+            dwErr = ERROR_CRC;
+    }
+
+    if (pIbwMgr)
+        tsi721_ibw_destroy(pIbwMgr);
+
+    if (hCons != INVALID_HANDLE_VALUE)
+        g_devOps->DeviceClose(hCons, NULL);
+
+    tsi721_pool_free(pBuf);
+
+    if (dwErr == ERROR_SUCCESS)
+        printf_s("Ring stream test completed successfully\n");
+
+    return dwErr;
+}
+
+typedef struct _SEG_VERIFY {
+    USHORT        StreamId;
+    volatile LONG Good;
+    volatile LONG Bad;
+} SEG_VERIFY, *PSEG_VERIFY;
+
+static VOID
+seg_verify_handler(
+    PVOID  pCtx,
+    DWORD  dwSrc,
+    USHORT wStreamId,
+    DWORD  dwSeq,
+    PVOID  pData,
+    DWORD  dwSize
+    )
+{
+    PSEG_VERIFY pVerify = (PSEG_VERIFY)pCtx;
+
+    UNREFERENCED_PARAMETER(dwSrc);
+
+    // Called by several receive workers at once
+    if (wStreamId == pVerify->StreamId &&
+        tsi721_pattern_verify(pData, dwSize, SEG_TEST_SEED(wStreamId, dwSeq), 0, NULL) == ERROR_SUCCESS)
+        InterlockedIncrement(&pVerify->Good);
+    else
+        InterlockedIncrement(&pVerify->Bad);
+}
+
+static DWORD
+master_seg(
+    DWORD  dwDevNum,
+    DWORD  dwDestId,
+    int    argc,
+    char*  argv[]
+    )
+/*++
+
+Routine Description:
+
+    Segmented payload mode. Sends pattern payloads larger than a message
+    as segments spread over several MBOXes and reports the payload rate.
+    The payloads are reassembled by the target or, for a loopback test, by
+    a local Tsi721 that also checks the pattern.
+
+Arguments:
+
+    dwDevNum - Tsi721 device index
+    dwDestId - destID of the target device
+    argc     - number of mode arguments
+    argv     - mode arguments: <count> [size_KB [mbox_mask [consumer_dev [credits]]]]
+
+Return Value:
+
+    Status returned by tsi721_seg_send() or tsi721_seg_flush().
+
+--*/
+{
+    SEG_TX_CFG    cfg;
+    SEG_TX_STATS  stats;
+    SEG_RX_CFG    rxCfg;
+    SEG_RX_STATS  rxStats;
+    MSGRX_STATS   msgRxStats;
+    MSGRX_CFG     msgRxCfg;
+    SEG_VERIFY    verify;
+    PSEG_TX       pTx = NULL;
+    PSEG_RX       pRx = NULL;
+    PMSGRX_ENGINE pMsgRx = NULL;
+    PUCHAR        pBuf = NULL;
+    ULONGLONG     t0, segs = 0;
+    DWORD         dwErr, count, dwSize = 64 * 1024, consDev, idle, i;
+    double        secs;
+
+    if (argc < 1) {
+        master_usage();
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    ZeroMemory(&cfg, sizeof(cfg));
+    cfg.DestId = dwDestId;
+    cfg.StreamId = (USHORT)_getpid();
+    cfg.bCrc = bCrc;
+
+    count = atoi(argv[0]);
+    if (argc > 1)
+        dwSize = atoi(argv[1]) * 1024;
+    if (argc > 2)
+        cfg.MboxMask = strtoul(argv[2], NULL, 0);
+    if (argc > 4)
+        cfg.Credits = atoi(argv[4]);
+
+    if (dwSize == 0 || dwSize > SEG_MAX_SIZE) {
+        master_usage();
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    ZeroMemory(&verify, sizeof(verify));
+    verify.StreamId = cfg.StreamId;
+
+    if (argc > 3) {
+        consDev = atoi(argv[3]);
+
+        ZeroMemory(&rxCfg, sizeof(rxCfg));
+        rxCfg.Handler = seg_verify_handler;
+        rxCfg.HandlerCtx = &verify;
+
+        dwErr = tsi721_seg_rx_create(&rxCfg, &pRx);
+        if (dwErr != ERROR_SUCCESS)
+            goto exit;
+
+        ZeroMemory(&msgRxCfg, sizeof(msgRxCfg));
+        msgRxCfg.MboxMask = cfg.MboxMask;
+        msgRxCfg.Handler = tsi721_seg_rx_msg;
+        msgRxCfg.HandlerCtx = pRx;
+        msgRxCfg.bCrc = bCrc;
+        if (cfg.Credits) {
+            msgRxCfg.BufNum = cfg.Credits;
+            msgRxCfg.CreditBatch = max(1, min(MSGRX_DEF_CREDIT_BATCH, cfg.Credits / 2));
+        }
+
+        dwErr = tsi721_msgrx_start(consDev, &msgRxCfg, &pMsgRx);
+        if (dwErr != ERROR_SUCCESS) {
+            printf_s("ERROR: Failed to start message receiver on Tsi721_%d, err = 0x%x\n", consDev, dwErr);
+            goto exit;
+        }
+        printf_s("Payloads reassembled by Tsi721_%d\n", consDev);
+    }
+
+    dwErr = tsi721_seg_tx_create(dwDevNum, &cfg, &pTx);
+    if (dwErr != ERROR_SUCCESS) {
+        printf_s("ERROR: Failed to create segment sender, err = 0x%x\n", dwErr);
+        goto exit;
+    }
+
+    pBuf = (PUCHAR)tsi721_pool_alloc(dwSize);
+    if (pBuf == NULL) {
+        dwErr = ERROR_NOT_ENOUGH_MEMORY;
+        goto exit;
+    }
+
+    printf_s("Sending %d payloads of %d bytes in segments of up to %d bytes. Please wait ....\n",
+             count, dwSize, (DWORD)SEG_PAYLOAD);
+    fflush(stdout);
+
+    t0 = lat_ticks();
+
+    for (i = 0; i < count; i++) {
+        // Payload i is the sender's sequence number i
+        tsi721_pattern_fill(pBuf, dwSize, SEG_TEST_SEED(cfg.StreamId, i), 0);
+
+        dwErr = tsi721_seg_send(pTx, pBuf, dwSize);
+        if (dwErr != ERROR_SUCCESS) {
+            printf_s("ERROR: Segmented send of payload %d failed, err = 0x%x\n", i, dwErr);
+            goto exit;
+        }
+    }
+
+    dwErr = tsi721_seg_flush(pTx);
+    if (dwErr != ERROR_SUCCESS) {
+        printf_s("ERROR: Segment flush failed, err = 0x%x\n", dwErr);
+        goto exit;
+    }
+
+    secs = (double)lat_ticks_to_ns(lat_ticks() - t0) / 1e9;
+
+    tsi721_seg_tx_stats(pTx, &stats);
+    for (i = 0; i < RIO_MSG_MAX_MBOX; i++)
+        segs += stats.Segments[i];
+
+    printf_s("SEG: %llu payloads, %llu bytes in %llu segments, %.3f s, %.1f MB/s\n",
+             stats.Payloads, stats.Bytes, segs, secs,
+             secs > 0 ? (double)stats.Bytes / secs / (1024 * 1024) : 0.0);
+    printf_s("SEG: segments per MBOX %llu/%llu/%llu/%llu\n",
+             stats.Segments[0], stats.Segments[1], stats.Segments[2], stats.Segments[3]);
+    if (cfg.Credits)
+        printf_s("SEG: %llu credit doorbells, %llu MBOXes skipped without a credit\n",
+                 stats.CreditDbs, stats.CreditWaits);
+
+exit:
+
+    if (pTx)
+        tsi721_seg_tx_destroy(pTx);
+
+    if (pMsgRx) {
+        // Let the receiver drain what is still on its way
+        for (idle = 0; idle < 100; idle++) {
+            tsi721_seg_rx_stats(pRx, &rxStats);
+            if (rxStats.Payloads + rxStats.Dropped >= count)
+                break;
+            if (rxStats.Segments != segs) {
+                segs = rxStats.Segments;
+                idle = 0;
+            }
+            Sleep(10);
+        }
+
+        tsi721_msgrx_stats(pMsgRx, &msgRxStats);
+        tsi721_msgrx_stop(pMsgRx);
+
+        for (i = 1; i < RIO_MSG_MAX_MBOX; i++) {
+            msgRxStats.Sealed[0] += msgRxStats.Sealed[i];
+            msgRxStats.CrcErrors[0] += msgRxStats.CrcErrors[i];
+        }
+        printf_s("SEG receiver: %llu segments CRC checked, %llu CRC errors\n",
+                 msgRxStats.Sealed[0], msgRxStats.CrcErrors[0]);
+        if (dwErr == ERROR_SUCCESS && msgRxStats.CrcErrors[0])
+            dwErr = ERROR_CRC;
+    }
+
+    if (pRx) {
+        tsi721_seg_rx_stats(pRx, &rxStats);
+        tsi721_seg_rx_destroy(pRx);
+
+        printf_s("SEG receiver: %llu payloads, %llu bytes, %llu segments, %llu duplicates, "
+                 "%llu dropped, %llu bad, %d incomplete, %d bad payloads\n",
+                 rxStats.Payloads, rxStats.Bytes, rxStats.Segments, rxStats.Duplicates,
+                 rxStats.Dropped, rxStats.Bad, rxStats.Active, verify.Bad);
+        if (dwErr == ERROR_SUCCESS && (verify.Bad || (DWORD)verify.Good != count))
+            dwErr = ERROR_CRC;
     }
 
-err_exit:
+    tsi721_pool_free(pBuf);
 
-    if (msgBuf)
-        _aligned_free(msgBuf);
+    if (dwErr == ERROR_SUCCESS)
+        printf_s("Segmented payload test completed successfully\n");
 
-    CloseHandle(ovl.hEvent);
+    return dwErr;
 }
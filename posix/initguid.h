@@ -0,0 +1,4 @@
+/*
+ * initguid.h - POSIX stand-in, see tsi721posix.h
+ */
+#include "tsi721posix.h"
@@ -0,0 +1,39 @@
+/*
+ * intrin.h - POSIX stand-in, see tsi721posix.h
+ *
+ *  Maps the MSVC CPUID and XGETBV intrinsics onto inline assembly; the GCC
+ *  versions have different signatures or require a target attribute.
+ */
+#ifndef _TSI721POSIX_INTRIN_H_
+#define _TSI721POSIX_INTRIN_H_
+
+#include "tsi721posix.h"
+#include <x86intrin.h>
+
+static inline void
+__cpuidex(int info[4], int leaf, int subleaf)
+{
+    __asm__ __volatile__("cpuid"
+                         : "=a"(info[0]), "=b"(info[1]), "=c"(info[2]), "=d"(info[3])
+                         : "a"(leaf), "c"(subleaf));
+}
+
+static inline void
+__cpuid(int info[4], int leaf)
+{
+    __cpuidex(info, leaf, 0);
+}
+
+static inline unsigned long long
+tsi721_xgetbv(unsigned int xcr)
+{
+    unsigned int lo, hi;
+
+    __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(xcr));
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+#undef _xgetbv
+#define _xgetbv tsi721_xgetbv
+
+#endif // _TSI721POSIX_INTRIN_H_
@@ -0,0 +1,4 @@
+/*
+ * process.h - POSIX stand-in, see tsi721posix.h
+ */
+#include "tsi721posix.h"
@@ -0,0 +1,1479 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721posix.cpp
+
+Description:
+
+    POSIX implementation of the Win32 subset declared in tsi721posix.h.
+
+    Events, semaphores and threads share one lock and one condition
+    variable, which keeps WaitForMultipleObjects() simple and exact (all
+    objects of a wait are tested and consumed under the same lock). The
+    tools wait on a handful of objects, so the shared wakeup is cheap.
+    Completion ports have their own lock so the message and BDMA paths
+    never touch the shared one.
+
+--*/
+
+#include <windows.h>
+#include <conio.h>
+#include <process.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define OBJ_EVENT       1
+#define OBJ_SEMAPHORE   2
+#define OBJ_THREAD      3
+#define OBJ_PORT        4
+#define OBJ_FILE        5
+#define OBJ_MAPPING     6
+
+#define PORT_DEF_SIZE   1024    // initial completion queue size (grows on demand)
+
+typedef struct _POSIX_OBJ {
+    DWORD Type;                 // OBJ_xxx
+} POSIX_OBJ, *PPOSIX_OBJ;
+
+//
+// Event, semaphore or thread. Count is the signal state: 0/1 for events and
+// threads (1 = exited), the current count for semaphores.
+//
+typedef struct _POSIX_WAITABLE {
+    DWORD Type;
+    BOOL  bManualReset;
+    LONG  Count;
+    LONG  Maximum;
+    LONG  Refs;                 // handle + running thread
+} POSIX_WAITABLE, *PPOSIX_WAITABLE;
+
+typedef struct _POSIX_THREAD_START {
+    PPOSIX_WAITABLE pObj;
+    void          (*pfnStart)(void *);
+    unsigned      (*pfnStartEx)(void *);
+    void           *pArg;
+} POSIX_THREAD_START, *PPOSIX_THREAD_START;
+
+typedef struct _POSIX_PORT {
+    DWORD             Type;
+    pthread_mutex_t   Lock;
+    pthread_cond_t    Cond;
+    LPOVERLAPPED_ENTRY Ring;
+    ULONG             Size;
+    ULONG             Head;
+    ULONG             Count;
+} POSIX_PORT, *PPOSIX_PORT;
+
+typedef struct _POSIX_FILE {
+    DWORD Type;
+    int   Fd;
+} POSIX_FILE, *PPOSIX_FILE;
+
+typedef struct _POSIX_VIEW {
+    struct _POSIX_VIEW *Next;
+    PVOID  Base;
+    size_t Size;
+} POSIX_VIEW, *PPOSIX_VIEW;
+
+static pthread_mutex_t g_objLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  g_objCond;
+static pthread_once_t  g_objOnce = PTHREAD_ONCE_INIT;
+static PPOSIX_VIEW     g_viewList = NULL;   // protected by g_objLock
+
+static __thread DWORD  t_lastError = ERROR_SUCCESS;
+
+static VOID
+posix_cond_init(
+    pthread_cond_t *pCond
+    )
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(pCond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static VOID
+posix_obj_once(
+    VOID
+    )
+{
+    posix_cond_init(&g_objCond);
+}
+
+static VOID
+posix_deadline(
+    DWORD            dwTimeout,
+    struct timespec *pTs
+    )
+/*++
+
+Routine Description:
+
+    Converts a relative timeout in milliseconds into an absolute
+    CLOCK_MONOTONIC time for pthread_cond_timedwait().
+
+--*/
+{
+    clock_gettime(CLOCK_MONOTONIC, pTs);
+    pTs->tv_sec += dwTimeout / 1000;
+    pTs->tv_nsec += (long)(dwTimeout % 1000) * 1000000;
+    if (pTs->tv_nsec >= 1000000000) {
+        pTs->tv_sec++;
+        pTs->tv_nsec -= 1000000000;
+    }
+}
+
+static DWORD
+posix_errno(
+    int err
+    )
+{
+    switch (err) {
+    case 0:         return ERROR_SUCCESS;
+    case ENOENT:    return ERROR_FILE_NOT_FOUND;
+    case EACCES:
+    case EPERM:     return ERROR_ACCESS_DENIED;
+    case EBADF:     return ERROR_INVALID_HANDLE;
+    case ENOMEM:    return ERROR_NOT_ENOUGH_MEMORY;
+    case EEXIST:    return ERROR_ALREADY_EXISTS;
+    case EINVAL:    return ERROR_INVALID_PARAMETER;
+    case EBUSY:     return ERROR_BUSY;
+    case ETIMEDOUT: return ERROR_TIMEOUT;
+    default:        return ERROR_GEN_FAILURE;
+    }
+}
+
+//
+// C runtime helpers
+//
+
+int
+fopen_s(
+    FILE      **ppFile,
+    const char *pName,
+    const char *pMode
+    )
+{
+    *ppFile = fopen(pName, pMode);
+    return (*ppFile == NULL) ? errno : 0;
+}
+
+int
+strcpy_s(
+    char       *pDst,
+    size_t      size,
+    const char *pSrc
+    )
+{
+    size_t len = strlen(pSrc);
+
+    if (pDst == NULL || size == 0)
+        return EINVAL;
+
+    if (len >= size) {
+        pDst[0] = '\0';
+        return ERANGE;
+    }
+
+    memcpy(pDst, pSrc, len + 1);
+    return 0;
+}
+
+//
+// Errors
+//
+
+DWORD
+GetLastError(
+    VOID
+    )
+{
+    return t_lastError;
+}
+
+VOID
+SetLastError(
+    DWORD dwErr
+    )
+{
+    t_lastError = dwErr;
+}
+
+DWORD
+RtlNtStatusToDosError(
+    ULONG_PTR status
+    )
+{
+    switch ((DWORD)status) {
+    case STATUS_SUCCESS:    return ERROR_SUCCESS;
+    case STATUS_PENDING:    return ERROR_IO_PENDING;
+    case STATUS_CANCELLED:  return ERROR_OPERATION_ABORTED;
+    default:                return ERROR_GEN_FAILURE;
+    }
+}
+
+//
+// Waitable objects
+//
+
+static PPOSIX_WAITABLE
+posix_waitable_create(
+    DWORD dwType,
+    BOOL  bManualReset,
+    LONG  lCount,
+    LONG  lMaximum
+    )
+{
+    PPOSIX_WAITABLE pObj;
+
+    pthread_once(&g_objOnce, posix_obj_once);
+
+    pObj = (PPOSIX_WAITABLE)calloc(1, sizeof(POSIX_WAITABLE));
+    if (pObj == NULL) {
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return NULL;
+    }
+
+    pObj->Type = dwType;
+    pObj->bManualReset = bManualReset;
+    pObj->Count = lCount;
+    pObj->Maximum = lMaximum;
+    pObj->Refs = 1;
+    return pObj;
+}
+
+static VOID
+posix_waitable_release(
+    PPOSIX_WAITABLE pObj
+    )
+{
+    LONG refs;
+
+    pthread_mutex_lock(&g_objLock);
+    refs = --pObj->Refs;
+    pthread_mutex_unlock(&g_objLock);
+
+    if (refs == 0)
+        free(pObj);
+}
+
+HANDLE
+CreateEvent(
+    PVOID  pAttr,
+    BOOL   bManualReset,
+    BOOL   bInitialState,
+    LPCSTR pName
+    )
+{
+    UNREFERENCED_PARAMETER(pAttr);
+    UNREFERENCED_PARAMETER(pName);
+
+    return posix_waitable_create(OBJ_EVENT, bManualReset, bInitialState ? 1 : 0, 1);
+}
+
+BOOL
+SetEvent(
+    HANDLE hEvent
+    )
+{
+    PPOSIX_WAITABLE pObj = (PPOSIX_WAITABLE)hEvent;
+
+    pthread_mutex_lock(&g_objLock);
+    pObj->Count = 1;
+    pthread_cond_broadcast(&g_objCond);
+    pthread_mutex_unlock(&g_objLock);
+    return TRUE;
+}
+
+BOOL
+ResetEvent(
+    HANDLE hEvent
+    )
+{
+    PPOSIX_WAITABLE pObj = (PPOSIX_WAITABLE)hEvent;
+
+    pthread_mutex_lock(&g_objLock);
+    pObj->Count = 0;
+    pthread_mutex_unlock(&g_objLock);
+    return TRUE;
+}
+
+HANDLE
+CreateSemaphore(
+    PVOID  pAttr,
+    LONG   lInitial,
+    LONG   lMaximum,
+    LPCSTR pName
+    )
+{
+    UNREFERENCED_PARAMETER(pAttr);
+    UNREFERENCED_PARAMETER(pName);
+
+    if (lInitial < 0 || lMaximum <= 0 || lInitial > lMaximum) {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return NULL;
+    }
+
+    return posix_waitable_create(OBJ_SEMAPHORE, FALSE, lInitial, lMaximum);
+}
+
+BOOL
+ReleaseSemaphore(
+    HANDLE hSem,
+    LONG   lCount,
+    PLONG  pPrevious
+    )
+{
+    PPOSIX_WAITABLE pObj = (PPOSIX_WAITABLE)hSem;
+    BOOL bOk = TRUE;
+
+    pthread_mutex_lock(&g_objLock);
+    if (pPrevious)
+        *pPrevious = pObj->Count;
+    if (lCount <= 0 || pObj->Count + lCount > pObj->Maximum)
+        bOk = FALSE;
+    else {
+        pObj->Count += lCount;
+        pthread_cond_broadcast(&g_objCond);
+    }
+    pthread_mutex_unlock(&g_objLock);
+
+    if (!bOk)
+        SetLastError(ERROR_INVALID_PARAMETER);
+    return bOk;
+}
+
+static BOOL
+posix_signaled(
+    PPOSIX_WAITABLE pObj
+    )
+{
+    return pObj->Count > 0;
+}
+
+static VOID
+posix_consume(
+    PPOSIX_WAITABLE pObj
+    )
+{
+    if (pObj->Type == OBJ_SEMAPHORE)
+        pObj->Count--;
+    else if (pObj->Type == OBJ_EVENT && !pObj->bManualReset)
+        pObj->Count = 0;
+}
+
+DWORD
+WaitForMultipleObjects(
+    DWORD         dwCount,
+    const HANDLE *phObjects,
+    BOOL          bWaitAll,
+    DWORD         dwTimeout
+    )
+{
+    PPOSIX_WAITABLE pObj;
+    struct timespec ts;
+    DWORD i, ready, dwRet;
+
+    if (dwCount == 0 || dwCount > MAXIMUM_WAIT_OBJECTS) {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return WAIT_FAILED;
+    }
+
+    for (i = 0; i < dwCount; i++) {
+        pObj = (PPOSIX_WAITABLE)phObjects[i];
+        if (pObj == NULL || pObj == INVALID_HANDLE_VALUE ||
+            (pObj->Type != OBJ_EVENT && pObj->Type != OBJ_SEMAPHORE && pObj->Type != OBJ_THREAD)) {
+            SetLastError(ERROR_INVALID_HANDLE);
+            return WAIT_FAILED;
+        }
+    }
+
+    pthread_once(&g_objOnce, posix_obj_once);
+
+    if (dwTimeout != INFINITE)
+        posix_deadline(dwTimeout, &ts);
+
+    pthread_mutex_lock(&g_objLock);
+
+    for (;;) {
+        if (bWaitAll) {
+            for (i = 0, ready = 0; i < dwCount; i++)
+                ready += posix_signaled((PPOSIX_WAITABLE)phObjects[i]) ? 1 : 0;
+
+            if (ready == dwCount) {
+                for (i = 0; i < dwCount; i++)
+                    posix_consume((PPOSIX_WAITABLE)phObjects[i]);
+                dwRet = WAIT_OBJECT_0;
+                break;
+            }
+        }
+        else {
+            for (i = 0; i < dwCount; i++) {
+                pObj = (PPOSIX_WAITABLE)phObjects[i];
+                if (posix_signaled(pObj)) {
+                    posix_consume(pObj);
+                    break;
+                }
+            }
+
+            if (i < dwCount) {
+                dwRet = WAIT_OBJECT_0 + i;
+                break;
+            }
+        }
+
+        if (dwTimeout == 0) {
+            dwRet = WAIT_TIMEOUT;
+            break;
+        }
+
+        if (dwTimeout == INFINITE)
+            pthread_cond_wait(&g_objCond, &g_objLock);
+        else if (pthread_cond_timedwait(&g_objCond, &g_objLock, &ts) == ETIMEDOUT) {
+            dwTimeout = 0;  // test once more, then report the timeout
+        }
+    }
+
+    pthread_mutex_unlock(&g_objLock);
+    return dwRet;
+}
+
+DWORD
+WaitForSingleObject(
+    HANDLE hObject,
+    DWORD  dwTimeout
+    )
+{
+    return WaitForMultipleObjects(1, &hObject, FALSE, dwTimeout);
+}
+
+//
+// Threads
+//
+
+static VOID
+posix_thread_exit(
+    PVOID pContext
+    )
+{
+    PPOSIX_WAITABLE pObj = (PPOSIX_WAITABLE)pContext;
+
+    pthread_mutex_lock(&g_objLock);
+    pObj->Count = 1;
+    pthread_cond_broadcast(&g_objCond);
+    pthread_mutex_unlock(&g_objLock);
+
+    posix_waitable_release(pObj);
+}
+
+static void *
+posix_thread_start(
+    void *pContext
+    )
+{
+    POSIX_THREAD_START start = *(PPOSIX_THREAD_START)pContext;
+
+    free(pContext);
+
+    //
+    // The cleanup handler also runs when the thread leaves through
+    // _endthread()/_endthreadex() (pthread_exit).
+    //
+    pthread_cleanup_push(posix_thread_exit, start.pObj);
+    if (start.pfnStartEx)
+        start.pfnStartEx(start.pArg);
+    else
+        start.pfnStart(start.pArg);
+    pthread_cleanup_pop(1);
+
+    return NULL;
+}
+
+static PPOSIX_WAITABLE
+posix_thread_create(
+    void    (*pfnStart)(void *),
+    unsigned (*pfnStartEx)(void *),
+    void     *pArg,
+    unsigned  stackSize
+    )
+{
+    PPOSIX_THREAD_START pStart;
+    PPOSIX_WAITABLE pObj;
+    pthread_attr_t attr;
+    pthread_t tid;
+    int err;
+
+    pObj = posix_waitable_create(OBJ_THREAD, TRUE, 0, 1);
+    pStart = (PPOSIX_THREAD_START)malloc(sizeof(POSIX_THREAD_START));
+    if (pObj == NULL || pStart == NULL) {
+        free(pObj);
+        free(pStart);
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return NULL;
+    }
+
+    pObj->Refs = 2;     // handle + running thread
+    pStart->pObj = pObj;
+    pStart->pfnStart = pfnStart;
+    pStart->pfnStartEx = pfnStartEx;
+    pStart->pArg = pArg;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (stackSize)
+        pthread_attr_setstacksize(&attr, stackSize);
+    err = pthread_create(&tid, &attr, posix_thread_start, pStart);
+    pthread_attr_destroy(&attr);
+
+    if (err) {
+        free(pObj);
+        free(pStart);
+        SetLastError(posix_errno(err));
+        return NULL;
+    }
+
+    return pObj;
+}
+
+uintptr_t
+_beginthread(
+    void   (*pfnStart)(void *),
+    unsigned stackSize,
+    void    *pArg
+    )
+{
+    PPOSIX_WAITABLE pObj;
+
+    //
+    // The CRT closes the handle of a _beginthread() thread by itself, yet
+    // callers wait on it. The handle reference is never released, so the
+    // object stays valid for such waits.
+    //
+    pObj = posix_thread_create(pfnStart, NULL, pArg, stackSize);
+    return (pObj == NULL) ? (uintptr_t)-1L : (uintptr_t)pObj;
+}
+
+uintptr_t
+_beginthreadex(
+    void     *pSecurity,
+    unsigned  stackSize,
+    unsigned (__stdcall *pfnStart)(void *),
+    void     *pArg,
+    unsigned  initFlag,
+    unsigned *pThreadId
+    )
+{
+    PPOSIX_WAITABLE pObj;
+
+    UNREFERENCED_PARAMETER(pSecurity);
+    UNREFERENCED_PARAMETER(initFlag);
+
+    pObj = posix_thread_create(NULL, pfnStart, pArg, stackSize);
+    if (pThreadId)
+        *pThreadId = 0;
+    return (uintptr_t)pObj;
+}
+
+void
+_endthread(
+    void
+    )
+{
+    pthread_exit(NULL);
+}
+
+void
+_endthreadex(
+    unsigned retVal
+    )
+{
+    UNREFERENCED_PARAMETER(retVal);
+    pthread_exit(NULL);
+}
+
+int
+_getpid(
+    void
+    )
+{
+    return (int)getpid();
+}
+
+DWORD
+GetCurrentThreadId(
+    VOID
+    )
+{
+    return (DWORD)syscall(SYS_gettid);
+}
+
+//
+// Critical sections and condition variables
+//
+
+VOID
+InitializeCriticalSection(
+    LPCRITICAL_SECTION pCs
+    )
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&pCs->Mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+BOOL
+InitializeCriticalSectionAndSpinCount(
+    LPCRITICAL_SECTION pCs,
+    DWORD              dwSpin
+    )
+{
+    UNREFERENCED_PARAMETER(dwSpin);
+
+    InitializeCriticalSection(pCs);
+    return TRUE;
+}
+
+VOID
+DeleteCriticalSection(
+    LPCRITICAL_SECTION pCs
+    )
+{
+    pthread_mutex_destroy(&pCs->Mutex);
+}
+
+VOID
+EnterCriticalSection(
+    LPCRITICAL_SECTION pCs
+    )
+{
+    pthread_mutex_lock(&pCs->Mutex);
+}
+
+VOID
+LeaveCriticalSection(
+    LPCRITICAL_SECTION pCs
+    )
+{
+    pthread_mutex_unlock(&pCs->Mutex);
+}
+
+VOID
+InitializeConditionVariable(
+    PCONDITION_VARIABLE pCv
+    )
+{
+    posix_cond_init(&pCv->Cond);
+}
+
+BOOL
+SleepConditionVariableCS(
+    PCONDITION_VARIABLE pCv,
+    LPCRITICAL_SECTION  pCs,
+    DWORD               dwTimeout
+    )
+{
+    struct timespec ts;
+
+    if (dwTimeout == INFINITE) {
+        pthread_cond_wait(&pCv->Cond, &pCs->Mutex);
+        return TRUE;
+    }
+
+    posix_deadline(dwTimeout, &ts);
+    if (pthread_cond_timedwait(&pCv->Cond, &pCs->Mutex, &ts) == ETIMEDOUT) {
+        SetLastError(ERROR_TIMEOUT);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+VOID
+WakeConditionVariable(
+    PCONDITION_VARIABLE pCv
+    )
+{
+    pthread_cond_signal(&pCv->Cond);
+}
+
+VOID
+WakeAllConditionVariable(
+    PCONDITION_VARIABLE pCv
+    )
+{
+    pthread_cond_broadcast(&pCv->Cond);
+}
+
+//
+// Completion ports
+//
+
+HANDLE
+CreateIoCompletionPort(
+    HANDLE    hFile,
+    HANDLE    hPort,
+    ULONG_PTR Key,
+    DWORD     dwThreads
+    )
+{
+    PPOSIX_PORT pPort;
+
+    UNREFERENCED_PARAMETER(Key);
+    UNREFERENCED_PARAMETER(dwThreads);
+
+    //
+    // File handles of this layer do not complete asynchronously; devices
+    // are bound to a port through the device layer instead.
+    //
+    if (hFile != INVALID_HANDLE_VALUE || hPort != NULL) {
+        SetLastError(ERROR_NOT_SUPPORTED);
+        return NULL;
+    }
+
+    pPort = (PPOSIX_PORT)calloc(1, sizeof(POSIX_PORT));
+    if (pPort)
+        pPort->Ring = (LPOVERLAPPED_ENTRY)malloc(PORT_DEF_SIZE * sizeof(OVERLAPPED_ENTRY));
+    if (pPort == NULL || pPort->Ring == NULL) {
+        free(pPort);
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return NULL;
+    }
+
+    pPort->Type = OBJ_PORT;
+    pPort->Size = PORT_DEF_SIZE;
+    pthread_mutex_init(&pPort->Lock, NULL);
+    posix_cond_init(&pPort->Cond);
+    return pPort;
+}
+
+BOOL
+PostQueuedCompletionStatus(
+    HANDLE       hPort,
+    DWORD        dwBytes,
+    ULONG_PTR    Key,
+    LPOVERLAPPED pOvl
+    )
+{
+    PPOSIX_PORT pPort = (PPOSIX_PORT)hPort;
+    LPOVERLAPPED_ENTRY pRing, pEntry;
+    ULONG i;
+
+    pthread_mutex_lock(&pPort->Lock);
+
+    if (pPort->Count == pPort->Size) {
+        pRing = (LPOVERLAPPED_ENTRY)malloc(2 * pPort->Size * sizeof(OVERLAPPED_ENTRY));
+        if (pRing == NULL) {
+            pthread_mutex_unlock(&pPort->Lock);
+            SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+            return FALSE;
+        }
+
+        for (i = 0; i < pPort->Count; i++)
+            pRing[i] = pPort->Ring[(pPort->Head + i) % pPort->Size];
+
+        free(pPort->Ring);
+        pPort->Ring = pRing;
+        pPort->Head = 0;
+        pPort->Size *= 2;
+    }
+
+    pEntry = &pPort->Ring[(pPort->Head + pPort->Count) % pPort->Size];
+    pEntry->lpCompletionKey = Key;
+    pEntry->lpOverlapped = pOvl;
+    pEntry->Internal = pOvl ? pOvl->Internal : 0;
+    pEntry->dwNumberOfBytesTransferred = dwBytes;
+    pPort->Count++;
+
+    pthread_cond_signal(&pPort->Cond);
+    pthread_mutex_unlock(&pPort->Lock);
+    return TRUE;
+}
+
+static BOOL
+posix_port_wait(
+    PPOSIX_PORT pPort,
+    DWORD       dwTimeout
+    )
+/*++
+
+Routine Description:
+
+    Waits until the port queue is not empty. Called with the port lock held.
+
+Return Value:
+
+    FALSE on timeout.
+
+--*/
+{
+    struct timespec ts;
+
+    if (pPort->Count)
+        return TRUE;
+
+    if (dwTimeout == 0)
+        return FALSE;
+
+    if (dwTimeout != INFINITE)
+        posix_deadline(dwTimeout, &ts);
+
+    while (pPort->Count == 0) {
+        if (dwTimeout == INFINITE)
+            pthread_cond_wait(&pPort->Cond, &pPort->Lock);
+        else if (pthread_cond_timedwait(&pPort->Cond, &pPort->Lock, &ts) == ETIMEDOUT)
+            return pPort->Count != 0;
+    }
+
+    return TRUE;
+}
+
+BOOL
+GetQueuedCompletionStatusEx(
+    HANDLE             hPort,
+    LPOVERLAPPED_ENTRY pEntries,
+    ULONG              ulCount,
+    PULONG             pulRemoved,
+    DWORD              dwTimeout,
+    BOOL               bAlertable
+    )
+{
+    PPOSIX_PORT pPort = (PPOSIX_PORT)hPort;
+    ULONG i, n;
+
+    UNREFERENCED_PARAMETER(bAlertable);
+
+    *pulRemoved = 0;
+
+    pthread_mutex_lock(&pPort->Lock);
+
+    if (!posix_port_wait(pPort, dwTimeout)) {
+        pthread_mutex_unlock(&pPort->Lock);
+        SetLastError(WAIT_TIMEOUT);
+        return FALSE;
+    }
+
+    n = min(ulCount, pPort->Count);
+    for (i = 0; i < n; i++) {
+        pEntries[i] = pPort->Ring[pPort->Head];
+        pPort->Head = (pPort->Head + 1) % pPort->Size;
+    }
+    pPort->Count -= n;
+
+    pthread_mutex_unlock(&pPort->Lock);
+
+    *pulRemoved = n;
+    return TRUE;
+}
+
+BOOL
+GetQueuedCompletionStatus(
+    HANDLE        hPort,
+    LPDWORD       pdwBytes,
+    PULONG_PTR    pKey,
+    LPOVERLAPPED *ppOvl,
+    DWORD         dwTimeout
+    )
+{
+    OVERLAPPED_ENTRY entry;
+    ULONG ulNum;
+
+    if (!GetQueuedCompletionStatusEx(hPort, &entry, 1, &ulNum, dwTimeout, FALSE)) {
+        *ppOvl = NULL;
+        return FALSE;
+    }
+
+    *pdwBytes = entry.dwNumberOfBytesTransferred;
+    *pKey = entry.lpCompletionKey;
+    *ppOvl = entry.lpOverlapped;
+
+    if (entry.lpOverlapped && entry.lpOverlapped->Internal != STATUS_SUCCESS) {
+        SetLastError(RtlNtStatusToDosError(entry.lpOverlapped->Internal));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOL
+GetOverlappedResult(
+    HANDLE       hFile,
+    LPOVERLAPPED pOvl,
+    LPDWORD      pdwBytes,
+    BOOL         bWait
+    )
+{
+    ULONG_PTR status;
+
+    UNREFERENCED_PARAMETER(hFile);
+
+    status = __atomic_load_n(&pOvl->Internal, __ATOMIC_ACQUIRE);
+
+    if (status == STATUS_PENDING) {
+        if (!bWait || pOvl->hEvent == NULL) {
+            SetLastError(ERROR_IO_INCOMPLETE);
+            return FALSE;
+        }
+
+        WaitForSingleObject(pOvl->hEvent, INFINITE);
+        status = __atomic_load_n(&pOvl->Internal, __ATOMIC_ACQUIRE);
+    }
+
+    *pdwBytes = (DWORD)pOvl->InternalHigh;
+
+    if (status != STATUS_SUCCESS) {
+        SetLastError(RtlNtStatusToDosError(status));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//
+// Handles
+//
+
+BOOL
+CloseHandle(
+    HANDLE hObject
+    )
+{
+    PPOSIX_OBJ pObj = (PPOSIX_OBJ)hObject;
+
+    if (pObj == NULL || pObj == INVALID_HANDLE_VALUE) {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    switch (pObj->Type) {
+    case OBJ_EVENT:
+    case OBJ_SEMAPHORE:
+    case OBJ_THREAD:
+        posix_waitable_release((PPOSIX_WAITABLE)pObj);
+        break;
+
+    case OBJ_PORT:
+        pthread_mutex_destroy(&((PPOSIX_PORT)pObj)->Lock);
+        pthread_cond_destroy(&((PPOSIX_PORT)pObj)->Cond);
+        free(((PPOSIX_PORT)pObj)->Ring);
+        free(pObj);
+        break;
+
+    case OBJ_FILE:
+    case OBJ_MAPPING:
+        close(((PPOSIX_FILE)pObj)->Fd);
+        free(pObj);
+        break;
+
+    default:
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//
+// Time and system information
+//
+
+BOOL
+QueryPerformanceCounter(
+    LARGE_INTEGER *pCount
+    )
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    pCount->QuadPart = (LONGLONG)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    return TRUE;
+}
+
+BOOL
+QueryPerformanceFrequency(
+    LARGE_INTEGER *pFreq
+    )
+{
+    pFreq->QuadPart = 1000000000;
+    return TRUE;
+}
+
+ULONGLONG
+GetTickCount64(
+    VOID
+    )
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ULONGLONG)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+DWORD
+GetTickCount(
+    VOID
+    )
+{
+    return (DWORD)GetTickCount64();
+}
+
+VOID
+Sleep(
+    DWORD dwMs
+    )
+{
+    struct timespec ts;
+
+    if (dwMs == 0) {
+        sched_yield();
+        return;
+    }
+
+    ts.tv_sec = dwMs / 1000;
+    ts.tv_nsec = (long)(dwMs % 1000) * 1000000;
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+        ;
+}
+
+BOOL
+SwitchToThread(
+    VOID
+    )
+{
+    return sched_yield() == 0;
+}
+
+VOID
+GetSystemInfo(
+    LPSYSTEM_INFO pInfo
+    )
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    ZeroMemory(pInfo, sizeof(*pInfo));
+    pInfo->dwPageSize = (DWORD)sysconf(_SC_PAGESIZE);
+    pInfo->dwAllocationGranularity = 64 * 1024;
+    pInfo->dwNumberOfProcessors = (n > 0) ? (DWORD)n : 1;
+}
+
+//
+// Memory. Mapped regions are registered with their size, which munmap()
+// needs and VirtualFree()/UnmapViewOfFile() do not pass.
+//
+
+static VOID
+posix_view_add(
+    PVOID  pBase,
+    size_t size
+    )
+{
+    PPOSIX_VIEW pView = (PPOSIX_VIEW)malloc(sizeof(POSIX_VIEW));
+
+    if (pView == NULL)
+        return;
+
+    pView->Base = pBase;
+    pView->Size = size;
+
+    pthread_mutex_lock(&g_objLock);
+    pView->Next = g_viewList;
+    g_viewList = pView;
+    pthread_mutex_unlock(&g_objLock);
+}
+
+static size_t
+posix_view_find(
+    PVOID pBase,
+    BOOL  bRemove
+    )
+{
+    PPOSIX_VIEW *ppView, pView;
+    size_t size = 0;
+
+    pthread_mutex_lock(&g_objLock);
+    for (ppView = &g_viewList; *ppView; ppView = &(*ppView)->Next) {
+        if ((*ppView)->Base == pBase) {
+            pView = *ppView;
+            size = pView->Size;
+            if (bRemove) {
+                *ppView = pView->Next;
+                free(pView);
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_objLock);
+
+    return size;
+}
+
+LPVOID
+VirtualAlloc(
+    LPVOID pAddr,
+    SIZE_T size,
+    DWORD  dwType,
+    DWORD  dwProtect
+    )
+{
+    PVOID p;
+    int   flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    if (pAddr != NULL) {
+        SetLastError(ERROR_NOT_SUPPORTED);
+        return NULL;
+    }
+
+    // Fails, as on Windows without SeLockMemoryPrivilege, if no huge pages are reserved
+    if (dwType & MEM_LARGE_PAGES)
+        flags |= MAP_HUGETLB;
+
+    p = mmap(NULL, size, (dwProtect == PAGE_READONLY) ? PROT_READ : PROT_READ | PROT_WRITE,
+             flags, -1, 0);
+    if (p == MAP_FAILED) {
+        SetLastError(posix_errno(errno));
+        return NULL;
+    }
+
+    posix_view_add(p, size);
+    return p;
+}
+
+BOOL
+VirtualFree(
+    LPVOID pAddr,
+    SIZE_T size,
+    DWORD  dwType
+    )
+{
+    UNREFERENCED_PARAMETER(dwType);
+
+    if (size == 0)
+        size = posix_view_find(pAddr, TRUE);
+
+    return size != 0 && munmap(pAddr, size) == 0;
+}
+
+SIZE_T
+GetLargePageMinimum(
+    VOID
+    )
+{
+    return 2 * 1024 * 1024;
+}
+
+PVOID
+_aligned_malloc(
+    size_t size,
+    size_t alignment
+    )
+{
+    PVOID p = NULL;
+
+    if (alignment < sizeof(PVOID))
+        alignment = sizeof(PVOID);
+
+    if (posix_memalign(&p, alignment, size) != 0)
+        return NULL;
+
+    return p;
+}
+
+VOID
+_aligned_free(
+    PVOID p
+    )
+{
+    free(p);
+}
+
+//
+// Files and file mappings
+//
+
+HANDLE
+CreateFileA(
+    LPCSTR pName,
+    DWORD  dwAccess,
+    DWORD  dwShare,
+    PVOID  pAttr,
+    DWORD  dwDisposition,
+    DWORD  dwFlags,
+    HANDLE hTemplate
+    )
+{
+    PPOSIX_FILE pFile;
+    int flags, fd;
+
+    UNREFERENCED_PARAMETER(dwShare);
+    UNREFERENCED_PARAMETER(pAttr);
+    UNREFERENCED_PARAMETER(dwFlags);
+    UNREFERENCED_PARAMETER(hTemplate);
+
+    if ((dwAccess & GENERIC_READ) && (dwAccess & GENERIC_WRITE))
+        flags = O_RDWR;
+    else if (dwAccess & GENERIC_WRITE)
+        flags = O_WRONLY;
+    else
+        flags = O_RDONLY;
+
+    switch (dwDisposition) {
+    case CREATE_NEW:    flags |= O_CREAT | O_EXCL; break;
+    case CREATE_ALWAYS: flags |= O_CREAT | O_TRUNC; break;
+    case OPEN_ALWAYS:   flags |= O_CREAT; break;
+    default:            break;
+    }
+
+    fd = open(pName, flags, 0644);
+    if (fd < 0) {
+        SetLastError(posix_errno(errno));
+        return INVALID_HANDLE_VALUE;
+    }
+
+    pFile = (PPOSIX_FILE)malloc(sizeof(POSIX_FILE));
+    if (pFile == NULL) {
+        close(fd);
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return INVALID_HANDLE_VALUE;
+    }
+
+    pFile->Type = OBJ_FILE;
+    pFile->Fd = fd;
+    return pFile;
+}
+
+HANDLE
+CreateFileMappingA(
+    HANDLE hFile,
+    PVOID  pAttr,
+    DWORD  dwProtect,
+    DWORD  dwSizeHi,
+    DWORD  dwSizeLo,
+    LPCSTR pName
+    )
+{
+    PPOSIX_FILE pFile = (PPOSIX_FILE)hFile;
+    PPOSIX_FILE pMap;
+    struct stat st;
+    off_t size = ((off_t)dwSizeHi << 32) | dwSizeLo;
+    int fd;
+
+    UNREFERENCED_PARAMETER(pAttr);
+    UNREFERENCED_PARAMETER(dwProtect);
+    UNREFERENCED_PARAMETER(pName);
+
+    if (pFile == NULL || pFile == INVALID_HANDLE_VALUE || pFile->Type != OBJ_FILE) {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return NULL;
+    }
+
+    //
+    // As on Windows, a mapping larger than the file extends the file
+    //
+    if (fstat(pFile->Fd, &st) != 0 || (size > st.st_size && ftruncate(pFile->Fd, size) != 0)) {
+        SetLastError(posix_errno(errno));
+        return NULL;
+    }
+
+    fd = dup(pFile->Fd);
+    pMap = (PPOSIX_FILE)malloc(sizeof(POSIX_FILE));
+    if (fd < 0 || pMap == NULL) {
+        if (fd >= 0)
+            close(fd);
+        free(pMap);
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return NULL;
+    }
+
+    pMap->Type = OBJ_MAPPING;
+    pMap->Fd = fd;
+    return pMap;
+}
+
+LPVOID
+MapViewOfFile(
+    HANDLE hMap,
+    DWORD  dwAccess,
+    DWORD  dwOffsetHi,
+    DWORD  dwOffsetLo,
+    SIZE_T size
+    )
+{
+    PPOSIX_FILE pMap = (PPOSIX_FILE)hMap;
+    off_t offset = ((off_t)dwOffsetHi << 32) | dwOffsetLo;
+    struct stat st;
+    PVOID p;
+
+    if (pMap == NULL || pMap->Type != OBJ_MAPPING) {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return NULL;
+    }
+
+    if (size == 0) {
+        if (fstat(pMap->Fd, &st) != 0) {
+            SetLastError(posix_errno(errno));
+            return NULL;
+        }
+        size = (SIZE_T)(st.st_size - offset);
+    }
+
+    p = mmap(NULL, size, (dwAccess & FILE_MAP_WRITE) ? PROT_READ | PROT_WRITE : PROT_READ,
+             MAP_SHARED, pMap->Fd, offset);
+    if (p == MAP_FAILED) {
+        SetLastError(posix_errno(errno));
+        return NULL;
+    }
+
+    posix_view_add(p, size);
+    return p;
+}
+
+BOOL
+FlushViewOfFile(
+    LPVOID pView,
+    SIZE_T size
+    )
+{
+    if (size == 0)
+        size = posix_view_find(pView, FALSE);
+
+    return msync(pView, size, MS_SYNC) == 0;
+}
+
+BOOL
+UnmapViewOfFile(
+    LPVOID pView
+    )
+{
+    size_t size = posix_view_find(pView, TRUE);
+
+    return size != 0 && munmap(pView, size) == 0;
+}
+
+BOOL
+GetFileSizeEx(
+    HANDLE         hFile,
+    PLARGE_INTEGER pSize
+    )
+{
+    struct stat st;
+
+    if (fstat(((PPOSIX_FILE)hFile)->Fd, &st) != 0) {
+        SetLastError(posix_errno(errno));
+        return FALSE;
+    }
+
+    pSize->QuadPart = st.st_size;
+    return TRUE;
+}
+
+BOOL
+SetFilePointerEx(
+    HANDLE         hFile,
+    LARGE_INTEGER  dist,
+    PLARGE_INTEGER pNew,
+    DWORD          dwMethod
+    )
+{
+    static const int whence[] = { SEEK_SET, SEEK_CUR, SEEK_END };
+    off_t pos;
+
+    if (dwMethod > FILE_END) {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    pos = lseek(((PPOSIX_FILE)hFile)->Fd, dist.QuadPart, whence[dwMethod]);
+    if (pos < 0) {
+        SetLastError(posix_errno(errno));
+        return FALSE;
+    }
+
+    if (pNew)
+        pNew->QuadPart = pos;
+    return TRUE;
+}
+
+BOOL
+SetEndOfFile(
+    HANDLE hFile
+    )
+{
+    int fd = ((PPOSIX_FILE)hFile)->Fd;
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+
+    if (pos < 0 || ftruncate(fd, pos) != 0) {
+        SetLastError(posix_errno(errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//
+// Console
+//
+
+int
+_kbhit(
+    void
+    )
+{
+    struct pollfd pfd;
+
+    pfd.fd = STDIN_FILENO;
+    pfd.events = POLLIN;
+    return poll(&pfd, 1, 0) > 0;
+}
+
+int
+_getch(
+    void
+    )
+{
+    struct termios saved, raw;
+    unsigned char ch;
+    BOOL bTty;
+    ssize_t n;
+
+    //
+    // Unbuffered, no echo when reading from a terminal; plain read
+    // otherwise so the tools can be driven from a pipe.
+    //
+    fflush(stdout);
+    bTty = isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &saved) == 0;
+    if (bTty) {
+        raw = saved;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    }
+
+    n = read(STDIN_FILENO, &ch, 1);
+
+    if (bTty)
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+
+    return (n == 1) ? ch : EOF;
+}
@@ -0,0 +1,374 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721posix.h
+
+Description:
+
+    Subset of the Win32 API used by the Tsi721 tools, implemented on top of
+    POSIX threads. The stand-in headers in this directory (windows.h,
+    process.h, conio.h, ...) include this file, so the tools build on Linux
+    unchanged and run against the Tsi721 emulator.
+
+    Types follow the Windows LLP64 model: LONG, ULONG and DWORD are 32 bits
+    wide on every platform.
+
+--*/
+
+#ifndef _TSI721POSIX_H_
+#define _TSI721POSIX_H_
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <wchar.h>
+#include <pthread.h>
+
+//
+// Compiler and annotation keywords
+//
+#define __in
+#define __out
+#define __inout
+#define __in_opt
+#define __out_opt
+#define __inout_opt
+#define __stdcall
+#define WINAPI
+#define CALLBACK
+#define __forceinline           inline __attribute__((always_inline))
+#define __int64                 long long
+
+#define __declspec(x)           __TSI721_DECLSPEC_##x
+#define __TSI721_DECLSPEC_thread        __thread
+#define __TSI721_DECLSPEC_dllimport
+#define __TSI721_DECLSPEC_dllexport
+#define __TSI721_DECLSPEC_noinline      __attribute__((noinline))
+#define DECLSPEC_ALIGN(x)       __attribute__((aligned(x)))
+
+//
+// Basic types
+//
+typedef int                 BOOL, *PBOOL;
+typedef unsigned char       BYTE, *PBYTE, UCHAR, *PUCHAR, BOOLEAN;
+typedef char                CHAR, *PCHAR, *PSTR, *LPSTR;
+typedef const char         *PCSTR, *LPCSTR;
+typedef wchar_t             WCHAR, *PWCHAR;
+typedef short               SHORT;
+typedef unsigned short      WORD, *PWORD, USHORT, *PUSHORT;
+typedef int                 INT;
+typedef unsigned int        UINT;
+typedef int32_t             LONG, *PLONG;
+typedef uint32_t            ULONG, *PULONG, DWORD, *PDWORD, *LPDWORD;
+typedef long long           LONGLONG, LONG64;
+typedef unsigned long long  ULONGLONG, *PULONGLONG, ULONG64, DWORD64;
+typedef uintptr_t           ULONG_PTR, *PULONG_PTR, DWORD_PTR, SIZE_T, *PSIZE_T;
+typedef intptr_t            LONG_PTR;
+typedef void                VOID, *PVOID, *LPVOID;
+typedef void               *HANDLE, **PHANDLE;
+
+typedef union _LARGE_INTEGER {
+    struct {
+        DWORD LowPart;
+        LONG  HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef struct _GUID {
+    DWORD Data1;
+    WORD  Data2;
+    WORD  Data3;
+    BYTE  Data4[8];
+} GUID;
+
+#define DEFINE_GUID(name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+    static const GUID name __attribute__((unused)) =                   \
+        { l, w1, w2, { b1, b2, b3, b4, b5, b6, b7, b8 } }
+
+typedef struct _OVERLAPPED {
+    ULONG_PTR Internal;         // NTSTATUS of the request
+    ULONG_PTR InternalHigh;     // bytes transferred
+    union {
+        struct {
+            DWORD Offset;
+            DWORD OffsetHigh;
+        };
+        PVOID Pointer;
+    };
+    HANDLE    hEvent;
+} OVERLAPPED, *LPOVERLAPPED;
+
+typedef struct _OVERLAPPED_ENTRY {
+    ULONG_PTR    lpCompletionKey;
+    LPOVERLAPPED lpOverlapped;
+    ULONG_PTR    Internal;
+    DWORD        dwNumberOfBytesTransferred;
+} OVERLAPPED_ENTRY, *LPOVERLAPPED_ENTRY;
+
+typedef struct _CRITICAL_SECTION {
+    pthread_mutex_t Mutex;
+} CRITICAL_SECTION, *LPCRITICAL_SECTION;
+
+typedef struct _CONDITION_VARIABLE {
+    pthread_cond_t Cond;
+} CONDITION_VARIABLE, *PCONDITION_VARIABLE;
+
+typedef struct _SYSTEM_INFO {
+    DWORD     dwOemId;
+    DWORD     dwPageSize;
+    LPVOID    lpMinimumApplicationAddress;
+    LPVOID    lpMaximumApplicationAddress;
+    DWORD_PTR dwActiveProcessorMask;
+    DWORD     dwNumberOfProcessors;
+    DWORD     dwProcessorType;
+    DWORD     dwAllocationGranularity;
+    WORD      wProcessorLevel;
+    WORD      wProcessorRevision;
+} SYSTEM_INFO, *LPSYSTEM_INFO;
+
+//
+// Constants
+//
+#define TRUE                    1
+#define FALSE                   0
+#define INFINITE                0xFFFFFFFF
+#define MAX_PATH                260
+#define INVALID_HANDLE_VALUE    ((HANDLE)(LONG_PTR)-1)
+
+#define ERROR_SUCCESS               0
+#define ERROR_FILE_NOT_FOUND        2
+#define ERROR_ACCESS_DENIED         5
+#define ERROR_INVALID_HANDLE        6
+#define ERROR_NOT_ENOUGH_MEMORY     8
+#define ERROR_INVALID_DATA          13
+#define ERROR_OUTOFMEMORY           14
+#define ERROR_CRC                   23
+#define ERROR_GEN_FAILURE           31
+#define ERROR_HANDLE_EOF            38
+#define ERROR_NOT_SUPPORTED         50
+#define ERROR_INVALID_PARAMETER     87
+#define ERROR_INSUFFICIENT_BUFFER   122
+#define ERROR_BUSY                  170
+#define ERROR_ALREADY_EXISTS        183
+#define ERROR_NO_DATA               232
+#define ERROR_MORE_DATA             234
+#define ERROR_NO_MORE_ITEMS         259
+#define ERROR_INVALID_ADDRESS       487
+#define ERROR_OPERATION_ABORTED     995
+#define ERROR_IO_INCOMPLETE         996
+#define ERROR_IO_PENDING            997
+#define ERROR_NOT_FOUND             1168
+#define ERROR_CANCELLED             1223
+#define ERROR_RETRY                 1237
+#define ERROR_TIMEOUT               1460
+#define ERROR_INVALID_STATE         5023
+
+#define WAIT_OBJECT_0           0
+#define WAIT_ABANDONED_0        0x80
+#define WAIT_TIMEOUT            258
+#define WAIT_FAILED             0xFFFFFFFF
+#define MAXIMUM_WAIT_OBJECTS    64
+
+#define STATUS_SUCCESS          0x00000000
+#define STATUS_PENDING          0x00000103
+#define STATUS_UNSUCCESSFUL     0xC0000001
+#define STATUS_CANCELLED        0xC0000120
+
+#define MEM_COMMIT              0x00001000
+#define MEM_RESERVE             0x00002000
+#define MEM_RELEASE             0x00008000
+#define MEM_LARGE_PAGES         0x20000000
+#define PAGE_READONLY           0x02
+#define PAGE_READWRITE          0x04
+
+#define GENERIC_READ            0x80000000
+#define GENERIC_WRITE           0x40000000
+#define FILE_SHARE_READ         0x00000001
+#define FILE_SHARE_WRITE        0x00000002
+#define CREATE_NEW              1
+#define CREATE_ALWAYS           2
+#define OPEN_EXISTING           3
+#define OPEN_ALWAYS             4
+#define FILE_ATTRIBUTE_NORMAL   0x00000080
+#define FILE_BEGIN              0
+#define FILE_CURRENT            1
+#define FILE_END                2
+#define FILE_MAP_WRITE          0x0002
+#define FILE_MAP_READ           0x0004
+
+//
+// Device I/O control codes (winioctl.h)
+//
+#define CTL_CODE(DeviceType, Function, Method, Access) \
+    (((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+#define FILE_DEVICE_UNKNOWN     0x00000022
+#define METHOD_BUFFERED         0
+#define METHOD_IN_DIRECT        1
+#define METHOD_OUT_DIRECT       2
+#define METHOD_NEITHER          3
+#define FILE_ANY_ACCESS         0
+#define FILE_READ_ACCESS        0x0001
+#define FILE_WRITE_ACCESS       0x0002
+
+//
+// Memory and string helpers
+//
+#define ZeroMemory(d, l)        memset((d), 0, (l))
+#define FillMemory(d, l, f)     memset((d), (f), (l))
+#define CopyMemory(d, s, l)     memcpy((d), (s), (l))
+#define MoveMemory(d, s, l)     memmove((d), (s), (l))
+#define FIELD_OFFSET(type, field)   offsetof(type, field)
+#define CONTAINING_RECORD(address, type, field) \
+    ((type *)((PCHAR)(address) - offsetof(type, field)))
+#define UNREFERENCED_PARAMETER(P)   (void)(P)
+
+#ifndef min
+#define min(a, b)               (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b)               (((a) > (b)) ? (a) : (b))
+#endif
+
+#define printf_s                printf
+#define fprintf_s               fprintf
+#define sprintf_s               snprintf
+#define sscanf_s                sscanf
+#define _stricmp                strcasecmp
+#define _strnicmp               strncasecmp
+#define _strtoui64              strtoull
+
+int fopen_s(FILE **ppFile, const char *pName, const char *pMode);
+int strcpy_s(char *pDst, size_t size, const char *pSrc);
+
+//
+// Errors
+//
+DWORD GetLastError(VOID);
+VOID  SetLastError(DWORD dwErr);
+
+//
+// Synchronization objects. Events, semaphores and threads are waitable
+// handles; CloseHandle() releases any handle created by this layer.
+//
+HANDLE CreateEvent(PVOID pAttr, BOOL bManualReset, BOOL bInitialState, LPCSTR pName);
+BOOL   SetEvent(HANDLE hEvent);
+BOOL   ResetEvent(HANDLE hEvent);
+HANDLE CreateSemaphore(PVOID pAttr, LONG lInitial, LONG lMaximum, LPCSTR pName);
+BOOL   ReleaseSemaphore(HANDLE hSem, LONG lCount, PLONG pPrevious);
+DWORD  WaitForSingleObject(HANDLE hObject, DWORD dwTimeout);
+DWORD  WaitForMultipleObjects(DWORD dwCount, const HANDLE *phObjects, BOOL bWaitAll, DWORD dwTimeout);
+BOOL   CloseHandle(HANDLE hObject);
+
+VOID InitializeCriticalSection(LPCRITICAL_SECTION pCs);
+BOOL InitializeCriticalSectionAndSpinCount(LPCRITICAL_SECTION pCs, DWORD dwSpin);
+VOID DeleteCriticalSection(LPCRITICAL_SECTION pCs);
+VOID EnterCriticalSection(LPCRITICAL_SECTION pCs);
+VOID LeaveCriticalSection(LPCRITICAL_SECTION pCs);
+
+VOID InitializeConditionVariable(PCONDITION_VARIABLE pCv);
+BOOL SleepConditionVariableCS(PCONDITION_VARIABLE pCv, LPCRITICAL_SECTION pCs, DWORD dwTimeout);
+VOID WakeConditionVariable(PCONDITION_VARIABLE pCv);
+VOID WakeAllConditionVariable(PCONDITION_VARIABLE pCv);
+
+//
+// I/O completion ports and OVERLAPPED results. Only ports created with
+// INVALID_HANDLE_VALUE are supported: device handles are associated with a
+// port through the device layer (see tsi721dev.h).
+//
+HANDLE CreateIoCompletionPort(HANDLE hFile, HANDLE hPort, ULONG_PTR Key, DWORD dwThreads);
+BOOL   PostQueuedCompletionStatus(HANDLE hPort, DWORD dwBytes, ULONG_PTR Key, LPOVERLAPPED pOvl);
+BOOL   GetQueuedCompletionStatus(HANDLE hPort, LPDWORD pdwBytes, PULONG_PTR pKey,
+                                 LPOVERLAPPED *ppOvl, DWORD dwTimeout);
+BOOL   GetQueuedCompletionStatusEx(HANDLE hPort, LPOVERLAPPED_ENTRY pEntries, ULONG ulCount,
+                                   PULONG pulRemoved, DWORD dwTimeout, BOOL bAlertable);
+BOOL   GetOverlappedResult(HANDLE hFile, LPOVERLAPPED pOvl, LPDWORD pdwBytes, BOOL bWait);
+DWORD  RtlNtStatusToDosError(ULONG_PTR status);
+
+//
+// Interlocked operations (full barriers, as on Windows)
+//
+static inline LONG InterlockedIncrement(LONG volatile *p) { return __sync_add_and_fetch(p, 1); }
+static inline LONG InterlockedDecrement(LONG volatile *p) { return __sync_sub_and_fetch(p, 1); }
+static inline LONG InterlockedExchangeAdd(LONG volatile *p, LONG v) { return __sync_fetch_and_add(p, v); }
+static inline LONG InterlockedExchange(LONG volatile *p, LONG v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+static inline LONG InterlockedCompareExchange(LONG volatile *p, LONG v, LONG c) { return __sync_val_compare_and_swap(p, c, v); }
+static inline LONG InterlockedOr(LONG volatile *p, LONG v) { return __sync_fetch_and_or(p, v); }
+static inline LONG InterlockedAnd(LONG volatile *p, LONG v) { return __sync_fetch_and_and(p, v); }
+static inline LONGLONG InterlockedIncrement64(LONGLONG volatile *p) { return __sync_add_and_fetch(p, 1); }
+static inline LONGLONG InterlockedDecrement64(LONGLONG volatile *p) { return __sync_sub_and_fetch(p, 1); }
+static inline LONGLONG InterlockedExchangeAdd64(LONGLONG volatile *p, LONGLONG v) { return __sync_fetch_and_add(p, v); }
+static inline LONGLONG InterlockedExchange64(LONGLONG volatile *p, LONGLONG v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+static inline LONGLONG InterlockedCompareExchange64(LONGLONG volatile *p, LONGLONG v, LONGLONG c) { return __sync_val_compare_and_swap(p, c, v); }
+static inline PVOID InterlockedExchangePointer(PVOID volatile *p, PVOID v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+static inline PVOID InterlockedCompareExchangePointer(PVOID volatile *p, PVOID v, PVOID c) { return __sync_val_compare_and_swap(p, c, v); }
+
+#define MemoryBarrier()         __sync_synchronize()
+#define _ReadWriteBarrier()     __asm__ __volatile__("" ::: "memory")
+#if defined(__x86_64__) || defined(__i386__)
+#define YieldProcessor()        __builtin_ia32_pause()
+#else
+#define YieldProcessor()        __asm__ __volatile__("" ::: "memory")
+#endif
+
+//
+// Time, threads and system information
+//
+BOOL      QueryPerformanceCounter(LARGE_INTEGER *pCount);
+BOOL      QueryPerformanceFrequency(LARGE_INTEGER *pFreq);
+DWORD     GetTickCount(VOID);
+ULONGLONG GetTickCount64(VOID);
+VOID      Sleep(DWORD dwMs);
+BOOL      SwitchToThread(VOID);
+DWORD     GetCurrentThreadId(VOID);
+VOID      GetSystemInfo(LPSYSTEM_INFO pInfo);
+
+//
+// Memory
+//
+LPVOID VirtualAlloc(LPVOID pAddr, SIZE_T size, DWORD dwType, DWORD dwProtect);
+BOOL   VirtualFree(LPVOID pAddr, SIZE_T size, DWORD dwType);
+SIZE_T GetLargePageMinimum(VOID);
+PVOID  _aligned_malloc(size_t size, size_t alignment);
+VOID   _aligned_free(PVOID p);
+
+//
+// Files and file mappings
+//
+HANDLE CreateFileA(LPCSTR pName, DWORD dwAccess, DWORD dwShare, PVOID pAttr,
+                   DWORD dwDisposition, DWORD dwFlags, HANDLE hTemplate);
+#define CreateFile CreateFileA
+HANDLE CreateFileMappingA(HANDLE hFile, PVOID pAttr, DWORD dwProtect, DWORD dwSizeHi,
+                          DWORD dwSizeLo, LPCSTR pName);
+#define CreateFileMapping CreateFileMappingA
+LPVOID MapViewOfFile(HANDLE hMap, DWORD dwAccess, DWORD dwOffsetHi, DWORD dwOffsetLo, SIZE_T size);
+BOOL   FlushViewOfFile(LPVOID pView, SIZE_T size);
+BOOL   UnmapViewOfFile(LPVOID pView);
+BOOL   GetFileSizeEx(HANDLE hFile, PLARGE_INTEGER pSize);
+BOOL   SetFilePointerEx(HANDLE hFile, LARGE_INTEGER dist, PLARGE_INTEGER pNew, DWORD dwMethod);
+BOOL   SetEndOfFile(HANDLE hFile);
+
+//
+// C runtime: threads (process.h) and console (conio.h)
+//
+uintptr_t _beginthread(void (*pfnStart)(void *), unsigned stackSize, void *pArg);
+uintptr_t _beginthreadex(void *pSecurity, unsigned stackSize, unsigned (__stdcall *pfnStart)(void *),
+                         void *pArg, unsigned initFlag, unsigned *pThreadId);
+void      _endthread(void);
+void      _endthreadex(unsigned retVal);
+int       _getpid(void);
+int       _getch(void);
+int       _kbhit(void);
+
+#endif // _TSI721POSIX_H_
@@ -0,0 +1,703 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721bench.cpp
+
+Description:
+
+    Transfer-size sweep benchmark. Measures latency percentiles and
+    throughput of BDMA data requests for payload sizes from 8 bytes up to the
+    inbound window size and emits the curves as CSV and JSON.
+
+    NOTE: The BDMA engine has no request type which issues only SWRITE packets.
+    The SWRITE column uses LAST_NWRITE_R where the engine sends the body of
+    an 8-byte aligned transfer as SWRITE and the last packet as NWRITE_R.
+
+    Maintenance concurrency benchmark. Runs a read/write mix of maintenance
+    requests from an increasing number of threads sharing one device handle
+    and finds the concurrency level where the maintenance BDMA channel
+    saturates.
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <process.h>
+#include <malloc.h>
+
+#include "tsi721api.h"
+#include "tsi721csr.h"
+#include "tsi721dev.h"
+#include "tsi721dma.h"
+#include "tsi721pool.h"
+#include "tsi721stat.h"
+#include "tsi721trace.h"
+#include "tsi721bench.h"
+
+static const struct {
+    DWORD Op;
+    DWORD Rtype;
+    DWORD Dir;
+    PCSTR Name;
+} g_benchOps[BENCH_OP_NUM] = {
+    { BENCH_OP_NWRITE,   ALL_NWRITE,    DMA_DIR_WRITE, "NWRITE"   },
+    { BENCH_OP_NWRITE_R, ALL_NWRITE_R,  DMA_DIR_WRITE, "NWRITE_R" },
+    { BENCH_OP_SWRITE,   LAST_NWRITE_R, DMA_DIR_WRITE, "SWRITE"   },
+    { BENCH_OP_NREAD,    NREAD,         DMA_DIR_READ,  "NREAD"    },
+};
+
+static double
+bench_mbps(
+    ULONGLONG bytes,
+    ULONGLONG ticks
+    )
+{
+    ULONGLONG ns = lat_ticks_to_ns(ticks);
+
+    return ns ? (double)bytes / (1024.0 * 1024.0) / ((double)ns / 1e9) : 0.0;
+}
+
+static DWORD
+bench_latency(
+    HANDLE        hDev,
+    PBENCH_CFG    pCfg,
+    DWORD         idx,
+    PVOID         pBuf,
+    PLAT_HIST     pHist,
+    PBENCH_RESULT pRes
+    )
+/*++
+
+Routine Description:
+
+    Issues synchronous requests one at a time and records the latency of each.
+
+--*/
+{
+    DMA_REQ_CTRL dmaCtrl;
+    ULONGLONG    t0, t1, total = 0;
+    DWORD        i, dwSize, dwErr;
+
+    dmaCtrl.dword = 0;
+    dmaCtrl.bits.Rtype = g_benchOps[idx].Rtype;
+
+    lat_hist_init(pHist);
+
+    for (i = 0; i < pCfg->Warmup + pCfg->Iterations; i++) {
+        dwSize = pRes->Size;
+
+        t0 = lat_ticks();
+        if (g_benchOps[idx].Dir == DMA_DIR_WRITE)
+            dwErr = g_devOps->SrioWrite(hDev, pCfg->DestId, pCfg->AddrHi, pCfg->AddrLo,
+                                    pBuf, &dwSize, dmaCtrl);
+        else
+            dwErr = g_devOps->SrioRead(hDev, pCfg->DestId, pCfg->AddrHi, pCfg->AddrLo,
+                                   pBuf, &dwSize, dmaCtrl);
+        t1 = lat_ticks();
+
+        if (i < pCfg->Warmup)
+            continue;
+
+        if (dwErr != ERROR_SUCCESS) {
+            if (pRes->Errors++ == 0)
+                printf_s("BENCH: %s of %d bytes failed, err = 0x%x\n",
+                         g_benchOps[idx].Name, pRes->Size, dwErr);
+            continue;
+        }
+
+        total += t1 - t0;
+        lat_hist_add(pHist, lat_ticks_to_ns(t1 - t0));
+    }
+
+    pRes->Count = (DWORD)pHist->Count;
+    pRes->MinNs = pHist->Count ? pHist->Min : 0;
+    pRes->P50Ns = lat_hist_percentile(pHist, 50.0);
+    pRes->P99Ns = lat_hist_percentile(pHist, 99.0);
+    pRes->P999Ns = lat_hist_percentile(pHist, 99.9);
+    pRes->MaxNs = pHist->Max;
+    pRes->MeanNs = lat_hist_mean(pHist);
+    pRes->Qd1MBps = bench_mbps((ULONGLONG)pRes->Size * pHist->Count, total);
+
+    return pHist->Count ? ERROR_SUCCESS : ERROR_GEN_FAILURE;
+}
+
+static DWORD
+bench_pipelined(
+    PDMA_ENGINE   pEng,
+    PBENCH_CFG    pCfg,
+    DWORD         idx,
+    PVOID         pBuf,
+    PBENCH_RESULT pRes
+    )
+/*++
+
+Routine Description:
+
+    Keeps all engine queues full with requests of the same size and measures
+    aggregate throughput.
+
+--*/
+{
+    PDMA_REQ  pReqs;
+    PDMA_REQ *pFree;
+    PDMA_REQ  done[DMA_ENG_MAX_BATCH];
+    DWORD     dwSlots, dwFree, dwInFlight = 0;
+    DWORD     issued = 0, completed = 0, dwCount, i, dwErr;
+    ULONGLONG t0, t1;
+
+    dwSlots = tsi721_dma_channels(pEng) * tsi721_dma_depth(pEng);
+
+    pReqs = (PDMA_REQ)malloc(dwSlots * sizeof(DMA_REQ));
+    pFree = (PDMA_REQ *)malloc(dwSlots * sizeof(PDMA_REQ));
+    if (pReqs == NULL || pFree == NULL) {
+        free(pReqs);
+        free(pFree);
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    for (i = 0; i < dwSlots; i++)
+        pFree[i] = &pReqs[i];
+    dwFree = dwSlots;
+
+    t0 = lat_ticks();
+
+    while (completed < pCfg->Iterations) {
+        while (issued < pCfg->Iterations && dwFree) {
+            PDMA_REQ pReq = pFree[dwFree - 1];
+
+            pReq->Dir = g_benchOps[idx].Dir;
+            pReq->DestId = pCfg->DestId;
+            pReq->AddrHi = pCfg->AddrHi;
+            pReq->AddrLo = pCfg->AddrLo;
+            pReq->Buffer = pBuf;
+            pReq->Size = pRes->Size;
+            pReq->Ctrl.dword = 0;
+            pReq->Ctrl.bits.Rtype = g_benchOps[idx].Rtype;
+
+            dwErr = tsi721_dma_submit(pEng, pReq);
+            if (dwErr == ERROR_BUSY)
+                break;
+            if (dwErr != ERROR_IO_PENDING)
+                goto exit;
+
+            dwFree--;
+            dwInFlight++;
+            issued++;
+        }
+
+        dwErr = tsi721_dma_complete(pEng, done, DMA_ENG_MAX_BATCH, INFINITE, &dwCount);
+        if (dwErr != ERROR_SUCCESS)
+            goto exit;
+
+        for (i = 0; i < dwCount; i++) {
+            if (done[i]->Status != ERROR_SUCCESS)
+                pRes->Errors++;
+            pFree[dwFree++] = done[i];
+        }
+
+        dwInFlight -= dwCount;
+        completed += dwCount;
+    }
+
+    t1 = lat_ticks();
+    pRes->PipeMBps = bench_mbps((ULONGLONG)pRes->Size * completed, t1 - t0);
+    dwErr = ERROR_SUCCESS;
+
+exit:
+
+    //
+    // Drain requests left in flight after an error
+    //
+    while (dwInFlight) {
+        if (tsi721_dma_complete(pEng, done, DMA_ENG_MAX_BATCH, INFINITE, &dwCount) != ERROR_SUCCESS)
+            break;
+        dwInFlight -= dwCount;
+    }
+
+    free(pFree);
+    free(pReqs);
+
+    return dwErr;
+}
+
+static VOID
+bench_write_csv(
+    PCSTR         path,
+    PBENCH_RESULT pRes,
+    DWORD         dwNum
+    )
+{
+    FILE *fp;
+    DWORD i;
+
+    if (fopen_s(&fp, path, "w") != 0 || fp == NULL) {
+        printf_s("BENCH: Unable to create %s\n", path);
+        return;
+    }
+
+    fprintf(fp, "op,size,count,errors,min_ns,p50_ns,p99_ns,p999_ns,max_ns,mean_ns,qd1_MBps,pipelined_MBps\n");
+
+    for (i = 0; i < dwNum; i++, pRes++) {
+        DWORD idx;
+
+        for (idx = 0; g_benchOps[idx].Op != pRes->Op; idx++)
+            ;
+
+        fprintf(fp, "%s,%u,%u,%u,%llu,%llu,%llu,%llu,%llu,%.1f,%.3f,%.3f\n",
+                g_benchOps[idx].Name, pRes->Size, pRes->Count, pRes->Errors,
+                pRes->MinNs, pRes->P50Ns, pRes->P99Ns, pRes->P999Ns, pRes->MaxNs,
+                pRes->MeanNs, pRes->Qd1MBps, pRes->PipeMBps);
+    }
+
+    fclose(fp);
+}
+
+static VOID
+bench_write_json(
+    PCSTR         path,
+    PBENCH_CFG    pCfg,
+    PBENCH_RESULT pRes,
+    DWORD         dwNum
+    )
+{
+    FILE *fp;
+    DWORD i;
+
+    if (fopen_s(&fp, path, "w") != 0 || fp == NULL) {
+        printf_s("BENCH: Unable to create %s\n", path);
+        return;
+    }
+
+    fprintf(fp, "{\n  \"dest_id\": %u,\n  \"iterations\": %u,\n  \"results\": [\n",
+            pCfg->DestId, pCfg->Iterations);
+
+    for (i = 0; i < dwNum; i++, pRes++) {
+        DWORD idx;
+
+        for (idx = 0; g_benchOps[idx].Op != pRes->Op; idx++)
+            ;
+
+        fprintf(fp, "    {\"op\": \"%s\", \"size\": %u, \"count\": %u, \"errors\": %u, "
+                "\"min_ns\": %llu, \"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, "
+                "\"max_ns\": %llu, \"mean_ns\": %.1f, \"qd1_MBps\": %.3f, \"pipelined_MBps\": %.3f}%s\n",
+                g_benchOps[idx].Name, pRes->Size, pRes->Count, pRes->Errors,
+                pRes->MinNs, pRes->P50Ns, pRes->P99Ns, pRes->P999Ns, pRes->MaxNs,
+                pRes->MeanNs, pRes->Qd1MBps, pRes->PipeMBps, (i + 1 < dwNum) ? "," : "");
+    }
+
+    fprintf(fp, "  ]\n}\n");
+    fclose(fp);
+}
+
+DWORD
+tsi721_bench_sweep(
+    HANDLE      hDev,
+    PDMA_ENGINE pEng,
+    PBENCH_CFG  pCfg
+    )
+/*++
+
+Routine Description:
+
+    Runs the size sweep for all selected request types.
+
+Arguments:
+
+    hDev - device handle
+    pEng - BDMA transfer engine
+    pCfg - benchmark configuration
+
+Return Value:
+
+    ERROR_SUCCESS or an error code.
+
+--*/
+{
+    PBENCH_RESULT pRes = NULL;
+    PLAT_HIST     pHist = NULL;
+    PVOID         pBuf = NULL;
+    DWORD         dwNum = 0, dwMax = 0;
+    DWORD         size, idx, i, dwErr = ERROR_SUCCESS;
+
+    if (pCfg->MinSize == 0)
+        pCfg->MinSize = BENCH_MIN_SIZE;
+    if (pCfg->Iterations == 0)
+        pCfg->Iterations = BENCH_DEF_ITER;
+    if (pCfg->OpMask == 0)
+        pCfg->OpMask = BENCH_OP_ALL;
+
+    if (pCfg->MaxSize < pCfg->MinSize)
+        return ERROR_INVALID_PARAMETER;
+
+    for (size = pCfg->MinSize; size && size <= pCfg->MaxSize; size <<= 1)
+        dwMax += BENCH_OP_NUM;
+
+    pRes = (PBENCH_RESULT)malloc(dwMax * sizeof(BENCH_RESULT));
+    pHist = (PLAT_HIST)malloc(sizeof(LAT_HIST));
+    pBuf = tsi721_pool_alloc(pCfg->MaxSize);
+    if (pRes == NULL || pHist == NULL || pBuf == NULL) {
+        dwErr = ERROR_NOT_ENOUGH_MEMORY;
+        goto exit;
+    }
+
+    for (i = 0; i < pCfg->MaxSize; i++)
+        ((PUCHAR)pBuf)[i] = (UCHAR)i;
+
+    printf_s("%-9s %10s %10s %10s %10s %10s %10s %11s %11s\n", "op", "size", "min_ns",
+             "p50_ns", "p99_ns", "p99.9_ns", "max_ns", "qd1_MB/s", "pipe_MB/s");
+
+    for (idx = 0; idx < BENCH_OP_NUM; idx++) {
+        if (!(pCfg->OpMask & g_benchOps[idx].Op))
+            continue;
+
+        for (size = pCfg->MinSize; size && size <= pCfg->MaxSize; size <<= 1) {
+            PBENCH_RESULT pR = &pRes[dwNum];
+
+            ZeroMemory(pR, sizeof(BENCH_RESULT));
+            pR->Op = g_benchOps[idx].Op;
+            pR->Size = size;
+
+            dwErr = bench_latency(hDev, pCfg, idx, pBuf, pHist, pR);
+            if (dwErr == ERROR_SUCCESS && pEng)
+                dwErr = bench_pipelined(pEng, pCfg, idx, pBuf, pR);
+
+            printf_s("%-9s %10u %10llu %10llu %10llu %10llu %10llu %11.2f %11.2f\n",
+                     g_benchOps[idx].Name, size, pR->MinNs, pR->P50Ns, pR->P99Ns,
+                     pR->P999Ns, pR->MaxNs, pR->Qd1MBps, pR->PipeMBps);
+            fflush(stdout);
+
+            dwNum++;
+
+            if (dwErr != ERROR_SUCCESS) {
+                printf_s("BENCH: %s sweep stopped at %d bytes, err = 0x%x\n",
+                         g_benchOps[idx].Name, size, dwErr);
+                break;
+            }
+        }
+    }
+
+    if (pCfg->CsvPath)
+        bench_write_csv(pCfg->CsvPath, pRes, dwNum);
+    if (pCfg->JsonPath)
+        bench_write_json(pCfg->JsonPath, pCfg, pRes, dwNum);
+
+exit:
+
+    tsi721_pool_free(pBuf);
+    free(pHist);
+    free(pRes);
+
+    return dwErr;
+}
+
+typedef struct _MAINT_BENCH_THREAD {
+    HANDLE           hDev;
+    PMAINT_BENCH_CFG pCfg;
+    DWORD            Hop;
+    DWORD            WrValue;   // value read from WrOffset before the run
+    HANDLE           hStart;    // manual reset, releases all threads at once
+    HANDLE           hThread;
+    DWORD            Errors;
+    DWORD            dwErr;     // first error
+    ULONGLONG        EndTicks;
+    LAT_HIST         Hist;
+} MAINT_BENCH_THREAD, *PMAINT_BENCH_THREAD;
+
+static unsigned __stdcall
+bench_maint_thread(
+    PVOID params
+    )
+/*++
+
+Routine Description:
+
+    Issues the request mix. Reads and writes are interleaved evenly, request
+    i is a read when the running share of reads reaches ReadPct.
+
+--*/
+{
+    PMAINT_BENCH_THREAD pThr = (PMAINT_BENCH_THREAD)params;
+    PMAINT_BENCH_CFG    pCfg = pThr->pCfg;
+    ULONGLONG           t0, t1;
+    DWORD               i, dwVal, dwErr;
+
+    lat_hist_init(&pThr->Hist);
+
+    WaitForSingleObject(pThr->hStart, INFINITE);
+
+    for (i = 0; i < pCfg->Ops; i++) {
+        BOOL bRead = ((i + 1) * pCfg->ReadPct / 100) != (i * pCfg->ReadPct / 100);
+
+        t0 = lat_ticks();
+        if (bRead) {
+            dwErr = g_devOps->SrioMaintRead(pThr->hDev, pCfg->DestId, pThr->Hop,
+                                            pCfg->RdOffset, &dwVal);
+            t1 = lat_ticks();
+            tsi721_trace(TRACE_EV_MAINT_READ, dwErr, pCfg->DestId, pCfg->RdOffset, dwVal, t0);
+        } else {
+            dwErr = g_devOps->SrioMaintWrite(pThr->hDev, pCfg->DestId, pThr->Hop,
+                                             pCfg->WrOffset, pThr->WrValue);
+            t1 = lat_ticks();
+            tsi721_trace(TRACE_EV_MAINT_WRITE, dwErr, pCfg->DestId, pCfg->WrOffset,
+                         pThr->WrValue, t0);
+        }
+
+        if (dwErr != ERROR_SUCCESS) {
+            if (pThr->Errors++ == 0)
+                pThr->dwErr = dwErr;
+            continue;
+        }
+
+        lat_hist_add(&pThr->Hist, lat_ticks_to_ns(t1 - t0));
+    }
+
+    pThr->EndTicks = lat_ticks();
+    return 0;
+}
+
+static DWORD
+bench_maint_level(
+    HANDLE              hDev,
+    PMAINT_BENCH_CFG    pCfg,
+    PMAINT_BENCH_THREAD pThr,
+    DWORD               dwWrValue,
+    PLAT_HIST           pHist,
+    PMAINT_BENCH_RESULT pRes
+    )
+/*++
+
+Routine Description:
+
+    Runs one concurrency level. Throughput is measured from the release of
+    the threads to the completion of the last one.
+
+--*/
+{
+    HANDLE    hStart;
+    ULONGLONG tStart, tEnd = 0;
+    DWORD     i, started, dwErr = ERROR_SUCCESS;
+
+    hStart = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (hStart == NULL)
+        return GetLastError();
+
+    for (started = 0; started < pRes->Threads; started++) {
+        ZeroMemory(&pThr[started], sizeof(MAINT_BENCH_THREAD));
+        pThr[started].hDev = hDev;
+        pThr[started].pCfg = pCfg;
+        pThr[started].Hop = pRes->Hop;
+        pThr[started].WrValue = dwWrValue;
+        pThr[started].hStart = hStart;
+
+        pThr[started].hThread = (HANDLE)_beginthreadex(NULL, 0, bench_maint_thread,
+                                                       &pThr[started], 0, NULL);
+        if (pThr[started].hThread == NULL) {
+            dwErr = GetLastError();
+            break;
+        }
+    }
+
+    tStart = lat_ticks();
+    SetEvent(hStart);
+
+    lat_hist_init(pHist);
+
+    for (i = 0; i < started; i++) {
+        WaitForSingleObject(pThr[i].hThread, INFINITE);
+        CloseHandle(pThr[i].hThread);
+
+        lat_hist_merge(pHist, &pThr[i].Hist);
+        pRes->Errors += pThr[i].Errors;
+        if (pThr[i].EndTicks > tEnd)
+            tEnd = pThr[i].EndTicks;
+        if (dwErr == ERROR_SUCCESS)
+            dwErr = pThr[i].dwErr;
+    }
+
+    CloseHandle(hStart);
+
+    pRes->Count = (DWORD)pHist->Count;
+    pRes->P50Ns = lat_hist_percentile(pHist, 50.0);
+    pRes->P99Ns = lat_hist_percentile(pHist, 99.0);
+    pRes->P999Ns = lat_hist_percentile(pHist, 99.9);
+    pRes->MaxNs = pHist->Max;
+    pRes->MeanNs = lat_hist_mean(pHist);
+    if (tEnd > tStart && pHist->Count)
+        pRes->OpsPerSec = (double)pHist->Count * 1e9 / (double)lat_ticks_to_ns(tEnd - tStart);
+
+    return dwErr;
+}
+
+static VOID
+bench_maint_write_csv(
+    PCSTR               path,
+    PMAINT_BENCH_CFG    pCfg,
+    PMAINT_BENCH_RESULT pRes,
+    DWORD               dwNum
+    )
+{
+    FILE *fp;
+    DWORD i;
+
+    if (fopen_s(&fp, path, "w") != 0 || fp == NULL) {
+        printf_s("BENCH: Unable to create %s\n", path);
+        return;
+    }
+
+    fprintf(fp, "hop,threads,read_pct,count,errors,ops_per_s,p50_ns,p99_ns,p999_ns,max_ns,mean_ns\n");
+
+    for (i = 0; i < dwNum; i++, pRes++)
+        fprintf(fp, "%u,%u,%u,%u,%u,%.0f,%llu,%llu,%llu,%llu,%.1f\n",
+                pRes->Hop, pRes->Threads, pCfg->ReadPct, pRes->Count, pRes->Errors,
+                pRes->OpsPerSec, pRes->P50Ns, pRes->P99Ns, pRes->P999Ns, pRes->MaxNs,
+                pRes->MeanNs);
+
+    fclose(fp);
+}
+
+static VOID
+bench_maint_report(
+    PMAINT_BENCH_RESULT pRes,
+    DWORD               dwNum
+    )
+/*++
+
+Routine Description:
+
+    Prints the peak and the knee of one hop count's scaling curve. The knee
+    is the last level where adding a thread still raised the throughput by
+    at least MAINT_BENCH_KNEE_GAIN over the best lower level.
+
+--*/
+{
+    DWORD i, peak = 0, knee = 0;
+
+    for (i = 1; i < dwNum; i++) {
+        if (pRes[i].OpsPerSec > pRes[peak].OpsPerSec * MAINT_BENCH_KNEE_GAIN && knee == i - 1)
+            knee = i;
+        if (pRes[i].OpsPerSec > pRes[peak].OpsPerSec)
+            peak = i;
+    }
+
+    printf_s("hop %u: peak %.0f ops/s at %u thread(s), channel saturates at %u thread(s)",
+             pRes[0].Hop, pRes[peak].OpsPerSec, pRes[peak].Threads, pRes[knee].Threads);
+    if (knee + 1 < dwNum)
+        printf_s(", p99 %llu -> %llu ns at %u threads",
+                 pRes[knee].P99Ns, pRes[dwNum - 1].P99Ns, pRes[dwNum - 1].Threads);
+    printf_s("\n");
+}
+
+DWORD
+tsi721_bench_maint(
+    HANDLE           hDev,
+    PMAINT_BENCH_CFG pCfg
+    )
+/*++
+
+Routine Description:
+
+    Runs the maintenance request mix for all hop counts and concurrency levels.
+
+Arguments:
+
+    hDev - device handle
+    pCfg - benchmark configuration
+
+Return Value:
+
+    ERROR_SUCCESS or an error code.
+
+--*/
+{
+    PMAINT_BENCH_RESULT pRes = NULL;
+    PMAINT_BENCH_THREAD pThr = NULL;
+    PLAT_HIST           pHist = NULL;
+    DWORD               dwNum = 0, dwMax, first;
+    DWORD               hop, thr, dwWrValue, dwErr = ERROR_SUCCESS;
+
+    if (pCfg->MaxThreads == 0)
+        pCfg->MaxThreads = MAINT_BENCH_DEF_THREADS;
+    if (pCfg->Ops == 0)
+        pCfg->Ops = MAINT_BENCH_DEF_OPS;
+    if (pCfg->RdOffset == 0)
+        pCfg->RdOffset = RIO_DEV_ID_CAR;
+    if (pCfg->WrOffset == 0)
+        pCfg->WrOffset = RIO_COMPONENT_TAG_CSR;
+
+    if (pCfg->MaxThreads > MAINT_BENCH_MAX_THREADS || pCfg->ReadPct > 100 ||
+        pCfg->HopMin > pCfg->HopMax || pCfg->HopMax > 0xff)
+        return ERROR_INVALID_PARAMETER;
+
+    dwMax = (pCfg->HopMax - pCfg->HopMin + 1) * pCfg->MaxThreads;
+
+    pRes = (PMAINT_BENCH_RESULT)calloc(dwMax, sizeof(MAINT_BENCH_RESULT));
+    pThr = (PMAINT_BENCH_THREAD)_aligned_malloc(pCfg->MaxThreads * sizeof(MAINT_BENCH_THREAD), 64);
+    pHist = (PLAT_HIST)malloc(sizeof(LAT_HIST));
+    if (pRes == NULL || pThr == NULL || pHist == NULL) {
+        dwErr = ERROR_NOT_ENOUGH_MEMORY;
+        goto exit;
+    }
+
+    printf_s("%-4s %7s %10s %10s %10s %10s %10s %7s\n", "hop", "threads", "ops/s",
+             "p50_ns", "p99_ns", "p99.9_ns", "max_ns", "errors");
+
+    for (hop = pCfg->HopMin; hop <= pCfg->HopMax; hop++) {
+        //
+        // Writes store the register's current value back, so the benchmark
+        // leaves the target unchanged
+        //
+        dwErr = g_devOps->SrioMaintRead(hDev, pCfg->DestId, hop, pCfg->WrOffset, &dwWrValue);
+        if (dwErr != ERROR_SUCCESS) {
+            printf_s("BENCH: Maintenance read at hop %u failed, err = 0x%x\n", hop, dwErr);
+            break;
+        }
+
+        first = dwNum;
+
+        for (thr = 1; thr <= pCfg->MaxThreads; thr++) {
+            PMAINT_BENCH_RESULT pR = &pRes[dwNum];
+
+            pR->Hop = hop;
+            pR->Threads = thr;
+
+            dwErr = bench_maint_level(hDev, pCfg, pThr, dwWrValue, pHist, pR);
+
+            printf_s("%-4u %7u %10.0f %10llu %10llu %10llu %10llu %7u\n",
+                     hop, thr, pR->OpsPerSec, pR->P50Ns, pR->P99Ns, pR->P999Ns,
+                     pR->MaxNs, pR->Errors);
+            fflush(stdout);
+
+            dwNum++;
+
+            if (dwErr != ERROR_SUCCESS) {
+                printf_s("BENCH: Hop %u stopped at %u threads, err = 0x%x\n", hop, thr, dwErr);
+                break;
+            }
+        }
+
+        if (dwNum - first > 1)
+            bench_maint_report(&pRes[first], dwNum - first);
+
+        if (dwErr != ERROR_SUCCESS)
+            break;
+    }
+
+    if (pCfg->CsvPath)
+        bench_maint_write_csv(pCfg->CsvPath, pCfg, pRes, dwNum);
+
+exit:
+
+    free(pHist);
+    if (pThr)
+        _aligned_free(pThr);
+    free(pRes);
+
+    return dwErr;
+}
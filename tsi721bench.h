@@ -0,0 +1,142 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721bench.h
+
+Description:
+
+    Transfer-size sweep and maintenance concurrency benchmarks.
+
+--*/
+
+#ifndef _TSI721BENCH_H_
+#define _TSI721BENCH_H_
+
+//
+// Request types measured by the sweep (bit mask for BENCH_CFG.OpMask)
+//
+#define BENCH_OP_NWRITE     0x01    // ALL_NWRITE
+#define BENCH_OP_NWRITE_R   0x02    // ALL_NWRITE_R
+#define BENCH_OP_SWRITE     0x04    // LAST_NWRITE_R (SWRITE body, NWRITE_R tail)
+#define BENCH_OP_NREAD      0x08    // NREAD
+#define BENCH_OP_ALL        0x0f
+#define BENCH_OP_NUM        4
+
+#define BENCH_MIN_SIZE      8
+#define BENCH_DEF_ITER      1000
+
+typedef struct _BENCH_CFG {
+    DWORD  DestId;      // destID of target SRIO device
+    DWORD  AddrHi;      // bits 63:32 of SRIO address of the target window
+    DWORD  AddrLo;      // bits 31:00 of SRIO address of the target window
+    DWORD  MinSize;     // first payload size (0 = BENCH_MIN_SIZE)
+    DWORD  MaxSize;     // last payload size, normally the window size
+    DWORD  Iterations;  // timed requests per size (0 = BENCH_DEF_ITER)
+    DWORD  Warmup;      // untimed requests per size
+    DWORD  OpMask;      // BENCH_OP_xxx (0 = all)
+    PCSTR  CsvPath;     // CSV output file (NULL = none)
+    PCSTR  JsonPath;    // JSON output file (NULL = none)
+} BENCH_CFG, *PBENCH_CFG;
+
+typedef struct _BENCH_RESULT {
+    DWORD     Op;           // BENCH_OP_xxx
+    DWORD     Size;         // payload size
+    DWORD     Count;        // timed requests
+    DWORD     Errors;       // failed requests
+    ULONGLONG MinNs;
+    ULONGLONG P50Ns;
+    ULONGLONG P99Ns;
+    ULONGLONG P999Ns;
+    ULONGLONG MaxNs;
+    double    MeanNs;
+    double    Qd1MBps;      // throughput with one request in flight
+    double    PipeMBps;     // throughput with all engine queues full
+} BENCH_RESULT, *PBENCH_RESULT;
+
+/*
+ * tsi721_bench_sweep()
+ *
+ *  Sweeps payload sizes from MinSize to MaxSize in powers of two for every
+ *  selected request type. For each size it measures per-request latency with
+ *  one request in flight and the throughput with the BDMA engine queues full,
+ *  prints a table and writes CSV/JSON files.
+ *
+ * Arguments:
+ *  hDev - device handle
+ *  pEng - BDMA transfer engine (used for the pipelined throughput column)
+ *  pCfg - benchmark configuration
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the sweep completed, otherwise an error code.
+ */
+DWORD
+tsi721_bench_sweep(
+    __in HANDLE      hDev,
+    __in PDMA_ENGINE pEng,
+    __in PBENCH_CFG  pCfg
+    );
+
+//
+// Maintenance benchmark
+//
+#define MAINT_BENCH_MAX_THREADS 64
+#define MAINT_BENCH_DEF_THREADS 16
+#define MAINT_BENCH_DEF_OPS     1000    // requests per thread and concurrency level
+#define MAINT_BENCH_KNEE_GAIN   1.05    // smallest throughput gain still worth another thread
+
+typedef struct _MAINT_BENCH_CFG {
+    DWORD  DestId;      // destID of the device addressed by the requests
+    DWORD  MaxThreads;  // concurrency levels 1...MaxThreads (0 = MAINT_BENCH_DEF_THREADS)
+    DWORD  HopMin;      // first hop count measured
+    DWORD  HopMax;      // last hop count measured
+    DWORD  Ops;         // requests per thread and level (0 = MAINT_BENCH_DEF_OPS)
+    DWORD  ReadPct;     // share of reads in the request mix, 0 - 100
+    DWORD  RdOffset;    // CSR read (0 = RIO_DEV_ID_CAR)
+    DWORD  WrOffset;    // CSR written with its own value (0 = RIO_COMPONENT_TAG_CSR)
+    PCSTR  CsvPath;     // CSV output file (NULL = none)
+} MAINT_BENCH_CFG, *PMAINT_BENCH_CFG;
+
+typedef struct _MAINT_BENCH_RESULT {
+    DWORD     Hop;
+    DWORD     Threads;
+    DWORD     Count;        // completed requests
+    DWORD     Errors;       // failed requests
+    double    OpsPerSec;    // aggregate over all threads
+    ULONGLONG P50Ns;        // per-request latency
+    ULONGLONG P99Ns;
+    ULONGLONG P999Ns;
+    ULONGLONG MaxNs;
+    double    MeanNs;
+} MAINT_BENCH_RESULT, *PMAINT_BENCH_RESULT;
+
+/*
+ * tsi721_bench_maint()
+ *
+ *  Runs the read/write request mix with 1 to MaxThreads threads sharing the
+ *  device handle, for every hop count from HopMin to HopMax, and prints
+ *  requests/s and latency percentiles per level. All maintenance requests
+ *  go through one BDMA channel (TSI721_BDMA_MAINT_CH); for every hop count
+ *  the report names the level of peak throughput and the knee past which
+ *  another thread gains less than MAINT_BENCH_KNEE_GAIN.
+ *
+ * Arguments:
+ *  hDev - device handle
+ *  pCfg - benchmark configuration
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the benchmark completed, otherwise an error code.
+ */
+DWORD
+tsi721_bench_maint(
+    __in HANDLE           hDev,
+    __in PMAINT_BENCH_CFG pCfg
+    );
+
+#endif // _TSI721BENCH_H_
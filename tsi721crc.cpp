@@ -0,0 +1,244 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721crc.cpp
+
+Description:
+
+    CRC32C (Castagnoli) checksums and the CRC trailer sealing messages.
+
+    The CRC32 instruction of SSE4.2 computes CRC32C directly, 8 bytes per
+    instruction. Without it a slicing-by-8 table version is used, which
+    looks up 8 bytes per step in 8 tables of 256 entries. The version is
+    selected at run time with CPUID.
+
+--*/
+
+#include <windows.h>
+#include <intrin.h>
+
+#include "tsi721crc.h"
+
+#define CRC32C_POLY     0x82F63B78  // reflected Castagnoli polynomial
+
+typedef DWORD (*PFN_CRC32C)(DWORD, const UCHAR *, DWORD);
+
+static PFN_CRC32C g_crcFn = NULL;
+static PCSTR      g_crcIsa = "table";
+static DWORD      g_crcTable[8][256];
+
+//
+// GCC only emits SSE4.2 instructions in functions compiled for that target;
+// the routine is still selected at run time from CPUID.
+//
+#ifdef __GNUC__
+#define CRC_TARGET_SSE42    __attribute__((target("sse4.2")))
+#else
+#define CRC_TARGET_SSE42
+#endif
+
+static DWORD
+crc32c_table(
+    DWORD        crc,
+    const UCHAR *p,
+    DWORD        len
+    )
+{
+    DWORD lo, hi;
+
+    while (len && ((ULONG_PTR)p & 7)) {
+        crc = g_crcTable[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+
+    for (; len >= 8; len -= 8, p += 8) {
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = g_crcTable[7][lo & 0xff] ^ g_crcTable[6][(lo >> 8) & 0xff] ^
+              g_crcTable[5][(lo >> 16) & 0xff] ^ g_crcTable[4][lo >> 24] ^
+              g_crcTable[3][hi & 0xff] ^ g_crcTable[2][(hi >> 8) & 0xff] ^
+              g_crcTable[1][(hi >> 16) & 0xff] ^ g_crcTable[0][hi >> 24];
+    }
+
+    while (len--)
+        crc = g_crcTable[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+    return crc;
+}
+
+static CRC_TARGET_SSE42 DWORD
+crc32c_sse42(
+    DWORD        crc,
+    const UCHAR *p,
+    DWORD        len
+    )
+{
+    ULONGLONG c = crc, d;
+
+    while (len && ((ULONG_PTR)p & 7)) {
+        c = _mm_crc32_u8((DWORD)c, *p++);
+        len--;
+    }
+
+    for (; len >= 8; len -= 8, p += 8) {
+        memcpy(&d, p, 8);
+        c = _mm_crc32_u64(c, d);
+    }
+
+    while (len--)
+        c = _mm_crc32_u8((DWORD)c, *p++);
+
+    return (DWORD)c;
+}
+
+static VOID
+crc_select(
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Builds the lookup tables and selects the SSE4.2 version if the CPU has
+    it. Table N maps a byte to the CRC of that byte followed by N zero
+    bytes.
+
+--*/
+{
+    int   info[4];
+    DWORD i, j, crc;
+
+    for (i = 0; i < 256; i++) {
+        crc = i;
+        for (j = 0; j < 8; j++)
+            crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+        g_crcTable[0][i] = crc;
+    }
+
+    for (i = 0; i < 256; i++)
+        for (j = 1; j < 8; j++)
+            g_crcTable[j][i] = g_crcTable[0][g_crcTable[j - 1][i] & 0xff] ^ (g_crcTable[j - 1][i] >> 8);
+
+    // The tables are complete before another thread can find g_crcFn set
+    MemoryBarrier();
+
+    __cpuid(info, 0);
+    if (info[0] >= 1) {
+        __cpuid(info, 1);
+        if (info[2] & (1 << 20)) {
+            g_crcIsa = "SSE4.2";
+            g_crcFn = crc32c_sse42;
+            return;
+        }
+    }
+
+    g_crcIsa = "table";
+    g_crcFn = crc32c_table;
+}
+
+DWORD
+tsi721_crc32c(
+    DWORD       dwCrc,
+    const VOID *pBuf,
+    DWORD       dwSize
+    )
+{
+    if (g_crcFn == NULL)
+        crc_select();
+
+    return ~g_crcFn(~dwCrc, (const UCHAR *)pBuf, dwSize);
+}
+
+DWORD
+tsi721_crc_seal(
+    PVOID pBuf,
+    DWORD dwSize
+    )
+/*++
+
+Routine Description:
+
+    Pads the data to a multiple of 8 bytes and appends the trailer, so the
+    trailer is the last doubleword of the message.
+
+Arguments:
+
+    pBuf   - message buffer, CRC_SEALED_SIZE(dwSize) bytes
+    dwSize - data bytes
+
+Return Value:
+
+    Size of the sealed message.
+
+--*/
+{
+    PUCHAR      p = (PUCHAR)pBuf;
+    DWORD       padded = (dwSize + 7) & ~7;
+    CRC_TRAILER trl;
+
+    ZeroMemory(p + dwSize, padded - dwSize);
+
+    trl.Magic = CRC_TRAILER_MAGIC;
+    trl.Crc = tsi721_crc32c(0, p, padded);
+    memcpy(p + padded, &trl, sizeof(trl));
+
+    return padded + sizeof(trl);
+}
+
+DWORD
+tsi721_crc_check(
+    PVOID  pBuf,
+    PDWORD pdwSize
+    )
+/*++
+
+Routine Description:
+
+    Looks for a trailer in the last doubleword of the message and checks
+    the data before it.
+
+Arguments:
+
+    pBuf    - received message
+    pdwSize - message size, reduced by the trailer if there is one
+
+Return Value:
+
+    ERROR_SUCCESS, ERROR_CRC or ERROR_NOT_FOUND.
+
+--*/
+{
+    CRC_TRAILER trl;
+    DWORD       dwSize = *pdwSize;
+
+    if (dwSize < sizeof(trl) || (dwSize & 7))
+        return ERROR_NOT_FOUND;
+
+    dwSize -= sizeof(trl);
+    memcpy(&trl, (PUCHAR)pBuf + dwSize, sizeof(trl));
+    if (trl.Magic != CRC_TRAILER_MAGIC)
+        return ERROR_NOT_FOUND;
+
+    *pdwSize = dwSize;
+
+    return (tsi721_crc32c(0, pBuf, dwSize) == trl.Crc) ? ERROR_SUCCESS : ERROR_CRC;
+}
+
+PCSTR
+tsi721_crc_isa(
+    VOID
+    )
+{
+    if (g_crcFn == NULL)
+        crc_select();
+
+    return g_crcIsa;
+}
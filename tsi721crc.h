@@ -0,0 +1,102 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721crc.h
+
+Description:
+
+    CRC32C (Castagnoli) checksums and the CRC trailer sealing messages.
+
+--*/
+
+#ifndef _TSI721CRC_H_
+#define _TSI721CRC_H_
+
+//
+// A sealed message carries its data padded with zeros to a multiple of 8
+// bytes, followed by a CRC_TRAILER holding the CRC32C of the padded data.
+// The receiver must know that a message is sealed (from its configuration
+// or a header flag); the magic only tells a plain message sent to such a
+// receiver from a sealed one, it does not mark a message as sealed.
+//
+#define CRC_TRAILER_MAGIC   0x43524343  // "CCRC"
+
+typedef struct _CRC_TRAILER {
+    DWORD Magic;        // CRC_TRAILER_MAGIC
+    DWORD Crc;          // CRC32C of the data before the trailer
+} CRC_TRAILER, *PCRC_TRAILER;
+
+#define CRC_SEALED_SIZE(size)   ((((size) + 7) & ~7) + sizeof(CRC_TRAILER))
+
+/*
+ * tsi721_crc32c()
+ *
+ *  Computes the CRC32C of a buffer. A CRC over several buffers is computed
+ *  by passing the result for the previous ones as dwCrc.
+ *
+ * Arguments:
+ *  dwCrc   - CRC of the preceding data, 0 to start
+ *  pBuf    - data (no alignment requirements)
+ *  dwSize  - number of bytes
+ *
+ * Return Value:
+ *  CRC32C of the preceding data and the buffer.
+ */
+DWORD
+tsi721_crc32c(
+    __in DWORD       dwCrc,
+    __in const VOID *pBuf,
+    __in DWORD       dwSize
+    );
+
+/*
+ * tsi721_crc_seal()
+ *
+ *  Pads the data of a message with zeros to a multiple of 8 bytes and
+ *  appends a CRC_TRAILER. The buffer must hold CRC_SEALED_SIZE(dwSize) bytes.
+ *
+ * Return Value:
+ *  Size of the sealed message, CRC_SEALED_SIZE(dwSize).
+ */
+DWORD
+tsi721_crc_seal(
+    __inout PVOID pBuf,
+    __in    DWORD dwSize
+    );
+
+/*
+ * tsi721_crc_check()
+ *
+ *  Checks the trailer of a received message.
+ *
+ * Arguments:
+ *  pBuf     - received message
+ *  pdwSize  - message size; set to the size of the padded data if the
+ *             message is sealed
+ *
+ * Return Value:
+ *  ERROR_SUCCESS   - if the message is sealed and its CRC matches,
+ *  ERROR_CRC       - if the message is sealed and its CRC differs,
+ *  ERROR_NOT_FOUND - if the message carries no trailer.
+ */
+DWORD
+tsi721_crc_check(
+    __in    PVOID  pBuf,
+    __inout PDWORD pdwSize
+    );
+
+/*
+ * tsi721_crc_isa()
+ *
+ *  Returns name of the implementation selected at run time ("SSE4.2" or "table").
+ */
+PCSTR tsi721_crc_isa(VOID);
+
+#endif // _TSI721CRC_H_
@@ -0,0 +1,428 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721csr.cpp
+
+Description:
+
+    Table-driven map of the Tsi721 SRIO CSRs and coalesced register
+    snapshots.
+
+    Each TSI721RegisterRead() is a separate IOCTL, so its fixed cost far
+    exceeds the cost of the PCIe reads behind it. A snapshot plan sorts
+    the requested registers once and reads them in as few contiguous
+    blocks as possible; the values are then scattered back into the
+    caller's order.
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tsi721api.h"
+#include "tsi721dev.h"
+#include "tsi721csr.h"
+#include "tsi721trace.h"
+#include "tsi721stat.h"
+
+#define CSR_ARRAY_SIZE(a)   (sizeof(a) / sizeof((a)[0]))
+
+//
+// Field layouts (RapidIO Interconnect Specification rev. 2.1, Tsi721 user
+// manual for the implementation specific bits)
+//
+static const CSR_FIELD g_fDevId[] = {
+    { "DEV_ID", 16, 16 }, { "VENDOR_ID", 0, 16 }
+};
+
+static const CSR_FIELD g_fPeFeat[] = {
+    { "BRIDGE", 31, 1 }, { "MEMORY", 30, 1 }, { "PROCESSOR", 29, 1 },
+    { "SWITCH", 28, 1 }, { "MULTIPORT", 27, 1 }, { "FLOW_ARB", 26, 1 },
+    { "MC", 25, 1 }, { "ERTC", 24, 1 }, { "SRTC", 23, 1 }, { "FLOW_CTRL", 7, 1 },
+    { "CRF", 5, 1 }, { "CTLS", 4, 1 }, { "EXT_FEA", 3, 1 }, { "EXT_AS", 0, 3 }
+};
+
+static const CSR_FIELD g_fXaddr[] = {
+    { "EXT_AS", 0, 3 }
+};
+
+static const CSR_FIELD g_fBaseId[] = {
+    { "BASE_ID", 16, 8 }, { "LAR_BASE_ID", 0, 16 }
+};
+
+static const CSR_FIELD g_fHostLock[] = {
+    { "HOST_BASE_ID", 0, 16 }
+};
+
+static const CSR_FIELD g_fLmReq[] = {
+    { "CMD", 0, 3 }
+};
+
+static const CSR_FIELD g_fLmResp[] = {
+    { "RESP_VLD", 31, 1 }, { "ACK_ID_STAT", 5, 6 }, { "LINK_STAT", 0, 5 }
+};
+
+static const CSR_FIELD g_fAckId[] = {
+    { "CLR", 31, 1 }, { "INB_ACKID", 24, 6 }, { "OUTSTD_ACKID", 8, 6 },
+    { "OUTB_ACKID", 0, 6 }
+};
+
+static const CSR_FIELD g_fCtl2[] = {
+    { "SEL_BAUD", 28, 4 }, { "BAUD_DISC", 27, 1 },
+    { "GB_1P25", 25, 1 }, { "GB_1P25_EN", 24, 1 },
+    { "GB_2P5", 23, 1 }, { "GB_2P5_EN", 22, 1 },
+    { "GB_3P125", 21, 1 }, { "GB_3P125_EN", 20, 1 },
+    { "GB_5P0", 19, 1 }, { "GB_5P0_EN", 18, 1 },
+    { "GB_6P25", 17, 1 }, { "GB_6P25_EN", 16, 1 },
+    { "INACT_EN", 3, 1 }, { "D_SCRM_DIS", 2, 1 }, { "RTEC", 1, 1 }, { "RTEC_EN", 0, 1 }
+};
+
+static const CSR_FIELD g_fErrStat[] = {
+    { "IDLE2", 31, 1 }, { "IDLE2_EN", 30, 1 }, { "IDLE_SEQ", 29, 1 },
+    { "OUTPUT_DROP", 26, 1 }, { "OUTPUT_FAIL", 25, 1 }, { "OUTPUT_DEGR", 24, 1 },
+    { "OUTPUT_RE", 20, 1 }, { "OUTPUT_R", 19, 1 }, { "OUTPUT_RS", 18, 1 },
+    { "OUTPUT_ERR", 17, 1 }, { "OUTPUT_ES", 16, 1 }, { "INPUT_RS", 10, 1 },
+    { "INPUT_ERR", 9, 1 }, { "INPUT_ES", 8, 1 }, { "PORT_W_PEND", 4, 1 },
+    { "PORT_ERR", 2, 1 }, { "PORT_OK", 1, 1 }, { "PORT_UNINIT", 0, 1 }
+};
+
+static const CSR_FIELD g_fCtl[] = {
+    { "PORT_WIDTH", 30, 2 }, { "INIT_PWIDTH", 27, 3 }, { "OVER_PWIDTH", 24, 3 },
+    { "PORT_DIS", 23, 1 }, { "OUTPUT_EN", 22, 1 }, { "INPUT_EN", 21, 1 },
+    { "ERR_DIS", 20, 1 }, { "MULT_CS", 19, 1 }, { "FLOW_CTRL", 18, 1 },
+    { "ENUM_B", 17, 1 }, { "FLOW_ARB", 16, 1 }, { "STOP_FAIL_EN", 3, 1 },
+    { "DROP_EN", 2, 1 }, { "PORT_LOCKOUT", 1, 1 }
+};
+
+static const CSR_FIELD g_fErrDet[] = {
+    { "IMP_SPEC", 31, 1 }, { "CS_CRC_ERR", 22, 1 }, { "CS_ILL_ID", 21, 1 },
+    { "CS_NOT_ACC", 20, 1 }, { "PKT_ILL_ACKID", 19, 1 }, { "PKT_CRC_ERR", 18, 1 },
+    { "PKT_ILL_SIZE", 17, 1 }, { "DSCRAM_LOS", 16, 1 }, { "LR_ACKID_ILL", 5, 1 },
+    { "PROT_ERR", 4, 1 }, { "DELIN_ERR", 2, 1 }, { "CS_ACK_ILL", 1, 1 },
+    { "LINK_TO", 0, 1 }
+};
+
+#define CSR_REG_ENTRY(name, fields) { #name, name, fields, CSR_ARRAY_SIZE(fields) }
+
+static const CSR_REG g_csrMap[] = {
+    CSR_REG_ENTRY(RIO_DEV_ID_CAR, g_fDevId),
+    CSR_REG_ENTRY(RIO_PE_FEAT, g_fPeFeat),
+    CSR_REG_ENTRY(RIO_SR_XADDR, g_fXaddr),
+    CSR_REG_ENTRY(RIO_BASE_ID_CSR, g_fBaseId),
+    CSR_REG_ENTRY(RIO_HOST_BASE_ID_LOCK, g_fHostLock),
+    CSR_REG_ENTRY(RIO_SP_LM_REQ, g_fLmReq),
+    CSR_REG_ENTRY(RIO_SP_LM_RESP, g_fLmResp),
+    CSR_REG_ENTRY(RIO_SP_ACKID_STAT, g_fAckId),
+    CSR_REG_ENTRY(RIO_SP_CTL2, g_fCtl2),
+    CSR_REG_ENTRY(RIO_PORT_N_ERR_STAT_CSR, g_fErrStat),
+    CSR_REG_ENTRY(RIO_SP_CTL, g_fCtl),
+    CSR_REG_ENTRY(RIO_SP_ERR_DET, g_fErrDet),
+    CSR_REG_ENTRY(RIO_SP_RATE_EN, g_fErrDet),   // same layout as RIO_SP_ERR_DET
+};
+
+typedef struct _CSR_RUN {
+    DWORD Offset;   // first register of the block
+    DWORD Num;      // registers in the block
+    DWORD Base;     // index of the first register in Raw[]
+} CSR_RUN, *PCSR_RUN;
+
+typedef struct _CSR_SNAP {
+    DWORD    RegNum;    // requested registers
+    DWORD    RunNum;    // block reads per snapshot
+    DWORD    RawNum;    // registers read per snapshot
+    PCSR_RUN Run;
+    PDWORD   Map;       // request index -> Raw[] index
+    PDWORD   Raw;
+} CSR_SNAP;
+
+const CSR_REG *
+tsi721_csr_find(
+    DWORD dwOffset
+    )
+{
+    DWORD i;
+
+    for (i = 0; i < CSR_ARRAY_SIZE(g_csrMap); i++) {
+        if (g_csrMap[i].Offset == dwOffset)
+            return &g_csrMap[i];
+    }
+
+    return NULL;
+}
+
+DWORD
+tsi721_csr_field(
+    DWORD            dwValue,
+    const CSR_FIELD *pField
+    )
+{
+    DWORD mask = (pField->Width >= 32) ? 0xffffffff : ((1UL << pField->Width) - 1);
+
+    return (dwValue >> pField->Lsb) & mask;
+}
+
+VOID
+tsi721_csr_print(
+    PCSTR pPrefix,
+    DWORD dwOffset,
+    DWORD dwValue
+    )
+{
+    const CSR_REG *pReg = tsi721_csr_find(dwOffset);
+    DWORD i, val;
+
+    if (pReg == NULL) {
+        printf_s("%sRegister 0x%06x = 0x%08x\n", pPrefix, dwOffset, dwValue);
+        return;
+    }
+
+    printf_s("%sRegister %-24s = 0x%08x", pPrefix, pReg->Name, dwValue);
+
+    for (i = 0; i < pReg->FieldNum; i++) {
+        val = tsi721_csr_field(dwValue, &pReg->Field[i]);
+
+        if (pReg->Field[i].Width == 1) {
+            if (val)
+                printf_s(" %s", pReg->Field[i].Name);
+        }
+        else
+            printf_s(" %s=0x%x", pReg->Field[i].Name, val);
+    }
+
+    printf_s("\n");
+}
+
+DWORD
+tsi721_csr_read(
+    HANDLE hDev,
+    DWORD  dwOffset,
+    PDWORD pValue
+    )
+{
+    ULONGLONG t0 = tsi721_trace_on() ? lat_ticks() : 0;
+    DWORD dwErr;
+
+    *pValue = 0;
+    dwErr = g_devOps->RegisterRead(hDev, dwOffset, 1, pValue);
+    tsi721_trace(TRACE_EV_REG_READ, dwErr, 1, dwOffset, *pValue, t0);
+
+    return dwErr;
+}
+
+static int
+csr_cmp(
+    const void *a,
+    const void *b
+    )
+{
+    DWORD oa = *(const DWORD *)a;
+    DWORD ob = *(const DWORD *)b;
+
+    return (oa < ob) ? -1 : (oa > ob) ? 1 : 0;
+}
+
+DWORD
+tsi721_csr_snap_create(
+    const DWORD *pOffset,
+    DWORD        dwNum,
+    DWORD        dwMaxGap,
+    PCSR_SNAP   *ppSnap
+    )
+/*++
+
+Routine Description:
+
+    Sorts a copy of the offsets and merges neighbours into blocks. The run
+    and map arrays are carved from the same allocation as the plan.
+
+--*/
+{
+    PCSR_SNAP pSnap;
+    PDWORD    pSorted = NULL;
+    PCSR_RUN  pRun = NULL;
+    DWORD     i, r, end;
+
+    *ppSnap = NULL;
+
+    if (pOffset == NULL || dwNum == 0)
+        return ERROR_INVALID_PARAMETER;
+
+    for (i = 0; i < dwNum; i++) {
+        if (pOffset[i] & 3)
+            return ERROR_INVALID_PARAMETER;
+    }
+
+    pSnap = (PCSR_SNAP)malloc(sizeof(CSR_SNAP) + dwNum * (sizeof(CSR_RUN) + sizeof(DWORD)));
+    pSorted = (PDWORD)malloc(dwNum * sizeof(DWORD));
+    if (pSnap == NULL || pSorted == NULL) {
+        free(pSnap);
+        free(pSorted);
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    pSnap->RegNum = dwNum;
+    pSnap->RunNum = 0;
+    pSnap->RawNum = 0;
+    pSnap->Run = (PCSR_RUN)(pSnap + 1);
+    pSnap->Map = (PDWORD)(pSnap->Run + dwNum);
+    pSnap->Raw = NULL;
+
+    CopyMemory(pSorted, pOffset, dwNum * sizeof(DWORD));
+    qsort(pSorted, dwNum, sizeof(DWORD), csr_cmp);
+
+    //
+    // Extend the current block while the next register is within dwMaxGap
+    // registers of its end, otherwise start a new one
+    //
+    for (i = 0; i < dwNum; i++) {
+        if (pRun != NULL) {
+            end = pRun->Offset + pRun->Num * 4;     // first register past the block
+
+            if (pSorted[i] < end)
+                continue;                           // duplicate
+
+            if ((pSorted[i] - end) / 4 <= dwMaxGap) {
+                pRun->Num = (pSorted[i] - pRun->Offset) / 4 + 1;
+                continue;
+            }
+
+            pSnap->RawNum += pRun->Num;
+        }
+
+        pRun = &pSnap->Run[pSnap->RunNum++];
+        pRun->Offset = pSorted[i];
+        pRun->Num = 1;
+        pRun->Base = pSnap->RawNum;
+    }
+
+    pSnap->RawNum += pRun->Num;
+
+    free(pSorted);
+
+    pSnap->Raw = (PDWORD)malloc(pSnap->RawNum * sizeof(DWORD));
+    if (pSnap->Raw == NULL) {
+        free(pSnap);
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    for (i = 0; i < dwNum; i++) {
+        for (r = 0; r < pSnap->RunNum; r++) {
+            pRun = &pSnap->Run[r];
+            if (pOffset[i] >= pRun->Offset && pOffset[i] < pRun->Offset + pRun->Num * 4)
+                break;
+        }
+        pSnap->Map[i] = pRun->Base + (pOffset[i] - pRun->Offset) / 4;
+    }
+
+    *ppSnap = pSnap;
+
+    return ERROR_SUCCESS;
+}
+
+VOID
+tsi721_csr_snap_free(
+    PCSR_SNAP pSnap
+    )
+{
+    if (pSnap == NULL)
+        return;
+
+    free(pSnap->Raw);
+    free(pSnap);
+}
+
+DWORD
+tsi721_csr_snap_reads(
+    PCSR_SNAP pSnap
+    )
+{
+    return pSnap->RunNum;
+}
+
+DWORD
+tsi721_csr_snap_read(
+    HANDLE    hDev,
+    PCSR_SNAP pSnap,
+    PDWORD    pValue
+    )
+{
+    PCSR_RUN  pRun;
+    ULONGLONG t0;
+    DWORD     i, dwErr;
+
+    for (i = 0; i < pSnap->RunNum; i++) {
+        pRun = &pSnap->Run[i];
+
+        t0 = tsi721_trace_on() ? lat_ticks() : 0;
+        dwErr = g_devOps->RegisterRead(hDev, pRun->Offset, pRun->Num, &pSnap->Raw[pRun->Base]);
+        tsi721_trace(TRACE_EV_REG_READ, dwErr, pRun->Num, pRun->Offset, pSnap->Raw[pRun->Base], t0);
+
+        if (dwErr != ERROR_SUCCESS)
+            return dwErr;
+    }
+
+    for (i = 0; i < pSnap->RegNum; i++)
+        pValue[i] = pSnap->Raw[pSnap->Map[i]];
+
+    return ERROR_SUCCESS;
+}
+
+DWORD
+tsi721_csr_snap_sample(
+    HANDLE     hDev,
+    PCSR_SNAP  pSnap,
+    DWORD      dwCount,
+    DWORD      dwIntervalUs,
+    PDWORD     pValue,
+    PULONGLONG pTicks
+    )
+/*++
+
+Routine Description:
+
+    Sleeps while more than two milliseconds remain to the next deadline
+    (the scheduler tick is too coarse below that) and spins for the rest.
+
+--*/
+{
+    LARGE_INTEGER freq;
+    ULONGLONG start, deadline, now, interval;
+    DWORD     i, dwErr;
+
+    QueryPerformanceFrequency(&freq);
+    interval = (ULONGLONG)freq.QuadPart * dwIntervalUs / 1000000;
+
+    start = lat_ticks();
+
+    for (i = 0; i < dwCount; i++) {
+        deadline = start + i * interval;
+
+        for (;;) {
+            now = lat_ticks();
+            if (now >= deadline)
+                break;
+
+            if (deadline - now > (ULONGLONG)freq.QuadPart / 500)
+                Sleep((DWORD)((deadline - now) * 1000 / freq.QuadPart) - 1);
+            else
+                YieldProcessor();
+        }
+
+        if (pTicks)
+            pTicks[i] = now;
+
+        dwErr = tsi721_csr_snap_read(hDev, pSnap, pValue + (SIZE_T)i * pSnap->RegNum);
+        if (dwErr != ERROR_SUCCESS)
+            return dwErr;
+    }
+
+    return ERROR_SUCCESS;
+}
@@ -0,0 +1,230 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721csr.h
+
+Description:
+
+    Table-driven map of the Tsi721 SRIO CSRs and coalesced register
+    snapshots.
+
+--*/
+
+#ifndef _TSI721CSR_H_
+#define _TSI721CSR_H_
+
+//
+// SRIO CSR offsets (local CSR space of Tsi721 or maintenance offsets of a
+// link partner)
+//
+#define RIO_DEV_ID_CAR              (0x000000)
+#define RIO_ASM_INFO_CAR            (0x00000C)
+#define RIO_PE_FEAT                 (0x000010)
+#define RIO_SWP_INFO_CAR            (0x000014)
+#define RIO_SR_XADDR                (0x00004c)
+#define RIO_BASE_ID_CSR             (0x000060)
+#define RIO_HOST_BASE_ID_LOCK       (0x000068)
+#define RIO_COMPONENT_TAG_CSR       (0x00006C)
+#define RIO_STD_RTE_DESTID_SEL_CSR  (0x000070)
+#define RIO_STD_RTE_PORT_SEL_CSR    (0x000074)
+#define RIO_PORT_GEN_CTRL_CSR       (0x00013C)
+#define RIO_SP_LM_REQ               (0x000140)
+#define RIO_SP_LM_RESP              (0x000144)
+#define RIO_SP_ACKID_STAT           (0x000148)
+#define RIO_SP_CTL2                 (0x000154)
+#define RIO_PORT_N_ERR_STAT_CSR     (0x000158)
+#define RIO_SP_CTL                  (0x00015C)
+#define RIO_SP_ERR_DET              (0x001040)
+#define RIO_SP_RATE_EN              (0x001044)
+#define RIO_SP_ERR_RATE             (0x001068)
+
+#define RIO_PE_FEAT_SWITCH          0x10000000
+#define RIO_ASM_INFO_EF_PTR(x)      ((x) & 0xffff)
+#define RIO_SWP_INFO_PORT_TOTAL(x)  (((x) >> 8) & 0xff)
+#define RIO_SWP_INFO_PORT_NUM(x)    ((x) & 0xff)
+
+//
+// Extended feature blocks: header [31:16] next block, [15:0] feature ID.
+// Port n error and status CSR of the LP-Serial blocks is at 0x58 + n * 0x20.
+//
+#define RIO_EF_NEXT(x)              (((x) >> 16) & 0xffff)
+#define RIO_EF_ID(x)                ((x) & 0xffff)
+#define RIO_EF_IS_LP_SERIAL(id)     ((id) == 0x0001 || (id) == 0x0002 || (id) == 0x0003 || (id) == 0x0009)
+#define RIO_EF_PORT_ERR_STAT(n)     (0x58 + (n) * 0x20)
+
+#define RIO_SP_CTL2_GB_EN_MASK      0x01550000  // all baud rate enable bits
+#define RIO_SP_CTL2_GB_1P25_EN      0x01000000  // supported bit is enable bit << 1
+#define RIO_SP_CTL2_GB_2P5_EN       0x00400000
+#define RIO_SP_CTL2_GB_3P125_EN     0x00100000
+#define RIO_SP_CTL2_GB_5P0_EN       0x00040000
+#define RIO_SP_CTL2_GB_6P25_EN      0x00010000
+#define RIO_SP_CTL2_SEL_BAUD(x)     (((x) >> 28) & 0xf)
+
+#define RIO_PORT_N_ERR_STAT_PORT_OK 0x00000002
+#define RIO_PORT_N_ERR_STAT_STOPPED 0x00010100  // input or output error-stopped
+
+#define RIO_SP_CTL_PORT_DIS         0x00800000
+
+// Error rate counter: counts errors enabled in RIO_SP_RATE_EN, saturates at
+// 0xff; with ERR_RATE_BIAS [31:24] zero it is never decremented
+#define RIO_SP_ERR_RATE_CNT(x)      ((x) & 0xff)
+
+#define CSR_DEF_GAP     16  // unrequested registers a block read may span
+
+typedef struct _CSR_FIELD {
+    PCSTR Name;
+    BYTE  Lsb;      // lowest bit of the field
+    BYTE  Width;    // field width in bits
+} CSR_FIELD, *PCSR_FIELD;
+
+typedef struct _CSR_REG {
+    PCSTR            Name;
+    DWORD            Offset;
+    const CSR_FIELD *Field;
+    DWORD            FieldNum;
+} CSR_REG, *PCSR_REG;
+
+typedef struct _CSR_SNAP *PCSR_SNAP;
+
+/*
+ * tsi721_csr_find()
+ *
+ *  Returns the register map entry for the offset or NULL if the register is
+ *  not described.
+ */
+const CSR_REG *tsi721_csr_find(__in DWORD dwOffset);
+
+/*
+ * tsi721_csr_field()
+ *
+ *  Extracts a field from a register value.
+ */
+DWORD
+tsi721_csr_field(
+    __in DWORD            dwValue,
+    __in const CSR_FIELD *pField
+    );
+
+/*
+ * tsi721_csr_print()
+ *
+ *  Prints a register value followed by its decoded fields. Single-bit
+ *  fields are listed only when set.
+ *
+ * Arguments:
+ *  pPrefix  - text printed before the register name
+ *  dwOffset - register offset
+ *  dwValue  - register value
+ */
+VOID
+tsi721_csr_print(
+    __in PCSTR pPrefix,
+    __in DWORD dwOffset,
+    __in DWORD dwValue
+    );
+
+/*
+ * tsi721_csr_read()
+ *
+ *  Reads one register of the local CSR space (traced as TRACE_EV_REG_READ).
+ */
+DWORD
+tsi721_csr_read(
+    __in  HANDLE hDev,
+    __in  DWORD  dwOffset,
+    __out PDWORD pValue
+    );
+
+/*
+ * tsi721_csr_snap_create()
+ *
+ *  Builds a read plan for a set of registers: the offsets are sorted and
+ *  merged into the minimum number of contiguous block reads, a block
+ *  spanning up to dwMaxGap unrequested registers rather than issuing
+ *  another request.
+ *
+ * Arguments:
+ *  pOffset  - register offsets (any order, duplicates allowed)
+ *  dwNum    - number of offsets
+ *  dwMaxGap - unrequested registers a block may span (CSR_DEF_GAP if unsure)
+ *  ppSnap   - pointer to variable to save the created plan
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the plan was created, otherwise an error code.
+ */
+DWORD
+tsi721_csr_snap_create(
+    __in  const DWORD *pOffset,
+    __in  DWORD        dwNum,
+    __in  DWORD        dwMaxGap,
+    __out PCSR_SNAP   *ppSnap
+    );
+
+/*
+ * tsi721_csr_snap_free()
+ */
+VOID tsi721_csr_snap_free(__in PCSR_SNAP pSnap);
+
+/*
+ * tsi721_csr_snap_reads()
+ *
+ *  Returns the number of block reads a snapshot takes.
+ */
+DWORD tsi721_csr_snap_reads(__in PCSR_SNAP pSnap);
+
+/*
+ * tsi721_csr_snap_read()
+ *
+ *  Takes one snapshot.
+ *
+ * Arguments:
+ *  hDev   - device handle
+ *  pSnap  - read plan
+ *  pValue - receives dwNum values in the order the offsets were given
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if all blocks were read, otherwise an error code.
+ */
+DWORD
+tsi721_csr_snap_read(
+    __in  HANDLE    hDev,
+    __in  PCSR_SNAP pSnap,
+    __out PDWORD    pValue
+    );
+
+/*
+ * tsi721_csr_snap_sample()
+ *
+ *  Takes dwCount snapshots at a fixed interval. Sample times are absolute
+ *  deadlines from the first sample, so a slow read does not shift the
+ *  following ones. Nothing is printed while sampling.
+ *
+ * Arguments:
+ *  hDev         - device handle
+ *  pSnap        - read plan
+ *  dwCount      - number of snapshots
+ *  dwIntervalUs - interval between snapshots in microseconds
+ *  pValue       - receives dwCount * dwNum values, one snapshot after another
+ *  pTicks       - optional, receives the performance counter of each snapshot
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if all snapshots were taken, otherwise an error code.
+ */
+DWORD
+tsi721_csr_snap_sample(
+    __in      HANDLE     hDev,
+    __in      PCSR_SNAP  pSnap,
+    __in      DWORD      dwCount,
+    __in      DWORD      dwIntervalUs,
+    __out     PDWORD     pValue,
+    __out_opt PULONGLONG pTicks
+    );
+
+#endif // _TSI721CSR_H_
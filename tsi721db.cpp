@@ -0,0 +1,729 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721db.cpp
+
+Description:
+
+    Doorbell round-trip (ping-pong) benchmark, echo responder and hybrid
+    poll/wait doorbell receiver.
+
+    The master keeps exactly one tagged doorbell on the link and waits for
+    the target to send it back, so every sample is a full round trip:
+    send, remote reception and wake-up, echo send, local reception. The
+    local reception is done either by waiting on a pending doorbell
+    request (the interrupt path) or by busy polling the inbound doorbell
+    queue, so the two can be compared on the same link.
+
+    Every completed wait request costs an interrupt, an IOCTL completion
+    and a thread wake-up. The hybrid receiver avoids them while doorbells
+    arrive back to back by polling the queue for a while after each
+    delivery, and only blocks once the queue has stayed empty for its
+    adaptive spin budget, so an idle receiver does not occupy a core.
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <process.h>
+
+#include "tsi721api.h"
+#include "tsi721dev.h"
+#include "tsi721db.h"
+#include "tsi721stat.h"
+#include "tsi721trace.h"
+
+static PCSTR g_dbRxName[DB_RX_MODE_NUM] = { "wait", "poll" };
+
+typedef struct _DB_PING_CTX {
+    HANDLE      hDev;
+    OVERLAPPED  Ovl;            // doorbell wait request, manual reset event
+    DWORD       DestId;
+    IB_DB_ENTRY Buf[DB_RX_BATCH];
+} DB_PING_CTX, *PDB_PING_CTX;
+
+typedef struct _DB_RX_ENGINE {
+    DB_RX_CFG     Cfg;
+    HANDLE        hDev;
+    HANDLE        hStop;
+    HANDLE        hThread;
+    volatile BOOL bStop;
+    PIB_DB_ENTRY  Buf;          // BatchMax entries
+    DB_RX_STATS   Stats;        // updated by the receiver thread only
+} DB_RX_ENGINE;
+
+typedef struct _DB_ECHO {
+    HANDLE        hDev;
+    PDB_RX_ENGINE pRx;
+    ULONGLONG     Echoed;
+} DB_ECHO;
+
+static unsigned __stdcall db_rx_thread(PVOID params);
+
+static BOOL
+db_ping_match(
+    PIB_DB_ENTRY pDb,
+    DWORD        dwNum,
+    DWORD        dwInfo
+    )
+{
+    DWORD i;
+
+    for (i = 0; i < dwNum; i++)
+        if (pDb[i].db.Info == dwInfo)
+            return TRUE;
+
+    return FALSE;
+}
+
+static VOID
+db_ping_drain(
+    PDB_PING_CTX pCtx
+    )
+/*++
+
+Routine Description:
+
+    Discards doorbells left in the inbound queue, e.g. late echoes of a
+    previous run.
+
+--*/
+{
+    DWORD dwNum, dwSize;
+
+    while (g_devOps->SrioDoorbellCheck(pCtx->hDev, &dwNum) == ERROR_SUCCESS && dwNum) {
+        dwSize = sizeof(pCtx->Buf);
+        if (g_devOps->SrioDoorbellGet(pCtx->hDev, pCtx->Buf, &dwSize) != ERROR_SUCCESS || dwSize == 0)
+            break;
+    }
+}
+
+static DWORD
+db_ping_wait(
+    PDB_PING_CTX pCtx,
+    DWORD        dwInfo,
+    PULONGLONG   pRttNs
+    )
+/*++
+
+Routine Description:
+
+    One round trip received through a pending doorbell wait request. The
+    request is posted before the doorbell is sent, as a receiver would keep
+    it posted, so the echo completes it directly.
+
+Return Value:
+
+    ERROR_SUCCESS, ERROR_TIMEOUT if the echo did not arrive, otherwise the
+    error of the failed request.
+
+--*/
+{
+    HANDLE    hDev = pCtx->hDev;
+    ULONGLONG t0 = 0, elapsedMs;
+    DWORD     dwErr, dwRet, dwSize;
+    BOOL      bSent = FALSE;
+
+    for (;;) {
+        dwErr = g_devOps->SrioIbDoorbellWait(hDev, pCtx->Buf, sizeof(pCtx->Buf), &dwSize, &pCtx->Ovl);
+
+        if (dwErr == ERROR_SUCCESS) {
+            // Doorbells were already queued
+            if (bSent && db_ping_match(pCtx->Buf, dwSize / sizeof(IB_DB_ENTRY), dwInfo))
+                break;
+            continue;
+        }
+
+        if (dwErr != ERROR_IO_PENDING)
+            return dwErr;
+
+        if (!bSent) {
+            t0 = lat_ticks();
+            dwErr = g_devOps->SrioDoorbellSend(hDev, pCtx->DestId, dwInfo);
+            tsi721_trace(TRACE_EV_DB_SEND, dwErr, pCtx->DestId, dwInfo, 0, t0);
+            if (dwErr != ERROR_SUCCESS) {
+                g_devOps->CancelIo(hDev, &pCtx->Ovl);
+                GetOverlappedResult(hDev, &pCtx->Ovl, &dwSize, TRUE);
+                return dwErr;
+            }
+            bSent = TRUE;
+        }
+
+        elapsedMs = lat_ticks_to_ns(lat_ticks() - t0) / 1000000;
+        dwRet = WAIT_TIMEOUT;
+        if (elapsedMs < DB_PING_TIMEOUT)
+            dwRet = WaitForSingleObject(pCtx->Ovl.hEvent, DB_PING_TIMEOUT - (DWORD)elapsedMs);
+
+        if (dwRet != WAIT_OBJECT_0) {
+            g_devOps->CancelIo(hDev, &pCtx->Ovl);
+            if (GetOverlappedResult(hDev, &pCtx->Ovl, &dwSize, TRUE) &&
+                db_ping_match(pCtx->Buf, dwSize / sizeof(IB_DB_ENTRY), dwInfo))
+                break;
+            return ERROR_TIMEOUT;
+        }
+
+        if (!GetOverlappedResult(hDev, &pCtx->Ovl, &dwSize, FALSE))
+            return GetLastError();
+
+        if (db_ping_match(pCtx->Buf, dwSize / sizeof(IB_DB_ENTRY), dwInfo))
+            break;
+    }
+
+    *pRttNs = lat_ticks_to_ns(lat_ticks() - t0);
+    tsi721_trace(TRACE_EV_DB_RECV, ERROR_SUCCESS, pCtx->DestId, dwInfo, 0, t0);
+    return ERROR_SUCCESS;
+}
+
+static DWORD
+db_ping_poll(
+    PDB_PING_CTX pCtx,
+    DWORD        dwInfo,
+    PULONGLONG   pRttNs
+    )
+/*++
+
+Routine Description:
+
+    One round trip received by busy polling the inbound doorbell queue.
+
+Return Value:
+
+    ERROR_SUCCESS, ERROR_TIMEOUT if the echo did not arrive, otherwise the
+    error of the failed request.
+
+--*/
+{
+    HANDLE    hDev = pCtx->hDev;
+    ULONGLONG t0, now;
+    DWORD     dwErr, dwNum, dwSize;
+
+    t0 = lat_ticks();
+    dwErr = g_devOps->SrioDoorbellSend(hDev, pCtx->DestId, dwInfo);
+    tsi721_trace(TRACE_EV_DB_SEND, dwErr, pCtx->DestId, dwInfo, 0, t0);
+    if (dwErr != ERROR_SUCCESS)
+        return dwErr;
+
+    for (;;) {
+        dwErr = g_devOps->SrioDoorbellCheck(hDev, &dwNum);
+        if (dwErr != ERROR_SUCCESS)
+            return dwErr;
+
+        now = lat_ticks();
+
+        if (dwNum) {
+            dwSize = sizeof(pCtx->Buf);
+            dwErr = g_devOps->SrioDoorbellGet(hDev, pCtx->Buf, &dwSize);
+            if (dwErr != ERROR_SUCCESS)
+                return dwErr;
+
+            if (db_ping_match(pCtx->Buf, dwSize / sizeof(IB_DB_ENTRY), dwInfo))
+                break;
+        } else if (lat_ticks_to_ns(now - t0) >= (ULONGLONG)DB_PING_TIMEOUT * 1000000)
+            return ERROR_TIMEOUT;
+        else
+            YieldProcessor();
+    }
+
+    *pRttNs = lat_ticks_to_ns(now - t0);
+    tsi721_trace(TRACE_EV_DB_RECV, ERROR_SUCCESS, pCtx->DestId, dwInfo, 0, t0);
+    return ERROR_SUCCESS;
+}
+
+DWORD
+tsi721_db_ping_run(
+    DWORD          dwDevNum,
+    PDB_PING_CFG   pCfg,
+    PDB_PING_STATS pStats
+    )
+/*++
+
+Routine Description:
+
+    Runs the ping-pong benchmark for every selected reception mode. The
+    warm-up round trips of each mode are not recorded.
+
+Arguments:
+
+    dwDevNum - Tsi721 device index
+    pCfg     - benchmark configuration
+    pStats   - optional array of DB_RX_MODE_NUM results
+
+Return Value:
+
+    ERROR_SUCCESS, ERROR_TIMEOUT if echoes were lost, otherwise the first
+    error reported by a doorbell request.
+
+--*/
+{
+    PDB_PING_CTX pCtx = NULL;
+    PLAT_HIST    pHist = NULL;
+    DB_PING_STATS st;
+    DWORD        modeMask, warmup, mode, i, seq = 0;
+    DWORD        dwErr = ERROR_SUCCESS, dwStatus;
+    ULONGLONG    rttNs = 0, lost;
+
+    if (pCfg == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    if (pStats)
+        ZeroMemory(pStats, DB_RX_MODE_NUM * sizeof(DB_PING_STATS));
+
+    modeMask = pCfg->ModeMask ? pCfg->ModeMask : (1 << DB_RX_MODE_NUM) - 1;
+    warmup = pCfg->Warmup ? pCfg->Warmup : DB_PING_DEF_WARMUP;
+
+    if (modeMask & ~((1 << DB_RX_MODE_NUM) - 1))
+        return ERROR_INVALID_PARAMETER;
+
+    pCtx = (PDB_PING_CTX)calloc(1, sizeof(DB_PING_CTX));
+    pHist = (PLAT_HIST)malloc(sizeof(LAT_HIST));
+    if (pCtx == NULL || pHist == NULL) {
+        dwErr = ERROR_NOT_ENOUGH_MEMORY;
+        goto exit;
+    }
+
+    pCtx->hDev = INVALID_HANDLE_VALUE;
+    pCtx->DestId = pCfg->DestId;
+
+    //
+    // Open a separate device handle: its requests are not bound to any
+    // completion port, so the wait request completes to its event only.
+    //
+    if (!g_devOps->DeviceOpen(&pCtx->hDev, dwDevNum, NULL)) {
+        dwErr = GetLastError();
+        printf_s("DB_PING: failed to open Tsi721_%d (err=%x)\n", dwDevNum, dwErr);
+        pCtx->hDev = INVALID_HANDLE_VALUE;
+        goto exit;
+    }
+
+    pCtx->Ovl.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (pCtx->Ovl.hEvent == NULL) {
+        dwErr = GetLastError();
+        goto exit;
+    }
+
+    for (mode = 0; mode < DB_RX_MODE_NUM; mode++) {
+        if (!(modeMask & (1 << mode)))
+            continue;
+
+        db_ping_drain(pCtx);
+        lat_hist_init(pHist);
+        lost = 0;
+
+        for (i = 0; i < warmup + pCfg->Count; i++) {
+            DWORD dwInfo = DB_PING_TAG | (seq++ & DB_PING_SEQ_MASK);
+
+            if (mode == DB_RX_WAIT)
+                dwStatus = db_ping_wait(pCtx, dwInfo, &rttNs);
+            else
+                dwStatus = db_ping_poll(pCtx, dwInfo, &rttNs);
+
+            if (dwStatus == ERROR_TIMEOUT) {
+                lost++;
+                if (dwErr == ERROR_SUCCESS)
+                    dwErr = dwStatus;
+
+                // Nobody is echoing: do not spend a timeout on every round trip
+                if (pHist->Count == 0 && lost >= 3) {
+                    printf_s("DB_PING: no echo from destID %d, is the target running?\n",
+                             pCfg->DestId);
+                    goto exit;
+                }
+                continue;
+            }
+
+            if (dwStatus != ERROR_SUCCESS) {
+                printf_s("DB_PING: %s round trip failed, err = 0x%x\n", g_dbRxName[mode], dwStatus);
+                tsi721_trace(TRACE_EV_ERROR, dwStatus, __LINE__, mode, i, 0);
+                if (dwErr == ERROR_SUCCESS)
+                    dwErr = dwStatus;
+                goto exit;
+            }
+
+            if (i >= warmup)
+                lat_hist_add(pHist, rttNs);
+        }
+
+        ZeroMemory(&st, sizeof(st));
+        st.Count = pHist->Count;
+        st.Lost = lost;
+        st.MinNs = pHist->Count ? pHist->Min : 0;
+        st.P50Ns = lat_hist_percentile(pHist, 50.0);
+        st.P99Ns = lat_hist_percentile(pHist, 99.0);
+        st.P999Ns = lat_hist_percentile(pHist, 99.9);
+        st.MaxNs = pHist->Max;
+        st.MeanNs = lat_hist_mean(pHist);
+
+        if (pCfg->bReport)
+            printf_s("DB_PING %s: %llu round trips, %llu lost, rtt min %llu p50 %llu p99 %llu "
+                     "p99.9 %llu max %llu mean %.0f ns\n",
+                     g_dbRxName[mode], st.Count, st.Lost, st.MinNs, st.P50Ns, st.P99Ns,
+                     st.P999Ns, st.MaxNs, st.MeanNs);
+
+        if (pStats)
+            pStats[mode] = st;
+    }
+
+exit:
+
+    if (pCtx) {
+        if (pCtx->hDev != INVALID_HANDLE_VALUE)
+            g_devOps->DeviceClose(pCtx->hDev, NULL);
+        if (pCtx->Ovl.hEvent)
+            CloseHandle(pCtx->Ovl.hEvent);
+        free(pCtx);
+    }
+
+    if (pHist)
+        free(pHist);
+
+    return dwErr;
+}
+
+DWORD
+tsi721_db_echo(
+    HANDLE       hDev,
+    PIB_DB_ENTRY pDb,
+    DWORD        dwNum
+    )
+{
+    DWORD i, dwErr, echoed = 0;
+
+    for (i = 0; i < dwNum; i++) {
+        if (!DB_IS_PING(pDb[i].db.Info))
+            continue;
+
+        dwErr = g_devOps->SrioDoorbellSend(hDev, pDb[i].db.SrcId, pDb[i].db.Info);
+        if (dwErr == ERROR_SUCCESS)
+            echoed++;
+        else
+            tsi721_trace(TRACE_EV_ERROR, dwErr, __LINE__, pDb[i].db.SrcId, pDb[i].db.Info, 0);
+    }
+
+    return echoed;
+}
+
+static VOID
+db_rx_deliver(
+    PDB_RX_ENGINE pEng,
+    DWORD         dwNum
+    )
+{
+    DWORD i;
+
+    if (tsi721_trace_on()) {
+        for (i = 0; i < dwNum; i++)
+            tsi721_trace(TRACE_EV_DB_RECV, ERROR_SUCCESS, pEng->Buf[i].db.SrcId,
+                         pEng->Buf[i].db.Info, 0, 0);
+    }
+
+    pEng->Stats.Doorbells += dwNum;
+    if (dwNum > pEng->Stats.MaxBatch)
+        pEng->Stats.MaxBatch = dwNum;
+
+    if (pEng->Cfg.Handler)
+        pEng->Cfg.Handler(pEng->Cfg.HandlerCtx, pEng->Buf, dwNum);
+}
+
+static BOOL
+db_rx_spin(
+    PDB_RX_ENGINE pEng,
+    DWORD         dwSpinUs
+    )
+/*++
+
+Routine Description:
+
+    Polls the inbound doorbell queue until it has been empty for dwSpinUs.
+
+Return Value:
+
+    TRUE if any doorbell was delivered.
+
+--*/
+{
+    ULONGLONG t0, now, last;
+    DWORD     dwErr, dwNum, dwSize;
+    BOOL      bHit = FALSE;
+
+    t0 = last = now = lat_ticks();
+
+    while (!pEng->bStop) {
+        dwErr = g_devOps->SrioDoorbellCheck(pEng->hDev, &dwNum);
+        now = lat_ticks();
+        if (dwErr != ERROR_SUCCESS) {
+            pEng->Stats.Errors++;
+            break;
+        }
+
+        if (dwNum) {
+            dwSize = pEng->Cfg.BatchMax * sizeof(IB_DB_ENTRY);
+            dwErr = g_devOps->SrioDoorbellGet(pEng->hDev, pEng->Buf, &dwSize);
+            if (dwErr != ERROR_SUCCESS) {
+                pEng->Stats.Errors++;
+                break;
+            }
+
+            dwNum = dwSize / sizeof(IB_DB_ENTRY);
+            if (dwNum) {
+                pEng->Stats.Polls++;
+                pEng->Stats.PollDoorbells += dwNum;
+                db_rx_deliver(pEng, dwNum);
+                bHit = TRUE;
+                last = now;
+                continue;
+            }
+        }
+
+        if (lat_ticks_to_ns(now - last) >= (ULONGLONG)dwSpinUs * 1000)
+            break;
+
+        YieldProcessor();
+    }
+
+    pEng->Stats.SpinNs += lat_ticks_to_ns(now - t0);
+    return bHit;
+}
+
+static unsigned __stdcall
+db_rx_thread(
+    PVOID params
+    )
+/*++
+
+Routine Description:
+
+    Receiver thread. Alternates between a polling phase and a blocking
+    doorbell wait request, adapting the spin budget of the polling phase.
+
+Arguments:
+
+    params - pointer to receiver structure
+
+Return Value:
+
+    0
+
+--*/
+{
+    PDB_RX_ENGINE pEng = (PDB_RX_ENGINE)params;
+    OVERLAPPED    ovl;
+    HANDLE        hWait[2];
+    ULONGLONG     t0, blockedNs;
+    DWORD         dwErr, dwSize, dwNum, spinUs = pEng->Cfg.SpinMinUs;
+
+    ZeroMemory(&ovl, sizeof(ovl));
+    ovl.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (ovl.hEvent == NULL) {
+        pEng->Stats.Errors++;
+        return 0;
+    }
+
+    hWait[0] = ovl.hEvent;
+    hWait[1] = pEng->hStop;
+
+    while (!pEng->bStop) {
+        if (pEng->Cfg.SpinMaxUs) {
+            pEng->Stats.SpinUs = spinUs;
+            if (!db_rx_spin(pEng, spinUs) && spinUs > pEng->Cfg.SpinMinUs)
+                spinUs = max(spinUs / 2, pEng->Cfg.SpinMinUs);
+            if (pEng->bStop)
+                break;
+        }
+
+        t0 = lat_ticks();
+        dwErr = g_devOps->SrioIbDoorbellWait(pEng->hDev, pEng->Buf,
+                                             pEng->Cfg.BatchMax * sizeof(IB_DB_ENTRY), &dwSize, &ovl);
+
+        if (dwErr == ERROR_IO_PENDING) {
+            if (WaitForMultipleObjects(2, hWait, FALSE, INFINITE) != WAIT_OBJECT_0) {
+                // Stop was requested
+                g_devOps->CancelIo(pEng->hDev, &ovl);
+                GetOverlappedResult(pEng->hDev, &ovl, &dwSize, TRUE);
+                break;
+            }
+
+            if (!GetOverlappedResult(pEng->hDev, &ovl, &dwSize, FALSE)) {
+                printf_s("DB_RX: doorbell wait failed, err = 0x%x\n", GetLastError());
+                pEng->Stats.Errors++;
+                break;
+            }
+        } else if (dwErr != ERROR_SUCCESS) {
+            printf_s("DB_RX: doorbell wait error 0x%x\n", dwErr);
+            pEng->Stats.Errors++;
+            break;
+        }
+
+        blockedNs = lat_ticks_to_ns(lat_ticks() - t0);
+
+        dwNum = dwSize / sizeof(IB_DB_ENTRY);
+        if (dwNum) {
+            pEng->Stats.Wakeups++;
+            pEng->Stats.WaitDoorbells += dwNum;
+            db_rx_deliver(pEng, dwNum);
+        }
+
+        // A slightly longer spin would have caught this doorbell
+        if (pEng->Cfg.SpinMaxUs && blockedNs < (ULONGLONG)pEng->Cfg.SpinMaxUs * 1000)
+            spinUs = min(spinUs * 2, pEng->Cfg.SpinMaxUs);
+    }
+
+    CloseHandle(ovl.hEvent);
+    return 0;
+}
+
+DWORD
+tsi721_db_rx_start(
+    HANDLE         hDev,
+    PDB_RX_CFG     pCfg,
+    PDB_RX_ENGINE *ppEng
+    )
+{
+    PDB_RX_ENGINE pEng;
+    DWORD dwErr;
+
+    if (pCfg == NULL || ppEng == NULL || pCfg->BatchMax > DB_RX_MAX_BATCH)
+        return ERROR_INVALID_PARAMETER;
+
+    pEng = (PDB_RX_ENGINE)calloc(1, sizeof(DB_RX_ENGINE));
+    if (pEng == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    pEng->Cfg = *pCfg;
+    pEng->hDev = hDev;
+
+    if (pEng->Cfg.BatchMax == 0)
+        pEng->Cfg.BatchMax = DB_RX_MAX_BATCH;
+    if (pEng->Cfg.SpinMinUs == 0)
+        pEng->Cfg.SpinMinUs = 1;
+    if (pEng->Cfg.SpinMinUs > pEng->Cfg.SpinMaxUs)
+        pEng->Cfg.SpinMinUs = pEng->Cfg.SpinMaxUs;
+
+    pEng->Buf = (PIB_DB_ENTRY)calloc(pEng->Cfg.BatchMax, sizeof(IB_DB_ENTRY));
+    pEng->hStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (pEng->Buf == NULL || pEng->hStop == NULL) {
+        dwErr = pEng->Buf ? GetLastError() : ERROR_NOT_ENOUGH_MEMORY;
+        goto err_exit;
+    }
+
+    pEng->hThread = (HANDLE)_beginthreadex(NULL, 0, db_rx_thread, pEng, 0, NULL);
+    if (pEng->hThread == NULL) {
+        dwErr = GetLastError();
+        goto err_exit;
+    }
+
+    *ppEng = pEng;
+    return ERROR_SUCCESS;
+
+err_exit:
+
+    if (pEng->hStop)
+        CloseHandle(pEng->hStop);
+    if (pEng->Buf)
+        free(pEng->Buf);
+    free(pEng);
+    return dwErr;
+}
+
+VOID
+tsi721_db_rx_stop(
+    PDB_RX_ENGINE pEng
+    )
+{
+    if (pEng == NULL)
+        return;
+
+    pEng->bStop = TRUE;
+    SetEvent(pEng->hStop);
+    WaitForSingleObject(pEng->hThread, INFINITE);
+
+    CloseHandle(pEng->hThread);
+    CloseHandle(pEng->hStop);
+    free(pEng->Buf);
+    free(pEng);
+}
+
+VOID
+tsi721_db_rx_stats(
+    PDB_RX_ENGINE pEng,
+    PDB_RX_STATS  pStats
+    )
+{
+    *pStats = pEng->Stats;
+}
+
+static VOID
+db_echo_handler(
+    PVOID        pCtx,
+    PIB_DB_ENTRY pDb,
+    DWORD        dwNum
+    )
+{
+    PDB_ECHO pEcho = (PDB_ECHO)pCtx;
+
+    pEcho->Echoed += tsi721_db_echo(pEcho->hDev, pDb, dwNum);
+}
+
+DWORD
+tsi721_db_echo_start(
+    DWORD     dwDevNum,
+    PDB_ECHO *ppEcho
+    )
+{
+    PDB_ECHO  pEcho;
+    DB_RX_CFG cfg;
+    DWORD     dwErr;
+
+    if (ppEcho == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    pEcho = (PDB_ECHO)calloc(1, sizeof(DB_ECHO));
+    if (pEcho == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    if (!g_devOps->DeviceOpen(&pEcho->hDev, dwDevNum, NULL)) {
+        dwErr = GetLastError();
+        free(pEcho);
+        return dwErr;
+    }
+
+    ZeroMemory(&cfg, sizeof(cfg));
+    cfg.SpinMinUs = DB_RX_DEF_SPIN_MIN_US;
+    cfg.SpinMaxUs = DB_RX_DEF_SPIN_MAX_US;
+    cfg.Handler = db_echo_handler;
+    cfg.HandlerCtx = pEcho;
+
+    dwErr = tsi721_db_rx_start(pEcho->hDev, &cfg, &pEcho->pRx);
+    if (dwErr != ERROR_SUCCESS) {
+        g_devOps->DeviceClose(pEcho->hDev, NULL);
+        free(pEcho);
+        return dwErr;
+    }
+
+    *ppEcho = pEcho;
+    return ERROR_SUCCESS;
+}
+
+ULONGLONG
+tsi721_db_echo_stop(
+    PDB_ECHO pEcho
+    )
+{
+    ULONGLONG echoed;
+
+    if (pEcho == NULL)
+        return 0;
+
+    tsi721_db_rx_stop(pEcho->pRx);
+    g_devOps->DeviceClose(pEcho->hDev, NULL);
+
+    echoed = pEcho->Echoed;
+    free(pEcho);
+    return echoed;
+}
@@ -0,0 +1,228 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721db.h
+
+Description:
+
+    Doorbell round-trip (ping-pong) benchmark, the echo responder used by
+    the test target and the hybrid poll/wait inbound doorbell receiver.
+
+--*/
+
+#ifndef _TSI721DB_H_
+#define _TSI721DB_H_
+
+//
+// Ping-pong doorbells carry a tag in INFO[15:12] and a sequence number in
+// INFO[11:0]; the responder sends tagged doorbells back unchanged. Other
+// doorbells (e.g. those sent by the master's test threads) are not echoed.
+//
+#define DB_PING_TAG         0xd000
+#define DB_PING_TAG_MASK    0xf000
+#define DB_PING_SEQ_MASK    0x0fff
+#define DB_IS_PING(info)    (((info) & DB_PING_TAG_MASK) == DB_PING_TAG)
+
+#define DB_PING_DEF_WARMUP  1000    // round trips run before the measurement
+#define DB_PING_TIMEOUT     1000    // ms without the echo before a round trip is counted as lost
+#define DB_RX_BATCH         16      // doorbells fetched by one receive call
+
+typedef enum _DB_RX_MODE {
+    DB_RX_WAIT = 0,     // TSI721SrioIbDoorbellWait() and wait for the completion event
+    DB_RX_POLL,         // busy poll with TSI721SrioDoorbellCheck()/TSI721SrioDoorbellGet()
+    DB_RX_MODE_NUM
+} DB_RX_MODE;
+
+typedef struct _DB_PING_CFG {
+    DWORD DestId;       // destID of the echoing device
+    DWORD Count;        // measured round trips per reception mode
+    DWORD Warmup;       // round trips before the measurement (0 = DB_PING_DEF_WARMUP)
+    DWORD ModeMask;     // bit N set = run DB_RX_MODE N (0 = all modes)
+    BOOL  bReport;      // print per-mode results
+} DB_PING_CFG, *PDB_PING_CFG;
+
+typedef struct _DB_PING_STATS {
+    ULONGLONG Count;    // completed round trips
+    ULONGLONG Lost;     // round trips without an echo within DB_PING_TIMEOUT
+    ULONGLONG MinNs;    // send to echo reception
+    ULONGLONG P50Ns;
+    ULONGLONG P99Ns;
+    ULONGLONG P999Ns;
+    ULONGLONG MaxNs;
+    double    MeanNs;
+} DB_PING_STATS, *PDB_PING_STATS;
+
+typedef struct _DB_ECHO *PDB_ECHO;
+
+//
+// Hybrid receiver. After every delivery the receiver keeps polling the
+// inbound doorbell queue until it has been empty for the current spin
+// budget, then blocks in a doorbell wait request. The budget adapts
+// between SpinMinUs and SpinMaxUs: it doubles when a blocking wait ends
+// sooner than SpinMaxUs (a longer spin would have caught the doorbell)
+// and halves after a spin that found nothing.
+//
+#define DB_RX_DEF_SPIN_MIN_US   10
+#define DB_RX_DEF_SPIN_MAX_US   200
+#define DB_RX_MAX_BATCH         IBDB_RING_SZ
+
+//
+// Doorbell callback, called from the receiver thread.
+//
+//  pCtx  - HandlerCtx from DB_RX_CFG
+//  pDb   - received doorbells
+//  dwNum - number of doorbells
+//
+typedef VOID (*PFN_DB_HANDLER)(PVOID pCtx, PIB_DB_ENTRY pDb, DWORD dwNum);
+
+typedef struct _DB_RX_CFG {
+    DWORD          SpinMinUs;   // smallest spin budget
+    DWORD          SpinMaxUs;   // largest spin budget (0 = never poll, always block)
+    DWORD          BatchMax;    // doorbells fetched by one call (0 = DB_RX_MAX_BATCH)
+    PFN_DB_HANDLER Handler;
+    PVOID          HandlerCtx;
+} DB_RX_CFG, *PDB_RX_CFG;
+
+typedef struct _DB_RX_STATS {
+    ULONGLONG Doorbells;        // doorbells delivered to the handler
+    ULONGLONG Wakeups;          // wait requests completed with doorbells
+    ULONGLONG WaitDoorbells;    // doorbells delivered by those wakeups
+    ULONGLONG Polls;            // polled fetches that returned doorbells
+    ULONGLONG PollDoorbells;    // doorbells delivered by those fetches
+    ULONGLONG MaxBatch;         // largest number of doorbells from one fetch
+    ULONGLONG SpinNs;           // time spent polling
+    ULONGLONG Errors;           // failed doorbell requests
+    DWORD     SpinUs;           // current spin budget
+} DB_RX_STATS, *PDB_RX_STATS;
+
+typedef struct _DB_RX_ENGINE *PDB_RX_ENGINE;
+
+/*
+ * tsi721_db_ping_run()
+ *
+ *  Sends one tagged doorbell at a time and waits for its echo, once for
+ *  every selected reception mode. The round trip is measured from the
+ *  doorbell send call to the reception of the echo.
+ *
+ * Arguments:
+ *  dwDevNum - Tsi721 device index. The benchmark opens its own device handle.
+ *  pCfg     - benchmark configuration
+ *  pStats   - optional array of DB_RX_MODE_NUM entries receiving the results
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if all round trips completed,
+ *  ERROR_TIMEOUT - if echoes were lost,
+ *                  otherwise the first error reported by a doorbell request.
+ */
+DWORD
+tsi721_db_ping_run(
+    __in  DWORD          dwDevNum,
+    __in  PDB_PING_CFG   pCfg,
+    __out PDB_PING_STATS pStats
+    );
+
+/*
+ * tsi721_db_echo()
+ *
+ *  Sends every ping-pong doorbell of a received batch back to its source.
+ *
+ * Arguments:
+ *  hDev  - device handle
+ *  pDb   - received doorbells
+ *  dwNum - number of doorbells
+ *
+ * Return Value:
+ *  Number of doorbells echoed.
+ */
+DWORD
+tsi721_db_echo(
+    __in HANDLE       hDev,
+    __in PIB_DB_ENTRY pDb,
+    __in DWORD        dwNum
+    );
+
+/*
+ * tsi721_db_echo_start()
+ *
+ *  Starts a hybrid receiver that echoes ping-pong doorbells received by
+ *  a local device, for tests where both ends of the link are in this host.
+ *
+ * Arguments:
+ *  dwDevNum - Tsi721 device index
+ *  ppEcho   - pointer to variable to save the created responder
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the responder was started successfully,
+ *                  otherwise an error code.
+ */
+DWORD
+tsi721_db_echo_start(
+    __in  DWORD     dwDevNum,
+    __out PDB_ECHO *ppEcho
+    );
+
+/*
+ * tsi721_db_echo_stop()
+ *
+ *  Stops the responder and closes its device handle.
+ *
+ * Return Value:
+ *  Number of doorbells echoed.
+ */
+ULONGLONG
+tsi721_db_echo_stop(
+    __in PDB_ECHO pEcho
+    );
+
+/*
+ * tsi721_db_rx_start()
+ *
+ *  Starts the hybrid doorbell receiver thread on a device handle. No other
+ *  thread may wait for or fetch inbound doorbells of the device while the
+ *  receiver runs.
+ *
+ * Arguments:
+ *  hDev  - device handle
+ *  pCfg  - receiver configuration
+ *  ppEng - pointer to variable to save the created receiver
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the receiver was started successfully,
+ *                  otherwise an error code.
+ */
+DWORD
+tsi721_db_rx_start(
+    __in  HANDLE         hDev,
+    __in  PDB_RX_CFG     pCfg,
+    __out PDB_RX_ENGINE *ppEng
+    );
+
+/*
+ * tsi721_db_rx_stop()
+ *
+ *  Cancels the pending wait request, stops the thread and frees the receiver.
+ */
+VOID
+tsi721_db_rx_stop(
+    __in PDB_RX_ENGINE pEng
+    );
+
+/*
+ * tsi721_db_rx_stats()
+ *
+ *  Returns counters accumulated since the receiver was started.
+ */
+VOID
+tsi721_db_rx_stats(
+    __in  PDB_RX_ENGINE pEng,
+    __out PDB_RX_STATS  pStats
+    );
+
+#endif // _TSI721DB_H_
@@ -0,0 +1,365 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721dbdisp.cpp
+
+Description:
+
+    Inbound doorbell dispatch table.
+
+    The receiving thread is the only producer of every deferred queue and
+    each queue has exactly one consumer, its route's worker thread, so the
+    queues need no locks: the producer owns Tail, the consumer owns Head,
+    and each index lives on its own cache line. A worker with an empty
+    queue announces that it is going to sleep; the producer checks the
+    announcements once per dispatched batch and wakes only the sleeping
+    workers that received entries.
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <process.h>
+#include <malloc.h>
+
+#include "tsi721api.h"
+#include "tsi721dbdisp.h"
+
+typedef struct _DB_ROUTE_ENT {
+    DB_ROUTE      Route;
+    PIB_DB_ENTRY  Ring;         // QueueSize entries (deferred routes)
+    ULONG         Mask;
+    HANDLE        hThread;
+    HANDLE        hEvent;       // auto reset, wakes the worker
+    volatile BOOL bStop;
+
+    // Written by the dispatching thread only
+    DECLSPEC_ALIGN(64) volatile ULONG Tail;
+    ULONGLONG     Matched;
+    ULONGLONG     Dropped;
+
+    // Written by the worker thread only
+    DECLSPEC_ALIGN(64) volatile ULONG Head;
+    volatile LONG Sleeping;     // worker found the queue empty and waits for hEvent
+    ULONGLONG     Handled;
+    ULONGLONG     Wakeups;
+} DB_ROUTE_ENT, *PDB_ROUTE_ENT;
+
+typedef struct _DB_DISP {
+    PDB_ROUTE_ENT volatile Route[DB_DISP_MAX_ROUTES];
+    volatile LONG RouteNum;
+    ULONGLONG     Unrouted;
+} DB_DISP;
+
+static unsigned __stdcall db_disp_worker(PVOID params);
+
+DWORD
+tsi721_db_disp_create(
+    PDB_DISP *ppDisp
+    )
+{
+    PDB_DISP pDisp;
+
+    if (ppDisp == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    pDisp = (PDB_DISP)calloc(1, sizeof(DB_DISP));
+    if (pDisp == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    *ppDisp = pDisp;
+    return ERROR_SUCCESS;
+}
+
+static VOID
+db_disp_free_route(
+    PDB_ROUTE_ENT pEnt
+    )
+{
+    if (pEnt->hThread) {
+        pEnt->bStop = TRUE;
+        SetEvent(pEnt->hEvent);
+        WaitForSingleObject(pEnt->hThread, INFINITE);
+        CloseHandle(pEnt->hThread);
+    }
+
+    if (pEnt->hEvent)
+        CloseHandle(pEnt->hEvent);
+    if (pEnt->Ring)
+        free(pEnt->Ring);
+
+    _aligned_free(pEnt);
+}
+
+DWORD
+tsi721_db_disp_add(
+    PDB_DISP  pDisp,
+    PDB_ROUTE pRoute,
+    PDWORD    pdwIndex
+    )
+/*++
+
+Routine Description:
+
+    Registers a route. The route becomes visible to the dispatching thread
+    only after its queue and worker are ready.
+
+Arguments:
+
+    pDisp    - dispatch table
+    pRoute   - route to add
+    pdwIndex - optional route index
+
+Return Value:
+
+    ERROR_SUCCESS or an error code.
+
+--*/
+{
+    PDB_ROUTE_ENT pEnt;
+    DWORD idx, qSize, dwErr;
+
+    if (pDisp == NULL || pRoute == NULL || pRoute->Handler == NULL ||
+        pRoute->InfoMin > pRoute->InfoMax || (pRoute->Flags & ~DB_ROUTE_DEFERRED))
+        return ERROR_INVALID_PARAMETER;
+
+    qSize = pRoute->QueueSize ? pRoute->QueueSize : DB_DISP_DEF_QUEUE;
+    if (qSize & (qSize - 1))
+        return ERROR_INVALID_PARAMETER;
+
+    idx = pDisp->RouteNum;
+    if (idx == DB_DISP_MAX_ROUTES)
+        return ERROR_NO_MORE_ITEMS;
+
+    pEnt = (PDB_ROUTE_ENT)_aligned_malloc(sizeof(DB_ROUTE_ENT), 64);
+    if (pEnt == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    ZeroMemory(pEnt, sizeof(DB_ROUTE_ENT));
+    pEnt->Route = *pRoute;
+    pEnt->Route.QueueSize = qSize;
+
+    if (pRoute->Flags & DB_ROUTE_DEFERRED) {
+        pEnt->Mask = qSize - 1;
+        pEnt->Ring = (PIB_DB_ENTRY)calloc(qSize, sizeof(IB_DB_ENTRY));
+        if (pEnt->Ring == NULL) {
+            dwErr = ERROR_NOT_ENOUGH_MEMORY;
+            goto err_exit;
+        }
+
+        pEnt->hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if (pEnt->hEvent == NULL) {
+            dwErr = GetLastError();
+            goto err_exit;
+        }
+
+        pEnt->hThread = (HANDLE)_beginthreadex(NULL, 0, db_disp_worker, pEnt, 0, NULL);
+        if (pEnt->hThread == NULL) {
+            dwErr = GetLastError();
+            goto err_exit;
+        }
+    }
+
+    // Publish the completed entry before the new count (stores are not
+    // reordered on x86, only the compiler has to be kept from doing so)
+    pDisp->Route[idx] = pEnt;
+    _ReadWriteBarrier();
+    pDisp->RouteNum = idx + 1;
+
+    if (pdwIndex)
+        *pdwIndex = idx;
+
+    return ERROR_SUCCESS;
+
+err_exit:
+
+    db_disp_free_route(pEnt);
+    return dwErr;
+}
+
+VOID
+tsi721_db_dispatch(
+    PVOID        pCtx,
+    PIB_DB_ENTRY pDb,
+    DWORD        dwNum
+    )
+/*++
+
+Routine Description:
+
+    Routes a batch of doorbells. Inline handlers run here; deferred entries
+    are published to their queues and the sleeping workers are woken after
+    the whole batch.
+
+Arguments:
+
+    pCtx  - dispatch table
+    pDb   - received doorbells
+    dwNum - number of doorbells
+
+Return Value:
+
+    NONE
+
+--*/
+{
+    PDB_DISP      pDisp = (PDB_DISP)pCtx;
+    PDB_ROUTE_ENT pEnt;
+    DWORD         routeNum = pDisp->RouteNum;
+    DWORD         pushed = 0, i, r;
+    ULONG         tail;
+
+    _ReadWriteBarrier();
+
+    for (i = 0; i < dwNum; i++) {
+        USHORT info = pDb[i].db.Info;
+
+        for (r = 0; r < routeNum; r++) {
+            pEnt = pDisp->Route[r];
+            if (info >= pEnt->Route.InfoMin && info <= pEnt->Route.InfoMax &&
+                (pEnt->Route.SrcId == DB_SRC_ANY || pEnt->Route.SrcId == pDb[i].db.SrcId))
+                break;
+        }
+
+        if (r == routeNum) {
+            pDisp->Unrouted++;
+            continue;
+        }
+
+        pEnt->Matched++;
+
+        if (!(pEnt->Route.Flags & DB_ROUTE_DEFERRED)) {
+            pEnt->Route.Handler(pEnt->Route.HandlerCtx, &pDb[i]);
+            pEnt->Handled++;
+            continue;
+        }
+
+        tail = pEnt->Tail;
+        if (tail - pEnt->Head > pEnt->Mask) {
+            pEnt->Dropped++;
+            continue;
+        }
+
+        pEnt->Ring[tail & pEnt->Mask] = pDb[i];
+        _ReadWriteBarrier();
+        pEnt->Tail = tail + 1;
+        pushed |= 1u << r;
+    }
+
+    if (pushed == 0)
+        return;
+
+    //
+    // The new Tail values must be visible before the Sleeping flags are
+    // read, otherwise a worker could go to sleep on an entry just queued.
+    //
+    MemoryBarrier();
+
+    for (r = 0; r < routeNum; r++) {
+        pEnt = pDisp->Route[r];
+        if ((pushed & (1u << r)) && pEnt->Sleeping &&
+            InterlockedCompareExchange(&pEnt->Sleeping, 0, 1) == 1)
+            SetEvent(pEnt->hEvent);
+    }
+}
+
+static unsigned __stdcall
+db_disp_worker(
+    PVOID params
+    )
+/*++
+
+Routine Description:
+
+    Worker thread of a deferred route. Drains the queue, then announces
+    that it sleeps and checks the queue once more before waiting, so that
+    an entry queued in between is never missed. Terminates when stop is
+    requested and the queue is empty.
+
+Arguments:
+
+    params - pointer to route entry
+
+Return Value:
+
+    0
+
+--*/
+{
+    PDB_ROUTE_ENT pEnt = (PDB_ROUTE_ENT)params;
+    IB_DB_ENTRY   db;
+    ULONG         head = pEnt->Head;
+
+    for (;;) {
+        while (head != pEnt->Tail) {
+            _ReadWriteBarrier();
+            db = pEnt->Ring[head & pEnt->Mask];
+            _ReadWriteBarrier();
+            pEnt->Head = ++head;
+
+            pEnt->Route.Handler(pEnt->Route.HandlerCtx, &db);
+            pEnt->Handled++;
+        }
+
+        if (pEnt->bStop)
+            break;
+
+        InterlockedExchange(&pEnt->Sleeping, 1);
+        if (head != pEnt->Tail) {
+            InterlockedExchange(&pEnt->Sleeping, 0);
+            continue;
+        }
+
+        WaitForSingleObject(pEnt->hEvent, INFINITE);
+        pEnt->Wakeups++;
+    }
+
+    return 0;
+}
+
+VOID
+tsi721_db_disp_stats(
+    PDB_DISP        pDisp,
+    DWORD           dwIndex,
+    PDB_ROUTE_STATS pStats,
+    PULONGLONG      pUnrouted
+    )
+{
+    PDB_ROUTE_ENT pEnt;
+
+    ZeroMemory(pStats, sizeof(DB_ROUTE_STATS));
+
+    if (dwIndex < (DWORD)pDisp->RouteNum) {
+        pEnt = pDisp->Route[dwIndex];
+        pStats->Matched = pEnt->Matched;
+        pStats->Handled = pEnt->Handled;
+        pStats->Dropped = pEnt->Dropped;
+        pStats->Wakeups = pEnt->Wakeups;
+    }
+
+    if (pUnrouted)
+        *pUnrouted = pDisp->Unrouted;
+}
+
+VOID
+tsi721_db_disp_destroy(
+    PDB_DISP pDisp
+    )
+{
+    LONG r;
+
+    if (pDisp == NULL)
+        return;
+
+    for (r = 0; r < pDisp->RouteNum; r++)
+        db_disp_free_route(pDisp->Route[r]);
+
+    free(pDisp);
+}
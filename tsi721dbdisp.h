@@ -0,0 +1,137 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721dbdisp.h
+
+Description:
+
+    Inbound doorbell dispatch table. Routes every received doorbell by its
+    INFO value and source destID to a registered handler, run either on
+    the receiving thread or on a worker thread of the route.
+
+--*/
+
+#ifndef _TSI721DBDISP_H_
+#define _TSI721DBDISP_H_
+
+#define DB_DISP_MAX_ROUTES  32
+#define DB_DISP_DEF_QUEUE   1024        // entries of a deferred route queue
+#define DB_SRC_ANY          0xffffffff  // route matches every source destID
+
+#define DB_ROUTE_INLINE     0x0000      // handler runs on the receiving thread
+#define DB_ROUTE_DEFERRED   0x0001      // entries are queued to the route's worker thread
+
+//
+// Doorbell event handler, called once per doorbell.
+//
+//  pCtx - HandlerCtx from DB_ROUTE
+//  pDb  - received doorbell (SrcId, DstId, Info)
+//
+typedef VOID (*PFN_DB_EVENT)(PVOID pCtx, PIB_DB_ENTRY pDb);
+
+typedef struct _DB_ROUTE {
+    USHORT       InfoMin;       // INFO range matched by the route (inclusive)
+    USHORT       InfoMax;
+    DWORD        SrcId;         // source destID matched (DB_SRC_ANY = all)
+    DWORD        Flags;         // DB_ROUTE_xxx
+    DWORD        QueueSize;     // deferred queue entries, power of two (0 = DB_DISP_DEF_QUEUE)
+    PFN_DB_EVENT Handler;
+    PVOID        HandlerCtx;
+} DB_ROUTE, *PDB_ROUTE;
+
+typedef struct _DB_ROUTE_STATS {
+    ULONGLONG Matched;          // doorbells routed to the route
+    ULONGLONG Handled;          // handler calls completed
+    ULONGLONG Dropped;          // doorbells lost to a full deferred queue
+    ULONGLONG Wakeups;          // times the worker was woken from an empty queue
+} DB_ROUTE_STATS, *PDB_ROUTE_STATS;
+
+typedef struct _DB_DISP *PDB_DISP;
+
+/*
+ * tsi721_db_disp_create()
+ *
+ *  Creates an empty dispatch table.
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the table was created successfully,
+ *                  otherwise an error code.
+ */
+DWORD tsi721_db_disp_create(__out PDB_DISP *ppDisp);
+
+/*
+ * tsi721_db_disp_add()
+ *
+ *  Registers a route. Routes are matched in registration order and the
+ *  first match wins. A deferred route gets a single-producer/single-
+ *  consumer queue and a worker thread of its own, so a slow handler
+ *  delays neither the receiving thread nor the other routes.
+ *  Routes may be added while doorbells are being dispatched, but only
+ *  from one thread at a time.
+ *
+ * Arguments:
+ *  pDisp    - dispatch table
+ *  pRoute   - route to add
+ *  pdwIndex - optional pointer to variable receiving the route index
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the route was added,
+ *  ERROR_INVALID_PARAMETER - if the route is invalid,
+ *  ERROR_NO_MORE_ITEMS - if the table is full,
+ *                  otherwise an error code.
+ */
+DWORD
+tsi721_db_disp_add(
+    __in      PDB_DISP  pDisp,
+    __in      PDB_ROUTE pRoute,
+    __out_opt PDWORD    pdwIndex
+    );
+
+/*
+ * tsi721_db_dispatch()
+ *
+ *  Routes a batch of received doorbells. Must always be called from the
+ *  same thread (the producer of all deferred queues). A doorbell that
+ *  matches no route is counted and discarded; a doorbell finding its
+ *  deferred queue full is dropped and counted by the route, the caller
+ *  is never blocked.
+ *
+ *  The signature matches PFN_DB_HANDLER (tsi721db.h), so the table can be
+ *  passed directly as the handler of a doorbell receiver.
+ */
+VOID
+tsi721_db_dispatch(
+    __in PVOID        pDisp,
+    __in PIB_DB_ENTRY pDb,
+    __in DWORD        dwNum
+    );
+
+/*
+ * tsi721_db_disp_stats()
+ *
+ *  Returns counters of one route and the number of unrouted doorbells.
+ */
+VOID
+tsi721_db_disp_stats(
+    __in      PDB_DISP        pDisp,
+    __in      DWORD           dwIndex,
+    __out     PDB_ROUTE_STATS pStats,
+    __out_opt PULONGLONG      pUnrouted
+    );
+
+/*
+ * tsi721_db_disp_destroy()
+ *
+ *  Stops the worker threads after their queues are drained and frees the
+ *  table. Dispatching must have stopped before.
+ */
+VOID tsi721_db_disp_destroy(__in PDB_DISP pDisp);
+
+#endif // _TSI721DBDISP_H_
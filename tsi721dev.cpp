@@ -0,0 +1,232 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721dev.cpp
+
+Description:
+
+    Device backend selection and the "hw" backend, which forwards to the
+    Tsi721 API library.
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tsi721api.h"
+#include "tsi721dev.h"
+#include "tsi721emu.h"
+
+#ifdef _WIN32
+
+static DWORD
+hw_bind_port(
+    HANDLE    hDev,
+    HANDLE    hPort,
+    ULONG_PTR Key
+    )
+{
+    if (CreateIoCompletionPort(hDev, hPort, Key, 0) == NULL)
+        return GetLastError();
+
+    return ERROR_SUCCESS;
+}
+
+static DWORD
+hw_cancel_io(
+    HANDLE       hDev,
+    LPOVERLAPPED pOvl
+    )
+{
+    if (!CancelIoEx(hDev, pOvl))
+        return GetLastError();
+
+    return ERROR_SUCCESS;
+}
+
+static DWORD
+hw_ibw_map(
+    HANDLE hDev,
+    DWORD  dwMapNum,
+    PVOID *ppBuffer,
+    PDWORD pdwBufSize
+    )
+{
+    UNREFERENCED_PARAMETER(hDev);
+    UNREFERENCED_PARAMETER(dwMapNum);
+    UNREFERENCED_PARAMETER(ppBuffer);
+    UNREFERENCED_PARAMETER(pdwBufSize);
+
+    // The driver does not map the window's common buffer into user space
+    return ERROR_NOT_SUPPORTED;
+}
+
+//
+// The driver exports neither the P2R window configuration nor a mapping of
+// BAR2/BAR4 (the outbound windows) into user space
+//
+
+static DWORD
+hw_cfg_p2r_win(
+    HANDLE      hDev,
+    DWORD       dwWinNum,
+    PP2R_WINCFG pWinCfg
+    )
+{
+    UNREFERENCED_PARAMETER(hDev);
+    UNREFERENCED_PARAMETER(dwWinNum);
+    UNREFERENCED_PARAMETER(pWinCfg);
+
+    return ERROR_NOT_SUPPORTED;
+}
+
+static DWORD
+hw_cfg_p2r_zone(
+    HANDLE       hDev,
+    DWORD        dwWinNum,
+    DWORD        dwZone,
+    PP2R_ZONECFG pZoneCfg
+    )
+{
+    UNREFERENCED_PARAMETER(hDev);
+    UNREFERENCED_PARAMETER(dwWinNum);
+    UNREFERENCED_PARAMETER(dwZone);
+    UNREFERENCED_PARAMETER(pZoneCfg);
+
+    return ERROR_NOT_SUPPORTED;
+}
+
+static DWORD
+hw_pio(
+    HANDLE hDev,
+    DWORD  dwWinNum,
+    DWORD  dwOffset,
+    PVOID  pBuffer,
+    DWORD  dwSize
+    )
+{
+    UNREFERENCED_PARAMETER(hDev);
+    UNREFERENCED_PARAMETER(dwWinNum);
+    UNREFERENCED_PARAMETER(dwOffset);
+    UNREFERENCED_PARAMETER(pBuffer);
+    UNREFERENCED_PARAMETER(dwSize);
+
+    return ERROR_NOT_SUPPORTED;
+}
+
+static const TSI721_DEV_OPS g_hwOps = {
+    "hw",
+    TSI721DeviceOpen,
+    TSI721DeviceClose,
+    TSI721RegisterRead,
+    TSI721RegisterWrite,
+    TSI721PciCfgRead,
+    TSI721GetLocalHostId,
+    TSI721SetLocalHostId,
+    TSI721SrioMaintRead,
+    TSI721SrioMaintWrite,
+    TSI721SrioWrite,
+    TSI721SrioRead,
+    TSI721CfgR2pWin,
+    TSI721FreeR2pWin,
+    TSI721IbwBufferGet,
+    TSI721IbwBufferPut,
+    hw_ibw_map,
+    hw_cfg_p2r_win,
+    hw_cfg_p2r_zone,
+    hw_pio,
+    hw_pio,
+    TSI721SrioDoorbellSend,
+    TSI721SrioIbDoorbellWait,
+    TSI721SrioDoorbellCheck,
+    TSI721SrioDoorbellGet,
+    TSI721SrioMsgSend,
+    TSI721SrioMsgAddRcvBuffer,
+    TSI721SrioIbMsgDevIdSet,
+    hw_bind_port,
+    hw_cancel_io,
+};
+
+const TSI721_DEV_OPS *g_devOps = &g_hwOps;
+
+#else
+
+const TSI721_DEV_OPS *g_devOps = &g_emuOps;
+
+#endif
+
+DWORD
+tsi721_dev_select(
+    PCSTR pSpec
+    )
+/*++
+
+Routine Description:
+
+    Selects the device backend used by all tools.
+
+Arguments:
+
+    pSpec - "hw" or "emu[:options]", NULL = value of TSI721_DEV
+
+Return Value:
+
+    ERROR_SUCCESS - if the backend was selected, otherwise an error code.
+
+--*/
+{
+    EMU_CFG cfg;
+    DWORD dwErr;
+
+    if (pSpec == NULL) {
+        pSpec = getenv("TSI721_DEV");
+        if (pSpec == NULL)
+            return ERROR_SUCCESS;
+    }
+
+    if (_stricmp(pSpec, "hw") == 0) {
+#ifdef _WIN32
+        g_devOps = &g_hwOps;
+        return ERROR_SUCCESS;
+#else
+        printf_s("Tsi721 driver is not available on this platform, use \"emu\"\n");
+        return ERROR_NOT_SUPPORTED;
+#endif
+    }
+
+    if (_strnicmp(pSpec, "emu", 3) != 0 || (pSpec[3] != '\0' && pSpec[3] != ':')) {
+        printf_s("Unknown device backend \"%s\" (expected hw or emu[:options])\n", pSpec);
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    tsi721_emu_defaults(&cfg);
+    if (pSpec[3] == ':') {
+        dwErr = tsi721_emu_parse(pSpec + 4, &cfg);
+        if (dwErr != ERROR_SUCCESS) {
+            printf_s("Invalid emulator options \"%s\"\n", pSpec + 4);
+            printf_s("   bw=<MB/s>,lat=<ns>,ch=<BDMA channels>,mbox=<mailboxes>,db=<doorbell queue>,win=<KB>\n");
+            return dwErr;
+        }
+    }
+
+    dwErr = tsi721_emu_config(&cfg);
+    if (dwErr != ERROR_SUCCESS) {
+        printf_s("Failed to configure Tsi721 emulator, err = 0x%x\n", dwErr);
+        return dwErr;
+    }
+
+    g_devOps = &g_emuOps;
+
+    printf_s("Using emulated Tsi721 pair: %u MB/s, %u ns round trip, %u BDMA channels, "
+             "%u MBOX, %u doorbells, %u KB window\n", cfg.LinkMBps, cfg.LatencyNs,
+             cfg.DmaChNum, cfg.MboxNum, cfg.DbFifoDepth, cfg.IbWinSize / 1024);
+    return ERROR_SUCCESS;
+}
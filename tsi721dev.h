@@ -0,0 +1,119 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721dev.h
+
+Description:
+
+    Device interface used by the tools in place of direct TSI721xxx() calls.
+    A backend is a table of routines with the signatures of the Tsi721 API:
+    "hw" forwards to the driver (Windows only), "emu" is the in-process
+    Tsi721 pair model (tsi721emu.h).
+
+--*/
+
+#ifndef _TSI721DEV_H_
+#define _TSI721DEV_H_
+
+#define OBWIN_MAX_CHNUM     8   // outbound (P2R) windows
+#define OBWIN_ZONE_NUM      8   // zones of an outbound window, each with its own translation
+
+typedef struct _TSI721_DEV_OPS {
+    PCSTR Name;
+
+    BOOL  (*DeviceOpen)(PHANDLE phDev, ULONG ulDevNum, APP_THREAD_PARAM *pAppThreadParam);
+    DWORD (*DeviceClose)(HANDLE hDev, APP_THREAD_PARAM *pAppThreadParam);
+
+    DWORD (*RegisterRead)(HANDLE hDev, DWORD dwOffset, DWORD dwNum, PDWORD pRegVal);
+    DWORD (*RegisterWrite)(HANDLE hDev, DWORD dwOffset, DWORD dwValue);
+    DWORD (*PciCfgRead)(HANDLE hDev, DWORD dwOffset, PDWORD pRegVal);
+    DWORD (*GetLocalHostId)(HANDLE hDev, PDWORD pdwHostId);
+    DWORD (*SetLocalHostId)(HANDLE hDev, DWORD dwHostId);
+
+    DWORD (*SrioMaintRead)(HANDLE hDev, DWORD dwDestId, DWORD dwHopCnt, DWORD dwOffset, PDWORD pData);
+    DWORD (*SrioMaintWrite)(HANDLE hDev, DWORD dwDestId, DWORD dwHopCnt, DWORD dwOffset, DWORD dwValue);
+
+    DWORD (*SrioWrite)(HANDLE hDev, DWORD dwDestId, DWORD dwAddrHi, DWORD dwAddrLo,
+                       PVOID pBuffer, PDWORD pdwBufSize, DMA_REQ_CTRL dwCtrl);
+    DWORD (*SrioRead)(HANDLE hDev, DWORD dwDestId, DWORD dwAddrHi, DWORD dwAddrLo,
+                      PVOID pBuffer, PDWORD pdwBufSize, DMA_REQ_CTRL dwCtrl);
+
+    DWORD (*CfgR2pWin)(HANDLE hDev, DWORD bWinNum, PR2P_WINCFG pWinCfg);
+    DWORD (*FreeR2pWin)(HANDLE hDev, DWORD bWinNum);
+    DWORD (*IbwBufferGet)(HANDLE hDev, DWORD dwMapNum, DWORD dwOffset, PVOID pBuffer, PDWORD pdwBufSize);
+    DWORD (*IbwBufferPut)(HANDLE hDev, DWORD dwMapNum, DWORD dwOffset, PVOID pBuffer, PDWORD pdwBufSize);
+
+    //
+    // IbwBufferMap() returns a directly readable view of the buffer behind an
+    // inbound window, valid until the window is freed or configured again.
+    // ERROR_NOT_SUPPORTED means the buffer is only reachable through
+    // IbwBufferGet()/IbwBufferPut().
+    //
+    DWORD (*IbwBufferMap)(HANDLE hDev, DWORD dwMapNum, PVOID *ppBuffer, PDWORD pdwBufSize);
+
+    //
+    // Outbound windows: CfgP2rWin() sets up window dwWinNum, CfgP2rZone()
+    // the destination of one of its OBWIN_ZONE_NUM zones (Size / 8 bytes
+    // each). PioWrite()/PioRead() are CPU stores/loads at a window offset,
+    // every store or load becoming an SRIO request of the zone; a range
+    // must not span zones. ERROR_NOT_SUPPORTED means the backend has no
+    // outbound windows.
+    //
+    DWORD (*CfgP2rWin)(HANDLE hDev, DWORD dwWinNum, PP2R_WINCFG pWinCfg);
+    DWORD (*CfgP2rZone)(HANDLE hDev, DWORD dwWinNum, DWORD dwZone, PP2R_ZONECFG pZoneCfg);
+    DWORD (*PioWrite)(HANDLE hDev, DWORD dwWinNum, DWORD dwOffset, PVOID pBuffer, DWORD dwSize);
+    DWORD (*PioRead)(HANDLE hDev, DWORD dwWinNum, DWORD dwOffset, PVOID pBuffer, DWORD dwSize);
+
+    DWORD (*SrioDoorbellSend)(HANDLE hDev, DWORD dwDestId, DWORD dwInfo);
+    DWORD (*SrioIbDoorbellWait)(HANDLE hDev, PVOID pDbBuf, DWORD dwBufSize,
+                                LPDWORD lpBytesReturned, LPOVERLAPPED lpOvl);
+    DWORD (*SrioDoorbellCheck)(HANDLE hDev, PDWORD pDbNum);
+    DWORD (*SrioDoorbellGet)(HANDLE hDev, PVOID pIbDbBuf, PDWORD pBufSize);
+
+    DWORD (*SrioMsgSend)(HANDLE hDev, DWORD dwMbox, DWORD dwDestId, PVOID pBuffer,
+                         PDWORD pdwBufSize, LPOVERLAPPED lpOvl);
+    DWORD (*SrioMsgAddRcvBuffer)(HANDLE hDev, DWORD dwMbox, PVOID pBuffer,
+                                 PDWORD pdwBufSize, LPOVERLAPPED lpOvl);
+    DWORD (*SrioIbMsgDevIdSet)(HANDLE hDev, DWORD dwIbMsgDevId);
+
+    //
+    // Asynchronous requests of a device handle: BindPort() associates the
+    // handle with an I/O completion port (as CreateIoCompletionPort() does
+    // for a file handle), CancelIo() cancels one request of the handle or,
+    // with pOvl == NULL, all of them.
+    //
+    DWORD (*BindPort)(HANDLE hDev, HANDLE hPort, ULONG_PTR Key);
+    DWORD (*CancelIo)(HANDLE hDev, LPOVERLAPPED pOvl);
+} TSI721_DEV_OPS, *PTSI721_DEV_OPS;
+
+//
+// Backend used by all tools. Defaults to "hw" on Windows and to "emu"
+// elsewhere until tsi721_dev_select() is called.
+//
+extern const TSI721_DEV_OPS *g_devOps;
+
+/*
+ * tsi721_dev_select()
+ *
+ *  Selects the device backend.
+ *
+ * Arguments:
+ *  pSpec - "hw" or "emu[:option=value,...]" (see tsi721_emu_parse() for the
+ *          options); NULL takes the value of the TSI721_DEV environment
+ *          variable and keeps the default backend if it is not set
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the backend was selected,
+ *  ERROR_NOT_SUPPORTED - if the backend is not available on this platform,
+ *  ERROR_INVALID_PARAMETER - if the specification is invalid.
+ */
+DWORD tsi721_dev_select(__in_opt PCSTR pSpec);
+
+#endif // _TSI721DEV_H_
@@ -0,0 +1,673 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721dma.cpp
+
+Description:
+
+    Asynchronous multi-channel BDMA transfer engine.
+
+    TSI721SrioWrite() and TSI721SrioRead() block the calling thread until the
+    transfer is done, so one thread keeps at most one BDMA request in flight.
+    The engine runs a service thread (lane) for every free BDMA channel in the
+    DMA_CFG channel map. Each lane owns a bounded request queue, submitted
+    requests are spread to the least loaded lane and completions are posted
+    to an I/O completion port from which they are reaped in batches.
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <process.h>
+
+#include "tsi721api.h"
+#include "tsi721dev.h"
+#include "tsi721dma.h"
+#include "tsi721trace.h"
+#include "tsi721stat.h"
+#include "tsi721pio.h"
+
+typedef struct _DMA_LANE {
+    struct _DMA_ENGINE *Eng;
+    DWORD              ChNum;       // BDMA channel served by this lane
+    HANDLE             hThread;
+    CRITICAL_SECTION   Lock;
+    CONDITION_VARIABLE NotEmpty;
+    PDMA_REQ          *Ring;        // QueueDepth entries
+    DWORD              Head;        // next request to service
+    DWORD              Count;       // requests waiting in the ring
+    volatile LONG      Pending;     // queued + in service
+} DMA_LANE, *PDMA_LANE;
+
+typedef struct _DMA_ENGINE {
+    HANDLE        hDev;
+    DMA_ENG_OPS   Ops;
+    PPIO_MAP      pPio;         // small transfers of tsi721_dma_xfer(), NULL = none
+    DWORD         QueueDepth;
+    DWORD         LaneNum;
+    DMA_LANE      Lane[DMA_MAX_CHNUM];
+    HANDLE        hCompletionPort;
+    volatile BOOL bStop;
+    volatile LONG Outstanding;
+    volatile LONG NextLane;
+    CRITICAL_SECTION   SpaceLock;
+    CONDITION_VARIABLE SpaceFree;   // a lane queue has room
+    volatile LONG      SpaceWaiters;
+} DMA_ENGINE;
+
+static unsigned __stdcall dma_lane_thread(PVOID params);
+
+DWORD
+tsi721_dma_create(
+    HANDLE       hDev,
+    PDMA_CFG     pCfg,
+    DWORD        dwQueueDepth,
+    PDMA_ENG_OPS pOps,
+    PDMA_ENGINE *ppEng
+    )
+/*++
+
+Routine Description:
+
+    Allocates an engine and starts one service thread per free BDMA channel.
+
+Arguments:
+
+    hDev         - device handle
+    pCfg         - BDMA channel map (NULL = all channels except maintenance)
+    dwQueueDepth - number of requests queued per channel
+    pOps         - data transfer routines (NULL = device backend)
+    ppEng        - pointer to variable to save the created engine
+
+Return Value:
+
+    ERROR_SUCCESS or an error code.
+
+--*/
+{
+    PDMA_ENGINE pEng;
+    DWORD dwStart, dwTotal, dwMap;
+    DWORD ch, i, dwErr;
+
+    if (ppEng == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    *ppEng = NULL;
+
+    if (dwQueueDepth == 0)
+        dwQueueDepth = DMA_ENG_DEF_DEPTH;
+    if (dwQueueDepth > DMA_ENG_MAX_DEPTH)
+        return ERROR_INVALID_PARAMETER;
+
+    if (pCfg) {
+        dwStart = pCfg->StartChNum;
+        dwTotal = pCfg->TotalChNum;
+        dwMap = pCfg->ChMap;
+    } else {
+        dwStart = 0;
+        dwTotal = DMA_MAX_CHNUM;
+        dwMap = (1 << DMA_MAX_CHNUM) - 1;
+    }
+
+    pEng = (PDMA_ENGINE)malloc(sizeof(DMA_ENGINE));
+    if (pEng == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    ZeroMemory(pEng, sizeof(DMA_ENGINE));
+    pEng->hDev = hDev;
+    pEng->QueueDepth = dwQueueDepth;
+    InitializeCriticalSection(&pEng->SpaceLock);
+    InitializeConditionVariable(&pEng->SpaceFree);
+
+    if (pOps) {
+        pEng->Ops = *pOps;
+    } else {
+        pEng->Ops.Write = g_devOps->SrioWrite;
+        pEng->Ops.Read = g_devOps->SrioRead;
+    }
+
+    pEng->hCompletionPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+    if (pEng->hCompletionPort == NULL) {
+        dwErr = GetLastError();
+        free(pEng);
+        return dwErr;
+    }
+
+    //
+    // Build lanes for free channels (1 - free, 0 - reserved)
+    //
+    for (ch = dwStart; ch < dwStart + dwTotal && ch < DMA_MAX_CHNUM; ch++) {
+        PDMA_LANE pLane;
+
+        if (ch == TSI721_BDMA_MAINT_CH || !(dwMap & (1 << ch)))
+            continue;
+
+        pLane = &pEng->Lane[pEng->LaneNum];
+        pLane->Eng = pEng;
+        pLane->ChNum = ch;
+        pLane->Ring = (PDMA_REQ *)malloc(dwQueueDepth * sizeof(PDMA_REQ));
+        if (pLane->Ring == NULL) {
+            dwErr = ERROR_NOT_ENOUGH_MEMORY;
+            goto err_exit;
+        }
+
+        InitializeCriticalSection(&pLane->Lock);
+        InitializeConditionVariable(&pLane->NotEmpty);
+        pEng->LaneNum++;
+    }
+
+    if (pEng->LaneNum == 0) {
+        dwErr = ERROR_INVALID_PARAMETER;
+        goto err_exit;
+    }
+
+    for (i = 0; i < pEng->LaneNum; i++) {
+        pEng->Lane[i].hThread = (HANDLE)_beginthreadex(NULL, 0, dma_lane_thread,
+                                                       &pEng->Lane[i], 0, NULL);
+        if (pEng->Lane[i].hThread == NULL) {
+            dwErr = GetLastError();
+            goto err_exit;
+        }
+    }
+
+    *ppEng = pEng;
+    return ERROR_SUCCESS;
+
+err_exit:
+
+    tsi721_dma_destroy(pEng);
+    return dwErr;
+}
+
+VOID
+tsi721_dma_destroy(
+    PDMA_ENGINE pEng
+    )
+{
+    DWORD i;
+
+    if (pEng == NULL)
+        return;
+
+    pEng->bStop = TRUE;
+
+    for (i = 0; i < pEng->LaneNum; i++) {
+        PDMA_LANE pLane = &pEng->Lane[i];
+
+        EnterCriticalSection(&pLane->Lock);
+        WakeAllConditionVariable(&pLane->NotEmpty);
+        LeaveCriticalSection(&pLane->Lock);
+    }
+
+    for (i = 0; i < pEng->LaneNum; i++) {
+        PDMA_LANE pLane = &pEng->Lane[i];
+
+        if (pLane->hThread) {
+            WaitForSingleObject(pLane->hThread, INFINITE);
+            CloseHandle(pLane->hThread);
+        }
+
+        DeleteCriticalSection(&pLane->Lock);
+        free(pLane->Ring);
+    }
+
+    if (pEng->hCompletionPort)
+        CloseHandle(pEng->hCompletionPort);
+
+    DeleteCriticalSection(&pEng->SpaceLock);
+    free(pEng);
+}
+
+static DWORD
+dma_submit_to(
+    PDMA_ENGINE pEng,
+    PDMA_REQ    pReq,
+    HANDLE      hPort
+    )
+/*++
+
+Routine Description:
+
+    Places a request into the queue of the least loaded lane. Lanes are
+    scanned starting from a rotating index so equally loaded channels
+    receive requests in turn.
+
+Arguments:
+
+    pEng  - engine
+    pReq  - request descriptor
+    hPort - completion port the request is posted to
+
+Return Value:
+
+    ERROR_IO_PENDING, ERROR_BUSY or ERROR_INVALID_PARAMETER.
+
+--*/
+{
+    DWORD i, start, best;
+    LONG  bestLoad;
+
+    if (pEng == NULL || pReq == NULL || pReq->Buffer == NULL || pReq->Size == 0)
+        return ERROR_INVALID_PARAMETER;
+
+    if (pReq->Dir != DMA_DIR_WRITE && pReq->Dir != DMA_DIR_READ)
+        return ERROR_INVALID_PARAMETER;
+
+    ZeroMemory(&pReq->Ovl, sizeof(pReq->Ovl));
+    pReq->hPort = hPort;
+    pReq->Status = ERROR_IO_PENDING;
+    pReq->SubmitTicks = tsi721_trace_on() ? lat_ticks() : 0;
+
+    start = (DWORD)InterlockedIncrement(&pEng->NextLane);
+
+    for (;;) {
+        PDMA_LANE pLane;
+
+        best = pEng->LaneNum;
+        bestLoad = (LONG)pEng->QueueDepth;
+
+        for (i = 0; i < pEng->LaneNum; i++) {
+            DWORD n = (start + i) % pEng->LaneNum;
+            LONG  load = pEng->Lane[n].Pending;
+
+            if (load < bestLoad) {
+                bestLoad = load;
+                best = n;
+                if (load == 0)
+                    break;
+            }
+        }
+
+        if (best == pEng->LaneNum)
+            return ERROR_BUSY;
+
+        pLane = &pEng->Lane[best];
+
+        EnterCriticalSection(&pLane->Lock);
+
+        // Re-check under the lock, another submitter may have taken the slot
+        if (pLane->Pending < (LONG)pEng->QueueDepth) {
+            pLane->Ring[(pLane->Head + pLane->Count) % pEng->QueueDepth] = pReq;
+            pLane->Count++;
+            InterlockedIncrement(&pLane->Pending);
+            InterlockedIncrement(&pEng->Outstanding);
+            WakeConditionVariable(&pLane->NotEmpty);
+            LeaveCriticalSection(&pLane->Lock);
+            tsi721_trace(TRACE_EV_DMA_SUBMIT, 0, pReq->Dir, pReq->Size, (ULONG_PTR)pReq, 0);
+            return ERROR_IO_PENDING;
+        }
+
+        LeaveCriticalSection(&pLane->Lock);
+    }
+}
+
+DWORD
+tsi721_dma_submit(
+    PDMA_ENGINE pEng,
+    PDMA_REQ    pReq
+    )
+{
+    if (pEng == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    return dma_submit_to(pEng, pReq, pEng->hCompletionPort);
+}
+
+static VOID
+dma_wait_space(
+    PDMA_ENGINE pEng
+    )
+/*++
+
+Routine Description:
+
+    Waits until a lane queue has room. A lane finishing a request wakes the
+    waiters only when there are some; both sides change their own counter
+    with an interlocked operation before reading the other's, so one of
+    them always sees the other.
+
+--*/
+{
+    DWORD i;
+    BOOL  bFull = TRUE;
+
+    EnterCriticalSection(&pEng->SpaceLock);
+    InterlockedIncrement(&pEng->SpaceWaiters);
+
+    while (bFull && !pEng->bStop) {
+        for (i = 0; i < pEng->LaneNum && bFull; i++)
+            bFull = (pEng->Lane[i].Pending >= (LONG)pEng->QueueDepth);
+        if (bFull)
+            SleepConditionVariableCS(&pEng->SpaceFree, &pEng->SpaceLock, INFINITE);
+    }
+
+    InterlockedDecrement(&pEng->SpaceWaiters);
+    LeaveCriticalSection(&pEng->SpaceLock);
+}
+
+static DWORD
+dma_reap(
+    PDMA_ENGINE pEng,
+    HANDLE      hPort,
+    PDMA_REQ   *ppReqs,
+    DWORD       dwMax,
+    DWORD       dwTimeout,
+    PDWORD      pdwCount
+    )
+{
+    OVERLAPPED_ENTRY entry[DMA_ENG_MAX_BATCH];
+    ULONG ulNum = 0;
+    ULONG i;
+    DWORD dwErr;
+
+    *pdwCount = 0;
+
+    if (dwMax > DMA_ENG_MAX_BATCH)
+        dwMax = DMA_ENG_MAX_BATCH;
+
+    if (!GetQueuedCompletionStatusEx(hPort, entry, dwMax, &ulNum, dwTimeout, FALSE)) {
+        dwErr = GetLastError();
+        return (dwErr == WAIT_TIMEOUT) ? ERROR_TIMEOUT : dwErr;
+    }
+
+    for (i = 0; i < ulNum; i++)
+        ppReqs[i] = CONTAINING_RECORD(entry[i].lpOverlapped, DMA_REQ, Ovl);
+
+    InterlockedExchangeAdd(&pEng->Outstanding, -(LONG)ulNum);
+    *pdwCount = ulNum;
+
+    return ERROR_SUCCESS;
+}
+
+DWORD
+tsi721_dma_complete(
+    PDMA_ENGINE pEng,
+    PDMA_REQ   *ppReqs,
+    DWORD       dwMax,
+    DWORD       dwTimeout,
+    PDWORD      pdwCount
+    )
+/*++
+
+Routine Description:
+
+    Reaps a batch of completed requests from the engine's completion port.
+
+Arguments:
+
+    pEng      - engine
+    ppReqs    - array receiving pointers to completed requests
+    dwMax     - size of the array
+    dwTimeout - wait timeout in milliseconds
+    pdwCount  - number of returned requests
+
+Return Value:
+
+    ERROR_SUCCESS, ERROR_TIMEOUT or value returned by GetLastError().
+
+--*/
+{
+    if (pEng == NULL || ppReqs == NULL || pdwCount == NULL || dwMax == 0)
+        return ERROR_INVALID_PARAMETER;
+
+    return dma_reap(pEng, pEng->hCompletionPort, ppReqs, dwMax, dwTimeout, pdwCount);
+}
+
+DWORD
+tsi721_dma_xfer(
+    PDMA_ENGINE  pEng,
+    DWORD        dwDir,
+    DWORD        dwDestId,
+    DWORD        dwAddrHi,
+    DWORD        dwAddrLo,
+    PVOID        pBuffer,
+    DWORD        dwSize,
+    DWORD        dwChunk,
+    DMA_REQ_CTRL dmaCtrl
+    )
+/*++
+
+Routine Description:
+
+    Transfers a buffer as a series of dwChunk sized requests keeping up to
+    (channels x queue depth) requests in flight. Request descriptors are
+    recycled as soon as they complete. The requests complete to a port of
+    this call, so completions of other engine users are never taken here.
+
+Arguments:
+
+    pEng     - engine
+    dwDir    - DMA_DIR_WRITE or DMA_DIR_READ
+    dwDestId - destID of target SRIO device
+    dwAddrHi - bits 63:32 of SRIO starting address
+    dwAddrLo - bits 31:00 of SRIO starting address
+    pBuffer  - data buffer
+    dwSize   - number of bytes to transfer
+    dwChunk  - size of a single request (0 = whole buffer in one request)
+    dmaCtrl  - DMA request specific control word
+
+Return Value:
+
+    ERROR_SUCCESS or status of the first failed request.
+
+--*/
+{
+    PDMA_REQ  pReqs;
+    PDMA_REQ *pFree;
+    PDMA_REQ  done[DMA_ENG_MAX_BATCH];
+    HANDLE    hPort;
+    DWORD     dwSlots, dwFree;
+    DWORD     dwOffset = 0, dwInFlight = 0;
+    DWORD     dwCount, i, dwErr, dwStatus = ERROR_SUCCESS;
+
+    if (pEng == NULL || pBuffer == NULL || dwSize == 0)
+        return ERROR_INVALID_PARAMETER;
+
+    // Below the calibrated threshold CPU stores/loads beat a BDMA request
+    if (pEng->pPio != NULL) {
+        dwErr = tsi721_pio_xfer(pEng->pPio, dwDir, dwDestId, dwAddrHi, dwAddrLo, pBuffer, dwSize, dmaCtrl);
+        if (dwErr != ERROR_NOT_SUPPORTED)
+            return dwErr;
+    }
+
+    if (dwChunk == 0 || dwChunk > dwSize)
+        dwChunk = dwSize;
+
+    dwSlots = pEng->LaneNum * pEng->QueueDepth;
+
+    pReqs = (PDMA_REQ)malloc(dwSlots * sizeof(DMA_REQ));
+    pFree = (PDMA_REQ *)malloc(dwSlots * sizeof(PDMA_REQ));
+    if (pReqs == NULL || pFree == NULL) {
+        free(pReqs);
+        free(pFree);
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    hPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    if (hPort == NULL) {
+        dwErr = GetLastError();
+        free(pFree);
+        free(pReqs);
+        return dwErr;
+    }
+
+    for (i = 0; i < dwSlots; i++)
+        pFree[i] = &pReqs[i];
+    dwFree = dwSlots;
+
+    while (dwOffset < dwSize || dwInFlight) {
+
+        //
+        // Keep the queues full while there is data left and no error
+        //
+        while (dwOffset < dwSize && dwFree && dwStatus == ERROR_SUCCESS) {
+            PDMA_REQ  pReq = pFree[dwFree - 1];
+            DWORD     dwLen = min(dwChunk, dwSize - dwOffset);
+            ULONGLONG addr = (((ULONGLONG)dwAddrHi << 32) | dwAddrLo) + dwOffset;
+
+            pReq->Dir = dwDir;
+            pReq->DestId = dwDestId;
+            pReq->AddrHi = (DWORD)(addr >> 32);
+            pReq->AddrLo = (DWORD)addr;
+            pReq->Buffer = (PUCHAR)pBuffer + dwOffset;
+            pReq->Size = dwLen;
+            pReq->Ctrl = dmaCtrl;
+            pReq->Context = dwOffset;
+
+            dwErr = dma_submit_to(pEng, pReq, hPort);
+            if (dwErr == ERROR_BUSY) {
+                // Other users hold every queue slot: nothing of ours will
+                // complete to make room, wait for theirs
+                if (dwInFlight == 0) {
+                    dma_wait_space(pEng);
+                    continue;
+                }
+                break;
+            }
+            if (dwErr != ERROR_IO_PENDING) {
+                dwStatus = dwErr;
+                break;
+            }
+
+            dwFree--;
+            dwInFlight++;
+            dwOffset += dwLen;
+        }
+
+        if (dwStatus != ERROR_SUCCESS)
+            dwOffset = dwSize; // stop issuing, drain what is in flight
+
+        if (dwInFlight == 0)
+            break;
+
+        dwErr = dma_reap(pEng, hPort, done, DMA_ENG_MAX_BATCH, INFINITE, &dwCount);
+        if (dwErr != ERROR_SUCCESS) {
+            dwStatus = dwErr;
+            break;
+        }
+
+        for (i = 0; i < dwCount; i++) {
+            if (done[i]->Status != ERROR_SUCCESS && dwStatus == ERROR_SUCCESS)
+                dwStatus = done[i]->Status;
+            pFree[dwFree++] = done[i];
+        }
+        dwInFlight -= dwCount;
+    }
+
+    CloseHandle(hPort);
+    free(pFree);
+    free(pReqs);
+
+    return dwStatus;
+}
+
+VOID
+tsi721_dma_set_pio(
+    PDMA_ENGINE pEng,
+    PPIO_MAP    pPio
+    )
+{
+    pEng->pPio = pPio;
+}
+
+DWORD
+tsi721_dma_channels(
+    PDMA_ENGINE pEng
+    )
+{
+    return pEng->LaneNum;
+}
+
+DWORD
+tsi721_dma_depth(
+    PDMA_ENGINE pEng
+    )
+{
+    return pEng->QueueDepth;
+}
+
+DWORD
+tsi721_dma_outstanding(
+    PDMA_ENGINE pEng
+    )
+{
+    return (DWORD)pEng->Outstanding;
+}
+
+static unsigned __stdcall
+dma_lane_thread(
+    PVOID params
+    )
+/*++
+
+Routine Description:
+
+    Lane service thread. Takes requests from the lane queue in order, issues
+    the blocking API call and posts the finished request to the completion port.
+
+Arguments:
+
+    params - pointer to lane structure
+
+Return Value:
+
+    0
+
+--*/
+{
+    PDMA_LANE   pLane = (PDMA_LANE)params;
+    PDMA_ENGINE pEng = pLane->Eng;
+    PDMA_REQ    pReq;
+
+    for (;;) {
+        EnterCriticalSection(&pLane->Lock);
+
+        while (pLane->Count == 0 && !pEng->bStop)
+            SleepConditionVariableCS(&pLane->NotEmpty, &pLane->Lock, INFINITE);
+
+        if (pLane->Count == 0) {
+            LeaveCriticalSection(&pLane->Lock);
+            break;
+        }
+
+        pReq = pLane->Ring[pLane->Head];
+        pLane->Head = (pLane->Head + 1) % pEng->QueueDepth;
+        pLane->Count--;
+
+        LeaveCriticalSection(&pLane->Lock);
+
+        pReq->ChNum = pLane->ChNum;
+
+        if (pReq->Dir == DMA_DIR_WRITE)
+            pReq->Status = pEng->Ops.Write(pEng->hDev, pReq->DestId, pReq->AddrHi,
+                                           pReq->AddrLo, pReq->Buffer, &pReq->Size,
+                                           pReq->Ctrl);
+        else
+            pReq->Status = pEng->Ops.Read(pEng->hDev, pReq->DestId, pReq->AddrHi,
+                                          pReq->AddrLo, pReq->Buffer, &pReq->Size,
+                                          pReq->Ctrl);
+
+        tsi721_trace(TRACE_EV_DMA_COMPLETE, pReq->Status, pLane->ChNum, pReq->Size,
+                     (ULONG_PTR)pReq, pReq->SubmitTicks);
+
+        // Post before the slot is released: a waiter for lane space may
+        // own the port and close it as soon as its last request is reaped
+        PostQueuedCompletionStatus(pReq->hPort, pReq->Size, pLane->ChNum, &pReq->Ovl);
+        InterlockedDecrement(&pLane->Pending);
+
+        if (pEng->SpaceWaiters) {
+            EnterCriticalSection(&pEng->SpaceLock);
+            WakeAllConditionVariable(&pEng->SpaceFree);
+            LeaveCriticalSection(&pEng->SpaceLock);
+        }
+    }
+
+    return 0;
+}
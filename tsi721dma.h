@@ -0,0 +1,192 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721dma.h
+
+Description:
+
+    Asynchronous multi-channel BDMA transfer engine built on top of blocking
+    SrioWrite()/SrioRead() calls of the device backend (g_devOps).
+
+--*/
+
+#ifndef _TSI721DMA_H_
+#define _TSI721DMA_H_
+
+#define DMA_ENG_DEF_DEPTH   4   // default number of requests queued per BDMA channel
+#define DMA_ENG_MAX_DEPTH   64  // maximum number of requests queued per BDMA channel
+#define DMA_ENG_MAX_BATCH   64  // maximum number of completions reported by one call
+
+#define DMA_DIR_WRITE       TSI721_WRITE_TYPE
+#define DMA_DIR_READ        TSI721_READ_TYPE
+
+//
+// Signature shared by TSI721SrioWrite() and TSI721SrioRead(). The engine calls
+// the data transfer routines through a table of this type so a software model
+// of the API can be substituted for the real driver.
+//
+typedef DWORD (*PFN_DMA_XFER)(HANDLE, DWORD, DWORD, DWORD, PVOID, PDWORD, DMA_REQ_CTRL);
+
+typedef struct _DMA_ENG_OPS {
+    PFN_DMA_XFER Write;     // defaults to g_devOps->SrioWrite
+    PFN_DMA_XFER Read;      // defaults to g_devOps->SrioRead
+} DMA_ENG_OPS, *PDMA_ENG_OPS;
+
+//
+// Transfer request descriptor. Owned by the caller, it must stay valid from
+// tsi721_dma_submit() until it is returned by tsi721_dma_complete().
+//
+typedef struct _DMA_REQ {
+    OVERLAPPED   Ovl;       // completion link (used by the engine)
+    DWORD        Dir;       // DMA_DIR_WRITE or DMA_DIR_READ
+    DWORD        DestId;    // destID of target SRIO device
+    DWORD        AddrHi;    // bits 63:32 of SRIO address
+    DWORD        AddrLo;    // bits 31:00 of SRIO address
+    PVOID        Buffer;    // source (write) or destination (read) buffer
+    DWORD        Size;      // requested size, updated with bytes transferred
+    DMA_REQ_CTRL Ctrl;      // DMA request specific control word
+    DWORD        Status;    // ERROR_SUCCESS or error returned by the API
+    DWORD        ChNum;     // BDMA channel which serviced the request
+    ULONG_PTR    Context;   // caller's cookie
+    ULONGLONG    SubmitTicks; // submission time stamp (used by the engine for tracing)
+    HANDLE       hPort;     // completion port of the request (used by the engine)
+} DMA_REQ, *PDMA_REQ;
+
+typedef struct _DMA_ENGINE *PDMA_ENGINE;
+
+/*
+ * tsi721_dma_create()
+ *
+ *  Creates a transfer engine with one service lane for every free BDMA channel
+ *  in the channel map. The channel reserved for maintenance requests
+ *  (TSI721_BDMA_MAINT_CH) is never used.
+ *
+ * Arguments:
+ *  hDev         - device handle
+ *  pCfg         - BDMA channel map (NULL = all channels except the maintenance one)
+ *  dwQueueDepth - number of requests queued per channel (0 = DMA_ENG_DEF_DEPTH)
+ *  pOps         - data transfer routines (NULL = SrioWrite/SrioRead of the device backend)
+ *  ppEng        - pointer to variable to save the created engine
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the engine was created successfully,
+ *                  otherwise an error code.
+ */
+DWORD
+tsi721_dma_create(
+    __in  HANDLE       hDev,
+    __in  PDMA_CFG     pCfg,
+    __in  DWORD        dwQueueDepth,
+    __in  PDMA_ENG_OPS pOps,
+    __out PDMA_ENGINE *ppEng
+    );
+
+/*
+ * tsi721_dma_destroy()
+ *
+ *  Stops channel service threads and frees the engine. A caller is expected
+ *  to reap all outstanding requests first.
+ */
+VOID
+tsi721_dma_destroy(
+    __in PDMA_ENGINE pEng
+    );
+
+/*
+ * tsi721_dma_submit()
+ *
+ *  Queues a request on the least loaded channel. Submitted requests complete
+ *  to one port per engine, so only one caller at a time may use
+ *  tsi721_dma_submit()/tsi721_dma_complete(). tsi721_dma_xfer() reaps its
+ *  requests privately and may run alongside that caller and other
+ *  tsi721_dma_xfer() calls.
+ *
+ * Return Value:
+ *  ERROR_IO_PENDING - request was queued, completion is reported by tsi721_dma_complete()
+ *  ERROR_BUSY       - queues of all channels are full, reap completions and retry
+ *  ERROR_INVALID_PARAMETER - if one of the input parameters is invalid
+ */
+DWORD
+tsi721_dma_submit(
+    __in PDMA_ENGINE pEng,
+    __in PDMA_REQ    pReq
+    );
+
+/*
+ * tsi721_dma_complete()
+ *
+ *  Waits for completed requests and returns them in a batch.
+ *
+ * Arguments:
+ *  pEng      - engine
+ *  ppReqs    - array receiving pointers to completed requests
+ *  dwMax     - size of the array (up to DMA_ENG_MAX_BATCH is used)
+ *  dwTimeout - wait timeout in milliseconds (INFINITE is allowed)
+ *  pdwCount  - number of returned requests
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - at least one request was returned,
+ *  ERROR_TIMEOUT - nothing completed within the timeout,
+ *                  otherwise value returned by GetLastError().
+ */
+DWORD
+tsi721_dma_complete(
+    __in  PDMA_ENGINE pEng,
+    __out PDMA_REQ   *ppReqs,
+    __in  DWORD       dwMax,
+    __in  DWORD       dwTimeout,
+    __out PDWORD      pdwCount
+    );
+
+/*
+ * tsi721_dma_xfer()
+ *
+ *  Synchronous helper: splits a buffer into dwChunk sized requests, keeps all
+ *  channels busy and returns when the whole buffer is transferred. The
+ *  requests complete to a port of the call, so any number of threads may
+ *  transfer through one engine; while other users fill every channel queue
+ *  the call waits for room.
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if all requests completed successfully,
+ *                  otherwise status of the first failed request.
+ */
+DWORD
+tsi721_dma_xfer(
+    __in PDMA_ENGINE  pEng,
+    __in DWORD        dwDir,
+    __in DWORD        dwDestId,
+    __in DWORD        dwAddrHi,
+    __in DWORD        dwAddrLo,
+    __in PVOID        pBuffer,
+    __in DWORD        dwSize,
+    __in DWORD        dwChunk,
+    __in DMA_REQ_CTRL dmaCtrl
+    );
+
+/*
+ * tsi721_dma_set_pio()
+ *
+ *  Lets tsi721_dma_xfer() do transfers eligible for PIO (see
+ *  tsi721_pio_xfer()) through an outbound window mapping instead of BDMA.
+ *  The mapping must outlive the engine or be detached with pPio = NULL.
+ *  Requests queued by tsi721_dma_submit() always use BDMA.
+ */
+VOID
+tsi721_dma_set_pio(
+    __in PDMA_ENGINE      pEng,
+    __in struct _PIO_MAP *pPio
+    );
+
+DWORD tsi721_dma_channels(__in PDMA_ENGINE pEng);
+DWORD tsi721_dma_depth(__in PDMA_ENGINE pEng);
+DWORD tsi721_dma_outstanding(__in PDMA_ENGINE pEng);
+
+#endif // _TSI721DMA_H_
@@ -0,0 +1,1886 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721emu.cpp
+
+Description:
+
+    Software model of a Tsi721 pair. Device 0 and device 1 live in the
+    calling process and are each other's link partner; every open returns a
+    new handle to the shared device state, as the driver does.
+
+    Modelled per device: the SRIO CSR space (link state follows RIO_SP_CTL
+    and the baud rates enabled in RIO_SP_CTL2 on both ends), inbound windows
+    backed by memory, outbound windows whose zones map onto the partner's
+    inbound windows, the inbound doorbell queue and the inbound mailboxes
+    fed by posted receive buffers.
+
+    Timing: each link direction is busy until a "busy-until" time, so
+    transfers sharing a direction are serialized at the link bandwidth while
+    the round trip latency overlaps. BDMA calls block for the modelled
+    duration, limited to DmaChNum concurrent transfers per device. Message
+    sends are asynchronous and driven by a timer thread which delivers the
+    message to the partner and completes the send one response later.
+
+    Asynchronous requests complete as the driver's do: Internal receives the
+    NTSTATUS and InternalHigh the byte count, then the event is signalled and
+    a packet is posted to the completion port bound with emu_bind_port().
+    A message arriving while no receive buffer is posted is discarded.
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <process.h>
+
+#include "tsi721api.h"
+#include "tsi721dev.h"
+#include "tsi721emu.h"
+#include "tsi721csr.h"
+
+#define EMU_HANDLE_MAGIC    0x31554d45  // "EMU1"
+#define EMU_CSR_SIZE        0x80000     // bytes of CSR space modelled per device
+#define EMU_PCI_CFG_SIZE    0x100
+#define EMU_DEV_ID          0x80ab0038
+#define EMU_PCI_ID          0x80ab111d  // device ID, vendor ID
+#define EMU_MIN_WIN_SIZE    (32 * 1024)
+#define EMU_SPIN_TICKS_MS   2           // waits shorter than this spin instead of sleeping
+#define EMU_PIO_PAYLOAD     8           // bytes carried by the SRIO request of a CPU store/load
+#define EMU_PIO_OVERHEAD    16          // header and CRC bytes of such a request
+
+//
+// Request status as found in OVERLAPPED.Internal (NTSTATUS)
+//
+#define EMU_STATUS_SUCCESS      0x00000000
+#define EMU_STATUS_PENDING      0x00000103
+#define EMU_STATUS_CANCELLED    0xC0000120  // ERROR_OPERATION_ABORTED
+#define EMU_STATUS_LINK_ERROR   0xC0000001  // ERROR_GEN_FAILURE
+
+#define EMU_REQ_DB_WAIT     1   // pending TSI721SrioIbDoorbellWait()
+#define EMU_REQ_RX_BUF      2   // posted receive buffer
+#define EMU_REQ_MSG_ARRIVE  3   // message on the link, due at the partner
+#define EMU_REQ_MSG_DONE    4   // message delivered, send completes when due
+
+#define RIO_SP_CTL2_GB_SUP_MASK (RIO_SP_CTL2_GB_EN_MASK << 1)
+#define RIO_PORT_N_ERR_STAT_UNINIT  0x00000001
+
+typedef struct _EMU_DEV *PEMU_DEV;
+
+typedef struct _EMU_HANDLE {
+    DWORD        Magic;
+    PEMU_DEV     pDev;
+    HANDLE       hPort;     // completion port bound with emu_bind_port()
+    ULONG_PTR    Key;
+    volatile LONG InFlight; // message sends still in the timer queue
+} EMU_HANDLE, *PEMU_HANDLE;
+
+typedef struct _EMU_REQ {
+    struct _EMU_REQ *Next;
+    PEMU_HANDLE  pHandle;   // issuing handle
+    LPOVERLAPPED pOvl;
+    DWORD        Type;      // EMU_REQ_xxx
+    PVOID        Buf;
+    DWORD        Size;
+    DWORD        Mbox;
+    DWORD        SrcId;     // message source destID
+    ULONGLONG    Due;       // performance counter at which the timer handles it
+    ULONGLONG    Seq;       // keeps requests with the same due time in order
+} EMU_REQ, *PEMU_REQ;
+
+typedef struct _EMU_REQ_LIST {
+    PEMU_REQ Head;
+    PEMU_REQ Tail;
+} EMU_REQ_LIST, *PEMU_REQ_LIST;
+
+typedef struct _EMU_WIN {
+    ULONGLONG Base;         // SRIO base address (bits 65:64 ignored)
+    DWORD     Size;         // 0 = window not mapped
+    PUCHAR    Buf;
+} EMU_WIN, *PEMU_WIN;
+
+typedef struct _EMU_ZONE {
+    BOOL      Valid;
+    ULONGLONG TAddr;        // SRIO translation address (bits 65:64 ignored)
+    DWORD     RdType;
+    DWORD     WrType;
+} EMU_ZONE, *PEMU_ZONE;
+
+typedef struct _EMU_OBWIN {
+    DWORD     Size;         // 0 = window disabled
+    EMU_ZONE  Zone[OBWIN_ZONE_NUM];
+} EMU_OBWIN, *PEMU_OBWIN;
+
+typedef struct _EMU_DEV {
+    DWORD            Index;
+    CRITICAL_SECTION Lock;      // CSRs, windows, doorbell queue and mailboxes
+    CRITICAL_SECTION MaintLock; // maintenance requests share one BDMA channel
+    HANDLE           hDmaSem;   // limits concurrent BDMA transfers
+    PDWORD           Csr;
+    DWORD            PciCfg[EMU_PCI_CFG_SIZE / sizeof(DWORD)];
+    EMU_WIN          Win[IBWIN_MAX_CHNUM];
+    EMU_OBWIN        ObWin[OBWIN_MAX_CHNUM];
+    PIB_DB_ENTRY     DbFifo;
+    DWORD            DbHead;
+    DWORD            DbCount;
+    EMU_REQ_LIST     DbWait;
+    EMU_REQ_LIST     RxBuf[RIO_MSG_MAX_MBOX];
+    DWORD            IbMsgDevId;
+    ULONGLONG        TxBusy;    // outbound link direction is busy until this time
+    ULONGLONG        MsgDropped;
+} EMU_DEV;
+
+typedef struct _EMU {
+    EMU_CFG            Cfg;
+    EMU_DEV            Dev[EMU_DEV_NUM];
+    ULONGLONG          Freq;        // performance counter frequency
+    ULONGLONG          LatTicks;    // round trip latency in ticks
+    double             TicksPerByte; // at 6.25 Gbaud
+    CRITICAL_SECTION   TimerLock;
+    CONDITION_VARIABLE TimerCv;
+    PEMU_REQ          *Heap;        // timer queue, earliest due first
+    DWORD              HeapNum;
+    DWORD              HeapSize;
+    ULONGLONG          Seq;
+    volatile LONG      HeadGen;     // bumped when a new earliest request is queued
+    HANDLE             hTimerThread;
+} EMU, *PEMU;
+
+static EMU           g_emu;
+static volatile LONG g_emuState = 0;   // 0 - not started, 1 - starting, 2 - running, 3 - failed
+
+//
+// Baud rates by decreasing speed: enable bit in RIO_SP_CTL2, SEL_BAUD code,
+// rate in 10 Mbaud units
+//
+static const struct {
+    DWORD Ctl2En;
+    DWORD SelBaud;
+    DWORD Rate;
+} g_emuRate[] = {
+    { RIO_SP_CTL2_GB_6P25_EN,  5, 625 },
+    { RIO_SP_CTL2_GB_5P0_EN,   4, 500 },
+    { RIO_SP_CTL2_GB_3P125_EN, 3, 312 },
+    { RIO_SP_CTL2_GB_2P5_EN,   2, 250 },
+    { RIO_SP_CTL2_GB_1P25_EN,  1, 125 },
+};
+
+#define EMU_RATE_NUM    (sizeof(g_emuRate) / sizeof(g_emuRate[0]))
+
+static unsigned __stdcall emu_timer_thread(PVOID pContext);
+
+static __forceinline ULONGLONG
+emu_now(
+    VOID
+    )
+{
+    LARGE_INTEGER li;
+
+    QueryPerformanceCounter(&li);
+    return (ULONGLONG)li.QuadPart;
+}
+
+static __forceinline PEMU_DEV
+emu_peer(
+    PEMU_DEV pDev
+    )
+{
+    return &g_emu.Dev[pDev->Index ^ 1];
+}
+
+static VOID
+emu_wait_until(
+    ULONGLONG due
+    )
+/*++
+
+Routine Description:
+
+    Blocks the calling thread until the performance counter reaches the due
+    time. Long waits sleep, the last EMU_SPIN_TICKS_MS milliseconds spin so
+    microsecond latencies are kept.
+
+--*/
+{
+    ULONGLONG now, spin = g_emu.Freq / 1000 * EMU_SPIN_TICKS_MS;
+
+    for (now = emu_now(); now < due; now = emu_now()) {
+        if (due - now > spin)
+            Sleep((DWORD)((due - now - spin) * 1000 / g_emu.Freq) + 1);
+        else
+            YieldProcessor();
+    }
+}
+
+//
+// Link state
+//
+
+static DWORD
+emu_link_rate(
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Returns the index in g_emuRate of the rate the link trained to: the
+    fastest one enabled on both ends. EMU_RATE_NUM if the link is down (a
+    port is disabled or there is no common rate).
+
+--*/
+{
+    DWORD ctl2, i;
+
+    if ((g_emu.Dev[0].Csr[RIO_SP_CTL / 4] | g_emu.Dev[1].Csr[RIO_SP_CTL / 4]) & RIO_SP_CTL_PORT_DIS)
+        return EMU_RATE_NUM;
+
+    ctl2 = g_emu.Dev[0].Csr[RIO_SP_CTL2 / 4] & g_emu.Dev[1].Csr[RIO_SP_CTL2 / 4];
+
+    for (i = 0; i < EMU_RATE_NUM; i++) {
+        if (ctl2 & g_emuRate[i].Ctl2En)
+            break;
+    }
+
+    return i;
+}
+
+static ULONGLONG
+emu_link_reserve(
+    PEMU_DEV  pTx,
+    DWORD     dwBytes,
+    ULONGLONG earliest
+    )
+/*++
+
+Routine Description:
+
+    Reserves the outbound link direction of a device for a transfer which
+    may not start before the earliest time.
+
+Return Value:
+
+    Time at which the last byte has left the device, 0 if the link is down.
+
+--*/
+{
+    DWORD rate = emu_link_rate();
+    ULONGLONG start, end;
+
+    if (rate == EMU_RATE_NUM)
+        return 0;
+
+    EnterCriticalSection(&pTx->Lock);
+    start = max(earliest, pTx->TxBusy);
+    end = start + (ULONGLONG)(dwBytes * g_emu.TicksPerByte * 625 / g_emuRate[rate].Rate);
+    pTx->TxBusy = end;
+    LeaveCriticalSection(&pTx->Lock);
+
+    return end;
+}
+
+//
+// CSR space
+//
+
+static DWORD
+emu_csr_get(
+    PEMU_DEV pDev,
+    DWORD    dwOffset
+    )
+{
+    DWORD val = pDev->Csr[dwOffset / 4];
+    DWORD rate;
+
+    switch (dwOffset) {
+    case RIO_PORT_N_ERR_STAT_CSR:
+        val &= ~(RIO_PORT_N_ERR_STAT_PORT_OK | RIO_PORT_N_ERR_STAT_UNINIT);
+        val |= (emu_link_rate() == EMU_RATE_NUM) ? RIO_PORT_N_ERR_STAT_UNINIT : RIO_PORT_N_ERR_STAT_PORT_OK;
+        break;
+
+    case RIO_SP_CTL2:
+        rate = emu_link_rate();
+        val = (val & RIO_SP_CTL2_GB_EN_MASK) | RIO_SP_CTL2_GB_SUP_MASK;
+        if (rate < EMU_RATE_NUM)
+            val |= g_emuRate[rate].SelBaud << 28;
+        break;
+    }
+
+    return val;
+}
+
+static VOID
+emu_csr_set(
+    PEMU_DEV pDev,
+    DWORD    dwOffset,
+    DWORD    dwValue
+    )
+{
+    PDWORD pReg = &pDev->Csr[dwOffset / 4];
+
+    switch (dwOffset) {
+    case RIO_DEV_ID_CAR:
+        break;  // read-only
+
+    case RIO_PORT_N_ERR_STAT_CSR:
+        *pReg &= ~dwValue;  // error bits are write-1-to-clear
+        break;
+
+    case RIO_SP_CTL2:
+        *pReg = dwValue & RIO_SP_CTL2_GB_EN_MASK;
+        break;
+
+    default:
+        *pReg = dwValue;
+        break;
+    }
+}
+
+static VOID
+emu_dev_init(
+    PEMU_DEV pDev,
+    DWORD    dwIndex
+    )
+{
+    pDev->Index = dwIndex;
+    pDev->Csr[RIO_DEV_ID_CAR / 4] = EMU_DEV_ID;
+    pDev->Csr[RIO_SP_CTL2 / 4] = RIO_SP_CTL2_GB_EN_MASK;
+    pDev->IbMsgDevId = 0xffff;
+    pDev->PciCfg[0] = EMU_PCI_ID;
+    pDev->PciCfg[0x10 / 4] = 0xf0000000 + (dwIndex << 20);   // BAR0
+
+    pDev->Win[0].Base = 0;
+    pDev->Win[0].Size = g_emu.Cfg.IbWinSize;
+}
+
+//
+// Request completion
+//
+
+static VOID
+emu_complete(
+    PEMU_HANDLE  pHandle,
+    LPOVERLAPPED pOvl,
+    DWORD        status,
+    DWORD        dwBytes
+    )
+/*++
+
+Routine Description:
+
+    Completes an asynchronous request: stores the result in the OVERLAPPED
+    structure, then signals its event and queues a completion packet if the
+    handle is bound to a port (unless the low bit of hEvent is set).
+
+--*/
+{
+    HANDLE hEvent = (HANDLE)((ULONG_PTR)pOvl->hEvent & ~(ULONG_PTR)1);
+
+    pOvl->InternalHigh = dwBytes;
+    MemoryBarrier();
+    pOvl->Internal = status;
+
+    if (hEvent)
+        SetEvent(hEvent);
+
+    if (pHandle->hPort && !((ULONG_PTR)pOvl->hEvent & 1))
+        PostQueuedCompletionStatus(pHandle->hPort, dwBytes, pHandle->Key, pOvl);
+}
+
+static VOID
+emu_pend(
+    LPOVERLAPPED pOvl
+    )
+{
+    HANDLE hEvent = (HANDLE)((ULONG_PTR)pOvl->hEvent & ~(ULONG_PTR)1);
+
+    pOvl->Internal = EMU_STATUS_PENDING;
+    pOvl->InternalHigh = 0;
+    if (hEvent)
+        ResetEvent(hEvent);
+}
+
+static PEMU_REQ
+emu_req_alloc(
+    PEMU_HANDLE  pHandle,
+    LPOVERLAPPED pOvl,
+    DWORD        dwType,
+    PVOID        pBuf,
+    DWORD        dwSize
+    )
+{
+    PEMU_REQ pReq = (PEMU_REQ)calloc(1, sizeof(EMU_REQ));
+
+    if (pReq) {
+        pReq->pHandle = pHandle;
+        pReq->pOvl = pOvl;
+        pReq->Type = dwType;
+        pReq->Buf = pBuf;
+        pReq->Size = dwSize;
+    }
+
+    return pReq;
+}
+
+static VOID
+emu_list_add(
+    PEMU_REQ_LIST pList,
+    PEMU_REQ      pReq
+    )
+{
+    pReq->Next = NULL;
+    if (pList->Tail)
+        pList->Tail->Next = pReq;
+    else
+        pList->Head = pReq;
+    pList->Tail = pReq;
+}
+
+static PEMU_REQ
+emu_list_remove(
+    PEMU_REQ_LIST pList
+    )
+{
+    PEMU_REQ pReq = pList->Head;
+
+    if (pReq) {
+        pList->Head = pReq->Next;
+        if (pList->Head == NULL)
+            pList->Tail = NULL;
+    }
+
+    return pReq;
+}
+
+static VOID
+emu_list_cancel(
+    PEMU_REQ_LIST pList,
+    PEMU_HANDLE   pHandle,
+    LPOVERLAPPED  pOvl,
+    PEMU_REQ_LIST pCancelled
+    )
+/*++
+
+Routine Description:
+
+    Moves the requests of a handle (or only the one using pOvl) from a
+    queue to the cancelled list.
+
+--*/
+{
+    EMU_REQ_LIST keep = { NULL, NULL };
+    PEMU_REQ pReq;
+
+    while ((pReq = emu_list_remove(pList)) != NULL) {
+        if (pReq->pHandle == pHandle && (pOvl == NULL || pReq->pOvl == pOvl))
+            emu_list_add(pCancelled, pReq);
+        else
+            emu_list_add(&keep, pReq);
+    }
+
+    *pList = keep;
+}
+
+//
+// Timer queue
+//
+
+static __forceinline BOOL
+emu_req_before(
+    PEMU_REQ pA,
+    PEMU_REQ pB
+    )
+{
+    return pA->Due < pB->Due || (pA->Due == pB->Due && pA->Seq < pB->Seq);
+}
+
+static DWORD
+emu_timer_add(
+    PEMU_REQ pReq
+    )
+{
+    PEMU_REQ *pHeap, pTmp;
+    DWORD i, parent;
+
+    EnterCriticalSection(&g_emu.TimerLock);
+
+    if (g_emu.HeapNum == g_emu.HeapSize) {
+        pHeap = (PEMU_REQ *)realloc(g_emu.Heap, 2 * g_emu.HeapSize * sizeof(PEMU_REQ));
+        if (pHeap == NULL) {
+            LeaveCriticalSection(&g_emu.TimerLock);
+            return ERROR_NOT_ENOUGH_MEMORY;
+        }
+        g_emu.Heap = pHeap;
+        g_emu.HeapSize *= 2;
+    }
+
+    pReq->Seq = g_emu.Seq++;
+    i = g_emu.HeapNum++;
+    g_emu.Heap[i] = pReq;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (!emu_req_before(g_emu.Heap[i], g_emu.Heap[parent]))
+            break;
+        pTmp = g_emu.Heap[i];
+        g_emu.Heap[i] = g_emu.Heap[parent];
+        g_emu.Heap[parent] = pTmp;
+        i = parent;
+    }
+
+    if (i == 0) {
+        InterlockedIncrement(&g_emu.HeadGen);
+        WakeConditionVariable(&g_emu.TimerCv);
+    }
+
+    LeaveCriticalSection(&g_emu.TimerLock);
+    return ERROR_SUCCESS;
+}
+
+static PEMU_REQ
+emu_timer_pop(
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Removes the earliest request from the timer queue. Called with the
+    timer lock held and a non-empty queue.
+
+--*/
+{
+    PEMU_REQ pReq = g_emu.Heap[0], pTmp;
+    DWORD i = 0, child;
+
+    g_emu.Heap[0] = g_emu.Heap[--g_emu.HeapNum];
+
+    for (;;) {
+        child = 2 * i + 1;
+        if (child >= g_emu.HeapNum)
+            break;
+        if (child + 1 < g_emu.HeapNum && emu_req_before(g_emu.Heap[child + 1], g_emu.Heap[child]))
+            child++;
+        if (!emu_req_before(g_emu.Heap[child], g_emu.Heap[i]))
+            break;
+        pTmp = g_emu.Heap[i];
+        g_emu.Heap[i] = g_emu.Heap[child];
+        g_emu.Heap[child] = pTmp;
+        i = child;
+    }
+
+    return pReq;
+}
+
+static VOID
+emu_msg_arrive(
+    PEMU_REQ pReq
+    )
+/*++
+
+Routine Description:
+
+    Delivers a message to the first receive buffer posted to the mailbox of
+    the link partner and schedules the completion of the send.
+
+--*/
+{
+    PEMU_DEV pDst = emu_peer(pReq->pHandle->pDev);
+    PEMU_REQ pRx;
+    DWORD len;
+
+    EnterCriticalSection(&pDst->Lock);
+    pRx = emu_list_remove(&pDst->RxBuf[pReq->Mbox]);
+    if (pRx == NULL)
+        pDst->MsgDropped++;
+    LeaveCriticalSection(&pDst->Lock);
+
+    if (pRx) {
+        len = min(pReq->Size, pRx->Size);
+        CopyMemory(pRx->Buf, pReq->Buf, len);
+
+        // Receive byte count carries the source destID in bits 15:0
+        emu_complete(pRx->pHandle, pRx->pOvl, EMU_STATUS_SUCCESS, (len << 16) | (pReq->SrcId & 0xffff));
+        free(pRx);
+    }
+
+    pReq->Type = EMU_REQ_MSG_DONE;
+    pReq->Due += g_emu.LatTicks / 2;
+    if (emu_timer_add(pReq) != ERROR_SUCCESS) {
+        emu_complete(pReq->pHandle, pReq->pOvl, EMU_STATUS_SUCCESS, pReq->Size);
+        InterlockedDecrement(&pReq->pHandle->InFlight);
+        free(pReq);
+    }
+}
+
+static unsigned __stdcall
+emu_timer_thread(
+    PVOID pContext
+    )
+/*++
+
+Routine Description:
+
+    Handles timer queue requests when they are due. The thread sleeps while
+    the earliest request is far away and spins for the last milliseconds,
+    restarting the wait when an earlier request is queued.
+
+--*/
+{
+    ULONGLONG now, spin = g_emu.Freq / 1000 * EMU_SPIN_TICKS_MS;
+    EMU_REQ_LIST due;
+    PEMU_REQ pReq;
+    LONG gen;
+
+    UNREFERENCED_PARAMETER(pContext);
+
+    for (;;) {
+        EnterCriticalSection(&g_emu.TimerLock);
+
+        while (g_emu.HeapNum == 0)
+            SleepConditionVariableCS(&g_emu.TimerCv, &g_emu.TimerLock, INFINITE);
+
+        now = emu_now();
+        pReq = g_emu.Heap[0];
+
+        if (pReq->Due > now) {
+            if (pReq->Due - now > spin) {
+                SleepConditionVariableCS(&g_emu.TimerCv, &g_emu.TimerLock,
+                                         (DWORD)((pReq->Due - now - spin) * 1000 / g_emu.Freq) + 1);
+                LeaveCriticalSection(&g_emu.TimerLock);
+            }
+            else {
+                gen = g_emu.HeadGen;
+                LeaveCriticalSection(&g_emu.TimerLock);
+                while (emu_now() < pReq->Due && gen == g_emu.HeadGen)
+                    YieldProcessor();
+            }
+            continue;
+        }
+
+        due.Head = due.Tail = NULL;
+        while (g_emu.HeapNum && g_emu.Heap[0]->Due <= now)
+            emu_list_add(&due, emu_timer_pop());
+
+        LeaveCriticalSection(&g_emu.TimerLock);
+
+        while ((pReq = emu_list_remove(&due)) != NULL) {
+            if (pReq->Type == EMU_REQ_MSG_ARRIVE)
+                emu_msg_arrive(pReq);
+            else {
+                emu_complete(pReq->pHandle, pReq->pOvl, EMU_STATUS_SUCCESS, pReq->Size);
+                InterlockedDecrement(&pReq->pHandle->InFlight);
+                free(pReq);
+            }
+        }
+    }
+
+    return 0;
+}
+
+//
+// Model start-up and configuration
+//
+
+VOID
+tsi721_emu_defaults(
+    PEMU_CFG pCfg
+    )
+{
+    pCfg->LinkMBps = EMU_DEF_LINK_MBPS;
+    pCfg->LatencyNs = EMU_DEF_LATENCY_NS;
+    pCfg->DmaChNum = DMA_MAX_CHNUM - 1;     // all but the maintenance channel
+    pCfg->MboxNum = RIO_MSG_MAX_MBOX;
+    pCfg->DbFifoDepth = IBDB_RING_SZ;
+    pCfg->IbWinSize = EMU_DEF_WIN_SIZE;
+    pCfg->IbWinMax = 0;
+    pCfg->IbWinMap = 1;
+}
+
+DWORD
+tsi721_emu_parse(
+    PCSTR    pOpts,
+    PEMU_CFG pCfg
+    )
+{
+    static const struct {
+        PCSTR Name;
+        DWORD Offset;
+        DWORD Scale;
+    } opt[] = {
+        { "bw",   FIELD_OFFSET(EMU_CFG, LinkMBps),    1 },
+        { "lat",  FIELD_OFFSET(EMU_CFG, LatencyNs),   1 },
+        { "ch",   FIELD_OFFSET(EMU_CFG, DmaChNum),    1 },
+        { "mbox", FIELD_OFFSET(EMU_CFG, MboxNum),     1 },
+        { "db",   FIELD_OFFSET(EMU_CFG, DbFifoDepth), 1 },
+        { "win",  FIELD_OFFSET(EMU_CFG, IbWinSize),   1024 },
+        { "winmax", FIELD_OFFSET(EMU_CFG, IbWinMax),  1024 },
+        { "ibmap",  FIELD_OFFSET(EMU_CFG, IbWinMap),  1 },
+    };
+    PCSTR p = pOpts, pEq;
+    char *pEnd;
+    DWORD i, val;
+    size_t len;
+
+    while (p && *p) {
+        pEq = strchr(p, '=');
+        if (pEq == NULL)
+            return ERROR_INVALID_PARAMETER;
+
+        len = pEq - p;
+        for (i = 0; i < sizeof(opt) / sizeof(opt[0]); i++) {
+            if (strlen(opt[i].Name) == len && _strnicmp(p, opt[i].Name, len) == 0)
+                break;
+        }
+        if (i == sizeof(opt) / sizeof(opt[0]))
+            return ERROR_INVALID_PARAMETER;
+
+        val = strtoul(pEq + 1, &pEnd, 0);
+        if (pEnd == pEq + 1 || (*pEnd != ',' && *pEnd != '\0'))
+            return ERROR_INVALID_PARAMETER;
+
+        *(PDWORD)((PUCHAR)pCfg + opt[i].Offset) = val * opt[i].Scale;
+        p = (*pEnd == ',') ? pEnd + 1 : pEnd;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+DWORD
+tsi721_emu_config(
+    const EMU_CFG *pCfg
+    )
+{
+    if (pCfg->LinkMBps == 0 || pCfg->DmaChNum == 0 || pCfg->DmaChNum > DMA_MAX_CHNUM ||
+        pCfg->MboxNum == 0 || pCfg->MboxNum > RIO_MSG_MAX_MBOX || pCfg->DbFifoDepth == 0 ||
+        pCfg->IbWinSize < EMU_MIN_WIN_SIZE)
+        return ERROR_INVALID_PARAMETER;
+
+    if (InterlockedCompareExchange(&g_emuState, 1, 0) != 0)
+        return ERROR_BUSY;
+
+    g_emu.Cfg = *pCfg;
+    g_emuState = 0;
+    return ERROR_SUCCESS;
+}
+
+static DWORD
+emu_start(
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Creates the device pair and the timer thread on the first open.
+
+--*/
+{
+    LARGE_INTEGER freq;
+    PEMU_DEV pDev;
+    DWORD i, dwErr = ERROR_SUCCESS;
+
+    if (g_emu.Cfg.LinkMBps == 0)
+        tsi721_emu_defaults(&g_emu.Cfg);
+
+    QueryPerformanceFrequency(&freq);
+    g_emu.Freq = freq.QuadPart;
+    g_emu.LatTicks = (ULONGLONG)g_emu.Cfg.LatencyNs * g_emu.Freq / 1000000000;
+    g_emu.TicksPerByte = (double)g_emu.Freq / ((double)g_emu.Cfg.LinkMBps * 1000000);
+
+    InitializeCriticalSection(&g_emu.TimerLock);
+    InitializeConditionVariable(&g_emu.TimerCv);
+    g_emu.HeapSize = 256;
+    g_emu.Heap = (PEMU_REQ *)malloc(g_emu.HeapSize * sizeof(PEMU_REQ));
+    if (g_emu.Heap == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    for (i = 0; i < EMU_DEV_NUM; i++) {
+        pDev = &g_emu.Dev[i];
+        InitializeCriticalSection(&pDev->Lock);
+        InitializeCriticalSection(&pDev->MaintLock);
+        pDev->hDmaSem = CreateSemaphore(NULL, g_emu.Cfg.DmaChNum, g_emu.Cfg.DmaChNum, NULL);
+        pDev->Csr = (PDWORD)calloc(EMU_CSR_SIZE / sizeof(DWORD), sizeof(DWORD));
+        pDev->DbFifo = (PIB_DB_ENTRY)calloc(g_emu.Cfg.DbFifoDepth, sizeof(IB_DB_ENTRY));
+        pDev->Win[0].Buf = (PUCHAR)calloc(1, g_emu.Cfg.IbWinSize);
+        if (pDev->hDmaSem == NULL || pDev->Csr == NULL || pDev->DbFifo == NULL ||
+            pDev->Win[0].Buf == NULL)
+            return ERROR_NOT_ENOUGH_MEMORY;
+
+        emu_dev_init(pDev, i);
+    }
+
+    g_emu.hTimerThread = (HANDLE)_beginthreadex(NULL, 0, emu_timer_thread, NULL, 0, NULL);
+    if (g_emu.hTimerThread == NULL)
+        dwErr = GetLastError();
+
+    return dwErr;
+}
+
+//
+// Device routines
+//
+
+static PEMU_HANDLE
+emu_handle(
+    HANDLE hDev
+    )
+{
+    PEMU_HANDLE pHandle = (PEMU_HANDLE)hDev;
+
+    if (pHandle == NULL || pHandle == INVALID_HANDLE_VALUE || pHandle->Magic != EMU_HANDLE_MAGIC)
+        return NULL;
+
+    return pHandle;
+}
+
+static BOOL
+emu_open(
+    PHANDLE           phDev,
+    ULONG             ulDevNum,
+    APP_THREAD_PARAM *pAppThreadParam
+    )
+{
+    PEMU_HANDLE pHandle;
+    DWORD dwErr;
+    LONG state;
+
+    UNREFERENCED_PARAMETER(pAppThreadParam);
+
+    if (ulDevNum >= EMU_DEV_NUM) {
+        SetLastError(ERROR_FILE_NOT_FOUND);
+        return FALSE;
+    }
+
+    //
+    // The first open starts the model, concurrent ones wait for it
+    //
+    while ((state = InterlockedCompareExchange(&g_emuState, 1, 0)) != 2) {
+        if (state == 0) {
+            dwErr = emu_start();
+            if (dwErr != ERROR_SUCCESS) {
+                printf_s("EMU: failed to start Tsi721 model, err = 0x%x\n", dwErr);
+                InterlockedExchange(&g_emuState, 3);
+                SetLastError(dwErr);
+                return FALSE;
+            }
+            InterlockedExchange(&g_emuState, 2);
+            break;
+        }
+        if (state == 3) {
+            SetLastError(ERROR_GEN_FAILURE);
+            return FALSE;
+        }
+        Sleep(1);
+    }
+
+    pHandle = (PEMU_HANDLE)calloc(1, sizeof(EMU_HANDLE));
+    if (pHandle == NULL) {
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return FALSE;
+    }
+
+    pHandle->Magic = EMU_HANDLE_MAGIC;
+    pHandle->pDev = &g_emu.Dev[ulDevNum];
+    *phDev = pHandle;
+    return TRUE;
+}
+
+static DWORD emu_cancel_io(HANDLE hDev, LPOVERLAPPED pOvl);
+
+static DWORD
+emu_close(
+    HANDLE            hDev,
+    APP_THREAD_PARAM *pAppThreadParam
+    )
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+
+    UNREFERENCED_PARAMETER(pAppThreadParam);
+
+    if (pHandle == NULL)
+        return ERROR_INVALID_HANDLE;
+
+    //
+    // Pending receives are cancelled; messages on the link complete shortly
+    //
+    emu_cancel_io(hDev, NULL);
+    while (pHandle->InFlight)
+        Sleep(1);
+
+    pHandle->Magic = 0;
+    free(pHandle);
+    return ERROR_SUCCESS;
+}
+
+static DWORD
+emu_reg_read(
+    HANDLE hDev,
+    DWORD  dwOffset,
+    DWORD  dwNum,
+    PDWORD pRegVal
+    )
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+    DWORD i;
+
+    if (pHandle == NULL || pRegVal == NULL || dwNum == 0 || (dwOffset & 3) ||
+        dwOffset >= EMU_CSR_SIZE || dwNum > (EMU_CSR_SIZE - dwOffset) / 4)
+        return ERROR_INVALID_PARAMETER;
+
+    EnterCriticalSection(&pHandle->pDev->Lock);
+    for (i = 0; i < dwNum; i++)
+        pRegVal[i] = emu_csr_get(pHandle->pDev, dwOffset + i * 4);
+    LeaveCriticalSection(&pHandle->pDev->Lock);
+
+    return ERROR_SUCCESS;
+}
+
+static DWORD
+emu_reg_write(
+    HANDLE hDev,
+    DWORD  dwOffset,
+    DWORD  dwValue
+    )
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+
+    if (pHandle == NULL || (dwOffset & 3) || dwOffset >= EMU_CSR_SIZE)
+        return ERROR_INVALID_PARAMETER;
+
+    EnterCriticalSection(&pHandle->pDev->Lock);
+    emu_csr_set(pHandle->pDev, dwOffset, dwValue);
+    LeaveCriticalSection(&pHandle->pDev->Lock);
+
+    return ERROR_SUCCESS;
+}
+
+static DWORD
+emu_pci_cfg_read(
+    HANDLE hDev,
+    DWORD  dwOffset,
+    PDWORD pRegVal
+    )
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+
+    if (pHandle == NULL || pRegVal == NULL || (dwOffset & 3) || dwOffset >= EMU_PCI_CFG_SIZE)
+        return ERROR_INVALID_PARAMETER;
+
+    *pRegVal = pHandle->pDev->PciCfg[dwOffset / 4];
+    return ERROR_SUCCESS;
+}
+
+static DWORD
+emu_get_host_id(
+    HANDLE hDev,
+    PDWORD pdwHostId
+    )
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+
+    if (pHandle == NULL || pdwHostId == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    *pdwHostId = (pHandle->pDev->Csr[RIO_BASE_ID_CSR / 4] >> 16) & 0xff;
+    return ERROR_SUCCESS;
+}
+
+static DWORD
+emu_set_host_id(
+    HANDLE hDev,
+    DWORD  dwHostId
+    )
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+
+    if (pHandle == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    // 8-bit base ID in bits 23:16, 16-bit large base ID in bits 15:0
+    return emu_reg_write(hDev, RIO_BASE_ID_CSR, ((dwHostId & 0xff) << 16) | (dwHostId & 0xffff));
+}
+
+static DWORD
+emu_maint(
+    HANDLE hDev,
+    DWORD  dwOffset,
+    PDWORD pData,
+    BOOL   bWrite
+    )
+/*++
+
+Routine Description:
+
+    Maintenance read or write of a link partner CSR. Requests of a device
+    are serialized (the driver uses one BDMA channel for them) and each
+    takes one round trip. The pair has no switches, so the destID and the
+    hop count are ignored as an end point does.
+
+--*/
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+    PEMU_DEV pDev, pPeer;
+    DWORD dwErr = ERROR_SUCCESS;
+
+    if (pHandle == NULL || pData == NULL || (dwOffset & 3) || dwOffset >= (1 << 24))
+        return ERROR_INVALID_PARAMETER;
+
+    pDev = pHandle->pDev;
+    pPeer = emu_peer(pDev);
+
+    EnterCriticalSection(&pDev->MaintLock);
+
+    emu_wait_until(emu_now() + g_emu.LatTicks);
+
+    if (emu_link_rate() == EMU_RATE_NUM)
+        dwErr = ERROR_GEN_FAILURE;
+    else {
+        EnterCriticalSection(&pPeer->Lock);
+        if (bWrite) {
+            if (dwOffset < EMU_CSR_SIZE)
+                emu_csr_set(pPeer, dwOffset, *pData);
+        }
+        else
+            *pData = (dwOffset < EMU_CSR_SIZE) ? emu_csr_get(pPeer, dwOffset) : 0;
+        LeaveCriticalSection(&pPeer->Lock);
+    }
+
+    LeaveCriticalSection(&pDev->MaintLock);
+    return dwErr;
+}
+
+static DWORD
+emu_maint_read(
+    HANDLE hDev,
+    DWORD  dwDestId,
+    DWORD  dwHopCnt,
+    DWORD  dwOffset,
+    PDWORD pData
+    )
+{
+    UNREFERENCED_PARAMETER(dwDestId);
+    UNREFERENCED_PARAMETER(dwHopCnt);
+
+    return emu_maint(hDev, dwOffset, pData, FALSE);
+}
+
+static DWORD
+emu_maint_write(
+    HANDLE hDev,
+    DWORD  dwDestId,
+    DWORD  dwHopCnt,
+    DWORD  dwOffset,
+    DWORD  dwValue
+    )
+{
+    UNREFERENCED_PARAMETER(dwDestId);
+    UNREFERENCED_PARAMETER(dwHopCnt);
+
+    return emu_maint(hDev, dwOffset, &dwValue, TRUE);
+}
+
+static PUCHAR
+emu_win_find(
+    PEMU_DEV  pDev,
+    ULONGLONG addr,
+    DWORD     dwSize
+    )
+/*++
+
+Routine Description:
+
+    Returns the memory behind an SRIO address range of the inbound windows
+    of a device, NULL if the range is not mapped by a single window. Called
+    with the device lock held.
+
+--*/
+{
+    PEMU_WIN pWin;
+    DWORD i;
+
+    for (i = 0; i < IBWIN_MAX_CHNUM; i++) {
+        pWin = &pDev->Win[i];
+        if (pWin->Size && addr >= pWin->Base && addr + dwSize <= pWin->Base + pWin->Size)
+            return pWin->Buf + (addr - pWin->Base);
+    }
+
+    return NULL;
+}
+
+static DWORD
+emu_dma(
+    HANDLE hDev,
+    DWORD  dwAddrHi,
+    DWORD  dwAddrLo,
+    PVOID  pBuffer,
+    PDWORD pdwBufSize,
+    BOOL   bWrite
+    )
+/*++
+
+Routine Description:
+
+    BDMA transfer to or from the inbound windows of the link partner. A
+    write occupies the outbound direction of the device, then waits for the
+    response; a read request travels half a round trip before the partner
+    sends the data back on its outbound direction.
+
+--*/
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+    ULONGLONG addr = ((ULONGLONG)dwAddrHi << 32) | dwAddrLo;
+    ULONGLONG end;
+    PEMU_DEV pDev, pPeer;
+    PUCHAR pMem;
+    DWORD dwErr = ERROR_SUCCESS;
+
+    if (pHandle == NULL || pBuffer == NULL || pdwBufSize == NULL || *pdwBufSize == 0)
+        return ERROR_INVALID_PARAMETER;
+
+    pDev = pHandle->pDev;
+    pPeer = emu_peer(pDev);
+
+    WaitForSingleObject(pDev->hDmaSem, INFINITE);
+
+    if (bWrite)
+        end = emu_link_reserve(pDev, *pdwBufSize, emu_now());
+    else
+        end = emu_link_reserve(pPeer, *pdwBufSize, emu_now() + g_emu.LatTicks / 2);
+
+    if (end == 0)
+        dwErr = ERROR_GEN_FAILURE;
+    else {
+        EnterCriticalSection(&pPeer->Lock);
+        pMem = emu_win_find(pPeer, addr, *pdwBufSize);
+        if (pMem == NULL)
+            dwErr = ERROR_INVALID_ADDRESS;
+        else if (bWrite)
+            CopyMemory(pMem, pBuffer, *pdwBufSize);
+        else
+            CopyMemory(pBuffer, pMem, *pdwBufSize);
+        LeaveCriticalSection(&pPeer->Lock);
+
+        emu_wait_until(end + (bWrite ? g_emu.LatTicks : g_emu.LatTicks / 2));
+    }
+
+    ReleaseSemaphore(pDev->hDmaSem, 1, NULL);
+
+    if (dwErr != ERROR_SUCCESS)
+        *pdwBufSize = 0;
+    return dwErr;
+}
+
+static DWORD
+emu_srio_write(
+    HANDLE       hDev,
+    DWORD        dwDestId,
+    DWORD        dwAddrHi,
+    DWORD        dwAddrLo,
+    PVOID        pBuffer,
+    PDWORD       pdwBufSize,
+    DMA_REQ_CTRL dwCtrl
+    )
+{
+    UNREFERENCED_PARAMETER(dwDestId);
+    UNREFERENCED_PARAMETER(dwCtrl);
+
+    return emu_dma(hDev, dwAddrHi, dwAddrLo, pBuffer, pdwBufSize, TRUE);
+}
+
+static DWORD
+emu_srio_read(
+    HANDLE       hDev,
+    DWORD        dwDestId,
+    DWORD        dwAddrHi,
+    DWORD        dwAddrLo,
+    PVOID        pBuffer,
+    PDWORD       pdwBufSize,
+    DMA_REQ_CTRL dwCtrl
+    )
+{
+    UNREFERENCED_PARAMETER(dwDestId);
+    UNREFERENCED_PARAMETER(dwCtrl);
+
+    return emu_dma(hDev, dwAddrHi, dwAddrLo, pBuffer, pdwBufSize, FALSE);
+}
+
+static DWORD
+emu_cfg_r2p_win(
+    HANDLE      hDev,
+    DWORD       bWinNum,
+    PR2P_WINCFG pWinCfg
+    )
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+    PEMU_WIN pWin;
+    PUCHAR pBuf, pOld;
+
+    if (pHandle == NULL || pWinCfg == NULL || bWinNum >= IBWIN_MAX_CHNUM ||
+        pWinCfg->Size < EMU_MIN_WIN_SIZE || (pWinCfg->Size & (pWinCfg->Size - 1)))
+        return ERROR_INVALID_PARAMETER;
+
+    // The driver fails to allocate a common buffer beyond IbWinMax
+    if (g_emu.Cfg.IbWinMax && pWinCfg->Size > g_emu.Cfg.IbWinMax)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    pBuf = (PUCHAR)calloc(1, pWinCfg->Size);
+    if (pBuf == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    pWin = &pHandle->pDev->Win[bWinNum];
+
+    EnterCriticalSection(&pHandle->pDev->Lock);
+    pOld = pWin->Buf;
+    pWin->Base = ((ULONGLONG)pWinCfg->BAddrHi << 32) | pWinCfg->BAddrLo;
+    pWin->Size = pWinCfg->Size;
+    pWin->Buf = pBuf;
+    LeaveCriticalSection(&pHandle->pDev->Lock);
+
+    free(pOld);
+    return ERROR_SUCCESS;
+}
+
+static DWORD
+emu_free_r2p_win(
+    HANDLE hDev,
+    DWORD  bWinNum
+    )
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+    PEMU_WIN pWin;
+    PUCHAR pOld;
+
+    if (pHandle == NULL || bWinNum >= IBWIN_MAX_CHNUM)
+        return ERROR_INVALID_PARAMETER;
+
+    pWin = &pHandle->pDev->Win[bWinNum];
+
+    EnterCriticalSection(&pHandle->pDev->Lock);
+    pOld = pWin->Buf;
+    pWin->Size = 0;
+    pWin->Buf = NULL;
+    LeaveCriticalSection(&pHandle->pDev->Lock);
+
+    free(pOld);
+    return ERROR_SUCCESS;
+}
+
+static DWORD
+emu_ibw_buffer(
+    HANDLE hDev,
+    DWORD  dwMapNum,
+    DWORD  dwOffset,
+    PVOID  pBuffer,
+    PDWORD pdwBufSize,
+    BOOL   bPut
+    )
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+    PEMU_WIN pWin;
+    DWORD dwErr = ERROR_SUCCESS;
+
+    if (pHandle == NULL || pBuffer == NULL || pdwBufSize == NULL || dwMapNum >= IBWIN_MAX_CHNUM)
+        return ERROR_INVALID_PARAMETER;
+
+    pWin = &pHandle->pDev->Win[dwMapNum];
+
+    EnterCriticalSection(&pHandle->pDev->Lock);
+    if (dwOffset >= pWin->Size)
+        dwErr = ERROR_INVALID_PARAMETER;
+    else {
+        *pdwBufSize = min(*pdwBufSize, pWin->Size - dwOffset);
+        if (bPut)
+            CopyMemory(pWin->Buf + dwOffset, pBuffer, *pdwBufSize);
+        else
+            CopyMemory(pBuffer, pWin->Buf + dwOffset, *pdwBufSize);
+    }
+    LeaveCriticalSection(&pHandle->pDev->Lock);
+
+    return dwErr;
+}
+
+static DWORD
+emu_ibw_get(
+    HANDLE hDev,
+    DWORD  dwMapNum,
+    DWORD  dwOffset,
+    PVOID  pBuffer,
+    PDWORD pdwBufSize
+    )
+{
+    return emu_ibw_buffer(hDev, dwMapNum, dwOffset, pBuffer, pdwBufSize, FALSE);
+}
+
+static DWORD
+emu_ibw_put(
+    HANDLE hDev,
+    DWORD  dwMapNum,
+    DWORD  dwOffset,
+    PVOID  pBuffer,
+    PDWORD pdwBufSize
+    )
+{
+    return emu_ibw_buffer(hDev, dwMapNum, dwOffset, pBuffer, pdwBufSize, TRUE);
+}
+
+static DWORD
+emu_ibw_map(
+    HANDLE hDev,
+    DWORD  dwMapNum,
+    PVOID *ppBuffer,
+    PDWORD pdwBufSize
+    )
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+    PEMU_WIN pWin;
+    DWORD dwErr = ERROR_SUCCESS;
+
+    if (pHandle == NULL || ppBuffer == NULL || pdwBufSize == NULL || dwMapNum >= IBWIN_MAX_CHNUM)
+        return ERROR_INVALID_PARAMETER;
+
+    if (!g_emu.Cfg.IbWinMap)
+        return ERROR_NOT_SUPPORTED;
+
+    pWin = &pHandle->pDev->Win[dwMapNum];
+
+    EnterCriticalSection(&pHandle->pDev->Lock);
+    if (pWin->Size == 0)
+        dwErr = ERROR_INVALID_PARAMETER;
+    else {
+        *ppBuffer = pWin->Buf;
+        *pdwBufSize = pWin->Size;
+    }
+    LeaveCriticalSection(&pHandle->pDev->Lock);
+
+    return dwErr;
+}
+
+static DWORD
+emu_cfg_p2r_win(
+    HANDLE      hDev,
+    DWORD       dwWinNum,
+    PP2R_WINCFG pWinCfg
+    )
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+    PEMU_OBWIN pWin;
+
+    if (pHandle == NULL || pWinCfg == NULL || dwWinNum >= OBWIN_MAX_CHNUM ||
+        (pWinCfg->Enable &&
+         (pWinCfg->Size < EMU_MIN_WIN_SIZE || (pWinCfg->Size & (pWinCfg->Size - 1)))))
+        return ERROR_INVALID_PARAMETER;
+
+    pWin = &pHandle->pDev->ObWin[dwWinNum];
+
+    EnterCriticalSection(&pHandle->pDev->Lock);
+    ZeroMemory(pWin, sizeof(EMU_OBWIN));
+    if (pWinCfg->Enable)
+        pWin->Size = pWinCfg->Size;
+    LeaveCriticalSection(&pHandle->pDev->Lock);
+
+    return ERROR_SUCCESS;
+}
+
+static DWORD
+emu_cfg_p2r_zone(
+    HANDLE       hDev,
+    DWORD        dwWinNum,
+    DWORD        dwZone,
+    PP2R_ZONECFG pZoneCfg
+    )
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+    PEMU_ZONE pZone;
+    DWORD dwErr = ERROR_SUCCESS;
+
+    if (pHandle == NULL || pZoneCfg == NULL || dwWinNum >= OBWIN_MAX_CHNUM || dwZone >= OBWIN_ZONE_NUM)
+        return ERROR_INVALID_PARAMETER;
+
+    // Maintenance zones would need the partner's CSR space mapped as memory
+    if (pZoneCfg->RdType != NRead ||
+        (pZoneCfg->WrType != NWrite && pZoneCfg->WrType != NWrite_R))
+        return ERROR_NOT_SUPPORTED;
+
+    pZone = &pHandle->pDev->ObWin[dwWinNum].Zone[dwZone];
+
+    EnterCriticalSection(&pHandle->pDev->Lock);
+    if (pHandle->pDev->ObWin[dwWinNum].Size == 0)
+        dwErr = ERROR_INVALID_PARAMETER;
+    else {
+        pZone->Valid = TRUE;
+        pZone->TAddr = ((ULONGLONG)pZoneCfg->TAddrHi << 32) | pZoneCfg->TAddrLo;
+        pZone->RdType = pZoneCfg->RdType;
+        pZone->WrType = pZoneCfg->WrType;
+    }
+    LeaveCriticalSection(&pHandle->pDev->Lock);
+
+    return dwErr;
+}
+
+static DWORD
+emu_pio(
+    HANDLE hDev,
+    DWORD  dwWinNum,
+    DWORD  dwOffset,
+    PVOID  pBuffer,
+    DWORD  dwSize,
+    BOOL   bWrite
+    )
+/*++
+
+Routine Description:
+
+    CPU stores to or loads from an outbound window. Each access of up to
+    EMU_PIO_PAYLOAD bytes is an SRIO request of its own. Stores are posted:
+    the call returns once the last request has left the device (plus a
+    round trip for NWRITE_R). Loads are non-posted and the CPU issues the
+    next one only after the previous response arrived.
+
+--*/
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+    PEMU_DEV pDev, pPeer;
+    PEMU_OBWIN pWin;
+    EMU_ZONE zone;
+    ULONGLONG start, end;
+    DWORD zoneSize, packets;
+    PUCHAR pMem;
+    DWORD dwErr = ERROR_SUCCESS;
+
+    if (pHandle == NULL || pBuffer == NULL || dwSize == 0 || dwWinNum >= OBWIN_MAX_CHNUM)
+        return ERROR_INVALID_PARAMETER;
+
+    pDev = pHandle->pDev;
+    pPeer = emu_peer(pDev);
+    pWin = &pDev->ObWin[dwWinNum];
+
+    ZeroMemory(&zone, sizeof(zone));
+
+    EnterCriticalSection(&pDev->Lock);
+    zoneSize = pWin->Size / OBWIN_ZONE_NUM;
+    if (dwOffset < pWin->Size && dwSize <= zoneSize - dwOffset % zoneSize)
+        zone = pWin->Zone[dwOffset / zoneSize];
+    LeaveCriticalSection(&pDev->Lock);
+
+    if (!zone.Valid)
+        return ERROR_INVALID_ADDRESS;
+
+    packets = (dwSize + EMU_PIO_PAYLOAD - 1) / EMU_PIO_PAYLOAD;
+    start = emu_now();
+
+    if (bWrite)
+        end = emu_link_reserve(pDev, dwSize + packets * EMU_PIO_OVERHEAD, start);
+    else
+        end = emu_link_reserve(pPeer, dwSize + packets * EMU_PIO_OVERHEAD, start + g_emu.LatTicks / 2);
+
+    if (end == 0)
+        return ERROR_GEN_FAILURE;
+
+    EnterCriticalSection(&pPeer->Lock);
+    pMem = emu_win_find(pPeer, zone.TAddr + dwOffset % zoneSize, dwSize);
+    if (pMem == NULL)
+        dwErr = ERROR_INVALID_ADDRESS;
+    else if (bWrite)
+        CopyMemory(pMem, pBuffer, dwSize);
+    else
+        CopyMemory(pBuffer, pMem, dwSize);
+    LeaveCriticalSection(&pPeer->Lock);
+
+    if (bWrite)
+        emu_wait_until(zone.WrType == NWrite_R ? end + g_emu.LatTicks : end);
+    else
+        emu_wait_until(max(end + g_emu.LatTicks / 2, start + packets * g_emu.LatTicks));
+
+    return dwErr;
+}
+
+static DWORD
+emu_pio_write(
+    HANDLE hDev,
+    DWORD  dwWinNum,
+    DWORD  dwOffset,
+    PVOID  pBuffer,
+    DWORD  dwSize
+    )
+{
+    return emu_pio(hDev, dwWinNum, dwOffset, pBuffer, dwSize, TRUE);
+}
+
+static DWORD
+emu_pio_read(
+    HANDLE hDev,
+    DWORD  dwWinNum,
+    DWORD  dwOffset,
+    PVOID  pBuffer,
+    DWORD  dwSize
+    )
+{
+    return emu_pio(hDev, dwWinNum, dwOffset, pBuffer, dwSize, FALSE);
+}
+
+static DWORD
+emu_db_copy(
+    PEMU_DEV pDev,
+    PVOID    pBuf,
+    DWORD    dwBufSize
+    )
+/*++
+
+Routine Description:
+
+    Moves queued doorbells into a buffer. Called with the device lock held.
+
+Return Value:
+
+    Number of bytes stored.
+
+--*/
+{
+    PIB_DB_ENTRY pEntry = (PIB_DB_ENTRY)pBuf;
+    DWORD i, n = min(pDev->DbCount, dwBufSize / (DWORD)sizeof(IB_DB_ENTRY));
+
+    for (i = 0; i < n; i++) {
+        pEntry[i] = pDev->DbFifo[pDev->DbHead];
+        pDev->DbHead = (pDev->DbHead + 1) % g_emu.Cfg.DbFifoDepth;
+    }
+    pDev->DbCount -= n;
+
+    return n * sizeof(IB_DB_ENTRY);
+}
+
+static DWORD
+emu_db_send(
+    HANDLE hDev,
+    DWORD  dwDestId,
+    DWORD  dwInfo
+    )
+/*++
+
+Routine Description:
+
+    Sends a doorbell. It reaches the partner after half a round trip and
+    the call returns when the response is back. A full inbound doorbell
+    queue of the partner rejects the doorbell with ERROR_BUSY.
+
+--*/
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+    ULONGLONG start = emu_now();
+    PEMU_DEV pPeer;
+    PEMU_REQ pWait = NULL;
+    IB_DB_ENTRY entry;
+    DWORD dwErr = ERROR_SUCCESS;
+
+    if (pHandle == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    if (emu_link_rate() == EMU_RATE_NUM)
+        return ERROR_GEN_FAILURE;
+
+    pPeer = emu_peer(pHandle->pDev);
+
+    entry.db.SrcId = (USHORT)((pHandle->pDev->Csr[RIO_BASE_ID_CSR / 4] >> 16) & 0xff);
+    entry.db.Info = (USHORT)dwInfo;
+    entry.db.Misc = 0;
+    entry.db.DstId = (USHORT)dwDestId;
+
+    emu_wait_until(start + g_emu.LatTicks / 2);
+
+    EnterCriticalSection(&pPeer->Lock);
+    if (pPeer->DbCount == g_emu.Cfg.DbFifoDepth)
+        dwErr = ERROR_BUSY;
+    else {
+        pPeer->DbFifo[(pPeer->DbHead + pPeer->DbCount) % g_emu.Cfg.DbFifoDepth] = entry;
+        pPeer->DbCount++;
+
+        pWait = emu_list_remove(&pPeer->DbWait);
+        if (pWait)
+            pWait->Size = emu_db_copy(pPeer, pWait->Buf, pWait->Size);
+    }
+    LeaveCriticalSection(&pPeer->Lock);
+
+    if (pWait) {
+        emu_complete(pWait->pHandle, pWait->pOvl, EMU_STATUS_SUCCESS, pWait->Size);
+        free(pWait);
+    }
+
+    emu_wait_until(start + g_emu.LatTicks);
+    return dwErr;
+}
+
+static DWORD
+emu_db_wait(
+    HANDLE       hDev,
+    PVOID        pDbBuf,
+    DWORD        dwBufSize,
+    LPDWORD      lpBytesReturned,
+    LPOVERLAPPED lpOvl
+    )
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+    PEMU_DEV pDev;
+    PEMU_REQ pReq;
+    DWORD dwBytes;
+
+    if (pHandle == NULL || pDbBuf == NULL || dwBufSize < sizeof(IB_DB_ENTRY) || lpOvl == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    pDev = pHandle->pDev;
+
+    pReq = emu_req_alloc(pHandle, lpOvl, EMU_REQ_DB_WAIT, pDbBuf, dwBufSize);
+    if (pReq == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    emu_pend(lpOvl);
+
+    EnterCriticalSection(&pDev->Lock);
+    if (pDev->DbCount) {
+        dwBytes = emu_db_copy(pDev, pDbBuf, dwBufSize);
+        LeaveCriticalSection(&pDev->Lock);
+
+        free(pReq);
+        if (lpBytesReturned)
+            *lpBytesReturned = dwBytes;
+        emu_complete(pHandle, lpOvl, EMU_STATUS_SUCCESS, dwBytes);
+        return ERROR_SUCCESS;
+    }
+
+    emu_list_add(&pDev->DbWait, pReq);
+    LeaveCriticalSection(&pDev->Lock);
+
+    return ERROR_IO_PENDING;
+}
+
+static DWORD
+emu_db_check(
+    HANDLE hDev,
+    PDWORD pDbNum
+    )
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+
+    if (pHandle == NULL || pDbNum == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    *pDbNum = pHandle->pDev->DbCount;
+    return ERROR_SUCCESS;
+}
+
+static DWORD
+emu_db_get(
+    HANDLE hDev,
+    PVOID  pIbDbBuf,
+    PDWORD pBufSize
+    )
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+
+    if (pHandle == NULL || pIbDbBuf == NULL || pBufSize == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    EnterCriticalSection(&pHandle->pDev->Lock);
+    *pBufSize = emu_db_copy(pHandle->pDev, pIbDbBuf, *pBufSize);
+    LeaveCriticalSection(&pHandle->pDev->Lock);
+
+    return ERROR_SUCCESS;
+}
+
+static DWORD
+emu_msg_send(
+    HANDLE       hDev,
+    DWORD        dwMbox,
+    DWORD        dwDestId,
+    PVOID        pBuffer,
+    PDWORD       pdwBufSize,
+    LPOVERLAPPED lpOvl
+    )
+/*++
+
+Routine Description:
+
+    Queues a message on the link. The caller's buffer is read when the
+    message arrives at the partner, so it must stay valid until the send
+    completes, as with the driver.
+
+--*/
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+    PEMU_REQ pReq;
+    ULONGLONG end;
+    DWORD dwErr;
+
+    UNREFERENCED_PARAMETER(dwDestId);
+
+    if (pHandle == NULL || pBuffer == NULL || pdwBufSize == NULL || lpOvl == NULL ||
+        dwMbox >= g_emu.Cfg.MboxNum || *pdwBufSize == 0 || *pdwBufSize > EMU_MSG_MAX_SIZE)
+        return ERROR_INVALID_PARAMETER;
+
+    pReq = emu_req_alloc(pHandle, lpOvl, EMU_REQ_MSG_ARRIVE, pBuffer, *pdwBufSize);
+    if (pReq == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    // Payload travels in 8-byte units
+    end = emu_link_reserve(pHandle->pDev, (*pdwBufSize + 7) & ~7, emu_now());
+    if (end == 0) {
+        free(pReq);
+        return ERROR_GEN_FAILURE;
+    }
+
+    pReq->Mbox = dwMbox;
+    pReq->SrcId = (pHandle->pDev->Csr[RIO_BASE_ID_CSR / 4] >> 16) & 0xff;
+    pReq->Due = end + g_emu.LatTicks / 2;
+
+    emu_pend(lpOvl);
+    InterlockedIncrement(&pHandle->InFlight);
+
+    dwErr = emu_timer_add(pReq);
+    if (dwErr != ERROR_SUCCESS) {
+        InterlockedDecrement(&pHandle->InFlight);
+        free(pReq);
+        return dwErr;
+    }
+
+    return ERROR_IO_PENDING;
+}
+
+static DWORD
+emu_msg_add_rcv_buffer(
+    HANDLE       hDev,
+    DWORD        dwMbox,
+    PVOID        pBuffer,
+    PDWORD       pdwBufSize,
+    LPOVERLAPPED lpOvl
+    )
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+    PEMU_REQ pReq;
+
+    if (pHandle == NULL || pBuffer == NULL || pdwBufSize == NULL || lpOvl == NULL ||
+        dwMbox >= g_emu.Cfg.MboxNum || *pdwBufSize == 0)
+        return ERROR_INVALID_PARAMETER;
+
+    pReq = emu_req_alloc(pHandle, lpOvl, EMU_REQ_RX_BUF, pBuffer, *pdwBufSize);
+    if (pReq == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    emu_pend(lpOvl);
+
+    EnterCriticalSection(&pHandle->pDev->Lock);
+    emu_list_add(&pHandle->pDev->RxBuf[dwMbox], pReq);
+    LeaveCriticalSection(&pHandle->pDev->Lock);
+
+    return ERROR_IO_PENDING;
+}
+
+static DWORD
+emu_ib_msg_devid_set(
+    HANDLE hDev,
+    DWORD  dwIbMsgDevId
+    )
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+
+    if (pHandle == NULL || dwIbMsgDevId > 0xffff)
+        return ERROR_INVALID_PARAMETER;
+
+    pHandle->pDev->IbMsgDevId = dwIbMsgDevId;
+    return ERROR_SUCCESS;
+}
+
+static DWORD
+emu_bind_port(
+    HANDLE    hDev,
+    HANDLE    hPort,
+    ULONG_PTR Key
+    )
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+
+    if (pHandle == NULL || hPort == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    pHandle->hPort = hPort;
+    pHandle->Key = Key;
+    return ERROR_SUCCESS;
+}
+
+static DWORD
+emu_cancel_io(
+    HANDLE       hDev,
+    LPOVERLAPPED pOvl
+    )
+/*++
+
+Routine Description:
+
+    Cancels pending doorbell waits and posted receive buffers of a handle.
+    Message sends already on the link are not cancelled.
+
+--*/
+{
+    PEMU_HANDLE pHandle = emu_handle(hDev);
+    EMU_REQ_LIST cancelled = { NULL, NULL };
+    PEMU_DEV pDev;
+    PEMU_REQ pReq;
+    DWORD i, n = 0;
+
+    if (pHandle == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    pDev = pHandle->pDev;
+
+    EnterCriticalSection(&pDev->Lock);
+    emu_list_cancel(&pDev->DbWait, pHandle, pOvl, &cancelled);
+    for (i = 0; i < RIO_MSG_MAX_MBOX; i++)
+        emu_list_cancel(&pDev->RxBuf[i], pHandle, pOvl, &cancelled);
+    LeaveCriticalSection(&pDev->Lock);
+
+    while ((pReq = emu_list_remove(&cancelled)) != NULL) {
+        emu_complete(pHandle, pReq->pOvl, EMU_STATUS_CANCELLED, 0);
+        free(pReq);
+        n++;
+    }
+
+    return (n == 0 && pOvl != NULL) ? ERROR_NOT_FOUND : ERROR_SUCCESS;
+}
+
+const TSI721_DEV_OPS g_emuOps = {
+    "emu",
+    emu_open,
+    emu_close,
+    emu_reg_read,
+    emu_reg_write,
+    emu_pci_cfg_read,
+    emu_get_host_id,
+    emu_set_host_id,
+    emu_maint_read,
+    emu_maint_write,
+    emu_srio_write,
+    emu_srio_read,
+    emu_cfg_r2p_win,
+    emu_free_r2p_win,
+    emu_ibw_get,
+    emu_ibw_put,
+    emu_ibw_map,
+    emu_cfg_p2r_win,
+    emu_cfg_p2r_zone,
+    emu_pio_write,
+    emu_pio_read,
+    emu_db_send,
+    emu_db_wait,
+    emu_db_check,
+    emu_db_get,
+    emu_msg_send,
+    emu_msg_add_rcv_buffer,
+    emu_ib_msg_devid_set,
+    emu_bind_port,
+    emu_cancel_io,
+};
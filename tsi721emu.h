@@ -0,0 +1,87 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721emu.h
+
+Description:
+
+    In-process software model of two Tsi721 devices connected by an SRIO
+    link (device 0 and device 1), used as the "emu" device backend.
+
+--*/
+
+#ifndef _TSI721EMU_H_
+#define _TSI721EMU_H_
+
+#define EMU_DEV_NUM         2           // devices of the modelled pair
+#define EMU_DEF_LINK_MBPS   1600        // payload bandwidth of a x4 link at 6.25 Gbaud
+#define EMU_DEF_LATENCY_NS  2000        // request to response round trip
+#define EMU_DEF_WIN_SIZE    (2 * 1024 * 1024)
+#define EMU_MSG_MAX_SIZE    4096
+
+//
+// Model parameters. The link bandwidth is scaled by the baud rate selected
+// through RIO_SP_CTL2, LinkMBps being the bandwidth at 6.25 Gbaud.
+//
+typedef struct _EMU_CFG {
+    DWORD LinkMBps;     // payload bandwidth per link direction, MB/s
+    DWORD LatencyNs;    // round trip of a request and its response
+    DWORD DmaChNum;     // BDMA transfers serviced concurrently by a device (1 - DMA_MAX_CHNUM)
+    DWORD MboxNum;      // inbound/outbound mailboxes (1 - RIO_MSG_MAX_MBOX)
+    DWORD DbFifoDepth;  // inbound doorbell queue entries
+    DWORD IbWinSize;    // size of inbound window 0, mapped at SRIO address 0 until reconfigured
+    DWORD IbWinMax;     // largest window buffer the driver can allocate (0 = no limit)
+    DWORD IbWinMap;     // window buffers readable in place (0 = copies only, as the driver)
+} EMU_CFG, *PEMU_CFG;
+
+//
+// Device routines of the model (see tsi721dev.h)
+//
+extern const TSI721_DEV_OPS g_emuOps;
+
+/*
+ * tsi721_emu_defaults()
+ *
+ *  Fills a configuration with the default model parameters.
+ */
+VOID tsi721_emu_defaults(__out PEMU_CFG pCfg);
+
+/*
+ * tsi721_emu_parse()
+ *
+ *  Applies a comma separated list of options to a configuration:
+ *   bw=<MB/s>  lat=<ns>  ch=<BDMA channels>  mbox=<mailboxes>
+ *   db=<doorbell queue entries>  win=<inbound window KB>
+ *   winmax=<largest inbound window KB>  ibmap=<0|1>
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if all options were applied,
+ *  ERROR_INVALID_PARAMETER - if an option or its value is invalid.
+ */
+DWORD
+tsi721_emu_parse(
+    __in    PCSTR    pOpts,
+    __inout PEMU_CFG pCfg
+    );
+
+/*
+ * tsi721_emu_config()
+ *
+ *  Sets the model parameters. Must be called before the first device is
+ *  opened; the defaults are used otherwise.
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the parameters were accepted,
+ *  ERROR_BUSY - if the model is already running,
+ *  ERROR_INVALID_PARAMETER - if a parameter is out of range.
+ */
+DWORD tsi721_emu_config(__in const EMU_CFG *pCfg);
+
+#endif // _TSI721EMU_H_
@@ -0,0 +1,920 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721enum.cpp
+
+Description:
+
+    Breadth-first SRIO fabric enumeration.
+
+    A hop level is handled in batches of independent requests, each batch
+    spread over a pool of threads issuing blocking maintenance requests:
+
+     1. probe    - device ID, features and component tag of the new nodes
+     2. tag      - write the enumeration tag, then read it back; of several
+                   new nodes that are one device reached over parallel
+                   paths only the last writer reads its own tag
+     3. init     - base destID of end points, port status of switches
+     4. routes   - destIDs of the next level into the switch route tables,
+                   one job per switch since a route is set by two writes
+
+    Every new node gets its destID before it is probed and the route to it
+    is programmed along its whole path, so nodes of a level are addressed
+    by (destID, hop count) and never by a shared probe ID.
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <process.h>
+
+#include "tsi721api.h"
+#include "tsi721csr.h"
+#include "tsi721dev.h"
+#include "tsi721stat.h"
+#include "tsi721trace.h"
+#include "tsi721enum.h"
+
+#define ENUM_FILE_VERSION   1
+#define ENUM_NO_NODE        0xffffffff
+
+typedef struct _ENUM_SCRATCH {
+    DWORD Tag;          // tag read by the probe
+    DWORD SwpInfo;
+    DWORD AsmInfo;
+    DWORD AliasId;      // destID of the same device reached earlier (ENUM_NO_NODE = none)
+} ENUM_SCRATCH, *PENUM_SCRATCH;
+
+typedef struct _ENUM_ROUTE {
+    DWORD Switch;       // node index
+    DWORD DestId;
+    DWORD Port;
+} ENUM_ROUTE, *PENUM_ROUTE;
+
+typedef struct _ENUM_CTX *PENUM_CTX;
+typedef DWORD (*PFN_ENUM_JOB)(PENUM_CTX pCtx, DWORD dwItem);
+
+typedef struct _ENUM_WORKER {
+    PENUM_CTX pCtx;
+    HANDLE    hThread;
+    HANDLE    hGo;          // auto reset, starts one batch
+} ENUM_WORKER, *PENUM_WORKER;
+
+typedef struct _ENUM_CTX {
+    HANDLE        hDev;
+    PENUM_TOPO    pTopo;
+    ENUM_SCRATCH  Scratch[ENUM_MAX_NODES];
+    DWORD         NodeOfId[ENUM_MAX_NODES];    // destID to node index
+    ENUM_ROUTE    Route[ENUM_MAX_NODES * ENUM_DEF_MAX_HOPS];
+    DWORD         RouteNum;
+
+    // Batch executed by the pool
+    PENUM_WORKER  Worker;
+    DWORD         WorkerNum;
+    HANDLE        hDone;        // auto reset, set by the last worker of a batch
+    volatile BOOL bStop;
+    PFN_ENUM_JOB  pfnJob;
+    PDWORD        pItem;
+    LONG          ItemNum;
+    volatile LONG Next;
+    volatile LONG Active;
+    volatile LONG Err;
+    volatile LONG MaintOps;
+} ENUM_CTX;
+
+static DWORD
+enum_rd(
+    PENUM_CTX pCtx,
+    DWORD     dwNode,
+    DWORD     dwOffset,
+    PDWORD    pValue
+    )
+{
+    PENUM_NODE pNode = &pCtx->pTopo->Node[dwNode];
+    ULONGLONG  t0 = lat_ticks();
+    DWORD      dwErr;
+
+    dwErr = g_devOps->SrioMaintRead(pCtx->hDev, pNode->DestId, pNode->HopCnt, dwOffset, pValue);
+    tsi721_trace(TRACE_EV_MAINT_READ, dwErr, pNode->DestId, dwOffset, *pValue, t0);
+    InterlockedIncrement(&pCtx->MaintOps);
+
+    return dwErr;
+}
+
+static DWORD
+enum_wr(
+    PENUM_CTX pCtx,
+    DWORD     dwNode,
+    DWORD     dwOffset,
+    DWORD     dwValue
+    )
+{
+    PENUM_NODE pNode = &pCtx->pTopo->Node[dwNode];
+    ULONGLONG  t0 = lat_ticks();
+    DWORD      dwErr;
+
+    dwErr = g_devOps->SrioMaintWrite(pCtx->hDev, pNode->DestId, pNode->HopCnt, dwOffset, dwValue);
+    tsi721_trace(TRACE_EV_MAINT_WRITE, dwErr, pNode->DestId, dwOffset, dwValue, t0);
+    InterlockedIncrement(&pCtx->MaintOps);
+
+    return dwErr;
+}
+
+//
+// Thread pool
+//
+
+static unsigned __stdcall
+enum_worker(
+    PVOID params
+    )
+{
+    PENUM_WORKER pWrk = (PENUM_WORKER)params;
+    PENUM_CTX    pCtx = pWrk->pCtx;
+    LONG         item;
+    DWORD        dwErr;
+
+    for (;;) {
+        WaitForSingleObject(pWrk->hGo, INFINITE);
+        if (pCtx->bStop)
+            break;
+
+        while ((item = InterlockedIncrement(&pCtx->Next) - 1) < pCtx->ItemNum) {
+            dwErr = pCtx->pfnJob(pCtx, pCtx->pItem[item]);
+            if (dwErr != ERROR_SUCCESS)
+                InterlockedCompareExchange(&pCtx->Err, (LONG)dwErr, ERROR_SUCCESS);
+        }
+
+        if (InterlockedDecrement(&pCtx->Active) == 0)
+            SetEvent(pCtx->hDone);
+    }
+
+    return 0;
+}
+
+static DWORD
+enum_batch(
+    PENUM_CTX    pCtx,
+    PFN_ENUM_JOB pfnJob,
+    PDWORD       pItem,
+    DWORD        dwNum
+    )
+/*++
+
+Routine Description:
+
+    Runs a job for every item on the pool and waits for all of them. Only
+    as many workers are started as there are items.
+
+Return Value:
+
+    ERROR_SUCCESS or the error of the first failed job.
+
+--*/
+{
+    DWORD i, workers;
+
+    if (dwNum == 0)
+        return ERROR_SUCCESS;
+
+    workers = min(dwNum, pCtx->WorkerNum);
+
+    pCtx->pfnJob = pfnJob;
+    pCtx->pItem = pItem;
+    pCtx->ItemNum = (LONG)dwNum;
+    pCtx->Next = 0;
+    pCtx->Err = ERROR_SUCCESS;
+    pCtx->Active = (LONG)workers;
+    MemoryBarrier();
+
+    for (i = 0; i < workers; i++)
+        SetEvent(pCtx->Worker[i].hGo);
+
+    WaitForSingleObject(pCtx->hDone, INFINITE);
+
+    return (DWORD)pCtx->Err;
+}
+
+static VOID
+enum_pool_stop(
+    PENUM_CTX pCtx
+    )
+{
+    DWORD i;
+
+    pCtx->bStop = TRUE;
+
+    for (i = 0; i < pCtx->WorkerNum; i++) {
+        if (pCtx->Worker[i].hThread) {
+            SetEvent(pCtx->Worker[i].hGo);
+            WaitForSingleObject(pCtx->Worker[i].hThread, INFINITE);
+            CloseHandle(pCtx->Worker[i].hThread);
+        }
+        if (pCtx->Worker[i].hGo)
+            CloseHandle(pCtx->Worker[i].hGo);
+    }
+
+    if (pCtx->hDone)
+        CloseHandle(pCtx->hDone);
+
+    free(pCtx->Worker);
+}
+
+static DWORD
+enum_pool_start(
+    PENUM_CTX pCtx,
+    DWORD     dwThreads
+    )
+{
+    DWORD i;
+
+    pCtx->Worker = (PENUM_WORKER)calloc(dwThreads, sizeof(ENUM_WORKER));
+    pCtx->hDone = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (pCtx->Worker == NULL || pCtx->hDone == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    for (i = 0; i < dwThreads; i++) {
+        pCtx->Worker[i].pCtx = pCtx;
+        pCtx->Worker[i].hGo = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if (pCtx->Worker[i].hGo == NULL)
+            return GetLastError();
+
+        pCtx->WorkerNum = i + 1;
+
+        pCtx->Worker[i].hThread = (HANDLE)_beginthreadex(NULL, 0, enum_worker,
+                                                        &pCtx->Worker[i], 0, NULL);
+        if (pCtx->Worker[i].hThread == NULL)
+            return GetLastError();
+    }
+
+    return ERROR_SUCCESS;
+}
+
+//
+// Jobs
+//
+
+static DWORD
+enum_job_probe(
+    PENUM_CTX pCtx,
+    DWORD     dwNode
+    )
+{
+    PENUM_NODE    pNode = &pCtx->pTopo->Node[dwNode];
+    PENUM_SCRATCH pScr = &pCtx->Scratch[dwNode];
+    DWORD         dwErr;
+
+    dwErr = enum_rd(pCtx, dwNode, RIO_DEV_ID_CAR, &pNode->DevId);
+    if (dwErr == ERROR_SUCCESS)
+        dwErr = enum_rd(pCtx, dwNode, RIO_PE_FEAT, &pNode->PeFeat);
+    if (dwErr == ERROR_SUCCESS)
+        dwErr = enum_rd(pCtx, dwNode, RIO_COMPONENT_TAG_CSR, &pScr->Tag);
+    if (dwErr == ERROR_SUCCESS && ENUM_IS_SWITCH(pNode))
+        dwErr = enum_rd(pCtx, dwNode, RIO_SWP_INFO_CAR, &pScr->SwpInfo);
+    if (dwErr == ERROR_SUCCESS && ENUM_IS_SWITCH(pNode))
+        dwErr = enum_rd(pCtx, dwNode, RIO_ASM_INFO_CAR, &pScr->AsmInfo);
+
+    return dwErr;
+}
+
+static DWORD
+enum_job_tag(
+    PENUM_CTX pCtx,
+    DWORD     dwNode
+    )
+{
+    return enum_wr(pCtx, dwNode, RIO_COMPONENT_TAG_CSR, pCtx->pTopo->Node[dwNode].Tag);
+}
+
+static DWORD
+enum_job_tag_check(
+    PENUM_CTX pCtx,
+    DWORD     dwNode
+    )
+{
+    return enum_rd(pCtx, dwNode, RIO_COMPONENT_TAG_CSR, &pCtx->Scratch[dwNode].Tag);
+}
+
+static DWORD
+enum_job_init(
+    PENUM_CTX pCtx,
+    DWORD     dwNode
+    )
+/*++
+
+Routine Description:
+
+    Sets the base destID of an end point. For a switch, finds the LP-Serial
+    extended feature block and records the ports whose link is up.
+
+--*/
+{
+    PENUM_NODE    pNode = &pCtx->pTopo->Node[dwNode];
+    PENUM_SCRATCH pScr = &pCtx->Scratch[dwNode];
+    DWORD         ef, hdr, stat, port, hops, dwErr;
+
+    if (!ENUM_IS_SWITCH(pNode))
+        return enum_wr(pCtx, dwNode, RIO_BASE_ID_CSR,
+                       ((pNode->DestId & 0xff) << 16) | (pNode->DestId & 0xffff));
+
+    pNode->PortTotal = min(RIO_SWP_INFO_PORT_TOTAL(pScr->SwpInfo), ENUM_MAX_PORTS);
+    pNode->IngressPort = RIO_SWP_INFO_PORT_NUM(pScr->SwpInfo);
+
+    // A bounded walk, a corrupt list must not hang the enumeration
+    for (ef = RIO_ASM_INFO_EF_PTR(pScr->AsmInfo), hops = 0; ef != 0 && hops < 16; hops++) {
+        dwErr = enum_rd(pCtx, dwNode, ef, &hdr);
+        if (dwErr != ERROR_SUCCESS)
+            return dwErr;
+
+        if (RIO_EF_IS_LP_SERIAL(RIO_EF_ID(hdr))) {
+            for (port = 0; port < pNode->PortTotal; port++) {
+                dwErr = enum_rd(pCtx, dwNode, ef + RIO_EF_PORT_ERR_STAT(port), &stat);
+                if (dwErr != ERROR_SUCCESS)
+                    return dwErr;
+
+                if (stat & RIO_PORT_N_ERR_STAT_PORT_OK)
+                    pNode->PortMask |= 1u << port;
+            }
+            break;
+        }
+
+        ef = RIO_EF_NEXT(hdr);
+    }
+
+    return ERROR_SUCCESS;
+}
+
+static DWORD
+enum_job_routes(
+    PENUM_CTX pCtx,
+    DWORD     dwFirst
+    )
+/*++
+
+Routine Description:
+
+    Programs the routes of one switch, starting at Route[dwFirst] and
+    ending with the last consecutive entry of the same switch.
+
+--*/
+{
+    PENUM_ROUTE pRt = &pCtx->Route[dwFirst];
+    DWORD       sw = pRt->Switch;
+    DWORD       dwErr = ERROR_SUCCESS;
+
+    for (; pRt < &pCtx->Route[pCtx->RouteNum] && pRt->Switch == sw; pRt++) {
+        dwErr = enum_wr(pCtx, sw, RIO_STD_RTE_DESTID_SEL_CSR, pRt->DestId);
+        if (dwErr == ERROR_SUCCESS)
+            dwErr = enum_wr(pCtx, sw, RIO_STD_RTE_PORT_SEL_CSR, pRt->Port);
+        if (dwErr != ERROR_SUCCESS)
+            break;
+    }
+
+    return dwErr;
+}
+
+static DWORD
+enum_job_verify(
+    PENUM_CTX pCtx,
+    DWORD     dwNode
+    )
+{
+    PENUM_NODE pNode = &pCtx->pTopo->Node[dwNode];
+    DWORD      devId, tag, dwErr;
+
+    dwErr = enum_rd(pCtx, dwNode, RIO_DEV_ID_CAR, &devId);
+    if (dwErr == ERROR_SUCCESS)
+        dwErr = enum_rd(pCtx, dwNode, RIO_COMPONENT_TAG_CSR, &tag);
+    if (dwErr == ERROR_SUCCESS && (devId != pNode->DevId || tag != pNode->Tag))
+        dwErr = ERROR_INVALID_DATA;
+
+    return dwErr;
+}
+
+//
+// Enumeration
+//
+
+static int
+enum_route_cmp(
+    const void *a,
+    const void *b
+    )
+{
+    const ENUM_ROUTE *ra = (const ENUM_ROUTE *)a;
+    const ENUM_ROUTE *rb = (const ENUM_ROUTE *)b;
+
+    if (ra->Switch != rb->Switch)
+        return (ra->Switch < rb->Switch) ? -1 : 1;
+    return (ra->DestId < rb->DestId) ? -1 : (ra->DestId > rb->DestId);
+}
+
+static DWORD
+enum_add_link(
+    PENUM_TOPO pTopo,
+    PENUM_NODE pNode,
+    DWORD      dwPeer
+    )
+{
+    PENUM_LINK pLink;
+
+    if (pNode->Parent == ENUM_NO_PARENT)
+        return ERROR_SUCCESS;   // the host port has a single link
+
+    if (pTopo->LinkNum == ENUM_MAX_LINKS)
+        return ERROR_NO_MORE_ITEMS;
+
+    pLink = &pTopo->Link[pTopo->LinkNum++];
+    pLink->Node = pNode->Parent;
+    pLink->Port = pNode->ParentPort;
+    pLink->Peer = dwPeer;
+
+    return ERROR_SUCCESS;
+}
+
+static DWORD
+enum_level(
+    PENUM_CTX pCtx,
+    DWORD     dwFirst,
+    PDWORD    pItem
+    )
+/*++
+
+Routine Description:
+
+    Identifies the nodes dwFirst...NodeNum-1 of one hop level, drops those
+    that are devices found before and initializes the others.
+
+--*/
+{
+    PENUM_TOPO pTopo = pCtx->pTopo;
+    DWORD      i, n, num, links, aliasId, dwErr;
+
+    for (i = dwFirst, num = 0; i < pTopo->NodeNum; i++)
+        pItem[num++] = i;
+
+    dwErr = enum_batch(pCtx, enum_job_probe, pItem, num);
+    if (dwErr != ERROR_SUCCESS)
+        return dwErr;
+
+    //
+    // A tag of this run names the host or a device of an earlier level. The
+    // others get their tag; nodes of this level that are one device all read
+    // back the tag of the last writer.
+    //
+    for (i = dwFirst, num = 0; i < pTopo->NodeNum; i++) {
+        DWORD tag = pCtx->Scratch[i].Tag;
+
+        pCtx->Scratch[i].AliasId = ENUM_NO_NODE;
+        if ((tag & ENUM_TAG_MAGIC_MASK) == ENUM_TAG_MAGIC && ENUM_TAG_GEN(tag) == pTopo->Gen)
+            pCtx->Scratch[i].AliasId = ENUM_TAG_DESTID(tag);
+        else
+            pItem[num++] = i;
+    }
+
+    dwErr = enum_batch(pCtx, enum_job_tag, pItem, num);
+    if (dwErr == ERROR_SUCCESS)
+        dwErr = enum_batch(pCtx, enum_job_tag_check, pItem, num);
+    if (dwErr != ERROR_SUCCESS)
+        return dwErr;
+
+    for (n = 0; n < num; n++) {
+        i = pItem[n];
+        if (pCtx->Scratch[i].Tag != pTopo->Node[i].Tag)
+            pCtx->Scratch[i].AliasId = ENUM_TAG_DESTID(pCtx->Scratch[i].Tag);
+    }
+
+    //
+    // Keep the first node of every device; the routes set up for the others
+    // lead to the same device and their destIDs stay unused. Links name the
+    // peer by destID until the level is compacted.
+    //
+    links = pTopo->LinkNum;
+
+    for (i = n = dwFirst; i < pTopo->NodeNum; i++) {
+        aliasId = pCtx->Scratch[i].AliasId;
+
+        if (aliasId != ENUM_NO_NODE) {
+            pCtx->NodeOfId[pTopo->Node[i].DestId] = ENUM_NO_NODE;
+
+            if (aliasId == pTopo->HostId)
+                continue;   // looped back to the host
+            if (aliasId >= ENUM_MAX_NODES || pCtx->NodeOfId[aliasId] == ENUM_NO_NODE)
+                return ERROR_INVALID_DATA;  // tag overwritten by someone else
+
+            dwErr = enum_add_link(pTopo, &pTopo->Node[i], aliasId);
+            if (dwErr != ERROR_SUCCESS)
+                return dwErr;
+            continue;
+        }
+
+        if (n != i) {
+            pTopo->Node[n] = pTopo->Node[i];
+            pCtx->Scratch[n] = pCtx->Scratch[i];
+            pCtx->NodeOfId[pTopo->Node[n].DestId] = n;
+        }
+        n++;
+    }
+
+    pTopo->NodeNum = n;
+
+    for (i = links; i < pTopo->LinkNum; i++)
+        pTopo->Link[i].Peer = pCtx->NodeOfId[pTopo->Link[i].Peer];
+
+    for (i = dwFirst, num = 0; i < pTopo->NodeNum; i++)
+        pItem[num++] = i;
+
+    return enum_batch(pCtx, enum_job_init, pItem, num);
+}
+
+static DWORD
+enum_next_level(
+    PENUM_CTX pCtx,
+    DWORD     dwFirst,
+    PDWORD    pdwNextId,
+    PDWORD    pItem
+    )
+/*++
+
+Routine Description:
+
+    Creates a node for every active port of the switches of the level
+    dwFirst...NodeNum-1 and routes its destID to it through all switches on
+    its path.
+
+--*/
+{
+    PENUM_TOPO pTopo = pCtx->pTopo;
+    DWORD      last = pTopo->NodeNum;
+    DWORD      i, port, child, node, num;
+
+    pCtx->RouteNum = 0;
+
+    for (i = dwFirst; i < last; i++) {
+        PENUM_NODE pSw = &pTopo->Node[i];
+
+        if (!ENUM_IS_SWITCH(pSw))
+            continue;
+
+        for (port = 0; port < pSw->PortTotal; port++) {
+            if (!(pSw->PortMask & (1u << port)) || port == pSw->IngressPort)
+                continue;
+
+            if (*pdwNextId == pTopo->HostId)
+                (*pdwNextId)++;
+            if (*pdwNextId >= ENUM_MAX_NODES || pTopo->NodeNum == ENUM_MAX_NODES)
+                return ERROR_NO_MORE_ITEMS;
+
+            child = pTopo->NodeNum++;
+            ZeroMemory(&pTopo->Node[child], sizeof(ENUM_NODE));
+            pTopo->Node[child].DestId = (*pdwNextId)++;
+            pTopo->Node[child].HopCnt = pSw->HopCnt + 1;
+            pTopo->Node[child].Parent = i;
+            pTopo->Node[child].ParentPort = port;
+            pTopo->Node[child].Tag = ENUM_TAG_MAGIC | (pTopo->Gen << 16) | pTopo->Node[child].DestId;
+            pCtx->NodeOfId[pTopo->Node[child].DestId] = child;
+
+            for (node = child; pTopo->Node[node].Parent != ENUM_NO_PARENT; node = pTopo->Node[node].Parent) {
+                PENUM_ROUTE pRt = &pCtx->Route[pCtx->RouteNum++];
+
+                pRt->Switch = pTopo->Node[node].Parent;
+                pRt->DestId = pTopo->Node[child].DestId;
+                pRt->Port = pTopo->Node[node].ParentPort;
+            }
+        }
+    }
+
+    qsort(pCtx->Route, pCtx->RouteNum, sizeof(ENUM_ROUTE), enum_route_cmp);
+
+    for (i = 0, num = 0; i < pCtx->RouteNum; i++)
+        if (i == 0 || pCtx->Route[i].Switch != pCtx->Route[i - 1].Switch)
+            pItem[num++] = i;
+
+    return enum_batch(pCtx, enum_job_routes, pItem, num);
+}
+
+DWORD
+tsi721_enum_run(
+    HANDLE     hDev,
+    PENUM_CFG  pCfg,
+    PENUM_TOPO pTopo
+    )
+/*++
+
+Routine Description:
+
+    Enumerates the fabric level by level.
+
+Arguments:
+
+    hDev  - device handle of the host
+    pCfg  - enumeration parameters
+    pTopo - receives the topology
+
+Return Value:
+
+    ERROR_SUCCESS or an error code.
+
+--*/
+{
+    PENUM_CTX pCtx;
+    PDWORD    pItem = NULL;
+    ULONGLONG t0 = lat_ticks();
+    DWORD     maxHops, nextId, first, hop, tag, dwErr;
+
+    maxHops = pCfg->MaxHops ? pCfg->MaxHops : ENUM_DEF_MAX_HOPS;
+    if (maxHops > ENUM_DEF_MAX_HOPS || pCfg->FirstDestId >= ENUM_MAX_NODES)
+        return ERROR_INVALID_PARAMETER;
+
+    pCtx = (PENUM_CTX)calloc(1, sizeof(ENUM_CTX));
+    pItem = (PDWORD)malloc(ENUM_MAX_NODES * ENUM_DEF_MAX_HOPS * sizeof(DWORD));
+    if (pCtx == NULL || pItem == NULL) {
+        dwErr = ERROR_NOT_ENOUGH_MEMORY;
+        goto exit;
+    }
+
+    ZeroMemory(pTopo, sizeof(ENUM_TOPO));
+    pCtx->hDev = hDev;
+    pCtx->pTopo = pTopo;
+    memset(pCtx->NodeOfId, 0xff, sizeof(pCtx->NodeOfId));
+
+    dwErr = enum_pool_start(pCtx, pCfg->Threads ? pCfg->Threads : ENUM_DEF_THREADS);
+    if (dwErr != ERROR_SUCCESS)
+        goto exit;
+
+    dwErr = g_devOps->GetLocalHostId(hDev, &pTopo->HostId);
+    if (dwErr != ERROR_SUCCESS)
+        goto exit;
+
+    //
+    // A new generation keeps tags of an earlier enumeration from matching:
+    // the host carries the generation of the previous run. The host is
+    // tagged too, so a path looping back to it is recognized.
+    //
+    dwErr = tsi721_csr_read(hDev, RIO_COMPONENT_TAG_CSR, &tag);
+    if (dwErr != ERROR_SUCCESS)
+        goto exit;
+
+    if ((tag & ENUM_TAG_MAGIC_MASK) == ENUM_TAG_MAGIC)
+        pTopo->Gen = (ENUM_TAG_GEN(tag) + 1) & 0xff;
+    else
+        pTopo->Gen = (DWORD)(lat_ticks() & 0xff);
+
+    dwErr = g_devOps->RegisterWrite(hDev, RIO_COMPONENT_TAG_CSR,
+                                    ENUM_TAG_MAGIC | (pTopo->Gen << 16) | pTopo->HostId);
+    if (dwErr != ERROR_SUCCESS)
+        goto exit;
+
+    //
+    // Level 0 is the link partner of the host port, reached without routing
+    //
+    nextId = pCfg->FirstDestId;
+    if (nextId == pTopo->HostId)
+        nextId++;
+
+    pTopo->NodeNum = 1;
+    pTopo->Node[0].DestId = nextId++;
+    pTopo->Node[0].Parent = ENUM_NO_PARENT;
+    pTopo->Node[0].Tag = ENUM_TAG_MAGIC | (pTopo->Gen << 16) | pTopo->Node[0].DestId;
+    pCtx->NodeOfId[pTopo->Node[0].DestId] = 0;
+
+    for (hop = 0, first = 0; first < pTopo->NodeNum; hop++) {
+        DWORD last;
+
+        dwErr = enum_level(pCtx, first, pItem);
+        if (dwErr != ERROR_SUCCESS)
+            break;
+
+        pTopo->MaxHop = hop;
+        last = pTopo->NodeNum;
+
+        if (hop + 1 < maxHops) {
+            dwErr = enum_next_level(pCtx, first, &nextId, pItem);
+            if (dwErr != ERROR_SUCCESS)
+                break;
+        }
+
+        first = last;
+    }
+
+exit:
+
+    if (pCtx) {
+        enum_pool_stop(pCtx);
+        pTopo->MaintOps = (DWORD)pCtx->MaintOps;
+        free(pCtx);
+    }
+    free(pItem);
+
+    pTopo->ElapsedNs = lat_ticks_to_ns(lat_ticks() - t0);
+
+    return dwErr;
+}
+
+DWORD
+tsi721_enum_verify(
+    HANDLE     hDev,
+    PENUM_TOPO pTopo,
+    DWORD      dwThreads
+    )
+/*++
+
+Routine Description:
+
+    Compares the identity of all saved nodes with the fabric. All routes
+    are in place, so every node is checked in one batch.
+
+Arguments:
+
+    hDev      - device handle of the host
+    pTopo     - saved topology
+    dwThreads - maintenance requests in flight (0 = ENUM_DEF_THREADS)
+
+Return Value:
+
+    ERROR_SUCCESS, ERROR_INVALID_DATA or an error code.
+
+--*/
+{
+    PENUM_CTX pCtx;
+    PDWORD    pItem = NULL;
+    ULONGLONG t0 = lat_ticks();
+    DWORD     i, dwErr;
+
+    pCtx = (PENUM_CTX)calloc(1, sizeof(ENUM_CTX));
+    pItem = (PDWORD)malloc(ENUM_MAX_NODES * sizeof(DWORD));
+    if (pCtx == NULL || pItem == NULL) {
+        dwErr = ERROR_NOT_ENOUGH_MEMORY;
+        goto exit;
+    }
+
+    pCtx->hDev = hDev;
+    pCtx->pTopo = pTopo;
+
+    dwErr = enum_pool_start(pCtx, dwThreads ? dwThreads : ENUM_DEF_THREADS);
+    if (dwErr != ERROR_SUCCESS)
+        goto exit;
+
+    for (i = 0; i < pTopo->NodeNum; i++)
+        pItem[i] = i;
+
+    dwErr = enum_batch(pCtx, enum_job_verify, pItem, pTopo->NodeNum);
+
+exit:
+
+    if (pCtx) {
+        enum_pool_stop(pCtx);
+        pTopo->MaintOps = (DWORD)pCtx->MaintOps;
+        free(pCtx);
+    }
+    free(pItem);
+
+    pTopo->ElapsedNs = lat_ticks_to_ns(lat_ticks() - t0);
+
+    return dwErr;
+}
+
+DWORD
+tsi721_enum_save(
+    PENUM_TOPO pTopo,
+    PCSTR      pPath
+    )
+{
+    FILE      *fp;
+    PENUM_NODE pNode;
+    DWORD      i;
+
+    if (fopen_s(&fp, pPath, "w") != 0 || fp == NULL)
+        return ERROR_FILE_NOT_FOUND;
+
+    fprintf(fp, "# Tsi721 fabric topology\n");
+    fprintf(fp, "topo %u host %u gen %u nodes %u links %u\n", ENUM_FILE_VERSION,
+            pTopo->HostId, pTopo->Gen, pTopo->NodeNum, pTopo->LinkNum);
+    fprintf(fp, "# node destid hop dev_id pe_feat tag parent parent_port ingress ports port_mask\n");
+
+    for (i = 0; i < pTopo->NodeNum; i++) {
+        pNode = &pTopo->Node[i];
+        fprintf(fp, "node %u %u 0x%08x 0x%08x 0x%08x %d %u %u %u 0x%08x\n",
+                pNode->DestId, pNode->HopCnt, pNode->DevId, pNode->PeFeat, pNode->Tag,
+                (int)pNode->Parent, pNode->ParentPort, pNode->IngressPort,
+                pNode->PortTotal, pNode->PortMask);
+    }
+
+    for (i = 0; i < pTopo->LinkNum; i++)
+        fprintf(fp, "link %u %u %u\n", pTopo->Link[i].Node, pTopo->Link[i].Port, pTopo->Link[i].Peer);
+
+    fclose(fp);
+    return ERROR_SUCCESS;
+}
+
+DWORD
+tsi721_enum_load(
+    PCSTR      pPath,
+    PENUM_TOPO pTopo
+    )
+{
+    FILE      *fp;
+    PENUM_NODE pNode;
+    char       line[256];
+    DWORD      ver = 0, nodeNum = 0, linkNum = 0, i;
+    int        parent;
+    DWORD      dwErr = ERROR_SUCCESS;
+
+    if (fopen_s(&fp, pPath, "r") != 0 || fp == NULL)
+        return ERROR_FILE_NOT_FOUND;
+
+    ZeroMemory(pTopo, sizeof(ENUM_TOPO));
+
+    while (dwErr == ERROR_SUCCESS && fgets(line, sizeof(line), fp) != NULL) {
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+
+        if (strncmp(line, "topo ", 5) == 0) {
+            if (sscanf_s(line, "topo %u host %u gen %u nodes %u links %u", &ver,
+                         &pTopo->HostId, &pTopo->Gen, &nodeNum, &linkNum) != 5 ||
+                ver != ENUM_FILE_VERSION || nodeNum > ENUM_MAX_NODES || linkNum > ENUM_MAX_LINKS)
+                dwErr = ERROR_INVALID_DATA;
+        }
+        else if (strncmp(line, "node ", 5) == 0 && ver && pTopo->NodeNum < nodeNum) {
+            pNode = &pTopo->Node[pTopo->NodeNum];
+            if (sscanf_s(line, "node %u %u %x %x %x %d %u %u %u %x", &pNode->DestId,
+                         &pNode->HopCnt, &pNode->DevId, &pNode->PeFeat, &pNode->Tag, &parent,
+                         &pNode->ParentPort, &pNode->IngressPort, &pNode->PortTotal,
+                         &pNode->PortMask) != 10 ||
+                (parent >= (int)pTopo->NodeNum) || parent < -1)
+                dwErr = ERROR_INVALID_DATA;
+
+            pNode->Parent = (DWORD)parent;
+            pTopo->MaxHop = max(pTopo->MaxHop, pNode->HopCnt);
+            pTopo->NodeNum++;
+        }
+        else if (strncmp(line, "link ", 5) == 0 && ver && pTopo->LinkNum < linkNum) {
+            PENUM_LINK pLink = &pTopo->Link[pTopo->LinkNum++];
+
+            if (sscanf_s(line, "link %u %u %u", &pLink->Node, &pLink->Port, &pLink->Peer) != 3)
+                dwErr = ERROR_INVALID_DATA;
+        }
+        else
+            dwErr = ERROR_INVALID_DATA;
+    }
+
+    fclose(fp);
+
+    if (dwErr == ERROR_SUCCESS && (ver == 0 || pTopo->NodeNum != nodeNum || pTopo->LinkNum != linkNum))
+        dwErr = ERROR_INVALID_DATA;
+
+    // Links index the node table, like the parents checked above
+    for (i = 0; dwErr == ERROR_SUCCESS && i < pTopo->LinkNum; i++)
+        if (pTopo->Link[i].Node >= pTopo->NodeNum || pTopo->Link[i].Peer >= pTopo->NodeNum)
+            dwErr = ERROR_INVALID_DATA;
+
+    return dwErr;
+}
+
+static VOID
+enum_print_node(
+    PENUM_TOPO pTopo,
+    DWORD      dwNode,
+    DWORD      dwDepth
+    )
+{
+    PENUM_NODE pNode = &pTopo->Node[dwNode];
+    DWORD      i;
+
+    printf_s("%*s", (int)dwDepth * 2, "");
+    if (pNode->Parent != ENUM_NO_PARENT)
+        printf_s("[port %u] ", pNode->ParentPort);
+
+    if (ENUM_IS_SWITCH(pNode))
+        printf_s("switch 0x%08x destID=%u hop=%u ports=%u active=0x%x\n", pNode->DevId,
+                 pNode->DestId, pNode->HopCnt, pNode->PortTotal, pNode->PortMask);
+    else
+        printf_s("endpoint 0x%08x destID=%u hop=%u\n", pNode->DevId, pNode->DestId, pNode->HopCnt);
+
+    for (i = 0; i < pTopo->LinkNum; i++)
+        if (pTopo->Link[i].Node == dwNode)
+            printf_s("%*s[port %u] -> destID=%u\n", (int)(dwDepth + 1) * 2, "",
+                     pTopo->Link[i].Port, pTopo->Node[pTopo->Link[i].Peer].DestId);
+
+    for (i = dwNode + 1; i < pTopo->NodeNum; i++)
+        if (pTopo->Node[i].Parent == dwNode)
+            enum_print_node(pTopo, i, dwDepth + 1);
+}
+
+VOID
+tsi721_enum_print(
+    PENUM_TOPO pTopo
+    )
+{
+    printf_s("host destID=%u\n", pTopo->HostId);
+
+    if (pTopo->NodeNum)
+        enum_print_node(pTopo, 0, 1);
+}
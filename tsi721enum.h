@@ -0,0 +1,151 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721enum.h
+
+Description:
+
+    Breadth-first enumeration of a switched SRIO fabric. Discovers switches
+    and end points one hop level at a time, assigns destIDs, programs the
+    switch routes and keeps the result as a topology that can be saved and
+    reloaded.
+
+--*/
+
+#ifndef _TSI721ENUM_H_
+#define _TSI721ENUM_H_
+
+#define ENUM_MAX_NODES      256     // small system: 8-bit destIDs
+#define ENUM_MAX_LINKS      256
+#define ENUM_MAX_PORTS      32      // switch ports tracked in PortMask
+#define ENUM_DEF_MAX_HOPS   16
+#define ENUM_DEF_THREADS    8
+#define ENUM_NO_PARENT      0xffffffff  // node attached to the host port
+
+//
+// Every enumerated device gets RIO_COMPONENT_TAG_CSR = magic | generation |
+// destID. A device found again with a tag of the current run is reached
+// over a redundant path and is recorded as a link only. Each run uses the
+// generation after the one in the host's tag, so tags left by the previous
+// run never match.
+//
+#define ENUM_TAG_MAGIC      0xe0000000
+#define ENUM_TAG_MAGIC_MASK 0xff000000
+#define ENUM_TAG_GEN(x)     (((x) >> 16) & 0xff)
+#define ENUM_TAG_DESTID(x)  ((x) & 0xffff)
+
+typedef struct _ENUM_NODE {
+    DWORD DestId;       // assigned destID (used as route to switches too)
+    DWORD HopCnt;       // hop count of maintenance requests to the node
+    DWORD DevId;        // RIO_DEV_ID_CAR
+    DWORD PeFeat;       // RIO_PE_FEAT
+    DWORD Tag;          // RIO_COMPONENT_TAG_CSR written by the enumeration
+    DWORD Parent;       // index of the switch the node was found behind
+    DWORD ParentPort;   // port of that switch leading to the node
+    DWORD IngressPort;  // switches: port the maintenance requests enter
+    DWORD PortTotal;    // switches: number of ports
+    DWORD PortMask;     // switches: ports with an initialized link
+} ENUM_NODE, *PENUM_NODE;
+
+typedef struct _ENUM_LINK {
+    DWORD Node;         // switch
+    DWORD Port;         // port of the switch
+    DWORD Peer;         // node reached through the port
+} ENUM_LINK, *PENUM_LINK;
+
+typedef struct _ENUM_TOPO {
+    DWORD     HostId;
+    DWORD     Gen;          // tag generation of the enumeration
+    DWORD     NodeNum;
+    DWORD     LinkNum;      // redundant links (the tree links are Parent/ParentPort)
+    DWORD     MaxHop;
+    DWORD     MaintOps;     // maintenance requests issued
+    ULONGLONG ElapsedNs;
+    ENUM_NODE Node[ENUM_MAX_NODES];
+    ENUM_LINK Link[ENUM_MAX_LINKS];
+} ENUM_TOPO, *PENUM_TOPO;
+
+typedef struct _ENUM_CFG {
+    DWORD FirstDestId;  // first destID assigned (the host's destID is skipped)
+    DWORD MaxHops;      // deepest hop count probed (0 = ENUM_DEF_MAX_HOPS)
+    DWORD Threads;      // maintenance requests in flight (0 = ENUM_DEF_THREADS)
+} ENUM_CFG, *PENUM_CFG;
+
+#define ENUM_IS_SWITCH(pNode)   (((pNode)->PeFeat & RIO_PE_FEAT_SWITCH) != 0)
+
+/*
+ * tsi721_enum_run()
+ *
+ *  Enumerates the fabric behind the host port. All requests of a hop level
+ *  (device identification, then port status of the new switches, then the
+ *  routes to the next level, grouped by switch) are issued concurrently by
+ *  Threads threads, so the level costs a few request latencies instead of
+ *  one per device. The destID of every new device is routed to it before
+ *  the device is probed; end points get it as their base destID.
+ *
+ * Arguments:
+ *  hDev   - device handle of the host
+ *  pCfg   - enumeration parameters
+ *  pTopo  - receives the topology
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the fabric was enumerated,
+ *  ERROR_NO_MORE_ITEMS - if the fabric has more devices or links than fit
+ *                  in ENUM_TOPO,
+ *                  otherwise the error of the first failed request.
+ */
+DWORD
+tsi721_enum_run(
+    __in  HANDLE     hDev,
+    __in  PENUM_CFG  pCfg,
+    __out PENUM_TOPO pTopo
+    );
+
+/*
+ * tsi721_enum_verify()
+ *
+ *  Checks that a saved topology still describes the fabric: reads the
+ *  device ID and the component tag of all nodes concurrently and compares
+ *  them with the saved values. A warm restart uses the topology as is
+ *  when the check passes, the routes and destIDs being still programmed.
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if every node answered with its saved identity,
+ *  ERROR_INVALID_DATA - if the fabric has changed,
+ *                  otherwise the error of the first failed request.
+ */
+DWORD
+tsi721_enum_verify(
+    __in HANDLE     hDev,
+    __in PENUM_TOPO pTopo,
+    __in DWORD      dwThreads
+    );
+
+/*
+ * tsi721_enum_save()/tsi721_enum_load()
+ *
+ *  Writes the topology to a text file and reads it back.
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - on success,
+ *  ERROR_FILE_NOT_FOUND - if the file cannot be opened,
+ *  ERROR_INVALID_DATA - if the file is not a valid topology.
+ */
+DWORD tsi721_enum_save(__in PENUM_TOPO pTopo, __in PCSTR pPath);
+DWORD tsi721_enum_load(__in PCSTR pPath, __out PENUM_TOPO pTopo);
+
+/*
+ * tsi721_enum_print()
+ *
+ *  Prints the topology as a tree.
+ */
+VOID tsi721_enum_print(__in PENUM_TOPO pTopo);
+
+#endif // _TSI721ENUM_H_
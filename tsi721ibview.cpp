@@ -0,0 +1,137 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721ibview.cpp
+
+Description:
+
+    Inbound window view. Every TSI721IbwBufferGet() copies from the driver's
+    buffer, so a consumer reading the window that way moves each byte twice;
+    a view serves the bytes in place whenever the backend maps the buffer.
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+
+#include "tsi721api.h"
+#include "tsi721dev.h"
+#include "tsi721ibview.h"
+
+typedef struct _IBW_VIEW {
+    HANDLE    hDev;
+    DWORD     WinNum;
+    PUCHAR    Base;         // window buffer, NULL = copies only
+    DWORD     Size;         // window size (in place only)
+    DWORD     ChunkSize;
+    PUCHAR    Buf;          // copy buffer, BufSize <= ChunkSize bytes
+    DWORD     BufSize;
+    IBV_STATS Stats;
+} IBW_VIEW;
+
+DWORD
+tsi721_ibv_open(
+    HANDLE     hDev,
+    DWORD      dwWinNum,
+    DWORD      dwChunkSize,
+    PIBW_VIEW *ppView
+    )
+{
+    PIBW_VIEW pView;
+    PVOID     pBase;
+    DWORD     dwSize, dwErr;
+
+    if (ppView == NULL || dwWinNum >= IBWIN_MAX_CHNUM)
+        return ERROR_INVALID_PARAMETER;
+
+    pView = (PIBW_VIEW)calloc(1, sizeof(IBW_VIEW));
+    if (pView == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    pView->hDev = hDev;
+    pView->WinNum = dwWinNum;
+    pView->ChunkSize = dwChunkSize ? dwChunkSize : IBV_DEF_CHUNK;
+
+    dwErr = g_devOps->IbwBufferMap(hDev, dwWinNum, &pBase, &dwSize);
+    if (dwErr == ERROR_SUCCESS) {
+        pView->Base = (PUCHAR)pBase;
+        pView->Size = dwSize;
+        pView->Stats.bMapped = TRUE;
+    } else if (dwErr != ERROR_NOT_SUPPORTED) {
+        free(pView);
+        return dwErr;
+    }
+
+    *ppView = pView;
+    return ERROR_SUCCESS;
+}
+
+VOID
+tsi721_ibv_close(
+    PIBW_VIEW pView
+    )
+{
+    if (pView == NULL)
+        return;
+
+    free(pView->Buf);
+    free(pView);
+}
+
+DWORD
+tsi721_ibv_get(
+    PIBW_VIEW pView,
+    DWORD     dwOffset,
+    PDWORD    pdwSize,
+    PVOID    *ppData
+    )
+{
+    PUCHAR pBuf;
+    DWORD  dwSize, dwErr;
+
+    if (pView->Base) {
+        if (dwOffset >= pView->Size)
+            return ERROR_INVALID_PARAMETER;
+
+        *pdwSize = min(*pdwSize, pView->Size - dwOffset);
+        *ppData = pView->Base + dwOffset;
+        pView->Stats.ZeroCopyBytes += *pdwSize;
+        return ERROR_SUCCESS;
+    }
+
+    dwSize = min(*pdwSize, pView->ChunkSize);
+
+    if (dwSize > pView->BufSize) {
+        pBuf = (PUCHAR)realloc(pView->Buf, dwSize);
+        if (pBuf == NULL)
+            return ERROR_NOT_ENOUGH_MEMORY;
+        pView->Buf = pBuf;
+        pView->BufSize = dwSize;
+    }
+
+    dwErr = g_devOps->IbwBufferGet(pView->hDev, pView->WinNum, dwOffset, pView->Buf, &dwSize);
+    if (dwErr != ERROR_SUCCESS)
+        return dwErr;
+
+    *pdwSize = dwSize;
+    *ppData = pView->Buf;
+    pView->Stats.CopiedBytes += dwSize;
+    pView->Stats.Copies++;
+    return ERROR_SUCCESS;
+}
+
+VOID
+tsi721_ibv_stats(
+    PIBW_VIEW  pView,
+    PIBV_STATS pStats
+    )
+{
+    *pStats = pView->Stats;
+}
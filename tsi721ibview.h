@@ -0,0 +1,101 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721ibview.h
+
+Description:
+
+    Read access to the contents of an inbound window: in place when the
+    backend maps the window buffer, otherwise through TSI721IbwBufferGet()
+    copies into a reused buffer.
+
+--*/
+
+#ifndef _TSI721IBVIEW_H_
+#define _TSI721IBVIEW_H_
+
+#define IBV_DEF_CHUNK       (64 * 1024)     // largest copy of tsi721_ibv_get() by default
+
+typedef struct _IBV_STATS {
+    BOOL      bMapped;          // window read in place
+    ULONGLONG ZeroCopyBytes;    // bytes served in place
+    ULONGLONG CopiedBytes;      // bytes copied by TSI721IbwBufferGet()
+    ULONGLONG Copies;           // TSI721IbwBufferGet() calls
+} IBV_STATS, *PIBV_STATS;
+
+typedef struct _IBW_VIEW *PIBW_VIEW;
+
+/*
+ * tsi721_ibv_open()
+ *
+ *  Creates a view of an inbound window. The window must stay mapped (and
+ *  not be reconfigured) while the view is open.
+ *
+ * Arguments:
+ *  hDev        - device handle
+ *  dwWinNum    - inbound window number
+ *  dwChunkSize - largest copy when the window cannot be read in place
+ *                (0 = IBV_DEF_CHUNK); the copy buffer grows up to it
+ *  ppView      - pointer to variable to save the created view
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the view was created, otherwise an error code.
+ */
+DWORD
+tsi721_ibv_open(
+    __in  HANDLE     hDev,
+    __in  DWORD      dwWinNum,
+    __in  DWORD      dwChunkSize,
+    __out PIBW_VIEW *ppView
+    );
+
+/*
+ * tsi721_ibv_close()
+ */
+VOID tsi721_ibv_close(__in PIBW_VIEW pView);
+
+/*
+ * tsi721_ibv_get()
+ *
+ *  Returns a pointer to window bytes [dwOffset, dwOffset + *pdwSize). In
+ *  place the whole range is available; otherwise at most the chunk size is
+ *  copied and *pdwSize is reduced accordingly. Copied data stays valid
+ *  until the next call, data read in place may change as the link partner
+ *  writes the window. A view must not be used by several threads at once.
+ *
+ * Arguments:
+ *  pView    - window view
+ *  dwOffset - window offset
+ *  pdwSize  - in: bytes wanted, out: bytes available at *ppData
+ *  ppData   - receives the data pointer
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if data is available,
+ *  ERROR_INVALID_PARAMETER - if the offset is outside the window,
+ *                  otherwise the error of TSI721IbwBufferGet().
+ */
+DWORD
+tsi721_ibv_get(
+    __in    PIBW_VIEW pView,
+    __in    DWORD     dwOffset,
+    __inout PDWORD    pdwSize,
+    __out   PVOID    *ppData
+    );
+
+/*
+ * tsi721_ibv_stats()
+ */
+VOID
+tsi721_ibv_stats(
+    __in  PIBW_VIEW  pView,
+    __out PIBV_STATS pStats
+    );
+
+#endif // _TSI721IBVIEW_H_
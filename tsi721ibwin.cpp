@@ -0,0 +1,365 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721ibwin.cpp
+
+Description:
+
+    Inbound window manager.
+
+    The driver backs every R2P window with a contiguous common buffer, so a
+    large mapping may fail on a system with fragmented memory; the manager
+    then retries with smaller power-of-two sizes. SRIO addresses are handed
+    out first fit, aligned to the window size as the IBWIN base registers
+    require.
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+
+#include "tsi721api.h"
+#include "tsi721dev.h"
+#include "tsi721ibwin.h"
+
+typedef struct _IBW_ENT {
+    BOOL      InUse;
+    ULONGLONG Base;
+    DWORD     Size;
+} IBW_ENT, *PIBW_ENT;
+
+typedef struct _IBW_MGR {
+    HANDLE           hDev;
+    ULONGLONG        Base;
+    CRITICAL_SECTION Lock;
+    IBW_ENT          Win[IBWIN_MAX_CHNUM];
+} IBW_MGR;
+
+DWORD
+tsi721_ibw_create(
+    HANDLE    hDev,
+    DWORD     dwBaseHi,
+    DWORD     dwBaseLo,
+    PIBW_MGR *ppMgr
+    )
+{
+    PIBW_MGR pMgr;
+
+    if (ppMgr == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    pMgr = (PIBW_MGR)calloc(1, sizeof(IBW_MGR));
+    if (pMgr == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    pMgr->hDev = hDev;
+    pMgr->Base = ((ULONGLONG)dwBaseHi << 32) | dwBaseLo;
+    InitializeCriticalSection(&pMgr->Lock);
+
+    *ppMgr = pMgr;
+    return ERROR_SUCCESS;
+}
+
+VOID
+tsi721_ibw_destroy(
+    PIBW_MGR pMgr
+    )
+{
+    DWORD i;
+
+    if (pMgr == NULL)
+        return;
+
+    for (i = 0; i < IBWIN_MAX_CHNUM; i++) {
+        if (pMgr->Win[i].InUse)
+            g_devOps->FreeR2pWin(pMgr->hDev, i);
+    }
+
+    DeleteCriticalSection(&pMgr->Lock);
+    free(pMgr);
+}
+
+static ULONGLONG
+ibw_place(
+    PIBW_MGR pMgr,
+    DWORD    dwSize
+    )
+/*++
+
+Routine Description:
+
+    Returns the lowest SRIO address aligned to dwSize whose range overlaps
+    no mapped window. Called with the manager lock held.
+
+--*/
+{
+    ULONGLONG addr, end;
+    PIBW_ENT  pEnt;
+    DWORD     i;
+    BOOL      bMoved;
+
+    addr = (pMgr->Base + dwSize - 1) & ~((ULONGLONG)dwSize - 1);
+
+    do {
+        bMoved = FALSE;
+        for (i = 0; i < IBWIN_MAX_CHNUM; i++) {
+            pEnt = &pMgr->Win[i];
+            if (!pEnt->InUse || addr >= pEnt->Base + pEnt->Size || addr + dwSize <= pEnt->Base)
+                continue;
+
+            end = pEnt->Base + pEnt->Size;
+            addr = (end + dwSize - 1) & ~((ULONGLONG)dwSize - 1);
+            bMoved = TRUE;
+        }
+    } while (bMoved);
+
+    return addr;
+}
+
+static DWORD
+ibw_set(
+    PIBW_MGR  pMgr,
+    DWORD     dwWinNum,
+    ULONGLONG addr,
+    DWORD     dwSize,
+    PIBW_WIN  pWin
+    )
+/*++
+
+Routine Description:
+
+    Maps a free window at the given SRIO address. Called with the manager
+    lock held.
+
+--*/
+{
+    R2P_WINCFG cfg;
+    DWORD      dwErr;
+
+    ZeroMemory(&cfg, sizeof(cfg));
+    cfg.BAddrHi = (DWORD)(addr >> 32);
+    cfg.BAddrLo = (DWORD)addr;
+    cfg.Size = dwSize;
+
+    dwErr = g_devOps->CfgR2pWin(pMgr->hDev, dwWinNum, &cfg);
+    if (dwErr != ERROR_SUCCESS)
+        return dwErr;
+
+    pMgr->Win[dwWinNum].InUse = TRUE;
+    pMgr->Win[dwWinNum].Base = addr;
+    pMgr->Win[dwWinNum].Size = dwSize;
+
+    pWin->WinNum = dwWinNum;
+    pWin->AddrHi = cfg.BAddrHi;
+    pWin->AddrLo = cfg.BAddrLo;
+    pWin->Size = dwSize;
+
+    return ERROR_SUCCESS;
+}
+
+static DWORD
+ibw_map(
+    PIBW_MGR pMgr,
+    DWORD    dwWinNum,
+    DWORD    dwSize,
+    DWORD    dwMinSize,
+    PIBW_WIN pWin
+    )
+/*++
+
+Routine Description:
+
+    Maps a free window with the largest power-of-two size from dwSize down
+    to dwMinSize the driver can allocate. Called with the manager lock held.
+
+--*/
+{
+    DWORD size, dwErr = ERROR_INVALID_PARAMETER;
+
+    for (size = dwSize; size >= dwMinSize; size >>= 1) {
+        dwErr = ibw_set(pMgr, dwWinNum, ibw_place(pMgr, size), size, pWin);
+        if (dwErr == ERROR_SUCCESS)
+            break;
+    }
+
+    return dwErr;
+}
+
+static BOOL
+ibw_sizes(
+    PDWORD pdwSize,
+    PDWORD pdwMinSize
+    )
+/*++
+
+Routine Description:
+
+    Rounds the requested sizes up to powers of two.
+
+Return Value:
+
+    FALSE if a size is out of range.
+
+--*/
+{
+    DWORD size = IBW_MIN_SIZE, minSize = IBW_MIN_SIZE;
+
+    if (*pdwSize > IBW_MAX_SIZE || *pdwMinSize > *pdwSize)
+        return FALSE;
+
+    while (size < *pdwSize)
+        size <<= 1;
+    while (minSize < *pdwMinSize)
+        minSize <<= 1;
+
+    *pdwSize = size;
+    *pdwMinSize = minSize;
+    return TRUE;
+}
+
+DWORD
+tsi721_ibw_alloc(
+    PIBW_MGR pMgr,
+    DWORD    dwSize,
+    DWORD    dwMinSize,
+    PIBW_WIN pWin
+    )
+{
+    DWORD i, dwErr = ERROR_NO_MORE_ITEMS;
+
+    if (pMgr == NULL || pWin == NULL || !ibw_sizes(&dwSize, &dwMinSize))
+        return ERROR_INVALID_PARAMETER;
+
+    EnterCriticalSection(&pMgr->Lock);
+
+    for (i = 0; i < IBWIN_MAX_CHNUM; i++) {
+        if (!pMgr->Win[i].InUse) {
+            dwErr = ibw_map(pMgr, i, dwSize, dwMinSize, pWin);
+            break;
+        }
+    }
+
+    LeaveCriticalSection(&pMgr->Lock);
+    return dwErr;
+}
+
+DWORD
+tsi721_ibw_resize(
+    PIBW_MGR pMgr,
+    DWORD    dwWinNum,
+    DWORD    dwSize,
+    DWORD    dwMinSize,
+    PIBW_WIN pWin
+    )
+{
+    IBW_ENT old;
+    IBW_WIN win;
+    DWORD   dwErr;
+
+    if (pMgr == NULL || pWin == NULL || dwWinNum >= IBWIN_MAX_CHNUM ||
+        !ibw_sizes(&dwSize, &dwMinSize))
+        return ERROR_INVALID_PARAMETER;
+
+    EnterCriticalSection(&pMgr->Lock);
+
+    old = pMgr->Win[dwWinNum];
+    if (!old.InUse) {
+        dwErr = ERROR_INVALID_PARAMETER;
+        goto exit;
+    }
+
+    // The driver cannot remap a window in use
+    g_devOps->FreeR2pWin(pMgr->hDev, dwWinNum);
+    pMgr->Win[dwWinNum].InUse = FALSE;
+
+    dwErr = ibw_map(pMgr, dwWinNum, dwSize, dwMinSize, pWin);
+    if (dwErr == ERROR_SUCCESS)
+        goto exit;
+
+    // Put the window back where the partner expects it
+    if (ibw_set(pMgr, dwWinNum, old.Base, old.Size, &win) != ERROR_SUCCESS)
+        dwErr = ERROR_INVALID_STATE;
+
+exit:
+
+    LeaveCriticalSection(&pMgr->Lock);
+    return dwErr;
+}
+
+DWORD
+tsi721_ibw_free(
+    PIBW_MGR pMgr,
+    DWORD    dwWinNum
+    )
+{
+    DWORD dwErr;
+
+    if (pMgr == NULL || dwWinNum >= IBWIN_MAX_CHNUM)
+        return ERROR_INVALID_PARAMETER;
+
+    EnterCriticalSection(&pMgr->Lock);
+
+    if (!pMgr->Win[dwWinNum].InUse)
+        dwErr = ERROR_INVALID_PARAMETER;
+    else {
+        dwErr = g_devOps->FreeR2pWin(pMgr->hDev, dwWinNum);
+        pMgr->Win[dwWinNum].InUse = FALSE;
+    }
+
+    LeaveCriticalSection(&pMgr->Lock);
+    return dwErr;
+}
+
+DWORD
+tsi721_ibw_query(
+    PIBW_MGR pMgr,
+    DWORD    dwWinNum,
+    PIBW_WIN pWin
+    )
+{
+    DWORD dwErr = ERROR_SUCCESS;
+
+    if (pMgr == NULL || pWin == NULL || dwWinNum >= IBWIN_MAX_CHNUM)
+        return ERROR_INVALID_PARAMETER;
+
+    EnterCriticalSection(&pMgr->Lock);
+
+    if (!pMgr->Win[dwWinNum].InUse)
+        dwErr = ERROR_INVALID_PARAMETER;
+    else {
+        pWin->WinNum = dwWinNum;
+        pWin->AddrHi = (DWORD)(pMgr->Win[dwWinNum].Base >> 32);
+        pWin->AddrLo = (DWORD)pMgr->Win[dwWinNum].Base;
+        pWin->Size = pMgr->Win[dwWinNum].Size;
+    }
+
+    LeaveCriticalSection(&pMgr->Lock);
+    return dwErr;
+}
+
+VOID
+tsi721_ibw_print(
+    PIBW_MGR pMgr
+    )
+{
+    PIBW_ENT pEnt;
+    DWORD    i;
+
+    EnterCriticalSection(&pMgr->Lock);
+
+    for (i = 0; i < IBWIN_MAX_CHNUM; i++) {
+        pEnt = &pMgr->Win[i];
+        if (pEnt->InUse)
+            printf_s("IB_WIN_%d: SRIO 0x%09llx - 0x%09llx (%u KB)\n",
+                     i, pEnt->Base, pEnt->Base + pEnt->Size - 1, pEnt->Size >> 10);
+    }
+
+    LeaveCriticalSection(&pMgr->Lock);
+}
@@ -0,0 +1,152 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721ibwin.h
+
+Description:
+
+    Inbound window manager: maps the IBWIN_MAX_CHNUM R2P windows of a
+    device on demand, each at its own SRIO address range.
+
+--*/
+
+#ifndef _TSI721IBWIN_H_
+#define _TSI721IBWIN_H_
+
+#define IBW_MIN_SIZE        (4 * 1024)      // smallest window (TSI721CfgR2pWin)
+#define IBW_MAX_SIZE        0x80000000      // largest window described by a DWORD size
+
+typedef struct _IBW_WIN {
+    DWORD WinNum;       // IB window number
+    DWORD AddrHi;       // SRIO base address of the window
+    DWORD AddrLo;
+    DWORD Size;         // size granted, may be smaller than requested
+} IBW_WIN, *PIBW_WIN;
+
+typedef struct _IBW_MGR *PIBW_MGR;
+
+/*
+ * tsi721_ibw_create()
+ *
+ *  Creates the manager of the inbound windows of a device. Windows are
+ *  placed in the SRIO address space from the given base address up, each
+ *  aligned to its size and overlapping no other window of the manager.
+ *  The manager may be used by several threads.
+ *
+ * Arguments:
+ *  hDev     - device handle
+ *  dwBaseHi - lowest SRIO address handed out
+ *  dwBaseLo
+ *  ppMgr    - pointer to variable to save the created manager
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the manager was created, otherwise an error code.
+ */
+DWORD
+tsi721_ibw_create(
+    __in  HANDLE    hDev,
+    __in  DWORD     dwBaseHi,
+    __in  DWORD     dwBaseLo,
+    __out PIBW_MGR *ppMgr
+    );
+
+/*
+ * tsi721_ibw_destroy()
+ *
+ *  Frees all windows mapped by the manager and the manager.
+ */
+VOID tsi721_ibw_destroy(__in PIBW_MGR pMgr);
+
+/*
+ * tsi721_ibw_alloc()
+ *
+ *  Maps the lowest free IB window. The size is rounded up to a power of
+ *  two; when the driver cannot allocate a buffer that large, the mapping
+ *  is retried with half the size down to dwMinSize.
+ *
+ * Arguments:
+ *  pMgr      - window manager
+ *  dwSize    - requested size
+ *  dwMinSize - smallest acceptable size (0 = IBW_MIN_SIZE)
+ *  pWin      - receives the window number, SRIO address and size granted
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if a window was mapped,
+ *  ERROR_NO_MORE_ITEMS - if all windows are in use,
+ *  ERROR_INVALID_PARAMETER - if a size is out of range,
+ *                  otherwise the error of the last TSI721CfgR2pWin() call.
+ */
+DWORD
+tsi721_ibw_alloc(
+    __in  PIBW_MGR pMgr,
+    __in  DWORD    dwSize,
+    __in  DWORD    dwMinSize,
+    __out PIBW_WIN pWin
+    );
+
+/*
+ * tsi721_ibw_resize()
+ *
+ *  Maps a window again with a new size, falling back to smaller sizes as
+ *  tsi721_ibw_alloc() does. The window keeps its number, but its SRIO
+ *  address may change and its contents are lost. If no new size can be
+ *  mapped the window is mapped again at its previous address and size.
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the window was mapped with the new size,
+ *  ERROR_INVALID_PARAMETER - if the window is not mapped by the manager,
+ *  ERROR_INVALID_STATE - if the previous mapping could not be restored
+ *                  either; the window is then free,
+ *                  otherwise the error of the last TSI721CfgR2pWin() call.
+ */
+DWORD
+tsi721_ibw_resize(
+    __in  PIBW_MGR pMgr,
+    __in  DWORD    dwWinNum,
+    __in  DWORD    dwSize,
+    __in  DWORD    dwMinSize,
+    __out PIBW_WIN pWin
+    );
+
+/*
+ * tsi721_ibw_free()
+ *
+ *  Frees a window mapped by the manager.
+ */
+DWORD
+tsi721_ibw_free(
+    __in PIBW_MGR pMgr,
+    __in DWORD    dwWinNum
+    );
+
+/*
+ * tsi721_ibw_query()
+ *
+ *  Returns the SRIO address and size of a window mapped by the manager.
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the window is mapped,
+ *  ERROR_INVALID_PARAMETER - if it is not mapped by the manager.
+ */
+DWORD
+tsi721_ibw_query(
+    __in  PIBW_MGR pMgr,
+    __in  DWORD    dwWinNum,
+    __out PIBW_WIN pWin
+    );
+
+/*
+ * tsi721_ibw_print()
+ *
+ *  Prints the windows mapped by the manager.
+ */
+VOID tsi721_ibw_print(__in PIBW_MGR pMgr);
+
+#endif // _TSI721IBWIN_H_
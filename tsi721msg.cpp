@@ -0,0 +1,604 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721msg.cpp
+
+Description:
+
+    Pipelined outbound mailbox message sender.
+
+    Every selected MBOX gets a fixed set of page-aligned message buffers, each
+    with its own OVERLAPPED context. All contexts are submitted up front, and
+    each completion reaped from the completion port resubmits its context
+    until the MBOX has sent its share of messages. Depth messages per MBOX
+    therefore stay queued in the driver instead of one.
+
+    With flow control, a context without a credit of its MBOX is parked
+    until a credit doorbell from the receiver wakes the completion port, so
+    the sender runs at the rate the receiver reposts its buffers instead of
+    overrunning them.
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+
+#include "tsi721api.h"
+#include "tsi721dev.h"
+#include "tsi721crc.h"
+#include "tsi721db.h"
+#include "tsi721msg.h"
+#include "tsi721msgrx.h"
+#include "tsi721pattern.h"
+#include "tsi721pool.h"
+#include "tsi721stat.h"
+#include "tsi721trace.h"
+
+#define MSG_TX_BATCH    64  // completions reaped by one call
+
+typedef struct _MSG_TX_CTX {
+    OVERLAPPED Ovl;
+    struct _MSG_TX_CTX *Next;   // parked waiting for a credit
+    PUCHAR     Buf;         // page-aligned message buffer
+    DWORD      Len;         // size passed to the driver
+    DWORD      Mbox;
+    ULONGLONG  Submit;      // submission timestamp
+} MSG_TX_CTX, *PMSG_TX_CTX;
+
+typedef struct _MSG_TX_MBOX {
+    DWORD       Sent;       // messages submitted
+    DWORD       Status;     // first error, stops further submissions
+    PMSG_TX_CTX Parked;     // contexts waiting for a credit
+    DWORD       ParkedNum;
+    ULONGLONG   Errors;     // failed or cancelled messages
+    ULONGLONG   CreditWaits;
+    ULONGLONG   LastTicks;  // timestamp of the last completion
+    LAT_HIST    Hist;
+} MSG_TX_MBOX, *PMSG_TX_MBOX;
+
+typedef struct _MSG_CREDIT {
+    HANDLE           hDev;                          // doorbell receive handle
+    HANDLE           hPort;                         // woken by credits
+    DWORD            DestId;
+    DWORD            Credits;                       // receive buffers per MBOX
+    PDB_RX_ENGINE    pRx;
+    volatile LONG    Taken[RIO_MSG_MAX_MBOX];       // credits taken by the sender
+    volatile LONG    Returned[RIO_MSG_MAX_MBOX];    // buffers reposted by the receiver
+    MSG_CREDIT_STATS Stats;
+} MSG_CREDIT;
+
+static VOID
+msg_credit_handler(
+    PVOID        pCtx,
+    PIB_DB_ENTRY pDb,
+    DWORD        dwNum
+    )
+{
+    PMSG_CREDIT pCredit = (PMSG_CREDIT)pCtx;
+    DWORD i, info, mbox, num, out;
+    BOOL  bCredit = FALSE;
+
+    for (i = 0; i < dwNum; i++) {
+        info = pDb[i].db.Info;
+        if (!MSGRX_DB_IS_CREDIT(info) || pDb[i].db.SrcId != pCredit->DestId)
+            continue;
+
+        mbox = (info >> MSGRX_DB_MBOX_SHIFT) & (RIO_MSG_MAX_MBOX - 1);
+        pCredit->Stats.Doorbells++;
+
+        // Never return more than is outstanding: the excess was left
+        // over by an earlier sender on this destID. Only this thread
+        // writes Returned.
+        num = info & MSGRX_DB_CNT_MASK;
+        out = (DWORD)(pCredit->Taken[mbox] - pCredit->Returned[mbox]);
+        if (num > out) {
+            pCredit->Stats.Excess += num - out;
+            num = out;
+        }
+
+        if (num) {
+            InterlockedExchangeAdd(&pCredit->Returned[mbox], (LONG)num);
+            bCredit = TRUE;
+        }
+    }
+
+    if (bCredit && pCredit->hPort)
+        PostQueuedCompletionStatus(pCredit->hPort, 0, 0, NULL);
+}
+
+DWORD
+tsi721_msg_credit_start(
+    DWORD        dwDevNum,
+    DWORD        dwDestId,
+    DWORD        dwCredits,
+    HANDLE       hPort,
+    PMSG_CREDIT *ppCredit
+    )
+{
+    PMSG_CREDIT pCredit;
+    DB_RX_CFG   rxCfg;
+    DWORD       dwErr;
+
+    if (ppCredit == NULL || dwCredits == 0 || dwCredits > MSGRX_MAX_BUFS)
+        return ERROR_INVALID_PARAMETER;
+
+    pCredit = (PMSG_CREDIT)calloc(1, sizeof(MSG_CREDIT));
+    if (pCredit == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    pCredit->hPort = hPort;
+    pCredit->DestId = dwDestId;
+    pCredit->Credits = dwCredits;
+
+    if (!g_devOps->DeviceOpen(&pCredit->hDev, dwDevNum, NULL)) {
+        dwErr = GetLastError();
+        printf_s("MSG_CREDIT: failed to open Tsi721_%d (err=%x)\n", dwDevNum, dwErr);
+        free(pCredit);
+        return dwErr;
+    }
+
+    ZeroMemory(&rxCfg, sizeof(rxCfg));
+    rxCfg.SpinMinUs = DB_RX_DEF_SPIN_MIN_US;
+    rxCfg.SpinMaxUs = DB_RX_DEF_SPIN_MAX_US;
+    rxCfg.Handler = msg_credit_handler;
+    rxCfg.HandlerCtx = pCredit;
+
+    dwErr = tsi721_db_rx_start(pCredit->hDev, &rxCfg, &pCredit->pRx);
+    if (dwErr != ERROR_SUCCESS) {
+        printf_s("MSG_CREDIT: failed to start doorbell receiver (err=%x)\n", dwErr);
+        g_devOps->DeviceClose(pCredit->hDev, NULL);
+        free(pCredit);
+        return dwErr;
+    }
+
+    *ppCredit = pCredit;
+    return ERROR_SUCCESS;
+}
+
+VOID
+tsi721_msg_credit_stop(
+    PMSG_CREDIT pCredit
+    )
+{
+    if (pCredit == NULL)
+        return;
+
+    tsi721_db_rx_stop(pCredit->pRx);
+    g_devOps->DeviceClose(pCredit->hDev, NULL);
+    free(pCredit);
+}
+
+BOOL
+tsi721_msg_credit_take(
+    PMSG_CREDIT pCredit,
+    DWORD       dwMbox
+    )
+{
+    if ((DWORD)(pCredit->Taken[dwMbox] - pCredit->Returned[dwMbox]) >= pCredit->Credits) {
+        pCredit->Stats.Waits[dwMbox]++;
+        return FALSE;
+    }
+
+    InterlockedIncrement(&pCredit->Taken[dwMbox]);
+    return TRUE;
+}
+
+VOID
+tsi721_msg_credit_put(
+    PMSG_CREDIT pCredit,
+    DWORD       dwMbox
+    )
+{
+    InterlockedDecrement(&pCredit->Taken[dwMbox]);
+}
+
+VOID
+tsi721_msg_credit_stats(
+    PMSG_CREDIT       pCredit,
+    PMSG_CREDIT_STATS pStats
+    )
+{
+    *pStats = pCredit->Stats;
+}
+
+static DWORD
+msg_tx_submit(
+    HANDLE      hDev,
+    DWORD       dwDestId,
+    DWORD       dwSize,
+    PMSG_TX_CTX pCtx
+    )
+{
+    DWORD dwErr;
+
+    ZeroMemory(&pCtx->Ovl, sizeof(OVERLAPPED));
+    pCtx->Len = dwSize;
+    pCtx->Submit = lat_ticks();
+
+    dwErr = g_devOps->SrioMsgSend(hDev, pCtx->Mbox, dwDestId, pCtx->Buf, &pCtx->Len, &pCtx->Ovl);
+
+    // The handle is bound to a completion port: a request completed
+    // synchronously is reported through the port as well.
+    return (dwErr == ERROR_SUCCESS) ? ERROR_IO_PENDING : dwErr;
+}
+
+static DWORD
+msg_tx_next(
+    HANDLE        hDev,
+    PMSG_SEND_CFG pCfg,
+    DWORD         dwSize,
+    PMSG_CREDIT   pCredit,
+    PMSG_TX_MBOX  pMb,
+    PMSG_TX_CTX   pCtx
+    )
+/*++
+
+Routine Description:
+
+    Submits the next message of a MBOX on a free context, or parks the
+    context if the MBOX has no credit.
+
+Return Value:
+
+    ERROR_IO_PENDING - if the message was submitted,
+    ERROR_RETRY      - if the context was parked,
+                       otherwise the error of the submission.
+
+--*/
+{
+    DWORD dwStatus;
+
+    if (pCredit && !tsi721_msg_credit_take(pCredit, pCtx->Mbox)) {
+        pCtx->Next = pMb->Parked;
+        pMb->Parked = pCtx;
+        pMb->ParkedNum++;
+        return ERROR_RETRY;
+    }
+
+    // Sealed again for every message, as if its data were new
+    if (pCfg->bCrc)
+        tsi721_crc_seal(pCtx->Buf, dwSize - sizeof(CRC_TRAILER));
+
+    dwStatus = msg_tx_submit(hDev, pCfg->DestId, dwSize, pCtx);
+    if (dwStatus != ERROR_IO_PENDING) {
+        printf_s("MSG_SEND: MBOX%d IOCTL error: 0x%x (%d)\n", pCtx->Mbox, dwStatus, dwStatus);
+        if (pCredit)
+            tsi721_msg_credit_put(pCredit, pCtx->Mbox);
+        pMb->Status = dwStatus;
+        return dwStatus;
+    }
+
+    pMb->Sent++;
+    return ERROR_IO_PENDING;
+}
+
+DWORD
+tsi721_msg_send_run(
+    DWORD           dwDevNum,
+    PMSG_SEND_CFG   pCfg,
+    PMSG_SEND_STATS pStats
+    )
+/*++
+
+Routine Description:
+
+    Runs the pipelined sender. The calling thread both submits messages and
+    reaps completions, so no locking is needed on the per-MBOX state. Credit
+    doorbells wake the port with empty packets, upon which the parked
+    contexts are retried.
+
+Arguments:
+
+    dwDevNum - Tsi721 device index
+    pCfg     - sender configuration
+    pStats   - optional results
+
+Return Value:
+
+    ERROR_SUCCESS or the first error reported for a message.
+
+--*/
+{
+    OVERLAPPED_ENTRY entry[MSG_TX_BATCH];
+    HANDLE       hDev = INVALID_HANDLE_VALUE;
+    HANDLE       hPort = NULL;
+    PMSG_TX_CTX  pCtx = NULL;
+    PMSG_TX_MBOX pMbox = NULL;
+    PMSG_CREDIT  pCredit = NULL;
+    MSG_CREDIT_STATS crStats;
+    DWORD        mboxMask, msgSize, depth, nMbox = 0, ctxNum, mbox, i, j;
+    DWORD        dwErr = ERROR_SUCCESS, dwStatus;
+    DWORD        inFlight = 0, parked = 0;
+    ULONGLONG    t0, t1;
+    BOOL         bCancelled = FALSE;
+
+    if (pCfg == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    if (pStats)
+        ZeroMemory(pStats, sizeof(MSG_SEND_STATS));
+
+    mboxMask = pCfg->MboxMask ? pCfg->MboxMask : 1;
+    msgSize = pCfg->MsgSize ? pCfg->MsgSize : MSG_DEF_SIZE;
+    depth = pCfg->Depth ? pCfg->Depth : MSG_DEF_DEPTH;
+
+    // A sealed message is a whole number of double-words ending in the trailer
+    if (pCfg->bCrc)
+        msgSize = (msgSize + 7) & ~7;
+
+    if (mboxMask & ~((1 << RIO_MSG_MAX_MBOX) - 1) || msgSize < 8 || msgSize > MSG_MAX_SIZE ||
+        (pCfg->bCrc && msgSize <= sizeof(CRC_TRAILER)) || pCfg->Credits > MSGRX_MAX_BUFS)
+        return ERROR_INVALID_PARAMETER;
+
+    if (pCfg->MsgCount == 0)
+        return ERROR_SUCCESS;
+
+    for (mbox = 0; mbox < RIO_MSG_MAX_MBOX; mbox++)
+        if (mboxMask & (1 << mbox))
+            nMbox++;
+
+    if (depth * nMbox > TSI721_NUM_ASYNCH_IO)
+        depth = TSI721_NUM_ASYNCH_IO / nMbox;
+    if (depth > pCfg->MsgCount)
+        depth = pCfg->MsgCount;
+
+    ctxNum = depth * nMbox;
+
+    //
+    // Open a separate device handle so that only this sender's requests
+    // complete to its completion port.
+    //
+    if (!g_devOps->DeviceOpen(&hDev, dwDevNum, NULL)) {
+        dwErr = GetLastError();
+        printf_s("MSG_SEND: failed to open Tsi721_%d (err=%x)\n", dwDevNum, dwErr);
+        hDev = INVALID_HANDLE_VALUE;
+        goto exit;
+    }
+
+    hPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    if (hPort == NULL) {
+        dwErr = GetLastError();
+        printf_s("MSG_SEND: Cannot create completion port err=%d\n", dwErr);
+        goto exit;
+    }
+
+    dwErr = g_devOps->BindPort(hDev, hPort, 0);
+    if (dwErr != ERROR_SUCCESS) {
+        printf_s("MSG_SEND: Cannot bind completion port err=%d\n", dwErr);
+        goto exit;
+    }
+
+    if (pCfg->Credits) {
+        dwErr = tsi721_msg_credit_start(dwDevNum, pCfg->DestId, pCfg->Credits, hPort, &pCredit);
+        if (dwErr != ERROR_SUCCESS)
+            goto exit;
+    }
+
+    pCtx = (PMSG_TX_CTX)calloc(ctxNum, sizeof(MSG_TX_CTX));
+    pMbox = (PMSG_TX_MBOX)calloc(RIO_MSG_MAX_MBOX, sizeof(MSG_TX_MBOX));
+    if (pCtx == NULL || pMbox == NULL) {
+        printf_s("MSG_SEND: Unable to allocate message buffers\n");
+        dwErr = ERROR_NOT_ENOUGH_MEMORY;
+        goto exit;
+    }
+
+    //
+    // Messaging buffers have to be aligned to the page boundary
+    //
+    for (i = 0; i < ctxNum; i++) {
+        pCtx[i].Buf = (PUCHAR)tsi721_pool_alloc(MSG_MAX_SIZE);
+        if (pCtx[i].Buf == NULL) {
+            printf_s("MSG_SEND: Unable to allocate message buffers\n");
+            dwErr = ERROR_NOT_ENOUGH_MEMORY;
+            goto exit;
+        }
+    }
+
+    for (i = 0, mbox = 0; mbox < RIO_MSG_MAX_MBOX; mbox++) {
+        lat_hist_init(&pMbox[mbox].Hist);
+
+        if (!(mboxMask & (1 << mbox)))
+            continue;
+
+        for (j = 0; j < depth; j++, i++) {
+            pCtx[i].Mbox = mbox;
+            tsi721_pattern_fill(pCtx[i].Buf, msgSize, pCfg->Seed + mbox, (ULONGLONG)j * msgSize);
+        }
+    }
+
+    t0 = lat_ticks();
+
+    for (i = 0; i < ctxNum; i++) {
+        PMSG_TX_MBOX pMb = &pMbox[pCtx[i].Mbox];
+
+        if (pMb->Status != ERROR_SUCCESS)
+            continue;
+
+        dwStatus = msg_tx_next(hDev, pCfg, msgSize, pCredit, pMb, &pCtx[i]);
+        if (dwStatus == ERROR_IO_PENDING)
+            inFlight++;
+        else if (dwStatus == ERROR_RETRY) {
+            pMb->CreditWaits++;
+            parked++;
+        } else if (dwErr == ERROR_SUCCESS)
+            dwErr = dwStatus;
+    }
+
+    while (inFlight || parked) {
+        ULONG ulNum = 0;
+
+        if (!GetQueuedCompletionStatusEx(hPort, entry, MSG_TX_BATCH, &ulNum, MSG_TX_TIMEOUT, FALSE)) {
+            dwStatus = GetLastError();
+
+            if (dwStatus == WAIT_TIMEOUT && !bCancelled) {
+                printf_s("MSG_SEND: no completion or credit in %d ms, cancelling %d messages "
+                         "(%d waiting for credits)\n", MSG_TX_TIMEOUT, inFlight, parked);
+                g_devOps->CancelIo(hDev, NULL);
+                bCancelled = TRUE;
+                if (dwErr == ERROR_SUCCESS)
+                    dwErr = ERROR_TIMEOUT;
+
+                // Parked contexts are not retried after a cancel
+                for (mbox = 0; mbox < RIO_MSG_MAX_MBOX; mbox++) {
+                    pMbox[mbox].Parked = NULL;
+                    pMbox[mbox].ParkedNum = 0;
+                }
+                parked = 0;
+                continue;
+            }
+
+            printf_s("MSG_SEND: GetQueuedCompletionStatusEx failed %d\n", dwStatus);
+            if (dwErr == ERROR_SUCCESS)
+                dwErr = dwStatus;
+            break;
+        }
+
+        for (i = 0; i < ulNum; i++) {
+            PMSG_TX_CTX  pC;
+            PMSG_TX_MBOX pMb;
+            ULONGLONG    now = lat_ticks();
+            DWORD        dwLen;
+
+            // Credit wakeup, the parked contexts are retried below
+            if (entry[i].lpOverlapped == NULL)
+                continue;
+
+            pC = CONTAINING_RECORD(entry[i].lpOverlapped, MSG_TX_CTX, Ovl);
+            pMb = &pMbox[pC->Mbox];
+            inFlight--;
+
+            if (GetOverlappedResult(hDev, &pC->Ovl, &dwLen, FALSE)) {
+                lat_hist_add(&pMb->Hist, lat_ticks_to_ns(now - pC->Submit));
+                pMb->LastTicks = now;
+                tsi721_trace(TRACE_EV_MSG_SEND, 0, pC->Mbox, msgSize, pCfg->DestId, pC->Submit);
+            } else {
+                dwStatus = GetLastError();
+                tsi721_trace(TRACE_EV_MSG_SEND, dwStatus, pC->Mbox, msgSize, pCfg->DestId, pC->Submit);
+                pMb->Errors++;
+                if (pMb->Status == ERROR_SUCCESS) {
+                    printf_s("MSG_SEND: MBOX%d message failed, err = 0x%x\n", pC->Mbox, dwStatus);
+                    pMb->Status = dwStatus;
+                }
+                if (dwErr == ERROR_SUCCESS)
+                    dwErr = dwStatus;
+            }
+
+            if (bCancelled || pMb->Status != ERROR_SUCCESS ||
+                pMb->Sent + pMb->ParkedNum >= pCfg->MsgCount)
+                continue;
+
+            dwStatus = msg_tx_next(hDev, pCfg, msgSize, pCredit, pMb, pC);
+            if (dwStatus == ERROR_IO_PENDING)
+                inFlight++;
+            else if (dwStatus == ERROR_RETRY) {
+                pMb->CreditWaits++;
+                parked++;
+            } else if (dwErr == ERROR_SUCCESS)
+                dwErr = dwStatus;
+        }
+
+        //
+        // Retry the parked contexts, in case credits have arrived
+        //
+        for (mbox = 0; mbox < RIO_MSG_MAX_MBOX && parked; mbox++) {
+            PMSG_TX_MBOX pMb = &pMbox[mbox];
+
+            while (pMb->Parked) {
+                PMSG_TX_CTX pC = pMb->Parked;
+
+                pMb->Parked = pC->Next;
+                pMb->ParkedNum--;
+                parked--;
+
+                if (pMb->Status != ERROR_SUCCESS)
+                    continue;
+
+                dwStatus = msg_tx_next(hDev, pCfg, msgSize, pCredit, pMb, pC);
+                if (dwStatus == ERROR_IO_PENDING)
+                    inFlight++;
+                else if (dwStatus == ERROR_RETRY) {
+                    parked++;
+                    break;
+                } else if (dwErr == ERROR_SUCCESS)
+                    dwErr = dwStatus;
+            }
+        }
+    }
+
+    t1 = lat_ticks();
+
+    for (mbox = 0; mbox < RIO_MSG_MAX_MBOX; mbox++) {
+        PMSG_TX_MBOX pMb = &pMbox[mbox];
+        MSG_MBOX_STATS st;
+
+        if (!(mboxMask & (1 << mbox)))
+            continue;
+
+        ZeroMemory(&st, sizeof(st));
+        st.Errors = pMb->Errors;
+        st.CreditWaits = pMb->CreditWaits;
+        st.Msgs = pMb->Hist.Count;
+        st.Bytes = st.Msgs * msgSize;
+        if (pMb->LastTicks > t0)
+            st.Seconds = (double)lat_ticks_to_ns(pMb->LastTicks - t0) / 1e9;
+        if (st.Seconds > 0.0) {
+            st.MsgsPerSec = (double)st.Msgs / st.Seconds;
+            st.MBps = (double)st.Bytes / (1024.0 * 1024.0) / st.Seconds;
+        }
+        st.P50Ns = lat_hist_percentile(&pMb->Hist, 50.0);
+        st.P99Ns = lat_hist_percentile(&pMb->Hist, 99.0);
+        st.MaxNs = pMb->Hist.Max;
+
+        if (pCfg->bReport) {
+            printf_s("MBOX%d: %llu msgs x %d bytes in %.3f s, %.0f msgs/s, %.2f MB/s, "
+                     "lat p50 %llu ns p99 %llu ns max %llu ns, %llu errors\n",
+                     mbox, st.Msgs, msgSize, st.Seconds, st.MsgsPerSec, st.MBps,
+                     st.P50Ns, st.P99Ns, st.MaxNs, st.Errors);
+            if (pCredit)
+                printf_s("MBOX%d: %d credits, %llu messages waited for a credit\n",
+                         mbox, pCfg->Credits, st.CreditWaits);
+        }
+
+        if (pStats)
+            pStats->Mbox[mbox] = st;
+    }
+
+    if (pStats)
+        pStats->Seconds = (double)lat_ticks_to_ns(t1 - t0) / 1e9;
+
+exit:
+
+    // Stop the credit doorbells before the port they wake is closed
+    if (pCredit) {
+        tsi721_msg_credit_stats(pCredit, &crStats);
+        if (pStats)
+            pStats->CreditDbs = crStats.Doorbells;
+        if (pCfg->bReport)
+            printf_s("Credits: %llu doorbells, %llu excess\n", crStats.Doorbells, crStats.Excess);
+        tsi721_msg_credit_stop(pCredit);
+    }
+
+    // Closing the handle cancels whatever the driver still holds
+    if (hDev != INVALID_HANDLE_VALUE)
+        g_devOps->DeviceClose(hDev, NULL);
+
+    if (hPort)
+        CloseHandle(hPort);
+
+    if (pMbox)
+        free(pMbox);
+    if (pCtx) {
+        for (i = 0; i < ctxNum; i++)
+            tsi721_pool_free(pCtx[i].Buf);
+        free(pCtx);
+    }
+
+    return dwErr;
+}
@@ -0,0 +1,163 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721msg.h
+
+Description:
+
+    Pipelined outbound mailbox message sender.
+
+--*/
+
+#ifndef _TSI721MSG_H_
+#define _TSI721MSG_H_
+
+#define MSG_MAX_SIZE        0x1000  // largest SRIO message (4KB, one page)
+#define MSG_DEF_SIZE        128     // default message size
+#define MSG_DEF_DEPTH       32      // default number of messages in flight per MBOX
+#define MSG_TX_TIMEOUT      10000   // ms without any completion before pending sends are cancelled
+
+typedef struct _MSG_SEND_CFG {
+    DWORD  DestId;      // destID of target SRIO device
+    DWORD  MboxMask;    // bit N set = send to MBOX N (0 = MBOX0 only)
+    DWORD  MsgSize;     // bytes per message, 8...MSG_MAX_SIZE (0 = MSG_DEF_SIZE)
+    DWORD  MsgCount;    // messages per MBOX
+    DWORD  Depth;       // messages in flight per MBOX (0 = MSG_DEF_DEPTH)
+    DWORD  Seed;        // payload pattern seed
+    DWORD  Credits;     // receive buffers per MBOX at the receiver (0 = no flow control)
+    BOOL   bCrc;        // seal every message with a CRC trailer (MsgSize includes it)
+    BOOL   bReport;     // print per-MBOX results
+} MSG_SEND_CFG, *PMSG_SEND_CFG;
+
+typedef struct _MSG_MBOX_STATS {
+    ULONGLONG Msgs;         // messages completed successfully
+    ULONGLONG Bytes;        // payload bytes completed successfully
+    ULONGLONG Errors;       // failed or cancelled messages
+    ULONGLONG CreditWaits;  // messages that had to wait for a credit
+    double    Seconds;      // time from first submission to last completion
+    double    MsgsPerSec;
+    double    MBps;
+    ULONGLONG P50Ns;        // submission to completion latency
+    ULONGLONG P99Ns;
+    ULONGLONG MaxNs;
+} MSG_MBOX_STATS, *PMSG_MBOX_STATS;
+
+typedef struct _MSG_SEND_STATS {
+    MSG_MBOX_STATS Mbox[RIO_MSG_MAX_MBOX];
+    ULONGLONG      CreditDbs;   // credit doorbells received
+    double         Seconds;     // wall time of the whole run
+} MSG_SEND_STATS, *PMSG_SEND_STATS;
+
+typedef struct _MSG_CREDIT_STATS {
+    ULONGLONG Doorbells;                    // credit doorbells received
+    ULONGLONG Excess;                       // credits returned beyond those taken
+    ULONGLONG Waits[RIO_MSG_MAX_MBOX];      // credits refused
+} MSG_CREDIT_STATS, *PMSG_CREDIT_STATS;
+
+typedef struct _MSG_CREDIT *PMSG_CREDIT;
+
+/*
+ * tsi721_msg_send_run()
+ *
+ *  Sends MsgCount messages to every selected MBOX, keeping up to Depth
+ *  messages in flight per MBOX. Message buffers and OVERLAPPED contexts are
+ *  allocated once as a ring and recycled from the completion port.
+ *  The total number of messages in flight is limited to TSI721_NUM_ASYNCH_IO.
+ *  With Credits set, a message is sent only with a credit of its MBOX, so
+ *  the receiver must return credits (MSGRX_CFG.CreditBatch).
+ *
+ * Arguments:
+ *  dwDevNum - Tsi721 device index. The sender opens its own device handle so
+ *             that only its requests complete to its completion port.
+ *  pCfg     - sender configuration
+ *  pStats   - optional pointer to structure receiving the results
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if all messages were sent successfully,
+ *                  otherwise the first error reported for a message.
+ */
+DWORD
+tsi721_msg_send_run(
+    __in  DWORD           dwDevNum,
+    __in  PMSG_SEND_CFG   pCfg,
+    __out PMSG_SEND_STATS pStats
+    );
+
+/*
+ * tsi721_msg_credit_start()
+ *
+ *  Starts collecting the credit doorbells of a message receiver. Every
+ *  MBOX starts with dwCredits credits, one per receive buffer posted by
+ *  the receiver, and gets them back as the receiver reposts its buffers.
+ *  The credits are received on a device handle of their own, so no other
+ *  doorbell receiver may run on the device at the same time.
+ *
+ * Arguments:
+ *  dwDevNum  - Tsi721 device index
+ *  dwDestId  - destID of the receiver, doorbells of other sources are ignored
+ *  dwCredits - receive buffers per MBOX, 1...MSGRX_MAX_BUFS
+ *  hPort     - completion port woken by an empty packet (key 0, no
+ *              OVERLAPPED) whenever credits arrive, or NULL
+ *  ppCredit  - pointer to variable to save the created tracker
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the tracker was started, otherwise an error code.
+ */
+DWORD
+tsi721_msg_credit_start(
+    __in  DWORD        dwDevNum,
+    __in  DWORD        dwDestId,
+    __in  DWORD        dwCredits,
+    __in  HANDLE       hPort,
+    __out PMSG_CREDIT *ppCredit
+    );
+
+/*
+ * tsi721_msg_credit_stop()
+ */
+VOID tsi721_msg_credit_stop(__in PMSG_CREDIT pCredit);
+
+/*
+ * tsi721_msg_credit_take()
+ *
+ *  Takes a credit of a MBOX for the next message. Only one thread may
+ *  take credits.
+ *
+ * Return Value:
+ *  TRUE if a credit was taken, FALSE if the MBOX has none left.
+ */
+BOOL
+tsi721_msg_credit_take(
+    __in PMSG_CREDIT pCredit,
+    __in DWORD       dwMbox
+    );
+
+/*
+ * tsi721_msg_credit_put()
+ *
+ *  Gives back a credit taken for a message that could not be sent. Called
+ *  by the thread taking credits.
+ */
+VOID
+tsi721_msg_credit_put(
+    __in PMSG_CREDIT pCredit,
+    __in DWORD       dwMbox
+    );
+
+/*
+ * tsi721_msg_credit_stats()
+ */
+VOID
+tsi721_msg_credit_stats(
+    __in  PMSG_CREDIT       pCredit,
+    __out PMSG_CREDIT_STATS pStats
+    );
+
+#endif // _TSI721MSG_H_
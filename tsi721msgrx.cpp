@@ -0,0 +1,599 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721msgrx.cpp
+
+Description:
+
+    Inbound mailbox message receive engine.
+
+    Each mailbox gets its own device handle, a ring of page-aligned receive
+    buffers and their OVERLAPPED contexts. All mailbox handles are bound to
+    one I/O completion port with the mailbox context as completion key. A
+    pool of worker threads drains the port in batches, passes each message to
+    the handler and returns the buffer to the driver right away. The hot path
+    takes no locks and does no console I/O. Counters are kept per worker and
+    summed on request.
+
+    When the senders seal their messages with a CRC trailer, the messages
+    are checked in the receive buffer before the handler sees them, so no
+    copy is made for the check.
+
+    Optionally every reposted buffer is a credit for the sender of the
+    message it held. Credits are batched into doorbells, so a sender that
+    waits for them never has more messages in flight than buffers posted.
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <process.h>
+#include <malloc.h>
+
+#include "tsi721api.h"
+#include "tsi721dev.h"
+#include "tsi721crc.h"
+#include "tsi721msgrx.h"
+#include "tsi721pool.h"
+#include "tsi721stat.h"
+#include "tsi721trace.h"
+
+#define MSGRX_BATCH         32      // completions reaped by one call
+#define MSGRX_STOP_TIMEOUT  2000    // ms to wait for cancelled buffers on stop
+
+typedef struct _MSGRX_CTX {
+    OVERLAPPED Ovl;
+    PUCHAR     Buf;         // page-aligned receive buffer
+    DWORD      Len;         // buffer size passed to the driver
+} MSGRX_CTX, *PMSGRX_CTX;
+
+typedef struct _MSGRX_MBOX {
+    struct _MSGRX_ENGINE *Eng;
+    DWORD         Mbox;
+    HANDLE        hDev;         // handle bound to the completion port
+    PMSGRX_CTX    Ctx;          // BufNum contexts
+    volatile LONG Posted;       // buffers owned by the driver
+    volatile LONG Consumed[MSGRX_CREDIT_SRCS];  // buffers reposted per source
+    volatile LONG Reported[MSGRX_CREDIT_SRCS];  // of them returned in doorbells
+} MSGRX_MBOX, *PMSGRX_MBOX;
+
+typedef struct DECLSPEC_ALIGN(64) _MSGRX_WORKER {
+    struct _MSGRX_ENGINE *Eng;
+    HANDLE    hThread;
+    ULONGLONG Msgs[RIO_MSG_MAX_MBOX];
+    ULONGLONG Bytes[RIO_MSG_MAX_MBOX];
+    ULONGLONG Errors[RIO_MSG_MAX_MBOX];
+    ULONGLONG Credits[RIO_MSG_MAX_MBOX];
+    ULONGLONG Sealed[RIO_MSG_MAX_MBOX];
+    ULONGLONG CrcErrors[RIO_MSG_MAX_MBOX];
+} MSGRX_WORKER, *PMSGRX_WORKER;
+
+typedef struct _MSGRX_ENGINE {
+    MSGRX_CFG     Cfg;
+    HANDLE        hCompletionPort;
+    HANDLE        hIdle;        // set when the last buffer is returned after stop
+    volatile BOOL bStop;
+    volatile LONG Outstanding;  // buffers owned by the driver, all mailboxes
+    MSGRX_MBOX    Mbox[RIO_MSG_MAX_MBOX];
+    DWORD         WorkerNum;
+    PMSGRX_WORKER Worker;       // WorkerNum entries, cache line aligned
+} MSGRX_ENGINE;
+
+static unsigned __stdcall msgrx_worker_thread(PVOID params);
+
+static VOID
+msgrx_drop(
+    PMSGRX_MBOX pMb
+    )
+/*++
+
+Routine Description:
+
+    Accounts for a buffer that was not returned to the driver.
+
+--*/
+{
+    PMSGRX_ENGINE pEng = pMb->Eng;
+
+    InterlockedDecrement(&pMb->Posted);
+    if (InterlockedDecrement(&pEng->Outstanding) == 0 && pEng->bStop)
+        SetEvent(pEng->hIdle);
+}
+
+static DWORD
+msgrx_post(
+    PMSGRX_MBOX pMb,
+    PMSGRX_CTX  pCtx
+    )
+{
+    DWORD dwErr;
+
+    ZeroMemory(&pCtx->Ovl, sizeof(OVERLAPPED));
+    pCtx->Len = MSGRX_BUF_SIZE;
+
+    dwErr = g_devOps->SrioMsgAddRcvBuffer(pMb->hDev, pMb->Mbox, pCtx->Buf, &pCtx->Len, &pCtx->Ovl);
+
+    // A synchronous completion is reported through the port as well
+    return (dwErr == ERROR_SUCCESS) ? ERROR_IO_PENDING : dwErr;
+}
+
+static BOOL
+msgrx_credit_send(
+    PMSGRX_WORKER pW,
+    PMSGRX_MBOX   pMb,
+    DWORD         dwSrc,
+    DWORD         dwMin
+    )
+/*++
+
+Routine Description:
+
+    Sends the source a credit doorbell if at least dwMin of its buffers are
+    unreported. Of several workers reporting at once, the one advancing
+    Reported sends, so every buffer is returned exactly once.
+
+Return Value:
+
+    TRUE if credits of the source may be left unreported.
+
+--*/
+{
+    LONG  rep, num;
+    DWORD dwInfo, dwErr;
+    ULONGLONG t0;
+
+    rep = pMb->Reported[dwSrc];
+    num = pMb->Consumed[dwSrc] - rep;
+    if (num == 0)
+        return FALSE;
+    if ((DWORD)num < dwMin)
+        return TRUE;
+    if (num > MSGRX_DB_CNT_MASK)
+        num = MSGRX_DB_CNT_MASK;
+    if (InterlockedCompareExchange(&pMb->Reported[dwSrc], rep + num, rep) != rep)
+        return TRUE;
+
+    dwInfo = MSGRX_DB_TAG | (pMb->Mbox << MSGRX_DB_MBOX_SHIFT) | (DWORD)num;
+
+    t0 = lat_ticks();
+    dwErr = g_devOps->SrioDoorbellSend(pMb->hDev, dwSrc, dwInfo);
+    tsi721_trace(TRACE_EV_DB_SEND, dwErr, dwSrc, dwInfo, 0, t0);
+    if (dwErr == ERROR_SUCCESS)
+        pW->Credits[pMb->Mbox]++;
+    else
+        pW->Errors[pMb->Mbox]++;
+
+    return (pMb->Consumed[dwSrc] != pMb->Reported[dwSrc]);
+}
+
+static BOOL
+msgrx_credit(
+    PMSGRX_WORKER pW,
+    PMSGRX_MBOX   pMb,
+    DWORD         dwSrc
+    )
+/*++
+
+Routine Description:
+
+    Counts a reposted buffer against the source of its message and reports
+    the source's buffers once CreditBatch of them are unreported.
+
+Return Value:
+
+    TRUE if credits of the source may be left unreported.
+
+--*/
+{
+    if (dwSrc >= MSGRX_CREDIT_SRCS)
+        return FALSE;
+
+    InterlockedIncrement(&pMb->Consumed[dwSrc]);
+
+    return msgrx_credit_send(pW, pMb, dwSrc, pMb->Eng->Cfg.CreditBatch);
+}
+
+static VOID
+msgrx_credit_flush(
+    PMSGRX_WORKER pW
+    )
+/*++
+
+Routine Description:
+
+    Reports the partial batches of all sources. Called when the completion
+    port drains: a sender waiting for credits has nothing more in flight,
+    and a sender starting later must not receive the remainder of an
+    earlier one.
+
+--*/
+{
+    PMSGRX_ENGINE pEng = pW->Eng;
+    DWORD mbox, src;
+
+    for (mbox = 0; mbox < RIO_MSG_MAX_MBOX; mbox++) {
+        PMSGRX_MBOX pMb = &pEng->Mbox[mbox];
+
+        if (!(pEng->Cfg.MboxMask & (1 << mbox)))
+            continue;
+
+        for (src = 0; src < MSGRX_CREDIT_SRCS; src++)
+            if (pMb->Consumed[src] != pMb->Reported[src])
+                msgrx_credit_send(pW, pMb, src, 1);
+    }
+}
+
+DWORD
+tsi721_msgrx_start(
+    DWORD          dwDevNum,
+    PMSGRX_CFG     pCfg,
+    PMSGRX_ENGINE *ppEng
+    )
+/*++
+
+Routine Description:
+
+    Creates the receive engine, posts the initial buffers and starts the
+    worker pool.
+
+Arguments:
+
+    dwDevNum - Tsi721 device index
+    pCfg     - configuration
+    ppEng    - pointer to variable to save the created engine
+
+Return Value:
+
+    ERROR_SUCCESS or an error code.
+
+--*/
+{
+    PMSGRX_ENGINE pEng;
+    SYSTEM_INFO   sysInfo;
+    DWORD         mbox, i, dwErr;
+
+    if (pCfg == NULL || ppEng == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    *ppEng = NULL;
+
+    pEng = (PMSGRX_ENGINE)malloc(sizeof(MSGRX_ENGINE));
+    if (pEng == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    ZeroMemory(pEng, sizeof(MSGRX_ENGINE));
+    pEng->Cfg = *pCfg;
+
+    if (pEng->Cfg.MboxMask == 0)
+        pEng->Cfg.MboxMask = (1 << RIO_MSG_MAX_MBOX) - 1;
+    if (pEng->Cfg.BufNum == 0)
+        pEng->Cfg.BufNum = MSGRX_DEF_BUFS;
+    if (pEng->Cfg.WorkerNum == 0) {
+        GetSystemInfo(&sysInfo);
+        pEng->Cfg.WorkerNum = sysInfo.dwNumberOfProcessors;
+    }
+    if (pEng->Cfg.WorkerNum > MSGRX_MAX_WORKERS)
+        pEng->Cfg.WorkerNum = MSGRX_MAX_WORKERS;
+
+    if ((pEng->Cfg.MboxMask & ~((1 << RIO_MSG_MAX_MBOX) - 1)) ||
+        pEng->Cfg.BufNum > MSGRX_MAX_BUFS || pEng->Cfg.CreditBatch > pEng->Cfg.BufNum) {
+        free(pEng);
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    for (mbox = 0; mbox < RIO_MSG_MAX_MBOX; mbox++) {
+        pEng->Mbox[mbox].Eng = pEng;
+        pEng->Mbox[mbox].Mbox = mbox;
+        pEng->Mbox[mbox].hDev = INVALID_HANDLE_VALUE;
+    }
+
+    pEng->hIdle = CreateEvent(NULL, TRUE, FALSE, NULL);
+    pEng->hCompletionPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0,
+                                                   pEng->Cfg.WorkerNum);
+    if (pEng->hIdle == NULL || pEng->hCompletionPort == NULL) {
+        dwErr = GetLastError();
+        goto err_exit;
+    }
+
+    //
+    // One device handle per mailbox, all bound to the same port. The
+    // completion key identifies the mailbox.
+    //
+    for (mbox = 0; mbox < RIO_MSG_MAX_MBOX; mbox++) {
+        PMSGRX_MBOX pMb = &pEng->Mbox[mbox];
+
+        if (!(pEng->Cfg.MboxMask & (1 << mbox)))
+            continue;
+
+        if (!g_devOps->DeviceOpen(&pMb->hDev, dwDevNum, NULL)) {
+            dwErr = GetLastError();
+            pMb->hDev = INVALID_HANDLE_VALUE;
+            goto err_exit;
+        }
+
+        dwErr = g_devOps->BindPort(pMb->hDev, pEng->hCompletionPort, (ULONG_PTR)pMb);
+        if (dwErr != ERROR_SUCCESS)
+            goto err_exit;
+
+        pMb->Ctx = (PMSGRX_CTX)calloc(pEng->Cfg.BufNum, sizeof(MSGRX_CTX));
+        if (pMb->Ctx == NULL) {
+            dwErr = ERROR_NOT_ENOUGH_MEMORY;
+            goto err_exit;
+        }
+
+        //
+        // Messaging buffers have to be aligned to the page boundary
+        //
+        for (i = 0; i < pEng->Cfg.BufNum; i++) {
+            pMb->Ctx[i].Buf = (PUCHAR)tsi721_pool_alloc(MSGRX_BUF_SIZE);
+            if (pMb->Ctx[i].Buf == NULL) {
+                dwErr = ERROR_NOT_ENOUGH_MEMORY;
+                goto err_exit;
+            }
+        }
+    }
+
+    pEng->Worker = (PMSGRX_WORKER)_aligned_malloc(pEng->Cfg.WorkerNum * sizeof(MSGRX_WORKER),
+                                                  __alignof(MSGRX_WORKER));
+    if (pEng->Worker == NULL) {
+        dwErr = ERROR_NOT_ENOUGH_MEMORY;
+        goto err_exit;
+    }
+
+    ZeroMemory(pEng->Worker, pEng->Cfg.WorkerNum * sizeof(MSGRX_WORKER));
+
+    for (i = 0; i < pEng->Cfg.WorkerNum; i++) {
+        pEng->Worker[i].Eng = pEng;
+        pEng->Worker[i].hThread = (HANDLE)_beginthreadex(NULL, 0, msgrx_worker_thread,
+                                                         &pEng->Worker[i], 0, NULL);
+        if (pEng->Worker[i].hThread == NULL) {
+            dwErr = GetLastError();
+            goto err_exit;
+        }
+        pEng->WorkerNum++;
+    }
+
+    //
+    // Send initial set of buffers to the driver
+    //
+    for (mbox = 0; mbox < RIO_MSG_MAX_MBOX; mbox++) {
+        PMSGRX_MBOX pMb = &pEng->Mbox[mbox];
+
+        if (pMb->hDev == INVALID_HANDLE_VALUE)
+            continue;
+
+        for (i = 0; i < pEng->Cfg.BufNum; i++) {
+            InterlockedIncrement(&pMb->Posted);
+            InterlockedIncrement(&pEng->Outstanding);
+
+            dwErr = msgrx_post(pMb, &pMb->Ctx[i]);
+            if (dwErr != ERROR_IO_PENDING) {
+                msgrx_drop(pMb);
+                goto err_exit;
+            }
+        }
+    }
+
+    *ppEng = pEng;
+    return ERROR_SUCCESS;
+
+err_exit:
+
+    tsi721_msgrx_stop(pEng);
+    return dwErr;
+}
+
+VOID
+tsi721_msgrx_stop(
+    PMSGRX_ENGINE pEng
+    )
+/*++
+
+Routine Description:
+
+    Cancels all posted buffers, waits until the driver has returned them and
+    then releases the workers with one empty completion packet each.
+
+Arguments:
+
+    pEng - engine
+
+Return Value:
+
+    NONE
+
+--*/
+{
+    DWORD mbox, i;
+
+    if (pEng == NULL)
+        return;
+
+    pEng->bStop = TRUE;
+
+    for (mbox = 0; mbox < RIO_MSG_MAX_MBOX; mbox++)
+        if (pEng->Mbox[mbox].hDev != INVALID_HANDLE_VALUE)
+            g_devOps->CancelIo(pEng->Mbox[mbox].hDev, NULL);
+
+    if (pEng->Outstanding && pEng->WorkerNum) {
+        if (WaitForSingleObject(pEng->hIdle, MSGRX_STOP_TIMEOUT) != WAIT_OBJECT_0)
+            printf_s("MSGRX: %d receive buffers not returned by the driver\n", pEng->Outstanding);
+    }
+
+    for (i = 0; i < pEng->WorkerNum; i++)
+        PostQueuedCompletionStatus(pEng->hCompletionPort, 0, 0, NULL);
+
+    for (i = 0; i < pEng->WorkerNum; i++) {
+        WaitForSingleObject(pEng->Worker[i].hThread, INFINITE);
+        CloseHandle(pEng->Worker[i].hThread);
+    }
+
+    for (mbox = 0; mbox < RIO_MSG_MAX_MBOX; mbox++) {
+        PMSGRX_MBOX pMb = &pEng->Mbox[mbox];
+
+        // Closing the handle releases buffers the driver did not return
+        if (pMb->hDev != INVALID_HANDLE_VALUE)
+            g_devOps->DeviceClose(pMb->hDev, NULL);
+
+        if (pMb->Ctx) {
+            for (i = 0; i < pEng->Cfg.BufNum; i++)
+                tsi721_pool_free(pMb->Ctx[i].Buf);
+            free(pMb->Ctx);
+        }
+    }
+
+    if (pEng->Worker)
+        _aligned_free(pEng->Worker);
+    if (pEng->hCompletionPort)
+        CloseHandle(pEng->hCompletionPort);
+    if (pEng->hIdle)
+        CloseHandle(pEng->hIdle);
+
+    free(pEng);
+}
+
+VOID
+tsi721_msgrx_stats(
+    PMSGRX_ENGINE pEng,
+    PMSGRX_STATS  pStats
+    )
+{
+    DWORD mbox, i;
+
+    ZeroMemory(pStats, sizeof(MSGRX_STATS));
+
+    for (mbox = 0; mbox < RIO_MSG_MAX_MBOX; mbox++) {
+        for (i = 0; i < pEng->WorkerNum; i++) {
+            pStats->Msgs[mbox] += pEng->Worker[i].Msgs[mbox];
+            pStats->Bytes[mbox] += pEng->Worker[i].Bytes[mbox];
+            pStats->Errors[mbox] += pEng->Worker[i].Errors[mbox];
+            pStats->Credits[mbox] += pEng->Worker[i].Credits[mbox];
+            pStats->Sealed[mbox] += pEng->Worker[i].Sealed[mbox];
+            pStats->CrcErrors[mbox] += pEng->Worker[i].CrcErrors[mbox];
+        }
+        pStats->Posted[mbox] = pEng->Mbox[mbox].Posted;
+    }
+}
+
+static unsigned __stdcall
+msgrx_worker_thread(
+    PVOID params
+    )
+/*++
+
+Routine Description:
+
+    Worker thread. Reaps inbound message completions from all mailboxes,
+    calls the handler and reposts each buffer. While credits are left
+    unreported the port is polled; once it is empty they are reported. An
+    empty completion packet (key 0) requests termination.
+
+Arguments:
+
+    params - pointer to worker structure
+
+Return Value:
+
+    0
+
+--*/
+{
+    PMSGRX_WORKER pW = (PMSGRX_WORKER)params;
+    PMSGRX_ENGINE pEng = pW->Eng;
+    OVERLAPPED_ENTRY entry[MSGRX_BATCH];
+    BOOL  bExit = FALSE;
+    BOOL  bUnreported = FALSE;
+    ULONG ulNum, i;
+    DWORD dwRet, dwErr, dwSrc;
+
+    while (!bExit) {
+        if (!GetQueuedCompletionStatusEx(pEng->hCompletionPort, entry, MSGRX_BATCH, &ulNum,
+                                         bUnreported ? 0 : INFINITE, FALSE)) {
+            if (!bUnreported || GetLastError() != WAIT_TIMEOUT)
+                break;
+
+            // Nothing more received: report the partial batches
+            msgrx_credit_flush(pW);
+            bUnreported = FALSE;
+            continue;
+        }
+
+        for (i = 0; i < ulNum; i++) {
+            PMSGRX_MBOX pMb = (PMSGRX_MBOX)entry[i].lpCompletionKey;
+            PMSGRX_CTX  pCtx;
+
+            if (pMb == NULL) {
+                // Leave extra termination packets to the other workers
+                if (bExit)
+                    PostQueuedCompletionStatus(pEng->hCompletionPort, 0, 0, NULL);
+                bExit = TRUE;
+                continue;
+            }
+
+            pCtx = CONTAINING_RECORD(entry[i].lpOverlapped, MSGRX_CTX, Ovl);
+            dwSrc = MSGRX_CREDIT_SRCS;  // no message, no credit
+
+            if (GetOverlappedResult(pMb->hDev, &pCtx->Ovl, &dwRet, FALSE)) {
+                // Bits 15:0 - source destID, bits 31:16 - message size
+                DWORD dwSize = (dwRet >> 16) & 0xffff;
+
+                dwSrc = dwRet & 0xffff;
+                pW->Msgs[pMb->Mbox]++;
+                pW->Bytes[pMb->Mbox] += dwSize;
+                tsi721_trace(TRACE_EV_MSG_RECV, 0, pMb->Mbox, dwSize, dwSrc, 0);
+
+                // A sealed message without a trailer is as bad as one
+                // with a wrong CRC
+                dwErr = ERROR_SUCCESS;
+                if (pEng->Cfg.bCrc) {
+                    dwErr = tsi721_crc_check(pCtx->Buf, &dwSize);
+                    if (dwErr == ERROR_SUCCESS)
+                        pW->Sealed[pMb->Mbox]++;
+                    else {
+                        pW->CrcErrors[pMb->Mbox]++;
+                        dwErr = ERROR_CRC;
+                    }
+                }
+
+                if (pEng->Cfg.Handler && dwErr != ERROR_CRC)
+                    pEng->Cfg.Handler(pEng->Cfg.HandlerCtx, pMb->Mbox, dwSrc, pCtx->Buf, dwSize);
+            } else if (!pEng->bStop) {
+                pW->Errors[pMb->Mbox]++;
+                tsi721_trace(TRACE_EV_MSG_RECV, GetLastError(), pMb->Mbox, 0, 0, 0);
+            }
+
+            if (pEng->bStop) {
+                msgrx_drop(pMb);
+                continue;
+            }
+
+            //
+            // Return processed message buffer to the driver receive queue
+            //
+            dwErr = msgrx_post(pMb, pCtx);
+            if (dwErr != ERROR_IO_PENDING) {
+                pW->Errors[pMb->Mbox]++;
+                msgrx_drop(pMb);
+            } else if (pEng->bStop) {
+                // Stop raced with the repost: cancel it explicitly
+                g_devOps->CancelIo(pMb->hDev, &pCtx->Ovl);
+            } else if (pEng->Cfg.CreditBatch) {
+                // The buffer is the driver's again: credit its sender
+                if (msgrx_credit(pW, pMb, dwSrc))
+                    bUnreported = TRUE;
+            }
+        }
+    }
+
+    // Handlers may have used the buffer pool
+    tsi721_pool_thread_flush();
+
+    return 0;
+}
@@ -0,0 +1,131 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721msgrx.h
+
+Description:
+
+    Inbound mailbox message receive engine.
+
+--*/
+
+#ifndef _TSI721MSGRX_H_
+#define _TSI721MSGRX_H_
+
+#define MSGRX_BUF_SIZE      0x1000  // size of one posted receive buffer (one page)
+#define MSGRX_DEF_BUFS      64      // default number of posted buffers per MBOX
+#define MSGRX_MAX_BUFS      TSI721_NUM_ASYNCH_IO
+#define MSGRX_MAX_WORKERS   16
+#define MSGRX_DEF_CREDIT_BATCH  16  // messages consumed from a source between credit doorbells
+
+//
+// Credit doorbells. The receiver counts, per source and MBOX, the messages
+// whose buffer it has posted again, and every CreditBatch messages sends
+// the source the number reposted since its previous doorbell: tag in
+// INFO[15:12], MBOX in INFO[11:10], number in INFO[9:0]. Once the receive
+// queue drains, a partial batch is reported as well, so no credits are
+// left over for a later sender on the same destID. Numbers rather than
+// running totals let a sender restart without resynchronising; a lost
+// doorbell loses its credits. Sources are counted by 8-bit destID.
+//
+#define MSGRX_DB_TAG        0xe000
+#define MSGRX_DB_TAG_MASK   0xf000
+#define MSGRX_DB_MBOX_SHIFT 10
+#define MSGRX_DB_CNT_MASK   0x03ff
+#define MSGRX_DB_IS_CREDIT(info)    (((info) & MSGRX_DB_TAG_MASK) == MSGRX_DB_TAG)
+#define MSGRX_CREDIT_SRCS   256
+
+//
+// Message callback. Called from a worker thread; the message buffer is
+// reposted to the driver as soon as the callback returns.
+//
+//  pCtx   - HandlerCtx from MSGRX_CFG
+//  dwMbox - mailbox the message arrived to
+//  dwSrc  - destID of the sender
+//  pMsg   - message data
+//  dwSize - message size in bytes
+//
+typedef VOID (*PFN_MSGRX_HANDLER)(PVOID pCtx, DWORD dwMbox, DWORD dwSrc, PVOID pMsg, DWORD dwSize);
+
+typedef struct _MSGRX_CFG {
+    DWORD             MboxMask;     // bit N set = receive on MBOX N (0 = all mailboxes)
+    DWORD             BufNum;       // posted buffers per MBOX (0 = MSGRX_DEF_BUFS)
+    DWORD             WorkerNum;    // worker threads (0 = number of processors)
+    PFN_MSGRX_HANDLER Handler;      // NULL = count messages only
+    PVOID             HandlerCtx;
+    DWORD             CreditBatch;  // messages per credit doorbell, up to BufNum (0 = no credits);
+                                    // BufNum / 2 or less keeps the sender from stalling
+    BOOL              bCrc;         // every message is sealed with a CRC trailer
+} MSGRX_CFG, *PMSGRX_CFG;
+
+typedef struct _MSGRX_STATS {
+    ULONGLONG Msgs[RIO_MSG_MAX_MBOX];   // messages received
+    ULONGLONG Bytes[RIO_MSG_MAX_MBOX];  // payload bytes received
+    ULONGLONG Errors[RIO_MSG_MAX_MBOX]; // failed receive or repost requests
+    ULONGLONG Credits[RIO_MSG_MAX_MBOX]; // credit doorbells sent
+    ULONGLONG Sealed[RIO_MSG_MAX_MBOX]; // sealed messages whose CRC matched
+    ULONGLONG CrcErrors[RIO_MSG_MAX_MBOX]; // sealed messages with a wrong CRC or no trailer
+    DWORD     Posted[RIO_MSG_MAX_MBOX]; // buffers currently owned by the driver
+} MSGRX_STATS, *PMSGRX_STATS;
+
+typedef struct _MSGRX_ENGINE *PMSGRX_ENGINE;
+
+/*
+ * tsi721_msgrx_start()
+ *
+ *  Opens one device handle per selected MBOX and associates all of them
+ *  with a single completion port, keyed by mailbox. Posts BufNum receive
+ *  buffers to every mailbox and starts a pool of worker threads that drain
+ *  the port, call the handler and repost the buffers. With CreditBatch set,
+ *  reposted buffers are returned to their senders as credit doorbells
+ *  (see tsi721_msg_credit_start()), in batches while messages keep arriving
+ *  and all at once when the receive queue drains. With bCrc set, every
+ *  message must be sealed (see tsi721_crc_seal()): it is checked and passed
+ *  to the handler without the trailer; messages failing the check or
+ *  carrying no trailer are counted and dropped.
+ *
+ * Arguments:
+ *  dwDevNum - Tsi721 device index
+ *  pCfg     - receive engine configuration
+ *  ppEng    - pointer to variable to save the created engine
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the engine was started successfully,
+ *                  otherwise an error code.
+ */
+DWORD
+tsi721_msgrx_start(
+    __in  DWORD          dwDevNum,
+    __in  PMSGRX_CFG     pCfg,
+    __out PMSGRX_ENGINE *ppEng
+    );
+
+/*
+ * tsi721_msgrx_stop()
+ *
+ *  Cancels posted buffers, stops the worker threads and frees the engine.
+ */
+VOID
+tsi721_msgrx_stop(
+    __in PMSGRX_ENGINE pEng
+    );
+
+/*
+ * tsi721_msgrx_stats()
+ *
+ *  Returns counters accumulated since the engine was started.
+ */
+VOID
+tsi721_msgrx_stats(
+    __in  PMSGRX_ENGINE pEng,
+    __out PMSGRX_STATS  pStats
+    );
+
+#endif // _TSI721MSGRX_H_
@@ -0,0 +1,632 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721pattern.cpp
+
+Description:
+
+    Vectorized test pattern generator and verifier.
+
+    Pattern words form an arithmetic sequence, so a vector of consecutive
+    words is advanced by adding a constant vector. AVX2 (8 words), SSE2
+    (4 words) and scalar versions are selected at run time with CPUID.
+    Mismatching vectors are rescanned byte by byte to report the exact
+    offset and count of bad bytes.
+
+    Random payload words are independent hashes of their index, so they are
+    computed without a carried state: the loop has no dependency between
+    words other than one addition, and the CPU overlaps the multiplications
+    of consecutive words.
+
+--*/
+
+#include <windows.h>
+#include <intrin.h>
+
+#include "tsi721pattern.h"
+
+typedef VOID  (*PFN_PAT_FILL)(PUCHAR, DWORD, DWORD, ULONGLONG);
+typedef VOID  (*PFN_PAT_VERIFY)(PUCHAR, DWORD, DWORD, ULONGLONG, PPATTERN_ERR);
+
+//
+// The routines of one instruction set. A single pointer to a constant
+// entry is published, so a thread finding it set also finds all of the
+// entry; first callers racing on the selection store the same pointer.
+//
+typedef struct _PATTERN_IMPL {
+    PCSTR          Isa;
+    PFN_PAT_FILL   Fill;
+    PFN_PAT_VERIFY Verify;
+} PATTERN_IMPL;
+
+static const PATTERN_IMPL *volatile g_pPat = NULL;
+
+//
+// GCC only emits AVX2 instructions in functions compiled for that target;
+// the routines are still selected at run time from CPUID.
+//
+#ifdef __GNUC__
+#define PATTERN_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define PATTERN_TARGET_AVX2
+#endif
+
+static __forceinline DWORD
+pattern_word(
+    DWORD     seed,
+    ULONGLONG word
+    )
+{
+    return seed + (DWORD)word * PATTERN_STEP;
+}
+
+static __forceinline UCHAR
+pattern_byte(
+    DWORD     seed,
+    ULONGLONG offset
+    )
+{
+    return (UCHAR)(pattern_word(seed, offset >> 2) >> ((offset & 3) * 8));
+}
+
+static VOID
+pattern_check_bytes(
+    PUCHAR       p,
+    DWORD        len,
+    DWORD        seed,
+    ULONGLONG    offset,
+    PPATTERN_ERR pErr
+    )
+{
+    DWORD i;
+
+    for (i = 0; i < len; i++) {
+        UCHAR exp = pattern_byte(seed, offset + i);
+
+        if (p[i] != exp) {
+            if (pErr->BadCount++ == 0) {
+                pErr->FirstBad = offset + i;
+                pErr->Expected = exp;
+                pErr->Actual = p[i];
+            }
+        }
+    }
+}
+
+//
+// Word-aligned bodies: p points to payload offset (word << 2), nWords words.
+//
+
+static VOID
+pattern_fill_scalar(
+    PUCHAR    p,
+    DWORD     nWords,
+    DWORD     seed,
+    ULONGLONG word
+    )
+{
+    DWORD v = pattern_word(seed, word);
+    DWORD i;
+
+    for (i = 0; i < nWords; i++, p += 4) {
+        memcpy(p, &v, 4);
+        v += PATTERN_STEP;
+    }
+}
+
+static VOID
+pattern_verify_scalar(
+    PUCHAR       p,
+    DWORD        nWords,
+    DWORD        seed,
+    ULONGLONG    word,
+    PPATTERN_ERR pErr
+    )
+{
+    DWORD v = pattern_word(seed, word);
+    DWORD i, d;
+
+    for (i = 0; i < nWords; i++, p += 4) {
+        memcpy(&d, p, 4);
+        if (d != v)
+            pattern_check_bytes(p, 4, seed, (word + i) << 2, pErr);
+        v += PATTERN_STEP;
+    }
+}
+
+static VOID
+pattern_fill_sse2(
+    PUCHAR    p,
+    DWORD     nWords,
+    DWORD     seed,
+    ULONGLONG word
+    )
+{
+    DWORD   v0 = pattern_word(seed, word);
+    __m128i v = _mm_setr_epi32((int)v0, (int)(v0 + PATTERN_STEP),
+                               (int)(v0 + 2 * PATTERN_STEP), (int)(v0 + 3 * PATTERN_STEP));
+    __m128i inc = _mm_set1_epi32((int)(4 * PATTERN_STEP));
+    DWORD   i;
+
+    for (i = 0; i + 4 <= nWords; i += 4, p += 16) {
+        _mm_storeu_si128((__m128i *)p, v);
+        v = _mm_add_epi32(v, inc);
+    }
+
+    pattern_fill_scalar(p, nWords - i, seed, word + i);
+}
+
+static VOID
+pattern_verify_sse2(
+    PUCHAR       p,
+    DWORD        nWords,
+    DWORD        seed,
+    ULONGLONG    word,
+    PPATTERN_ERR pErr
+    )
+{
+    DWORD   v0 = pattern_word(seed, word);
+    __m128i v = _mm_setr_epi32((int)v0, (int)(v0 + PATTERN_STEP),
+                               (int)(v0 + 2 * PATTERN_STEP), (int)(v0 + 3 * PATTERN_STEP));
+    __m128i inc = _mm_set1_epi32((int)(4 * PATTERN_STEP));
+    DWORD   i;
+
+    for (i = 0; i + 4 <= nWords; i += 4, p += 16) {
+        __m128i d = _mm_loadu_si128((const __m128i *)p);
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(d, v)) != 0xffff)
+            pattern_check_bytes(p, 16, seed, (word + i) << 2, pErr);
+        v = _mm_add_epi32(v, inc);
+    }
+
+    pattern_verify_scalar(p, nWords - i, seed, word + i, pErr);
+}
+
+static PATTERN_TARGET_AVX2 VOID
+pattern_fill_avx2(
+    PUCHAR    p,
+    DWORD     nWords,
+    DWORD     seed,
+    ULONGLONG word
+    )
+{
+    DWORD   v0 = pattern_word(seed, word);
+    __m256i v = _mm256_setr_epi32((int)v0, (int)(v0 + PATTERN_STEP),
+                                  (int)(v0 + 2 * PATTERN_STEP), (int)(v0 + 3 * PATTERN_STEP),
+                                  (int)(v0 + 4 * PATTERN_STEP), (int)(v0 + 5 * PATTERN_STEP),
+                                  (int)(v0 + 6 * PATTERN_STEP), (int)(v0 + 7 * PATTERN_STEP));
+    __m256i inc = _mm256_set1_epi32((int)(8 * PATTERN_STEP));
+    __m256i inc2 = _mm256_set1_epi32((int)(16 * PATTERN_STEP));
+    __m256i w = _mm256_add_epi32(v, inc);
+    DWORD   i;
+
+    // Two independent accumulators per iteration
+    for (i = 0; i + 16 <= nWords; i += 16, p += 64) {
+        _mm256_storeu_si256((__m256i *)p, v);
+        _mm256_storeu_si256((__m256i *)(p + 32), w);
+        v = _mm256_add_epi32(v, inc2);
+        w = _mm256_add_epi32(w, inc2);
+    }
+
+    _mm256_zeroupper();
+
+    pattern_fill_sse2(p, nWords - i, seed, word + i);
+}
+
+static PATTERN_TARGET_AVX2 VOID
+pattern_verify_avx2(
+    PUCHAR       p,
+    DWORD        nWords,
+    DWORD        seed,
+    ULONGLONG    word,
+    PPATTERN_ERR pErr
+    )
+{
+    DWORD   v0 = pattern_word(seed, word);
+    __m256i v = _mm256_setr_epi32((int)v0, (int)(v0 + PATTERN_STEP),
+                                  (int)(v0 + 2 * PATTERN_STEP), (int)(v0 + 3 * PATTERN_STEP),
+                                  (int)(v0 + 4 * PATTERN_STEP), (int)(v0 + 5 * PATTERN_STEP),
+                                  (int)(v0 + 6 * PATTERN_STEP), (int)(v0 + 7 * PATTERN_STEP));
+    __m256i inc = _mm256_set1_epi32((int)(8 * PATTERN_STEP));
+    DWORD   i;
+
+    for (i = 0; i + 8 <= nWords; i += 8, p += 32) {
+        __m256i d = _mm256_loadu_si256((const __m256i *)p);
+
+        if ((DWORD)_mm256_movemask_epi8(_mm256_cmpeq_epi8(d, v)) != 0xffffffff)
+            pattern_check_bytes(p, 32, seed, (word + i) << 2, pErr);
+        v = _mm256_add_epi32(v, inc);
+    }
+
+    _mm256_zeroupper();
+
+    pattern_verify_sse2(p, nWords - i, seed, word + i, pErr);
+}
+
+static const PATTERN_IMPL g_patImpl[] = {
+    { "scalar", pattern_fill_scalar, pattern_verify_scalar },
+    { "SSE2",   pattern_fill_sse2,   pattern_verify_sse2 },
+    { "AVX2",   pattern_fill_avx2,   pattern_verify_avx2 },
+};
+
+static const PATTERN_IMPL *
+pattern_select(
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Selects the widest instruction set supported by the CPU and the OS.
+
+Return Value:
+
+    Routines of the selected instruction set.
+
+--*/
+{
+    const PATTERN_IMPL *pPat;
+    int  info[4];
+    BOOL bSse2, bAvx2 = FALSE;
+
+    __cpuid(info, 0);
+    if (info[0] >= 1) {
+        int maxLeaf = info[0];
+
+        __cpuid(info, 1);
+        bSse2 = (info[3] & (1 << 26)) != 0;
+
+        // AVX2 requires OS support for YMM state (OSXSAVE + XCR0 bits 1,2)
+        if ((info[2] & (1 << 27)) && (info[2] & (1 << 28)) && maxLeaf >= 7 &&
+            (_xgetbv(0) & 6) == 6) {
+            __cpuidex(info, 7, 0);
+            bAvx2 = (info[1] & (1 << 5)) != 0;
+        }
+    } else
+        bSse2 = FALSE;
+
+    pPat = &g_patImpl[bAvx2 ? 2 : bSse2 ? 1 : 0];
+    g_pPat = pPat;
+
+    return pPat;
+}
+
+VOID
+tsi721_pattern_fill(
+    PVOID     pBuf,
+    DWORD     dwSize,
+    DWORD     dwSeed,
+    ULONGLONG Offset
+    )
+/*++
+
+Routine Description:
+
+    Generates the pattern in place. Bytes up to the next word boundary of the
+    payload offset and the trailing partial word are produced one by one, the
+    body by the selected vector routine.
+
+Arguments:
+
+    pBuf   - buffer to fill
+    dwSize - number of bytes
+    dwSeed - pattern seed
+    Offset - payload offset of the first byte
+
+Return Value:
+
+    NONE
+
+--*/
+{
+    const PATTERN_IMPL *pPat = g_pPat;
+    PUCHAR p = (PUCHAR)pBuf;
+    DWORD  nWords;
+
+    if (pPat == NULL)
+        pPat = pattern_select();
+
+    while (dwSize && (Offset & 3)) {
+        *p++ = pattern_byte(dwSeed, Offset++);
+        dwSize--;
+    }
+
+    nWords = dwSize >> 2;
+    pPat->Fill(p, nWords, dwSeed, Offset >> 2);
+
+    p += nWords << 2;
+    Offset += (ULONGLONG)nWords << 2;
+    dwSize &= 3;
+
+    while (dwSize--)
+        *p++ = pattern_byte(dwSeed, Offset++);
+}
+
+DWORD
+tsi721_pattern_verify(
+    PVOID        pBuf,
+    DWORD        dwSize,
+    DWORD        dwSeed,
+    ULONGLONG    Offset,
+    PPATTERN_ERR pErr
+    )
+/*++
+
+Routine Description:
+
+    Compares received data with the pattern regenerated from the seed.
+
+Arguments:
+
+    pBuf   - received data
+    dwSize - number of bytes
+    dwSeed - pattern seed
+    Offset - payload offset of the first byte
+    pErr   - optional mismatch details
+
+Return Value:
+
+    ERROR_SUCCESS or ERROR_CRC.
+
+--*/
+{
+    const PATTERN_IMPL *pPat = g_pPat;
+    PATTERN_ERR err;
+    PUCHAR p = (PUCHAR)pBuf;
+    DWORD  nHead, nWords;
+
+    if (pPat == NULL)
+        pPat = pattern_select();
+
+    ZeroMemory(&err, sizeof(err));
+
+    nHead = (DWORD)min((ULONGLONG)dwSize, (4 - (Offset & 3)) & 3);
+    pattern_check_bytes(p, nHead, dwSeed, Offset, &err);
+    p += nHead;
+    Offset += nHead;
+    dwSize -= nHead;
+
+    nWords = dwSize >> 2;
+    pPat->Verify(p, nWords, dwSeed, Offset >> 2, &err);
+
+    p += nWords << 2;
+    Offset += (ULONGLONG)nWords << 2;
+    pattern_check_bytes(p, dwSize & 3, dwSeed, Offset, &err);
+
+    if (pErr)
+        *pErr = err;
+
+    return err.BadCount ? ERROR_CRC : ERROR_SUCCESS;
+}
+
+PCSTR
+tsi721_pattern_isa(
+    VOID
+    )
+{
+    const PATTERN_IMPL *pPat = g_pPat;
+
+    if (pPat == NULL)
+        pPat = pattern_select();
+
+    return pPat->Isa;
+}
+
+static __forceinline ULONGLONG
+rng_mix(
+    ULONGLONG z
+    )
+{
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static __forceinline ULONGLONG
+rng_word(
+    const RNG_STREAM *pRng,
+    ULONGLONG         word
+    )
+{
+    return rng_mix(pRng->Key + word * pRng->Gamma);
+}
+
+static __forceinline UCHAR
+rng_byte(
+    const RNG_STREAM *pRng,
+    ULONGLONG         offset
+    )
+{
+    return (UCHAR)(rng_word(pRng, offset >> 3) >> ((offset & 7) * 8));
+}
+
+static VOID
+rng_check_bytes(
+    const RNG_STREAM *pRng,
+    PUCHAR            p,
+    DWORD             len,
+    ULONGLONG         offset,
+    PPATTERN_ERR      pErr
+    )
+{
+    DWORD i;
+
+    for (i = 0; i < len; i++) {
+        UCHAR exp = rng_byte(pRng, offset + i);
+
+        if (p[i] != exp) {
+            if (pErr->BadCount++ == 0) {
+                pErr->FirstBad = offset + i;
+                pErr->Expected = exp;
+                pErr->Actual = p[i];
+            }
+        }
+    }
+}
+
+VOID
+tsi721_rng_init(
+    PRNG_STREAM pRng,
+    ULONGLONG   Seed,
+    DWORD       dwStream
+    )
+/*++
+
+Routine Description:
+
+    Derives the key and the increment of a stream the way SplitMix64 splits
+    a generator. Every stream gets its own odd increment, so two streams
+    are not shifted copies of one sequence. Increments with few bit
+    transitions mix poorly and are toggled with an alternating pattern.
+
+Arguments:
+
+    pRng     - generator to initialize
+    Seed     - run seed
+    dwStream - stream number
+
+Return Value:
+
+    NONE
+
+--*/
+{
+    ULONGLONG z, t;
+    DWORD     bits;
+
+    z = Seed + ((ULONGLONG)dwStream + 1) * RNG_GOLDEN;
+    pRng->Key = rng_mix(z);
+
+    z = rng_mix(z + RNG_GOLDEN);
+    z = (z ^ (z >> 33)) * 0xFF51AFD7ED558CCDULL;
+    z = (z ^ (z >> 33)) * 0xC4CEB9FE1A85EC53ULL;
+    z = (z ^ (z >> 33)) | 1;
+
+    for (bits = 0, t = z ^ (z >> 1); t; t &= t - 1)
+        bits++;
+    if (bits < 24)
+        z ^= 0xAAAAAAAAAAAAAAAAULL;
+
+    pRng->Gamma = z;
+}
+
+VOID
+tsi721_rng_fill(
+    const RNG_STREAM *pRng,
+    PVOID             pBuf,
+    DWORD             dwSize,
+    ULONGLONG         Offset
+    )
+/*++
+
+Routine Description:
+
+    Generates stream bytes in place. Bytes up to the next word boundary of
+    the payload offset and the trailing partial word are produced one by
+    one, the body a word at a time.
+
+Arguments:
+
+    pRng   - stream generator
+    pBuf   - buffer to fill
+    dwSize - number of bytes
+    Offset - payload offset of the first byte
+
+Return Value:
+
+    NONE
+
+--*/
+{
+    PUCHAR    p = (PUCHAR)pBuf;
+    ULONGLONG x, v;
+    DWORD     i, nWords;
+
+    while (dwSize && (Offset & 7)) {
+        *p++ = rng_byte(pRng, Offset++);
+        dwSize--;
+    }
+
+    nWords = dwSize >> 3;
+    x = pRng->Key + (Offset >> 3) * pRng->Gamma;
+
+    for (i = 0; i < nWords; i++, p += 8) {
+        v = rng_mix(x);
+        memcpy(p, &v, 8);
+        x += pRng->Gamma;
+    }
+
+    Offset += (ULONGLONG)nWords << 3;
+    dwSize &= 7;
+
+    while (dwSize--)
+        *p++ = rng_byte(pRng, Offset++);
+}
+
+DWORD
+tsi721_rng_verify(
+    const RNG_STREAM *pRng,
+    PVOID             pBuf,
+    DWORD             dwSize,
+    ULONGLONG         Offset,
+    PPATTERN_ERR      pErr
+    )
+/*++
+
+Routine Description:
+
+    Compares received data with the stream regenerated from its key.
+    Mismatching words are rescanned byte by byte.
+
+Arguments:
+
+    pRng   - stream generator
+    pBuf   - received data
+    dwSize - number of bytes
+    Offset - payload offset of the first byte
+    pErr   - optional mismatch details
+
+Return Value:
+
+    ERROR_SUCCESS or ERROR_CRC.
+
+--*/
+{
+    PATTERN_ERR err;
+    PUCHAR    p = (PUCHAR)pBuf;
+    ULONGLONG x, d;
+    DWORD     i, nHead, nWords;
+
+    ZeroMemory(&err, sizeof(err));
+
+    nHead = (DWORD)min((ULONGLONG)dwSize, (8 - (Offset & 7)) & 7);
+    rng_check_bytes(pRng, p, nHead, Offset, &err);
+    p += nHead;
+    Offset += nHead;
+    dwSize -= nHead;
+
+    nWords = dwSize >> 3;
+    x = pRng->Key + (Offset >> 3) * pRng->Gamma;
+
+    for (i = 0; i < nWords; i++, p += 8) {
+        memcpy(&d, p, 8);
+        if (d != rng_mix(x))
+            rng_check_bytes(pRng, p, 8, Offset + ((ULONGLONG)i << 3), &err);
+        x += pRng->Gamma;
+    }
+
+    Offset += (ULONGLONG)nWords << 3;
+    rng_check_bytes(pRng, p, dwSize & 7, Offset, &err);
+
+    if (pErr)
+        *pErr = err;
+
+    return err.BadCount ? ERROR_CRC : ERROR_SUCCESS;
+}
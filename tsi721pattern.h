@@ -0,0 +1,166 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721pattern.h
+
+Description:
+
+    Vectorized test pattern generator and verifier, and a counter-based
+    random payload generator for parallel data generation.
+
+--*/
+
+#ifndef _TSI721PATTERN_H_
+#define _TSI721PATTERN_H_
+
+//
+// Pattern definition: the payload is a sequence of little-endian 32-bit words,
+// word W (counted from payload offset 0) holds Seed + W * PATTERN_STEP.
+// Any byte of the payload can be generated or checked from the seed and its
+// payload offset alone, so no reference buffer is needed.
+//
+#define PATTERN_STEP    0x9E3779B1
+
+typedef struct _PATTERN_ERR {
+    ULONGLONG FirstBad;     // payload offset of the first differing byte
+    ULONGLONG BadCount;     // total number of differing bytes
+    UCHAR     Expected;     // expected value of the first differing byte
+    UCHAR     Actual;       // received value of the first differing byte
+} PATTERN_ERR, *PPATTERN_ERR;
+
+/*
+ * tsi721_pattern_fill()
+ *
+ *  Fills a buffer with the pattern for payload bytes [Offset, Offset + dwSize).
+ *
+ * Arguments:
+ *  pBuf    - buffer to fill (no alignment requirements)
+ *  dwSize  - number of bytes
+ *  dwSeed  - pattern seed
+ *  Offset  - payload offset of the first byte in the buffer
+ */
+VOID
+tsi721_pattern_fill(
+    __out PVOID     pBuf,
+    __in  DWORD     dwSize,
+    __in  DWORD     dwSeed,
+    __in  ULONGLONG Offset
+    );
+
+/*
+ * tsi721_pattern_verify()
+ *
+ *  Checks received data against the pattern.
+ *
+ * Arguments:
+ *  pBuf    - received data
+ *  dwSize  - number of bytes
+ *  dwSeed  - pattern seed
+ *  Offset  - payload offset of the first byte in the buffer
+ *  pErr    - optional pointer to structure receiving mismatch details
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if data matches the pattern,
+ *  ERROR_CRC     - if at least one byte differs.
+ */
+DWORD
+tsi721_pattern_verify(
+    __in  PVOID        pBuf,
+    __in  DWORD        dwSize,
+    __in  DWORD        dwSeed,
+    __in  ULONGLONG    Offset,
+    __out PPATTERN_ERR pErr
+    );
+
+/*
+ * tsi721_pattern_isa()
+ *
+ *  Returns name of the instruction set selected at run time ("AVX2", "SSE2" or "scalar").
+ */
+PCSTR tsi721_pattern_isa(VOID);
+
+//
+// Random payloads. A stream is selected by a seed and a stream number, e.g.
+// one run seed and one stream per thread or pass. Its 64-bit little-endian
+// word W (counted from payload offset 0) is a SplitMix64 hash of
+// Key + W * Gamma, with Key and an odd Gamma derived from seed and stream,
+// so any byte of any stream is generated from the seed, stream and payload
+// offset alone. Streams share no state: every thread keeps its own
+// RNG_STREAM, there is no lock and no hidden sequence.
+//
+#define RNG_GOLDEN      0x9E3779B97F4A7C15ULL
+
+typedef struct _RNG_STREAM {
+    ULONGLONG Key;
+    ULONGLONG Gamma;
+} RNG_STREAM, *PRNG_STREAM;
+
+/*
+ * tsi721_rng_init()
+ *
+ *  Derives the generator of stream dwStream under Seed.
+ *
+ * Arguments:
+ *  pRng     - generator to initialize
+ *  Seed     - run seed
+ *  dwStream - stream number
+ */
+VOID
+tsi721_rng_init(
+    __out PRNG_STREAM pRng,
+    __in  ULONGLONG   Seed,
+    __in  DWORD       dwStream
+    );
+
+/*
+ * tsi721_rng_fill()
+ *
+ *  Fills a buffer with the stream bytes [Offset, Offset + dwSize).
+ *
+ * Arguments:
+ *  pRng    - stream generator
+ *  pBuf    - buffer to fill (no alignment requirements)
+ *  dwSize  - number of bytes
+ *  Offset  - payload offset of the first byte in the buffer
+ */
+VOID
+tsi721_rng_fill(
+    __in  const RNG_STREAM *pRng,
+    __out PVOID             pBuf,
+    __in  DWORD             dwSize,
+    __in  ULONGLONG         Offset
+    );
+
+/*
+ * tsi721_rng_verify()
+ *
+ *  Checks received data against the stream.
+ *
+ * Arguments:
+ *  pRng    - stream generator
+ *  pBuf    - received data
+ *  dwSize  - number of bytes
+ *  Offset  - payload offset of the first byte in the buffer
+ *  pErr    - optional pointer to structure receiving mismatch details
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if data matches the stream,
+ *  ERROR_CRC     - if at least one byte differs.
+ */
+DWORD
+tsi721_rng_verify(
+    __in  const RNG_STREAM *pRng,
+    __in  PVOID             pBuf,
+    __in  DWORD             dwSize,
+    __in  ULONGLONG         Offset,
+    __out PPATTERN_ERR      pErr
+    );
+
+#endif // _TSI721PATTERN_H_
@@ -0,0 +1,375 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721pio.cpp
+
+Description:
+
+    Outbound window PIO.
+
+    A BDMA request costs a driver call, descriptor processing and a
+    completion interrupt however small it is, while a CPU store to an
+    outbound window leaves as an SRIO request right away. Each store or
+    load carries a few bytes only, so PIO loses to BDMA beyond some size;
+    tsi721_pio_calibrate() finds that size on the running system.
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+
+#include "tsi721api.h"
+#include "tsi721dev.h"
+#include "tsi721dma.h"
+#include "tsi721stat.h"
+#include "tsi721pio.h"
+
+typedef struct _PIO_MAP {
+    HANDLE             hDev;
+    DWORD              WinNum;
+    DWORD              DestId;
+    ULONGLONG          Base;        // SRIO address of window offset 0
+    DWORD              Size;        // bytes mapped
+    DWORD              ZoneSize;
+    volatile LONG      WrThreshold;
+    volatile LONG      RdThreshold;
+    volatile LONGLONG  Writes;
+    volatile LONGLONG  Reads;
+    volatile LONGLONG  Bytes;
+    volatile LONGLONG  Declined;
+} PIO_MAP;
+
+DWORD
+tsi721_pio_open(
+    HANDLE    hDev,
+    DWORD     dwWinNum,
+    DWORD     dwDestId,
+    DWORD     dwAddrHi,
+    DWORD     dwAddrLo,
+    DWORD     dwSize,
+    PPIO_MAP *ppPio
+    )
+{
+    PPIO_MAP    pPio;
+    P2R_WINCFG  winCfg;
+    P2R_ZONECFG zoneCfg;
+    DWORD       winSize = PIO_MIN_WIN_SIZE;
+    DWORD       i, dwErr;
+
+    if (ppPio == NULL || dwWinNum >= OBWIN_MAX_CHNUM || dwSize == 0 || dwSize > 0x80000000)
+        return ERROR_INVALID_PARAMETER;
+
+    while (winSize < dwSize)
+        winSize <<= 1;
+
+    pPio = (PPIO_MAP)calloc(1, sizeof(PIO_MAP));
+    if (pPio == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    pPio->hDev = hDev;
+    pPio->WinNum = dwWinNum;
+    pPio->DestId = dwDestId;
+    pPio->Base = ((ULONGLONG)dwAddrHi << 32) | dwAddrLo;
+    pPio->Size = dwSize;
+    pPio->ZoneSize = winSize / OBWIN_ZONE_NUM;
+
+    ZeroMemory(&winCfg, sizeof(winCfg));
+    winCfg.Size = winSize;
+    winCfg.Enable = TRUE;
+
+    dwErr = g_devOps->CfgP2rWin(hDev, dwWinNum, &winCfg);
+    if (dwErr != ERROR_SUCCESS)
+        goto err_exit;
+
+    for (i = 0; i < OBWIN_ZONE_NUM; i++) {
+        ULONGLONG addr = pPio->Base + (ULONGLONG)i * pPio->ZoneSize;
+
+        ZeroMemory(&zoneCfg, sizeof(zoneCfg));
+        zoneCfg.TAddrHi = (DWORD)(addr >> 32);
+        zoneCfg.TAddrLo = (DWORD)addr;
+        zoneCfg.RdType = NRead;
+        zoneCfg.WrType = NWrite;
+        zoneCfg.DestId = (WORD)dwDestId;
+        zoneCfg.LrgId = (dwDestId > 0xff);
+
+        dwErr = g_devOps->CfgP2rZone(hDev, dwWinNum, i, &zoneCfg);
+        if (dwErr != ERROR_SUCCESS)
+            goto err_exit;
+    }
+
+    *ppPio = pPio;
+    return ERROR_SUCCESS;
+
+err_exit:
+
+    winCfg.Enable = FALSE;
+    g_devOps->CfgP2rWin(hDev, dwWinNum, &winCfg);
+    free(pPio);
+    return dwErr;
+}
+
+VOID
+tsi721_pio_close(
+    PPIO_MAP pPio
+    )
+{
+    P2R_WINCFG winCfg;
+
+    if (pPio == NULL)
+        return;
+
+    ZeroMemory(&winCfg, sizeof(winCfg));
+    g_devOps->CfgP2rWin(pPio->hDev, pPio->WinNum, &winCfg);
+    free(pPio);
+}
+
+static DWORD
+pio_access(
+    PPIO_MAP pPio,
+    DWORD    dwOffset,
+    PUCHAR   pBuffer,
+    DWORD    dwSize,
+    BOOL     bWrite
+    )
+/*++
+
+Routine Description:
+
+    Splits an access at zone boundaries, which a single access must not
+    cross.
+
+--*/
+{
+    DWORD dwLen, dwErr = ERROR_SUCCESS;
+
+    if (dwOffset > pPio->Size || dwSize > pPio->Size - dwOffset)
+        return ERROR_INVALID_PARAMETER;
+
+    while (dwSize && dwErr == ERROR_SUCCESS) {
+        dwLen = min(dwSize, pPio->ZoneSize - dwOffset % pPio->ZoneSize);
+
+        if (bWrite)
+            dwErr = g_devOps->PioWrite(pPio->hDev, pPio->WinNum, dwOffset, pBuffer, dwLen);
+        else
+            dwErr = g_devOps->PioRead(pPio->hDev, pPio->WinNum, dwOffset, pBuffer, dwLen);
+
+        dwOffset += dwLen;
+        pBuffer += dwLen;
+        dwSize -= dwLen;
+    }
+
+    return dwErr;
+}
+
+DWORD
+tsi721_pio_write(
+    PPIO_MAP pPio,
+    DWORD    dwOffset,
+    PVOID    pBuffer,
+    DWORD    dwSize
+    )
+{
+    return pio_access(pPio, dwOffset, (PUCHAR)pBuffer, dwSize, TRUE);
+}
+
+DWORD
+tsi721_pio_read(
+    PPIO_MAP pPio,
+    DWORD    dwOffset,
+    PVOID    pBuffer,
+    DWORD    dwSize
+    )
+{
+    return pio_access(pPio, dwOffset, (PUCHAR)pBuffer, dwSize, FALSE);
+}
+
+static DWORD
+pio_time(
+    PPIO_MAP   pPio,
+    DWORD      dwOffset,
+    PUCHAR     pBuffer,
+    DWORD      dwSize,
+    BOOL       bWrite,
+    BOOL       bPio,
+    ULONGLONG *pNs
+    )
+/*++
+
+Routine Description:
+
+    Returns the mean duration of PIO_CAL_ITER transfers of one path, after
+    one untimed transfer.
+
+--*/
+{
+    ULONGLONG    addr = pPio->Base + dwOffset;
+    ULONGLONG    t0 = 0;
+    DMA_REQ_CTRL ctrl;
+    DWORD        i, size, dwErr = ERROR_SUCCESS;
+
+    ctrl.dword = 0;
+    ctrl.bits.Rtype = bWrite ? ALL_NWRITE : NREAD;
+
+    for (i = 0; i <= PIO_CAL_ITER && dwErr == ERROR_SUCCESS; i++) {
+        if (i == 1)
+            t0 = lat_ticks();
+
+        size = dwSize;
+        if (bPio)
+            dwErr = pio_access(pPio, dwOffset, pBuffer, dwSize, bWrite);
+        else if (bWrite)
+            dwErr = g_devOps->SrioWrite(pPio->hDev, pPio->DestId, (DWORD)(addr >> 32), (DWORD)addr,
+                                        pBuffer, &size, ctrl);
+        else
+            dwErr = g_devOps->SrioRead(pPio->hDev, pPio->DestId, (DWORD)(addr >> 32), (DWORD)addr,
+                                       pBuffer, &size, ctrl);
+    }
+
+    *pNs = lat_ticks_to_ns(lat_ticks() - t0) / PIO_CAL_ITER;
+    return dwErr;
+}
+
+DWORD
+tsi721_pio_calibrate(
+    PPIO_MAP pPio,
+    DWORD    dwOffset,
+    BOOL     bReport
+    )
+/*++
+
+Routine Description:
+
+    Times both paths for every power-of-two size. A threshold stops at the
+    first size where BDMA wins, even if PIO wins again above it.
+
+--*/
+{
+    ULONGLONG pioNs[2], dmaNs[2];
+    PUCHAR    pBuf;
+    DWORD     thr[2] = { 0, 0 };
+    BOOL      bDone[2] = { FALSE, FALSE };
+    DWORD     size, dir, dwErr = ERROR_SUCCESS;
+
+    if (pPio == NULL || dwOffset > pPio->Size || pPio->Size - dwOffset < PIO_CAL_MAX_SIZE)
+        return ERROR_INVALID_PARAMETER;
+
+    pBuf = (PUCHAR)malloc(PIO_CAL_MAX_SIZE);
+    if (pBuf == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    for (size = 0; size < PIO_CAL_MAX_SIZE; size++)
+        pBuf[size] = (UCHAR)size;
+
+    if (bReport)
+        printf_s("PIO calibration (ns per transfer):\n"
+                 "    size    PIO wr   BDMA wr    PIO rd   BDMA rd\n");
+
+    for (size = PIO_CAL_MIN_SIZE; size <= PIO_CAL_MAX_SIZE && dwErr == ERROR_SUCCESS; size <<= 1) {
+        for (dir = 0; dir < 2 && dwErr == ERROR_SUCCESS; dir++) {
+            dwErr = pio_time(pPio, dwOffset, pBuf, size, dir == 0, TRUE, &pioNs[dir]);
+            if (dwErr == ERROR_SUCCESS)
+                dwErr = pio_time(pPio, dwOffset, pBuf, size, dir == 0, FALSE, &dmaNs[dir]);
+        }
+        if (dwErr != ERROR_SUCCESS)
+            break;
+
+        for (dir = 0; dir < 2; dir++) {
+            if (bDone[dir] || pioNs[dir] >= dmaNs[dir])
+                bDone[dir] = TRUE;
+            else
+                thr[dir] = size;
+        }
+
+        if (bReport)
+            printf_s("%8u %9llu %9llu %9llu %9llu\n", size, pioNs[0], dmaNs[0], pioNs[1], dmaNs[1]);
+    }
+
+    free(pBuf);
+
+    if (dwErr != ERROR_SUCCESS)
+        return dwErr;
+
+    pPio->WrThreshold = thr[0];
+    pPio->RdThreshold = thr[1];
+
+    if (bReport)
+        printf_s("PIO used for writes up to %u bytes, reads up to %u bytes\n", thr[0], thr[1]);
+
+    return ERROR_SUCCESS;
+}
+
+VOID
+tsi721_pio_set_threshold(
+    PPIO_MAP pPio,
+    DWORD    dwDir,
+    DWORD    dwSize
+    )
+{
+    if (dwDir == DMA_DIR_WRITE)
+        pPio->WrThreshold = dwSize;
+    else
+        pPio->RdThreshold = dwSize;
+}
+
+DWORD
+tsi721_pio_xfer(
+    PPIO_MAP     pPio,
+    DWORD        dwDir,
+    DWORD        dwDestId,
+    DWORD        dwAddrHi,
+    DWORD        dwAddrLo,
+    PVOID        pBuffer,
+    DWORD        dwSize,
+    DMA_REQ_CTRL dmaCtrl
+    )
+{
+    ULONGLONG addr = ((ULONGLONG)dwAddrHi << 32) | dwAddrLo;
+    DWORD     dwOffset, flush, dwErr;
+    BOOL      bWrite = (dwDir == DMA_DIR_WRITE);
+
+    if (pPio == NULL)
+        return ERROR_NOT_SUPPORTED;
+
+    if (dwDestId != pPio->DestId || dmaCtrl.bits.XAddr != 0 || dwSize == 0 || dwSize > pPio->Size ||
+        dwSize > (DWORD)(bWrite ? pPio->WrThreshold : pPio->RdThreshold) ||
+        addr < pPio->Base || addr - pPio->Base > pPio->Size - dwSize) {
+        InterlockedIncrement64(&pPio->Declined);
+        return ERROR_NOT_SUPPORTED;
+    }
+
+    dwOffset = (DWORD)(addr - pPio->Base);
+
+    dwErr = pio_access(pPio, dwOffset, (PUCHAR)pBuffer, dwSize, bWrite);
+
+    // A load is not passed by earlier stores, its completion confirms them
+    if (dwErr == ERROR_SUCCESS && bWrite && dmaCtrl.bits.Rtype != ALL_NWRITE)
+        dwErr = pio_access(pPio, dwOffset + dwSize - min(dwSize, 4), (PUCHAR)&flush, min(dwSize, 4), FALSE);
+
+    if (dwErr == ERROR_SUCCESS) {
+        InterlockedIncrement64(bWrite ? &pPio->Writes : &pPio->Reads);
+        InterlockedExchangeAdd64(&pPio->Bytes, dwSize);
+    }
+
+    return dwErr;
+}
+
+VOID
+tsi721_pio_stats(
+    PPIO_MAP   pPio,
+    PPIO_STATS pStats
+    )
+{
+    pStats->WrThreshold = pPio->WrThreshold;
+    pStats->RdThreshold = pPio->RdThreshold;
+    pStats->Writes = pPio->Writes;
+    pStats->Reads = pPio->Reads;
+    pStats->Bytes = pPio->Bytes;
+    pStats->Declined = pPio->Declined;
+}
@@ -0,0 +1,177 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721pio.h
+
+Description:
+
+    Programmed I/O to a remote address range through an outbound (P2R)
+    window: small transfers become CPU stores/loads instead of BDMA
+    requests, once a startup calibration has shown where PIO is faster.
+
+--*/
+
+#ifndef _TSI721PIO_H_
+#define _TSI721PIO_H_
+
+#define PIO_MIN_WIN_SIZE    (32 * 1024)
+#define PIO_CAL_MIN_SIZE    4           // smallest size timed by tsi721_pio_calibrate()
+#define PIO_CAL_MAX_SIZE    4096        // largest size timed, the scratch area size
+#define PIO_CAL_ITER        16          // timed transfers per size and path
+
+typedef struct _PIO_STATS {
+    DWORD     WrThreshold;  // largest write done by PIO (0 = none)
+    DWORD     RdThreshold;  // largest read done by PIO (0 = none)
+    ULONGLONG Writes;       // PIO writes
+    ULONGLONG Reads;        // PIO reads
+    ULONGLONG Bytes;        // bytes moved by PIO
+    ULONGLONG Declined;     // transfers left to BDMA
+} PIO_STATS, *PPIO_STATS;
+
+typedef struct _PIO_MAP *PPIO_MAP;
+
+/*
+ * tsi721_pio_open()
+ *
+ *  Maps a remote SRIO address range through an outbound window. The range
+ *  is split linearly over the OBWIN_ZONE_NUM zones of the window (NWRITE
+ *  stores, NREAD loads). The thresholds are 0, so no transfer is done by
+ *  PIO until tsi721_pio_calibrate() or tsi721_pio_set_threshold().
+ *
+ * Arguments:
+ *  hDev     - device handle
+ *  dwWinNum - outbound window number
+ *  dwDestId - destID of the target SRIO device
+ *  dwAddrHi - bits 63:32 of the SRIO starting address
+ *  dwAddrLo - bits 31:00 of the SRIO starting address
+ *  dwSize   - size of the range (the window is the next power of two,
+ *             at least PIO_MIN_WIN_SIZE)
+ *  ppPio    - pointer to variable to save the created mapping
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the range was mapped,
+ *  ERROR_NOT_SUPPORTED - if the backend has no outbound windows,
+ *                  otherwise an error code.
+ */
+DWORD
+tsi721_pio_open(
+    __in  HANDLE    hDev,
+    __in  DWORD     dwWinNum,
+    __in  DWORD     dwDestId,
+    __in  DWORD     dwAddrHi,
+    __in  DWORD     dwAddrLo,
+    __in  DWORD     dwSize,
+    __out PPIO_MAP *ppPio
+    );
+
+/*
+ * tsi721_pio_close()
+ *
+ *  Disables the outbound window and frees the mapping.
+ */
+VOID tsi721_pio_close(__in PPIO_MAP pPio);
+
+/*
+ * tsi721_pio_write()/tsi721_pio_read()
+ *
+ *  Stores/loads dwSize bytes at an offset of the mapped range, regardless
+ *  of the thresholds. Stores are posted: a write returns before the data
+ *  has reached the target.
+ */
+DWORD
+tsi721_pio_write(
+    __in PPIO_MAP pPio,
+    __in DWORD    dwOffset,
+    __in PVOID    pBuffer,
+    __in DWORD    dwSize
+    );
+
+DWORD
+tsi721_pio_read(
+    __in  PPIO_MAP pPio,
+    __in  DWORD    dwOffset,
+    __out PVOID    pBuffer,
+    __in  DWORD    dwSize
+    );
+
+/*
+ * tsi721_pio_calibrate()
+ *
+ *  Times PIO against blocking BDMA calls for sizes from PIO_CAL_MIN_SIZE to
+ *  PIO_CAL_MAX_SIZE and sets each direction's threshold to the largest size
+ *  up to which PIO was faster. The comparison is with the bare driver call,
+ *  so the thresholds err on the side of BDMA.
+ *
+ * Arguments:
+ *  pPio      - mapping
+ *  dwOffset  - offset of a PIO_CAL_MAX_SIZE scratch area in the mapped range
+ *              (its contents are overwritten)
+ *  bReport   - print the timings
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if both paths worked, otherwise the first error.
+ */
+DWORD
+tsi721_pio_calibrate(
+    __in PPIO_MAP pPio,
+    __in DWORD    dwOffset,
+    __in BOOL     bReport
+    );
+
+/*
+ * tsi721_pio_set_threshold()
+ *
+ *  Overrides a calibrated threshold (dwDir = DMA_DIR_WRITE or DMA_DIR_READ).
+ */
+VOID
+tsi721_pio_set_threshold(
+    __in PPIO_MAP pPio,
+    __in DWORD    dwDir,
+    __in DWORD    dwSize
+    );
+
+/*
+ * tsi721_pio_xfer()
+ *
+ *  Performs a transfer by PIO if it is eligible: same destID, range mapped,
+ *  no bits 65:64, size up to the direction's threshold. A write asking for
+ *  a response (LAST_NWRITE_R, ALL_NWRITE_R) is followed by a load, which
+ *  returns only after the preceding stores have reached the target.
+ *
+ * Arguments:
+ *  as tsi721_dma_xfer() without a chunk size
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the data was transferred,
+ *  ERROR_NOT_SUPPORTED - if the transfer is not eligible (use BDMA),
+ *                  otherwise the error of the PIO access.
+ */
+DWORD
+tsi721_pio_xfer(
+    __in PPIO_MAP     pPio,
+    __in DWORD        dwDir,
+    __in DWORD        dwDestId,
+    __in DWORD        dwAddrHi,
+    __in DWORD        dwAddrLo,
+    __in PVOID        pBuffer,
+    __in DWORD        dwSize,
+    __in DMA_REQ_CTRL dmaCtrl
+    );
+
+/*
+ * tsi721_pio_stats()
+ */
+VOID
+tsi721_pio_stats(
+    __in  PPIO_MAP   pPio,
+    __out PPIO_STATS pStats
+    );
+
+#endif // _TSI721PIO_H_
@@ -0,0 +1,442 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721pool.cpp
+
+Description:
+
+    Buffer pool.
+
+    Buffers are carved from slabs taken with VirtualAlloc() and never go
+    back to the system, so a buffer the driver has locked before is backed
+    by the same resident pages the next time. Free buffers of a size class
+    are kept on a list linked through their first bytes.
+
+    Every thread keeps up to CacheDepth buffers per class, fewer of the
+    large classes (POOL_CACHE_BYTES per class at most, but one buffer). An
+    allocation served from the cache takes no lock; a miss moves half a
+    cache worth from the class list, a full cache spills half of it back.
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+
+#include "tsi721pool.h"
+
+#define POOL_CACHE_BYTES    (256 * 1024)    // bytes of a class cached by a thread, at least one buffer
+
+typedef struct _POOL_FREE {
+    struct _POOL_FREE *Next;
+} POOL_FREE, *PPOOL_FREE;
+
+typedef struct _POOL_SLAB {
+    PUCHAR Base;
+    SIZE_T Size;
+    DWORD  Class;
+} POOL_SLAB, *PPOOL_SLAB;
+
+typedef struct _POOL_LIST {
+    CRITICAL_SECTION Lock;
+    PPOOL_FREE       Head;
+    DWORD            Buffers;
+    DWORD            Held;
+    DWORD            HighWater;
+    ULONGLONG        Refills;
+} POOL_LIST, *PPOOL_LIST;
+
+typedef struct _POOL_CACHE {
+    DWORD Count[POOL_CLASS_NUM];
+    PVOID Buf[POOL_CLASS_NUM][POOL_MAX_CACHE];
+} POOL_CACHE, *PPOOL_CACHE;
+
+typedef struct _POOL {
+    POOL_CFG           Cfg;
+    SIZE_T             LargeMin;    // large page size, 0 = not used
+    POOL_LIST          List[POOL_CLASS_NUM];
+    POOL_SLAB          Slab[POOL_MAX_SLABS];
+    volatile LONG      SlabNum;
+    volatile LONG      Threads;
+    volatile LONGLONG  Bytes;
+    volatile LONGLONG  LargeBytes;
+} POOL;
+
+static POOL           g_pool;
+static volatile LONG  g_poolState = 0;  // 0 - not started, 1 - starting, 2 - running
+
+static __declspec(thread) PPOOL_CACHE t_pCache = NULL;
+
+DWORD
+tsi721_pool_config(
+    const POOL_CFG *pCfg
+    )
+{
+    if (pCfg == NULL || pCfg->CacheDepth > POOL_MAX_CACHE)
+        return ERROR_INVALID_PARAMETER;
+
+    if (InterlockedCompareExchange(&g_poolState, 1, 0) != 0)
+        return ERROR_BUSY;
+
+    g_pool.Cfg = *pCfg;
+    g_poolState = 0;
+    return ERROR_SUCCESS;
+}
+
+static VOID
+pool_start(
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Sets up the class lists on the first allocation, concurrent callers
+    wait for it.
+
+--*/
+{
+    LONG  state;
+    DWORD i;
+
+    while ((state = InterlockedCompareExchange(&g_poolState, 1, 0)) != 2) {
+        if (state == 0) {
+            if (g_pool.Cfg.CacheDepth == 0)
+                g_pool.Cfg.CacheDepth = POOL_DEF_CACHE;
+            if (g_pool.Cfg.Flags & POOL_F_LARGE_PAGES)
+                g_pool.LargeMin = GetLargePageMinimum();
+
+            for (i = 0; i < POOL_CLASS_NUM; i++)
+                InitializeCriticalSection(&g_pool.List[i].Lock);
+
+            InterlockedExchange(&g_poolState, 2);
+            break;
+        }
+        SwitchToThread();
+    }
+}
+
+static __forceinline DWORD
+pool_class(
+    SIZE_T dwSize
+    )
+{
+    DWORD cls = 0;
+
+    while (((SIZE_T)POOL_MIN_SIZE << cls) < dwSize)
+        cls++;
+
+    return cls;
+}
+
+static __forceinline DWORD
+pool_depth(
+    DWORD dwClass
+    )
+{
+    return max(min(g_pool.Cfg.CacheDepth, (DWORD)(POOL_CACHE_BYTES >> (POOL_MIN_SHIFT + dwClass))), 1);
+}
+
+static PPOOL_CACHE
+pool_cache(
+    VOID
+    )
+{
+    if (t_pCache == NULL) {
+        t_pCache = (PPOOL_CACHE)calloc(1, sizeof(POOL_CACHE));
+        if (t_pCache != NULL)
+            InterlockedIncrement(&g_pool.Threads);
+    }
+
+    return t_pCache;
+}
+
+static DWORD
+pool_grow(
+    DWORD dwClass
+    )
+/*++
+
+Routine Description:
+
+    Adds a slab of buffers to a class list. Large pages are tried first if
+    configured, a slab is then rounded up to whole large pages. Called with
+    the class lock held.
+
+--*/
+{
+    PPOOL_LIST pList = &g_pool.List[dwClass];
+    SIZE_T     bufSize = (SIZE_T)POOL_MIN_SIZE << dwClass;
+    SIZE_T     size = max(bufSize, (SIZE_T)POOL_SLAB_MIN);
+    SIZE_T     off;
+    PUCHAR     pBase = NULL;
+    PPOOL_FREE pFree;
+    LONG       idx;
+
+    idx = InterlockedIncrement(&g_pool.SlabNum) - 1;
+    if (idx >= POOL_MAX_SLABS) {
+        InterlockedDecrement(&g_pool.SlabNum);
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    if (g_pool.LargeMin) {
+        SIZE_T large = (size + g_pool.LargeMin - 1) & ~(g_pool.LargeMin - 1);
+
+        pBase = (PUCHAR)VirtualAlloc(NULL, large, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES,
+                                     PAGE_READWRITE);
+        if (pBase != NULL) {
+            size = large;
+            InterlockedExchangeAdd64(&g_pool.LargeBytes, size);
+        }
+    }
+
+    if (pBase == NULL)
+        pBase = (PUCHAR)VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    // The slot stays empty (size 0), tsi721_pool_free() never matches it
+    if (pBase == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    if (g_pool.Cfg.Flags & POOL_F_PREFAULT) {
+        for (off = 0; off < size; off += POOL_MIN_SIZE)
+            ((volatile UCHAR *)pBase)[off] = 0;
+    }
+
+    g_pool.Slab[idx].Size = size;
+    g_pool.Slab[idx].Class = dwClass;
+    MemoryBarrier();
+    g_pool.Slab[idx].Base = pBase;
+    InterlockedExchangeAdd64(&g_pool.Bytes, size);
+
+    for (off = size; off >= bufSize; off -= bufSize) {
+        pFree = (PPOOL_FREE)(pBase + off - bufSize);
+        pFree->Next = pList->Head;
+        pList->Head = pFree;
+        pList->Buffers++;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+static DWORD
+pool_refill(
+    PPOOL_CACHE pCache,
+    DWORD       dwClass
+    )
+{
+    PPOOL_LIST pList = &g_pool.List[dwClass];
+    DWORD      n = max(pool_depth(dwClass) / 2, 1);
+    DWORD      dwErr = ERROR_SUCCESS;
+
+    EnterCriticalSection(&pList->Lock);
+
+    pList->Refills++;
+
+    while (pCache->Count[dwClass] < n) {
+        if (pList->Head == NULL) {
+            dwErr = pool_grow(dwClass);
+            if (dwErr != ERROR_SUCCESS)
+                break;
+        }
+
+        pCache->Buf[dwClass][pCache->Count[dwClass]++] = pList->Head;
+        pList->Head = pList->Head->Next;
+        pList->Held++;
+    }
+
+    pList->HighWater = max(pList->HighWater, pList->Held);
+
+    LeaveCriticalSection(&pList->Lock);
+
+    // A partial refill still serves the allocation
+    return pCache->Count[dwClass] ? ERROR_SUCCESS : dwErr;
+}
+
+static VOID
+pool_spill(
+    PPOOL_CACHE pCache,
+    DWORD       dwClass,
+    DWORD       dwKeep
+    )
+{
+    PPOOL_LIST pList = &g_pool.List[dwClass];
+    PPOOL_FREE pFree;
+
+    EnterCriticalSection(&pList->Lock);
+
+    while (pCache->Count[dwClass] > dwKeep) {
+        pFree = (PPOOL_FREE)pCache->Buf[dwClass][--pCache->Count[dwClass]];
+        pFree->Next = pList->Head;
+        pList->Head = pFree;
+        pList->Held--;
+    }
+
+    LeaveCriticalSection(&pList->Lock);
+}
+
+static PPOOL_SLAB
+pool_slab(
+    PUCHAR pBuf
+    )
+{
+    LONG i, num = min(g_pool.SlabNum, POOL_MAX_SLABS);
+
+    for (i = 0; i < num; i++) {
+        if (pBuf >= g_pool.Slab[i].Base && pBuf < g_pool.Slab[i].Base + g_pool.Slab[i].Size)
+            return &g_pool.Slab[i];
+    }
+
+    return NULL;
+}
+
+PVOID
+tsi721_pool_alloc(
+    SIZE_T dwSize
+    )
+{
+    PPOOL_CACHE pCache;
+    DWORD       cls, dwErr;
+
+    if (dwSize == 0 || dwSize > POOL_MAX_SIZE) {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return NULL;
+    }
+
+    if (g_poolState != 2)
+        pool_start();
+
+    pCache = pool_cache();
+    if (pCache == NULL) {
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return NULL;
+    }
+
+    cls = pool_class(dwSize);
+
+    if (pCache->Count[cls] == 0) {
+        dwErr = pool_refill(pCache, cls);
+        if (dwErr != ERROR_SUCCESS) {
+            SetLastError(dwErr);
+            return NULL;
+        }
+    }
+
+    return pCache->Buf[cls][--pCache->Count[cls]];
+}
+
+VOID
+tsi721_pool_free(
+    PVOID pBuf
+    )
+{
+    PPOOL_CACHE pCache;
+    PPOOL_SLAB  pSlab;
+    PPOOL_LIST  pList;
+    PPOOL_FREE  pFree;
+
+    if (pBuf == NULL)
+        return;
+
+    pSlab = pool_slab((PUCHAR)pBuf);
+    if (pSlab == NULL) {
+        printf_s("POOL: free of unknown buffer %p\n", pBuf);
+        return;
+    }
+
+    pCache = pool_cache();
+    if (pCache == NULL) {
+        pList = &g_pool.List[pSlab->Class];
+        pFree = (PPOOL_FREE)pBuf;
+
+        EnterCriticalSection(&pList->Lock);
+        pFree->Next = pList->Head;
+        pList->Head = pFree;
+        pList->Held--;
+        LeaveCriticalSection(&pList->Lock);
+        return;
+    }
+
+    if (pCache->Count[pSlab->Class] == pool_depth(pSlab->Class))
+        pool_spill(pCache, pSlab->Class, pool_depth(pSlab->Class) / 2);
+
+    pCache->Buf[pSlab->Class][pCache->Count[pSlab->Class]++] = pBuf;
+}
+
+VOID
+tsi721_pool_thread_flush(
+    VOID
+    )
+{
+    DWORD i;
+
+    if (t_pCache == NULL)
+        return;
+
+    for (i = 0; i < POOL_CLASS_NUM; i++) {
+        if (t_pCache->Count[i])
+            pool_spill(t_pCache, i, 0);
+    }
+
+    free(t_pCache);
+    t_pCache = NULL;
+}
+
+VOID
+tsi721_pool_stats(
+    PPOOL_STATS pStats
+    )
+{
+    PPOOL_LIST pList;
+    DWORD      i;
+
+    ZeroMemory(pStats, sizeof(POOL_STATS));
+
+    for (i = 0; i < POOL_CLASS_NUM; i++)
+        pStats->Class[i].Size = POOL_MIN_SIZE << i;
+
+    if (g_poolState != 2)
+        return;
+
+    pStats->Slabs = min(g_pool.SlabNum, POOL_MAX_SLABS);
+    pStats->Threads = g_pool.Threads;
+    pStats->Bytes = g_pool.Bytes;
+    pStats->LargeBytes = g_pool.LargeBytes;
+
+    for (i = 0; i < POOL_CLASS_NUM; i++) {
+        pList = &g_pool.List[i];
+
+        EnterCriticalSection(&pList->Lock);
+        pStats->Class[i].Buffers = pList->Buffers;
+        pStats->Class[i].Held = pList->Held;
+        pStats->Class[i].HighWater = pList->HighWater;
+        pStats->Class[i].Refills = pList->Refills;
+        LeaveCriticalSection(&pList->Lock);
+    }
+}
+
+VOID
+tsi721_pool_print(
+    VOID
+    )
+{
+    POOL_STATS st;
+    DWORD      i;
+
+    tsi721_pool_stats(&st);
+
+    printf_s("Buffer pool: %u slabs, %llu KB (%llu KB large pages), %u threads\n",
+             st.Slabs, st.Bytes >> 10, st.LargeBytes >> 10, st.Threads);
+
+    for (i = 0; i < POOL_CLASS_NUM; i++) {
+        if (st.Class[i].Buffers)
+            printf_s("  %5u KB: %u buffers, %u held, high water %u, %llu refills\n",
+                     st.Class[i].Size >> 10, st.Class[i].Buffers, st.Class[i].Held,
+                     st.Class[i].HighWater, st.Class[i].Refills);
+    }
+}
@@ -0,0 +1,105 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721pool.h
+
+Description:
+
+    Process-wide pool of page-aligned data buffers (BDMA and message
+    buffers) in power-of-two size classes, with a buffer cache per thread.
+
+--*/
+
+#ifndef _TSI721POOL_H_
+#define _TSI721POOL_H_
+
+#define POOL_MIN_SHIFT      12                  // smallest size class 4 KB (one page)
+#define POOL_CLASS_NUM      11                  // size classes 4 KB ... 4 MB
+#define POOL_MIN_SIZE       (1 << POOL_MIN_SHIFT)
+#define POOL_MAX_SIZE       (POOL_MIN_SIZE << (POOL_CLASS_NUM - 1))
+#define POOL_SLAB_MIN       (256 * 1024)        // smallest block carved into buffers of one class
+#define POOL_MAX_SLABS      1024
+#define POOL_DEF_CACHE      8                   // buffers per size class cached by a thread
+#define POOL_MAX_CACHE      64
+
+#define POOL_F_LARGE_PAGES  0x01    // back slabs with large pages where the system allows it
+#define POOL_F_PREFAULT     0x02    // touch every page of a new slab
+
+typedef struct _POOL_CFG {
+    DWORD Flags;            // POOL_F_xxx
+    DWORD CacheDepth;       // 1...POOL_MAX_CACHE (0 = POOL_DEF_CACHE)
+} POOL_CFG, *PPOOL_CFG;
+
+typedef struct _POOL_CLASS_STATS {
+    DWORD     Size;         // buffer size
+    DWORD     Buffers;      // buffers created
+    DWORD     Held;         // buffers taken by threads (in use or in a thread cache)
+    DWORD     HighWater;    // largest Held so far
+    ULONGLONG Refills;      // thread cache misses
+} POOL_CLASS_STATS, *PPOOL_CLASS_STATS;
+
+typedef struct _POOL_STATS {
+    DWORD            Slabs;
+    DWORD            Threads;       // thread caches created
+    ULONGLONG        Bytes;         // bytes in slabs
+    ULONGLONG        LargeBytes;    // of them on large pages
+    POOL_CLASS_STATS Class[POOL_CLASS_NUM];
+} POOL_STATS, *PPOOL_STATS;
+
+/*
+ * tsi721_pool_config()
+ *
+ *  Sets the pool options. Must be called before the first allocation,
+ *  otherwise defaults (no flags, POOL_DEF_CACHE) are used.
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the options were accepted,
+ *  ERROR_BUSY    - if the pool is already in use,
+ *  ERROR_INVALID_PARAMETER - if an option is out of range.
+ */
+DWORD tsi721_pool_config(__in const POOL_CFG *pCfg);
+
+/*
+ * tsi721_pool_alloc()
+ *
+ *  Returns a page-aligned buffer of the smallest size class holding dwSize
+ *  bytes. Its contents are undefined. A buffer returned by the pool keeps
+ *  its pages, so the driver finds the same physical memory on reuse.
+ *
+ * Return Value:
+ *  Buffer address, NULL if dwSize is 0 or above POOL_MAX_SIZE or memory is
+ *  exhausted (GetLastError() tells which).
+ */
+PVOID tsi721_pool_alloc(__in SIZE_T dwSize);
+
+/*
+ * tsi721_pool_free()
+ *
+ *  Returns a buffer of tsi721_pool_alloc() to the pool (NULL is ignored).
+ *  Any thread may free any buffer.
+ */
+VOID tsi721_pool_free(__in PVOID pBuf);
+
+/*
+ * tsi721_pool_thread_flush()
+ *
+ *  Returns the buffers cached by the calling thread to the pool. A thread
+ *  which used the pool should call it before exiting, cached buffers are
+ *  not reclaimed otherwise.
+ */
+VOID tsi721_pool_thread_flush(VOID);
+
+/*
+ * tsi721_pool_stats()/tsi721_pool_print()
+ */
+VOID tsi721_pool_stats(__out PPOOL_STATS pStats);
+VOID tsi721_pool_print(VOID);
+
+#endif // _TSI721POOL_H_
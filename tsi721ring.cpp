@@ -0,0 +1,663 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721ring.cpp
+
+Description:
+
+    Producer/consumer ring carried by a target inbound window.
+
+    Records are written with NWRITE and the tail index is published with
+    NWRITE_R once a batch of records has been written. All requests of the
+    producer are issued in order by one BDMA channel, so a consumer that
+    sees the new tail also sees the records before it. The consumer stores
+    its Head in the window and returns credits by doorbell; the producer
+    only reads Head back (NREAD) when no credit arrives for a while.
+
+    Optionally the producer puts the CRC32C of each record into its slot
+    header. The consumer checks the record where it lies in the window, so
+    no second transfer is needed to validate it.
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <process.h>
+
+#include "tsi721api.h"
+#include "tsi721dev.h"
+#include "tsi721crc.h"
+#include "tsi721db.h"
+#include "tsi721ibview.h"
+#include "tsi721pool.h"
+#include "tsi721ring.h"
+#include "tsi721stat.h"
+#include "tsi721trace.h"
+
+typedef struct _RING_PROD {
+    HANDLE          hDev;
+    RING_CFG        Cfg;
+    DWORD           Epoch;
+    DWORD           MaxRecord;      // payload bytes that fit a slot
+    PUCHAR          Slot;           // slot image written by one NWRITE
+    PDB_RX_ENGINE   pRx;
+    HANDLE          hCredit;        // auto reset, set by every credit doorbell
+    DWORD           Tail;           // records written
+    volatile LONG   PubTail;        // records published to the consumer
+    volatile LONG   Head;           // records credited back
+    RING_PROD_STATS Stats;
+} RING_PROD;
+
+typedef struct _RING_CONS {
+    HANDLE          hDev;
+    RING_RX_CFG     Cfg;
+    HANDLE          hThread;
+    volatile BOOL   bStop;
+    PIBW_VIEW       pView;          // window contents, in place if possible
+    RING_CONS_STATS Stats;
+} RING_CONS;
+
+static DWORD
+ring_prod_xfer(
+    PRING_PROD pProd,
+    DWORD      dwOffset,
+    PVOID      pBuf,
+    DWORD      dwSize,
+    DWORD      dwRtype
+    )
+{
+    DMA_REQ_CTRL ctrl;
+    DWORD dwLen = dwSize, dwErr;
+
+    ctrl.dword = 0;
+    ctrl.bits.Rtype = dwRtype;
+
+    if (dwRtype == NREAD)
+        dwErr = g_devOps->SrioRead(pProd->hDev, pProd->Cfg.DestId, pProd->Cfg.WinAddrHi,
+                                   pProd->Cfg.WinAddrLo + dwOffset, pBuf, &dwLen, ctrl);
+    else
+        dwErr = g_devOps->SrioWrite(pProd->hDev, pProd->Cfg.DestId, pProd->Cfg.WinAddrHi,
+                                    pProd->Cfg.WinAddrLo + dwOffset, pBuf, &dwLen, ctrl);
+
+    if (dwErr == ERROR_SUCCESS && dwLen != dwSize)
+        dwErr = ERROR_GEN_FAILURE;
+    if (dwErr != ERROR_SUCCESS)
+        tsi721_trace(TRACE_EV_ERROR, dwErr, __LINE__, dwOffset, dwSize, 0);
+
+    return dwErr;
+}
+
+static VOID
+ring_prod_head(
+    PRING_PROD pProd,
+    DWORD      dwHead
+    )
+/*++
+
+Routine Description:
+
+    Advances Head to a credited index. Stale or out of range credits (the
+    consumer cannot be past the published tail) are ignored.
+
+--*/
+{
+    LONG cur;
+
+    do {
+        cur = pProd->Head;
+        if ((LONG)(dwHead - (DWORD)cur) <= 0 || (LONG)((DWORD)pProd->PubTail - dwHead) < 0)
+            return;
+    } while (InterlockedCompareExchange(&pProd->Head, (LONG)dwHead, cur) != cur);
+}
+
+static VOID
+ring_credit_handler(
+    PVOID        pCtx,
+    PIB_DB_ENTRY pDb,
+    DWORD        dwNum
+    )
+{
+    PRING_PROD pProd = (PRING_PROD)pCtx;
+    DWORD i, info, pub, epochBit;
+    BOOL  bCredit = FALSE;
+
+    epochBit = (pProd->Epoch & 1) ? RING_DB_EPOCH_BIT : 0;
+
+    for (i = 0; i < dwNum; i++) {
+        info = pDb[i].db.Info;
+        if (!RING_DB_IS_CREDIT(info) || (info & RING_DB_EPOCH_BIT) != epochBit)
+            continue;
+
+        // Rebuild the full index: it is at most RING_MAX_SLOTS behind the tail
+        pub = (DWORD)pProd->PubTail;
+        ring_prod_head(pProd, pub - ((pub - info) & RING_DB_IDX_MASK));
+        pProd->Stats.Credits++;
+        bCredit = TRUE;
+    }
+
+    if (bCredit)
+        SetEvent(pProd->hCredit);
+}
+
+static DWORD
+ring_prod_publish(
+    PRING_PROD pProd
+    )
+{
+    DWORD dwErr;
+
+    if ((DWORD)pProd->PubTail == pProd->Tail)
+        return ERROR_SUCCESS;
+
+    dwErr = ring_prod_xfer(pProd, RING_TAIL_OFS, &pProd->Tail, sizeof(DWORD), ALL_NWRITE_R);
+    if (dwErr == ERROR_SUCCESS) {
+        InterlockedExchange(&pProd->PubTail, (LONG)pProd->Tail);
+        pProd->Stats.Publishes++;
+    }
+
+    return dwErr;
+}
+
+static DWORD
+ring_prod_wait(
+    PRING_PROD pProd,
+    DWORD      dwTarget,
+    DWORD      dwTimeoutMs
+    )
+/*++
+
+Routine Description:
+
+    Publishes the tail and waits until the consumer has credited dwTarget
+    records. Head is read back from the window whenever no credit arrives
+    within RING_CREDIT_TIMEOUT, which also recovers lost doorbells.
+
+Return Value:
+
+    ERROR_SUCCESS - if Head reached dwTarget,
+    ERROR_TIMEOUT - if it did not within dwTimeoutMs,
+                    otherwise the error of a failed request.
+
+--*/
+{
+    RING_HEAD head;
+    DWORD     dwErr, waited = 0;
+
+    dwErr = ring_prod_publish(pProd);
+    if (dwErr != ERROR_SUCCESS)
+        return dwErr;
+
+    while ((LONG)((DWORD)pProd->Head - dwTarget) < 0) {
+        if (WaitForSingleObject(pProd->hCredit, RING_CREDIT_TIMEOUT) != WAIT_TIMEOUT)
+            continue;
+
+        dwErr = ring_prod_xfer(pProd, RING_HEAD_OFS, &head, sizeof(head), NREAD);
+        if (dwErr != ERROR_SUCCESS)
+            return dwErr;
+
+        pProd->Stats.HeadReads++;
+        if (head.Epoch == pProd->Epoch)
+            ring_prod_head(pProd, head.Head);
+
+        waited += RING_CREDIT_TIMEOUT;
+        if (waited >= dwTimeoutMs && (LONG)((DWORD)pProd->Head - dwTarget) < 0)
+            return ERROR_TIMEOUT;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+DWORD
+tsi721_ring_prod_create(
+    HANDLE      hDev,
+    PRING_CFG   pCfg,
+    PRING_PROD *ppProd
+    )
+{
+    PRING_PROD pProd;
+    RING_HDR   hdr;
+    DB_RX_CFG  rxCfg;
+    DWORD      dwErr;
+
+    if (pCfg == NULL || ppProd == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    pProd = (PRING_PROD)calloc(1, sizeof(RING_PROD));
+    if (pProd == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    pProd->hDev = hDev;
+    pProd->Cfg = *pCfg;
+
+    if (pProd->Cfg.SlotSize == 0)
+        pProd->Cfg.SlotSize = RING_DEF_SLOT_SIZE;
+    if (pProd->Cfg.SlotNum == 0 && pProd->Cfg.WinSize > RING_SLOTS_OFS)
+        pProd->Cfg.SlotNum = min((pProd->Cfg.WinSize - RING_SLOTS_OFS) / pProd->Cfg.SlotSize,
+                                 RING_MAX_SLOTS);
+    if (pProd->Cfg.PublishBatch == 0)
+        pProd->Cfg.PublishBatch = RING_DEF_PUBLISH;
+    pProd->Cfg.PublishBatch = min(pProd->Cfg.PublishBatch, pProd->Cfg.SlotNum);
+
+    if ((pProd->Cfg.SlotSize % RING_SLOT_ALIGN) || pProd->Cfg.SlotNum == 0 ||
+        pProd->Cfg.SlotNum > RING_MAX_SLOTS ||
+        RING_SLOTS_OFS + (ULONGLONG)pProd->Cfg.SlotNum * pProd->Cfg.SlotSize > pProd->Cfg.WinSize) {
+        free(pProd);
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    pProd->MaxRecord = pProd->Cfg.SlotSize - sizeof(RING_SLOT_HDR);
+
+    pProd->Slot = (PUCHAR)tsi721_pool_alloc(pProd->Cfg.SlotSize);
+    pProd->hCredit = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (pProd->Slot == NULL || pProd->hCredit == NULL) {
+        dwErr = pProd->Slot ? GetLastError() : ERROR_NOT_ENOUGH_MEMORY;
+        goto err_exit;
+    }
+
+    //
+    // The new epoch differs from the previous stream's in bit 0, so credits
+    // of that stream still in flight are told apart
+    //
+    dwErr = ring_prod_xfer(pProd, 0, &hdr, sizeof(hdr), NREAD);
+    if (dwErr != ERROR_SUCCESS)
+        goto err_exit;
+
+    pProd->Epoch = (hdr.Magic == RING_MAGIC) ? hdr.Epoch + 1 : 1;
+
+    ZeroMemory(&rxCfg, sizeof(rxCfg));
+    rxCfg.SpinMinUs = DB_RX_DEF_SPIN_MIN_US;
+    rxCfg.SpinMaxUs = DB_RX_DEF_SPIN_MAX_US;
+    rxCfg.Handler = ring_credit_handler;
+    rxCfg.HandlerCtx = pProd;
+
+    dwErr = tsi721_db_rx_start(hDev, &rxCfg, &pProd->pRx);
+    if (dwErr != ERROR_SUCCESS)
+        goto err_exit;
+
+    //
+    // Reset the tail before the header announces the new stream
+    //
+    dwErr = ring_prod_xfer(pProd, RING_TAIL_OFS, &pProd->Tail, sizeof(DWORD), ALL_NWRITE);
+    if (dwErr != ERROR_SUCCESS)
+        goto err_exit;
+
+    hdr.Magic = RING_MAGIC;
+    hdr.Epoch = pProd->Epoch;
+    hdr.SlotSize = pProd->Cfg.SlotSize;
+    hdr.SlotNum = pProd->Cfg.SlotNum;
+    hdr.ProducerId = pProd->Cfg.ProducerId;
+
+    dwErr = ring_prod_xfer(pProd, 0, &hdr, sizeof(hdr), ALL_NWRITE_R);
+    if (dwErr != ERROR_SUCCESS)
+        goto err_exit;
+
+    *ppProd = pProd;
+    return ERROR_SUCCESS;
+
+err_exit:
+
+    if (pProd->pRx)
+        tsi721_db_rx_stop(pProd->pRx);
+    if (pProd->hCredit)
+        CloseHandle(pProd->hCredit);
+    tsi721_pool_free(pProd->Slot);
+    free(pProd);
+    return dwErr;
+}
+
+DWORD
+tsi721_ring_send(
+    PRING_PROD pProd,
+    PVOID      pData,
+    DWORD      dwSize
+    )
+{
+    PRING_SLOT_HDR pHdr = (PRING_SLOT_HDR)pProd->Slot;
+    DWORD dwErr;
+
+    if (dwSize > pProd->MaxRecord || (pData == NULL && dwSize))
+        return ERROR_INVALID_PARAMETER;
+
+    if (pProd->Tail - (DWORD)pProd->Head >= pProd->Cfg.SlotNum) {
+        pProd->Stats.CreditWaits++;
+        dwErr = ring_prod_wait(pProd, pProd->Tail - pProd->Cfg.SlotNum + 1, RING_SEND_TIMEOUT);
+        if (dwErr != ERROR_SUCCESS)
+            return dwErr;
+    }
+
+    pHdr->Seq = pProd->Tail;
+    pHdr->Size = dwSize;
+    pHdr->Flags = pProd->Cfg.bCrc ? RING_SLOT_F_CRC : 0;
+    if (dwSize)
+        CopyMemory(pHdr + 1, pData, dwSize);
+    if (pProd->Cfg.bCrc)
+        pHdr->Crc = tsi721_crc32c(0, pHdr + 1, dwSize);
+
+    dwErr = ring_prod_xfer(pProd, RING_SLOTS_OFS + (pProd->Tail % pProd->Cfg.SlotNum) * pProd->Cfg.SlotSize,
+                           pProd->Slot, sizeof(RING_SLOT_HDR) + dwSize, ALL_NWRITE);
+    if (dwErr != ERROR_SUCCESS)
+        return dwErr;
+
+    pProd->Tail++;
+    pProd->Stats.Records++;
+    pProd->Stats.Bytes += dwSize;
+
+    if (pProd->Tail - (DWORD)pProd->PubTail >= pProd->Cfg.PublishBatch)
+        dwErr = ring_prod_publish(pProd);
+
+    return dwErr;
+}
+
+DWORD
+tsi721_ring_flush(
+    PRING_PROD pProd,
+    DWORD      dwTimeoutMs
+    )
+{
+    return ring_prod_wait(pProd, pProd->Tail, dwTimeoutMs);
+}
+
+VOID
+tsi721_ring_prod_stats(
+    PRING_PROD       pProd,
+    PRING_PROD_STATS pStats
+    )
+{
+    *pStats = pProd->Stats;
+}
+
+VOID
+tsi721_ring_prod_destroy(
+    PRING_PROD pProd
+    )
+{
+    if (pProd == NULL)
+        return;
+
+    tsi721_db_rx_stop(pProd->pRx);
+    CloseHandle(pProd->hCredit);
+    tsi721_pool_free(pProd->Slot);
+    free(pProd);
+}
+
+static DWORD
+ring_cons_credit(
+    PRING_CONS pCons,
+    PRING_HDR  pHdr,
+    DWORD      dwHead
+    )
+/*++
+
+Routine Description:
+
+    Stores Head in the window, then tells the producer with a credit
+    doorbell.
+
+--*/
+{
+    RING_HEAD head;
+    DWORD     dwSize = sizeof(head), dwInfo, dwErr;
+    ULONGLONG t0;
+
+    head.Head = dwHead;
+    head.Epoch = pHdr->Epoch;
+
+    dwErr = g_devOps->IbwBufferPut(pCons->hDev, pCons->Cfg.WinNum, RING_HEAD_OFS, &head, &dwSize);
+    if (dwErr != ERROR_SUCCESS)
+        return dwErr;
+
+    dwInfo = RING_DB_TAG | ((pHdr->Epoch & 1) ? RING_DB_EPOCH_BIT : 0) | (dwHead & RING_DB_IDX_MASK);
+
+    t0 = tsi721_trace_on() ? lat_ticks() : 0;
+    dwErr = g_devOps->SrioDoorbellSend(pCons->hDev, pHdr->ProducerId, dwInfo);
+    tsi721_trace(TRACE_EV_DB_SEND, dwErr, pHdr->ProducerId, dwInfo, 0, t0);
+
+    if (dwErr == ERROR_SUCCESS)
+        pCons->Stats.Credits++;
+
+    return dwErr;
+}
+
+static BOOL
+ring_cons_geometry(
+    PRING_CONS pCons,
+    PRING_HDR  pHdr
+    )
+{
+    return pHdr->SlotSize >= RING_SLOT_ALIGN && (pHdr->SlotSize % RING_SLOT_ALIGN) == 0 &&
+           pHdr->SlotNum && pHdr->SlotNum <= RING_MAX_SLOTS &&
+           RING_SLOTS_OFS + (ULONGLONG)pHdr->SlotNum * pHdr->SlotSize <= pCons->Cfg.WinSize;
+}
+
+static DWORD
+ring_cons_read(
+    PRING_CONS pCons,
+    DWORD      dwOffset,
+    DWORD      dwSize,
+    PVOID     *ppData
+    )
+/*++
+
+Routine Description:
+
+    Gets window bytes through the view, all of them or none.
+
+--*/
+{
+    DWORD dwLen = dwSize, dwErr;
+
+    dwErr = tsi721_ibv_get(pCons->pView, dwOffset, &dwLen, ppData);
+    if (dwErr == ERROR_SUCCESS && dwLen != dwSize)
+        dwErr = ERROR_INVALID_DATA;
+
+    return dwErr;
+}
+
+static unsigned __stdcall
+ring_cons_thread(
+    PVOID params
+    )
+/*++
+
+Routine Description:
+
+    Consumer thread. Polls the header and the published tail, passes new
+    records to the handler and credits them back every CreditBatch
+    records and whenever the ring has been drained. A new epoch in the
+    header restarts the consumer at index 0.
+
+Arguments:
+
+    params - pointer to consumer structure
+
+Return Value:
+
+    0
+
+--*/
+{
+    PRING_CONS pCons = (PRING_CONS)params;
+    PRING_HDR  pHdr;
+    PRING_SLOT_HDR pSlot;
+    RING_HDR   hdr;
+    ULONGLONG  idle = 0;
+    PVOID      pData;
+    DWORD      dwErr, dwOffset, size, flags, crc, tail, head = 0, credited = 0, batch = 1;
+    BOOL       bRun = FALSE, bGood;
+
+    ZeroMemory(&hdr, sizeof(hdr));
+
+    while (!pCons->bStop) {
+        dwErr = ring_cons_read(pCons, 0, RING_TAIL_OFS + sizeof(DWORD), (PVOID *)&pHdr);
+        if (dwErr != ERROR_SUCCESS) {
+            pCons->Stats.Errors++;
+            Sleep(1);
+            continue;
+        }
+
+        if (pHdr->Magic == RING_MAGIC && (!bRun || pHdr->Epoch != hdr.Epoch)) {
+            hdr = *pHdr;
+            bRun = ring_cons_geometry(pCons, &hdr);
+            if (!bRun)
+                pCons->Stats.Errors++;
+            else {
+                head = credited = 0;
+                batch = pCons->Cfg.CreditBatch ? pCons->Cfg.CreditBatch : hdr.SlotNum / 4;
+                batch = max(1, min(batch, hdr.SlotNum));
+                pCons->Stats.Streams++;
+                ring_cons_credit(pCons, &hdr, 0);
+            }
+        }
+
+        tail = *(volatile DWORD *)((PUCHAR)pHdr + RING_TAIL_OFS);
+
+        if (!bRun || tail == head || tail - head > hdr.SlotNum) {
+            if (idle == 0)
+                idle = lat_ticks();
+            else if (lat_ticks_to_ns(lat_ticks() - idle) >= RING_RX_SPIN_US * 1000ULL)
+                Sleep(1);
+            else
+                YieldProcessor();
+            continue;
+        }
+
+        idle = 0;
+
+        // Records before the tail are complete (read in place, order the reads)
+        MemoryBarrier();
+
+        while (head != tail && !pCons->bStop) {
+            dwOffset = RING_SLOTS_OFS + (head % hdr.SlotNum) * hdr.SlotSize;
+
+            dwErr = ring_cons_read(pCons, dwOffset, sizeof(RING_SLOT_HDR), (PVOID *)&pSlot);
+            if (dwErr != ERROR_SUCCESS) {
+                pCons->Stats.Errors++;
+                break;
+            }
+
+            // The header view may not survive the read of the payload
+            size = pSlot->Size;
+            flags = pSlot->Flags;
+            crc = pSlot->Crc;
+            if (pSlot->Seq != head || size > hdr.SlotSize - sizeof(RING_SLOT_HDR)) {
+                pCons->Stats.SeqErrors++;
+            } else {
+                pData = NULL;
+                if (size)
+                    dwErr = ring_cons_read(pCons, dwOffset + sizeof(RING_SLOT_HDR), size, &pData);
+                if (dwErr != ERROR_SUCCESS) {
+                    pCons->Stats.Errors++;
+                    break;
+                }
+
+                bGood = TRUE;
+                if (flags & RING_SLOT_F_CRC) {
+                    bGood = (tsi721_crc32c(0, pData, size) == crc);
+                    if (bGood)
+                        pCons->Stats.Sealed++;
+                    else
+                        pCons->Stats.CrcErrors++;
+                }
+
+                if (pCons->Cfg.Handler && bGood)
+                    pCons->Cfg.Handler(pCons->Cfg.HandlerCtx, pData, size);
+                pCons->Stats.Records++;
+                pCons->Stats.Bytes += size;
+            }
+
+            head++;
+            if (head - credited >= batch) {
+                if (ring_cons_credit(pCons, &hdr, head) != ERROR_SUCCESS)
+                    pCons->Stats.Errors++;
+                credited = head;
+            }
+        }
+
+        if (credited != head) {
+            if (ring_cons_credit(pCons, &hdr, head) != ERROR_SUCCESS)
+                pCons->Stats.Errors++;
+            credited = head;
+        }
+    }
+
+    return 0;
+}
+
+DWORD
+tsi721_ring_cons_start(
+    HANDLE       hDev,
+    PRING_RX_CFG pCfg,
+    PRING_CONS  *ppCons
+    )
+{
+    PRING_CONS pCons;
+    DWORD      dwErr;
+
+    if (pCfg == NULL || ppCons == NULL || pCfg->WinNum >= IBWIN_MAX_CHNUM ||
+        pCfg->WinSize <= RING_SLOTS_OFS)
+        return ERROR_INVALID_PARAMETER;
+
+    pCons = (PRING_CONS)calloc(1, sizeof(RING_CONS));
+    if (pCons == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    pCons->hDev = hDev;
+    pCons->Cfg = *pCfg;
+
+    // Copies, if any, are one slot at most
+    dwErr = tsi721_ibv_open(hDev, pCfg->WinNum, pCfg->WinSize, &pCons->pView);
+    if (dwErr != ERROR_SUCCESS) {
+        free(pCons);
+        return dwErr;
+    }
+
+    pCons->hThread = (HANDLE)_beginthreadex(NULL, 0, ring_cons_thread, pCons, 0, NULL);
+    if (pCons->hThread == NULL) {
+        dwErr = GetLastError();
+        tsi721_ibv_close(pCons->pView);
+        free(pCons);
+        return dwErr;
+    }
+
+    *ppCons = pCons;
+    return ERROR_SUCCESS;
+}
+
+VOID
+tsi721_ring_cons_stop(
+    PRING_CONS pCons
+    )
+{
+    if (pCons == NULL)
+        return;
+
+    pCons->bStop = TRUE;
+    WaitForSingleObject(pCons->hThread, INFINITE);
+
+    CloseHandle(pCons->hThread);
+    tsi721_ibv_close(pCons->pView);
+    free(pCons);
+}
+
+VOID
+tsi721_ring_cons_stats(
+    PRING_CONS       pCons,
+    PRING_CONS_STATS pStats
+    )
+{
+    IBV_STATS viewStats;
+
+    *pStats = pCons->Stats;
+
+    tsi721_ibv_stats(pCons->pView, &viewStats);
+    pStats->bZeroCopy = viewStats.bMapped;
+    pStats->ZeroCopyBytes = viewStats.ZeroCopyBytes;
+    pStats->CopiedBytes = viewStats.CopiedBytes;
+}
@@ -0,0 +1,236 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721ring.h
+
+Description:
+
+    Producer/consumer ring carried by a target inbound window. The master
+    writes records into a slot array in the window and publishes its tail
+    index; the target consumes the records and returns credits with
+    doorbells.
+
+--*/
+
+#ifndef _TSI721RING_H_
+#define _TSI721RING_H_
+
+//
+// Window layout. The producer owns the header and Tail, the consumer owns
+// Head; Tail and Head are on separate 64-byte lines so neither side's
+// writes touch the other's.
+//
+//  0x000  RING_HDR     written once per stream by the producer
+//  0x040  Tail         producer index, published with NWRITE_R
+//  0x080  Head         consumer index and stream epoch, written by the consumer
+//  0x100  slot 0       RING_SLOT_HDR + payload, SlotSize bytes per slot
+//
+#define RING_MAGIC          0x474e4952  // "RING"
+#define RING_TAIL_OFS       0x040
+#define RING_HEAD_OFS       0x080
+#define RING_SLOTS_OFS      0x100
+#define RING_SLOT_ALIGN     64
+#define RING_MAX_SLOTS      1024        // credits carry 11 index bits, see below
+#define RING_DEF_SLOT_SIZE  (64 * 1024)
+#define RING_DEF_PUBLISH    4           // records written before the tail is published
+#define RING_CREDIT_TIMEOUT 100         // ms without a credit doorbell before Head is read back
+#define RING_SEND_TIMEOUT   5000        // ms tsi721_ring_send() waits for a free slot
+#define RING_RX_SPIN_US     200         // consumer polls this long before sleeping between polls
+
+//
+// Credit doorbells carry a tag in INFO[15:12], bit 0 of the stream epoch in
+// INFO[11] and the low 11 bits of the consumer's Head in INFO[10:0]. The
+// producer is never more than RING_MAX_SLOTS records ahead of Head, so it
+// rebuilds the full index from its own tail.
+//
+#define RING_DB_TAG         0xc000
+#define RING_DB_TAG_MASK    0xf000
+#define RING_DB_EPOCH_BIT   0x0800
+#define RING_DB_IDX_MASK    0x07ff
+#define RING_DB_IS_CREDIT(info) (((info) & RING_DB_TAG_MASK) == RING_DB_TAG)
+
+typedef struct _RING_HDR {
+    DWORD Magic;        // RING_MAGIC
+    DWORD Epoch;        // new value for every stream, resets the consumer
+    DWORD SlotSize;     // slot stride in bytes
+    DWORD SlotNum;      // number of slots
+    DWORD ProducerId;   // destID receiving the credit doorbells
+} RING_HDR, *PRING_HDR;
+
+typedef struct _RING_HEAD {
+    DWORD Head;         // records consumed
+    DWORD Epoch;        // stream the index belongs to
+} RING_HEAD, *PRING_HEAD;
+
+#define RING_SLOT_F_CRC     0x01        // Crc holds the CRC32C of the payload
+
+typedef struct _RING_SLOT_HDR {
+    DWORD Seq;          // producer index of the record
+    DWORD Size;         // payload bytes
+    DWORD Flags;        // RING_SLOT_F_xxx
+    DWORD Crc;
+} RING_SLOT_HDR, *PRING_SLOT_HDR;
+
+typedef struct _RING_CFG {
+    DWORD DestId;       // destID of the target
+    DWORD ProducerId;   // local destID, where credits are sent
+    DWORD WinAddrHi;    // SRIO base address of the target window
+    DWORD WinAddrLo;
+    DWORD WinSize;      // size of the target window
+    DWORD SlotSize;     // slot stride, multiple of RING_SLOT_ALIGN (0 = RING_DEF_SLOT_SIZE)
+    DWORD SlotNum;      // slots (0 = as many as fit, at most RING_MAX_SLOTS)
+    DWORD PublishBatch; // records per tail update (0 = RING_DEF_PUBLISH)
+    BOOL  bCrc;         // put the CRC32C of every record in its slot header
+} RING_CFG, *PRING_CFG;
+
+typedef struct _RING_PROD_STATS {
+    ULONGLONG Records;
+    ULONGLONG Bytes;            // payload bytes
+    ULONGLONG Publishes;        // tail updates (NWRITE_R)
+    ULONGLONG Credits;          // credit doorbells received
+    ULONGLONG CreditWaits;      // times the ring was full
+    ULONGLONG HeadReads;        // Head read back after RING_CREDIT_TIMEOUT
+} RING_PROD_STATS, *PRING_PROD_STATS;
+
+//
+// Record callback of the consumer. The data is valid until the callback
+// returns, its slot is credited back afterwards. When the backend maps the
+// window the data is passed in place, without a copy. Records carrying a
+// CRC are checked in the window before the callback sees them.
+//
+typedef VOID (*PFN_RING_RX)(PVOID pCtx, PVOID pData, DWORD dwSize);
+
+typedef struct _RING_RX_CFG {
+    DWORD       WinNum;         // inbound window carrying the ring
+    DWORD       WinSize;        // size of the window
+    DWORD       CreditBatch;    // records consumed per credit doorbell (0 = SlotNum / 4)
+    PFN_RING_RX Handler;        // NULL = count records only
+    PVOID       HandlerCtx;
+} RING_RX_CFG, *PRING_RX_CFG;
+
+typedef struct _RING_CONS_STATS {
+    ULONGLONG Records;
+    ULONGLONG Bytes;
+    ULONGLONG Credits;          // credit doorbells sent
+    ULONGLONG Streams;          // producer epochs seen
+    ULONGLONG SeqErrors;        // slots whose sequence number did not match
+    ULONGLONG Sealed;           // records with a CRC that matched
+    ULONGLONG CrcErrors;        // records with a CRC that differed (not passed on)
+    ULONGLONG Errors;           // failed window or doorbell requests
+    BOOL      bZeroCopy;        // window read in place
+    ULONGLONG ZeroCopyBytes;    // window bytes read in place (headers included)
+    ULONGLONG CopiedBytes;      // window bytes copied by TSI721IbwBufferGet()
+} RING_CONS_STATS, *PRING_CONS_STATS;
+
+typedef struct _RING_PROD *PRING_PROD;
+typedef struct _RING_CONS *PRING_CONS;
+
+/*
+ * tsi721_ring_prod_create()
+ *
+ *  Writes a new ring header into the target window and starts receiving
+ *  credit doorbells on the device handle. No other receiver of inbound
+ *  doorbells may run on the device.
+ *
+ * Arguments:
+ *  hDev   - device handle
+ *  pCfg   - ring configuration
+ *  ppProd - pointer to variable to save the created producer
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the ring was created,
+ *  ERROR_INVALID_PARAMETER - if the slots do not fit the window,
+ *                  otherwise an error code.
+ */
+DWORD
+tsi721_ring_prod_create(
+    __in  HANDLE     hDev,
+    __in  PRING_CFG  pCfg,
+    __out PRING_PROD *ppProd
+    );
+
+/*
+ * tsi721_ring_send()
+ *
+ *  Writes one record (NWRITE) into the next free slot, waiting for a
+ *  credit if the ring is full. The tail is published every PublishBatch
+ *  records and before waiting for credits.
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the record was written,
+ *  ERROR_INVALID_PARAMETER - if the record does not fit a slot,
+ *  ERROR_TIMEOUT - if the consumer returned no credit,
+ *                  otherwise an error code.
+ */
+DWORD
+tsi721_ring_send(
+    __in PRING_PROD pProd,
+    __in PVOID      pData,
+    __in DWORD      dwSize
+    );
+
+/*
+ * tsi721_ring_flush()
+ *
+ *  Publishes the tail and waits until the consumer has credited all
+ *  records back.
+ */
+DWORD
+tsi721_ring_flush(
+    __in PRING_PROD pProd,
+    __in DWORD      dwTimeoutMs
+    );
+
+/*
+ * tsi721_ring_prod_stats()/tsi721_ring_prod_destroy()
+ */
+VOID
+tsi721_ring_prod_stats(
+    __in  PRING_PROD       pProd,
+    __out PRING_PROD_STATS pStats
+    );
+
+VOID tsi721_ring_prod_destroy(__in PRING_PROD pProd);
+
+/*
+ * tsi721_ring_cons_start()
+ *
+ *  Starts the consumer thread on an inbound window of the device. The
+ *  thread polls the published tail and serves every stream a producer
+ *  starts in the window. It reads the window in place if the backend maps
+ *  it, through TSI721IbwBufferGet() otherwise.
+ *
+ * Arguments:
+ *  hDev   - device handle (may be shared with other users)
+ *  pCfg   - consumer configuration
+ *  ppCons - pointer to variable to save the created consumer
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the consumer was started, otherwise an error code.
+ */
+DWORD
+tsi721_ring_cons_start(
+    __in  HANDLE       hDev,
+    __in  PRING_RX_CFG pCfg,
+    __out PRING_CONS  *ppCons
+    );
+
+/*
+ * tsi721_ring_cons_stop()/tsi721_ring_cons_stats()
+ */
+VOID tsi721_ring_cons_stop(__in PRING_CONS pCons);
+
+VOID
+tsi721_ring_cons_stats(
+    __in  PRING_CONS       pCons,
+    __out PRING_CONS_STATS pStats
+    );
+
+#endif // _TSI721RING_H_
@@ -0,0 +1,727 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721seg.cpp
+
+Description:
+
+    Segmentation of payloads larger than one mailbox message into a
+    sequence of messages spread over several mailboxes, and their
+    reassembly at the receiver.
+
+    The sender keeps a free list of message buffers per MBOX. Segments go
+    round robin over the mailboxes; a mailbox without a free buffer or,
+    with flow control, without a credit is skipped, so a slow mailbox does
+    not hold back the others. Only when all of them are blocked does the
+    sender wait for a completion or a credit.
+
+    The receiver assembles each payload in one pool buffer. Only the slot
+    lookup and the bookkeeping are done under the lock: segments of one
+    payload arriving on different mailboxes are copied into place by the
+    receive workers in parallel.
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+
+#include "tsi721api.h"
+#include "tsi721dev.h"
+#include "tsi721crc.h"
+#include "tsi721msg.h"
+#include "tsi721msgrx.h"
+#include "tsi721seg.h"
+#include "tsi721pool.h"
+#include "tsi721stat.h"
+#include "tsi721trace.h"
+
+#define SEG_TX_BATCH    64  // completions reaped by one call
+
+typedef struct _SEG_TX_CTX {
+    OVERLAPPED          Ovl;
+    struct _SEG_TX_CTX *Next;       // MBOX free list
+    PUCHAR              Buf;        // page-aligned message buffer
+    DWORD               Len;        // size passed to the driver
+    DWORD               Mbox;
+    ULONGLONG           Submit;     // submission timestamp
+} SEG_TX_CTX, *PSEG_TX_CTX;
+
+typedef struct _SEG_TX {
+    SEG_TX_CFG   Cfg;
+    HANDLE       hDev;
+    HANDLE       hPort;
+    PSEG_TX_CTX  pCtx;
+    DWORD        CtxNum;
+    PSEG_TX_CTX  Free[RIO_MSG_MAX_MBOX];    // idle buffers per MBOX (NULL = MBOX full or unused)
+    PMSG_CREDIT  pCredit;                   // NULL = no flow control
+    DWORD        NextMbox;                  // round robin position
+    DWORD        InFlight;
+    DWORD        Seq;                       // sequence number of the next payload
+    DWORD        Status;                    // first error, stops further submissions
+    SEG_TX_STATS Stats;
+} SEG_TX;
+
+typedef struct _SEG_SLOT {
+    BOOL      InUse;
+    DWORD     Src;
+    USHORT    StreamId;
+    DWORD     Seq;
+    DWORD     Total;
+    DWORD     SegNum;       // segments making up the payload
+    DWORD     Received;     // segments copied into Buf
+    DWORD     Copying;      // segments being copied outside the lock
+    ULONGLONG Stamp;        // last use, for evicting the slot idle longest
+    PUCHAR    Buf;          // pool buffer of Total bytes
+    DWORD     Map[(SEG_MAX_SEGS + 31) / 32];    // bit N set = segment N claimed
+} SEG_SLOT, *PSEG_SLOT;
+
+typedef struct _SEG_RX {
+    SEG_RX_CFG       Cfg;
+    CRITICAL_SECTION Lock;
+    ULONGLONG        Clock;     // Stamp source
+    SEG_RX_STATS     Stats;     // Active is counted in tsi721_seg_rx_stats()
+    SEG_SLOT         Slot[SEG_RX_SLOTS];
+} SEG_RX;
+
+//
+// Sender
+//
+
+static VOID
+seg_tx_fail(
+    PSEG_TX pTx,
+    DWORD   dwErr
+    )
+{
+    if (pTx->Status == ERROR_SUCCESS)
+        pTx->Status = dwErr;
+}
+
+static DWORD
+seg_tx_reap(
+    PSEG_TX pTx,
+    DWORD   dwTimeout
+    )
+/*++
+
+Routine Description:
+
+    Reaps available completions and returns their buffers to the free lists
+    of their mailboxes. Waits up to dwTimeout ms for the first one or for a
+    credit. When nothing arrives within SEG_TX_TIMEOUT the pending segments
+    are cancelled, their completions are reaped by later calls.
+
+Return Value:
+
+    ERROR_SUCCESS, WAIT_TIMEOUT if nothing completed, or the port error.
+
+--*/
+{
+    OVERLAPPED_ENTRY entry[SEG_TX_BATCH];
+    ULONG ulNum = 0, i;
+    DWORD dwStatus, dwLen;
+
+    if (!GetQueuedCompletionStatusEx(pTx->hPort, entry, SEG_TX_BATCH, &ulNum, dwTimeout, FALSE)) {
+        dwStatus = GetLastError();
+
+        if (dwStatus == WAIT_TIMEOUT && dwTimeout >= SEG_TX_TIMEOUT) {
+            printf_s("SEG_SEND: no completion in %d ms, cancelling %d segments\n",
+                     dwTimeout, pTx->InFlight);
+            g_devOps->CancelIo(pTx->hDev, NULL);
+            seg_tx_fail(pTx, ERROR_TIMEOUT);
+        } else if (dwStatus != WAIT_TIMEOUT) {
+            printf_s("SEG_SEND: GetQueuedCompletionStatusEx failed %d\n", dwStatus);
+            seg_tx_fail(pTx, dwStatus);
+        }
+
+        return dwStatus;
+    }
+
+    for (i = 0; i < ulNum; i++) {
+        PSEG_TX_CTX pC;
+
+        // Credit wakeup
+        if (entry[i].lpOverlapped == NULL)
+            continue;
+
+        pC = CONTAINING_RECORD(entry[i].lpOverlapped, SEG_TX_CTX, Ovl);
+        pTx->InFlight--;
+
+        if (GetOverlappedResult(pTx->hDev, &pC->Ovl, &dwLen, FALSE)) {
+            pTx->Stats.Segments[pC->Mbox]++;
+            tsi721_trace(TRACE_EV_MSG_SEND, 0, pC->Mbox, pC->Len, pTx->Cfg.DestId, pC->Submit);
+        } else {
+            dwStatus = GetLastError();
+            tsi721_trace(TRACE_EV_MSG_SEND, dwStatus, pC->Mbox, pC->Len, pTx->Cfg.DestId, pC->Submit);
+            if (pTx->Status == ERROR_SUCCESS)
+                printf_s("SEG_SEND: MBOX%d segment failed, err = 0x%x\n", pC->Mbox, dwStatus);
+            pTx->Stats.Errors++;
+            seg_tx_fail(pTx, dwStatus);
+        }
+
+        pC->Next = pTx->Free[pC->Mbox];
+        pTx->Free[pC->Mbox] = pC;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+static PSEG_TX_CTX
+seg_tx_get(
+    PSEG_TX pTx
+    )
+/*++
+
+Routine Description:
+
+    Takes a free buffer of the next mailbox in round robin order that has
+    one and a credit, waiting for completions or credits while all
+    mailboxes are blocked.
+
+Return Value:
+
+    Buffer, NULL if the sender has failed.
+
+--*/
+{
+    PSEG_TX_CTX pC;
+    DWORD i, mbox;
+
+    while (pTx->Status == ERROR_SUCCESS) {
+        for (i = 0; i < RIO_MSG_MAX_MBOX; i++) {
+            mbox = (pTx->NextMbox + i) % RIO_MSG_MAX_MBOX;
+            pC = pTx->Free[mbox];
+            if (pC != NULL && (pTx->pCredit == NULL || tsi721_msg_credit_take(pTx->pCredit, mbox))) {
+                pTx->Free[mbox] = pC->Next;
+                pTx->NextMbox = mbox + 1;
+                return pC;
+            }
+        }
+
+        seg_tx_reap(pTx, SEG_TX_TIMEOUT);
+    }
+
+    return NULL;
+}
+
+DWORD
+tsi721_seg_tx_create(
+    DWORD       dwDevNum,
+    PSEG_TX_CFG pCfg,
+    PSEG_TX    *ppTx
+    )
+/*++
+
+Routine Description:
+
+    Creates a segmenting sender with Depth message buffers per selected
+    MBOX, bound to a completion port of its own device handle.
+
+Arguments:
+
+    dwDevNum - Tsi721 device index
+    pCfg     - sender configuration
+    ppTx     - created sender
+
+Return Value:
+
+    ERROR_SUCCESS or an error code.
+
+--*/
+{
+    PSEG_TX pTx;
+    DWORD   mboxMask, depth, nMbox = 0, mbox, i, j;
+    DWORD   dwErr = ERROR_SUCCESS;
+
+    if (pCfg == NULL || ppTx == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    mboxMask = pCfg->MboxMask ? pCfg->MboxMask : (1 << RIO_MSG_MAX_MBOX) - 1;
+    depth = pCfg->Depth ? pCfg->Depth : MSG_DEF_DEPTH;
+
+    if (mboxMask & ~((1 << RIO_MSG_MAX_MBOX) - 1) || pCfg->Credits > MSGRX_MAX_BUFS)
+        return ERROR_INVALID_PARAMETER;
+
+    for (mbox = 0; mbox < RIO_MSG_MAX_MBOX; mbox++)
+        if (mboxMask & (1 << mbox))
+            nMbox++;
+
+    if (depth * nMbox > TSI721_NUM_ASYNCH_IO)
+        depth = TSI721_NUM_ASYNCH_IO / nMbox;
+
+    pTx = (PSEG_TX)calloc(1, sizeof(SEG_TX));
+    if (pTx == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    pTx->Cfg = *pCfg;
+    pTx->Cfg.MboxMask = mboxMask;
+    pTx->Cfg.Depth = depth;
+    pTx->hDev = INVALID_HANDLE_VALUE;
+    pTx->CtxNum = depth * nMbox;
+
+    //
+    // Open a separate device handle so that only this sender's requests
+    // complete to its completion port.
+    //
+    if (!g_devOps->DeviceOpen(&pTx->hDev, dwDevNum, NULL)) {
+        dwErr = GetLastError();
+        printf_s("SEG_SEND: failed to open Tsi721_%d (err=%x)\n", dwDevNum, dwErr);
+        pTx->hDev = INVALID_HANDLE_VALUE;
+        goto err_exit;
+    }
+
+    pTx->hPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    if (pTx->hPort == NULL) {
+        dwErr = GetLastError();
+        printf_s("SEG_SEND: Cannot create completion port err=%d\n", dwErr);
+        goto err_exit;
+    }
+
+    dwErr = g_devOps->BindPort(pTx->hDev, pTx->hPort, 0);
+    if (dwErr != ERROR_SUCCESS) {
+        printf_s("SEG_SEND: Cannot bind completion port err=%d\n", dwErr);
+        goto err_exit;
+    }
+
+    if (pCfg->Credits) {
+        dwErr = tsi721_msg_credit_start(dwDevNum, pCfg->DestId, pCfg->Credits, pTx->hPort, &pTx->pCredit);
+        if (dwErr != ERROR_SUCCESS)
+            goto err_exit;
+    }
+
+    pTx->pCtx = (PSEG_TX_CTX)calloc(pTx->CtxNum, sizeof(SEG_TX_CTX));
+    if (pTx->pCtx == NULL) {
+        dwErr = ERROR_NOT_ENOUGH_MEMORY;
+        goto err_exit;
+    }
+
+    for (i = 0, mbox = 0; mbox < RIO_MSG_MAX_MBOX; mbox++) {
+        if (!(mboxMask & (1 << mbox)))
+            continue;
+
+        for (j = 0; j < depth; j++, i++) {
+            pTx->pCtx[i].Buf = (PUCHAR)tsi721_pool_alloc(MSG_MAX_SIZE);
+            if (pTx->pCtx[i].Buf == NULL) {
+                printf_s("SEG_SEND: Unable to allocate message buffers\n");
+                dwErr = ERROR_NOT_ENOUGH_MEMORY;
+                goto err_exit;
+            }
+
+            pTx->pCtx[i].Mbox = mbox;
+            pTx->pCtx[i].Next = pTx->Free[mbox];
+            pTx->Free[mbox] = &pTx->pCtx[i];
+        }
+    }
+
+    *ppTx = pTx;
+    return ERROR_SUCCESS;
+
+err_exit:
+
+    tsi721_seg_tx_destroy(pTx);
+    return dwErr;
+}
+
+VOID
+tsi721_seg_tx_destroy(
+    PSEG_TX pTx
+    )
+{
+    DWORD i;
+
+    if (pTx == NULL)
+        return;
+
+    // Stop the credit doorbells before the port they wake is closed
+    if (pTx->pCredit)
+        tsi721_msg_credit_stop(pTx->pCredit);
+
+    // Closing the handle cancels whatever the driver still holds
+    if (pTx->hDev != INVALID_HANDLE_VALUE)
+        g_devOps->DeviceClose(pTx->hDev, NULL);
+
+    if (pTx->hPort)
+        CloseHandle(pTx->hPort);
+
+    if (pTx->pCtx) {
+        for (i = 0; i < pTx->CtxNum; i++)
+            tsi721_pool_free(pTx->pCtx[i].Buf);
+        free(pTx->pCtx);
+    }
+
+    free(pTx);
+}
+
+DWORD
+tsi721_seg_send(
+    PSEG_TX pTx,
+    PVOID   pData,
+    DWORD   dwSize
+    )
+/*++
+
+Routine Description:
+
+    Copies the payload segment by segment into free message buffers and
+    submits them. Completions are reaped without waiting after every
+    segment, so buffers return to the free lists as early as possible.
+
+Arguments:
+
+    pTx    - sender
+    pData  - payload
+    dwSize - payload size
+
+Return Value:
+
+    ERROR_SUCCESS or the first error of the sender.
+
+--*/
+{
+    PSEG_TX_CTX pC;
+    PSEG_HDR    pHdr;
+    DWORD       segNum, idx, offset, len, dwErr;
+
+    if (pTx == NULL || pData == NULL || dwSize == 0 || dwSize > SEG_MAX_SIZE)
+        return ERROR_INVALID_PARAMETER;
+
+    segNum = (dwSize + SEG_PAYLOAD - 1) / SEG_PAYLOAD;
+
+    for (idx = 0, offset = 0; idx < segNum; idx++, offset += len) {
+        pC = seg_tx_get(pTx);
+        if (pC == NULL)
+            break;
+
+        len = min(dwSize - offset, (DWORD)SEG_PAYLOAD);
+
+        pHdr = (PSEG_HDR)pC->Buf;
+        pHdr->Magic = SEG_MAGIC;
+        pHdr->StreamId = pTx->Cfg.StreamId;
+        pHdr->Seq = pTx->Seq;
+        pHdr->Total = dwSize;
+        pHdr->Index = idx;
+        CopyMemory(pHdr + 1, (PUCHAR)pData + offset, len);
+
+        // Messages are sent in double-words, the receiver sizes the
+        // segment from the header
+        ZeroMemory(&pC->Ovl, sizeof(OVERLAPPED));
+        if (pTx->Cfg.bCrc)
+            pC->Len = tsi721_crc_seal(pC->Buf, sizeof(SEG_HDR) + len);
+        else
+            pC->Len = (sizeof(SEG_HDR) + len + 7) & ~7;
+        pC->Submit = lat_ticks();
+
+        dwErr = g_devOps->SrioMsgSend(pTx->hDev, pC->Mbox, pTx->Cfg.DestId, pC->Buf, &pC->Len, &pC->Ovl);
+
+        // The handle is bound to a completion port: a request completed
+        // synchronously is reported through the port as well.
+        if (dwErr != ERROR_SUCCESS && dwErr != ERROR_IO_PENDING) {
+            printf_s("SEG_SEND: MBOX%d IOCTL error: 0x%x (%d)\n", pC->Mbox, dwErr, dwErr);
+            if (pTx->pCredit)
+                tsi721_msg_credit_put(pTx->pCredit, pC->Mbox);
+            pC->Next = pTx->Free[pC->Mbox];
+            pTx->Free[pC->Mbox] = pC;
+            seg_tx_fail(pTx, dwErr);
+            break;
+        }
+
+        pTx->InFlight++;
+        seg_tx_reap(pTx, 0);
+    }
+
+    if (pTx->Status == ERROR_SUCCESS) {
+        pTx->Stats.Payloads++;
+        pTx->Stats.Bytes += dwSize;
+    }
+
+    pTx->Seq++;
+    return pTx->Status;
+}
+
+DWORD
+tsi721_seg_flush(
+    PSEG_TX pTx
+    )
+{
+    DWORD dwStatus;
+    BOOL  bCancelled;
+
+    if (pTx == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    while (pTx->InFlight) {
+        bCancelled = (pTx->Status == ERROR_TIMEOUT);
+        dwStatus = seg_tx_reap(pTx, SEG_TX_TIMEOUT);
+
+        // Give up if even the cancelled requests do not come back
+        if (dwStatus != ERROR_SUCCESS && (dwStatus != WAIT_TIMEOUT || bCancelled))
+            break;
+    }
+
+    return pTx->Status;
+}
+
+VOID
+tsi721_seg_tx_stats(
+    PSEG_TX       pTx,
+    PSEG_TX_STATS pStats
+    )
+{
+    MSG_CREDIT_STATS crStats;
+    DWORD mbox;
+
+    *pStats = pTx->Stats;
+
+    if (pTx->pCredit) {
+        tsi721_msg_credit_stats(pTx->pCredit, &crStats);
+        pStats->CreditDbs = crStats.Doorbells;
+        for (mbox = 0; mbox < RIO_MSG_MAX_MBOX; mbox++)
+            pStats->CreditWaits += crStats.Waits[mbox];
+    }
+}
+
+//
+// Receiver
+//
+
+DWORD
+tsi721_seg_rx_create(
+    PSEG_RX_CFG pCfg,
+    PSEG_RX    *ppRx
+    )
+{
+    PSEG_RX pRx;
+
+    if (pCfg == NULL || ppRx == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    pRx = (PSEG_RX)calloc(1, sizeof(SEG_RX));
+    if (pRx == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    pRx->Cfg = *pCfg;
+    InitializeCriticalSection(&pRx->Lock);
+
+    *ppRx = pRx;
+    return ERROR_SUCCESS;
+}
+
+VOID
+tsi721_seg_rx_destroy(
+    PSEG_RX pRx
+    )
+{
+    DWORD i;
+
+    if (pRx == NULL)
+        return;
+
+    for (i = 0; i < SEG_RX_SLOTS; i++)
+        tsi721_pool_free(pRx->Slot[i].Buf);
+
+    DeleteCriticalSection(&pRx->Lock);
+    free(pRx);
+}
+
+static PSEG_SLOT
+seg_rx_slot(
+    PSEG_RX  pRx,
+    DWORD    dwSrc,
+    PSEG_HDR pHdr
+    )
+/*++
+
+Routine Description:
+
+    Finds the slot assembling the payload of a segment or claims one for
+    a new payload, evicting the incomplete payload idle longest when all
+    slots are in use. Called with the lock held.
+
+Return Value:
+
+    Slot, NULL if no slot or payload buffer is available (the segment is
+    lost and its payload will be dropped eventually).
+
+--*/
+{
+    PSEG_SLOT pSlot, pFree = NULL, pOld = NULL;
+    DWORD i;
+
+    for (i = 0; i < SEG_RX_SLOTS; i++) {
+        pSlot = &pRx->Slot[i];
+
+        if (!pSlot->InUse) {
+            if (pFree == NULL)
+                pFree = pSlot;
+            continue;
+        }
+
+        if (pSlot->Src == dwSrc && pSlot->StreamId == pHdr->StreamId && pSlot->Seq == pHdr->Seq)
+            return pSlot;
+
+        // A slot being copied into cannot be evicted
+        if (pSlot->Copying == 0 && (pOld == NULL || pSlot->Stamp < pOld->Stamp))
+            pOld = pSlot;
+    }
+
+    if (pFree == NULL) {
+        if (pOld == NULL)
+            return NULL;
+
+        tsi721_pool_free(pOld->Buf);
+        pOld->Buf = NULL;
+        pOld->InUse = FALSE;
+        pRx->Stats.Dropped++;
+        pFree = pOld;
+    }
+
+    pFree->Buf = (PUCHAR)tsi721_pool_alloc(pHdr->Total);
+    if (pFree->Buf == NULL)
+        return NULL;
+
+    pFree->InUse = TRUE;
+    pFree->Src = dwSrc;
+    pFree->StreamId = pHdr->StreamId;
+    pFree->Seq = pHdr->Seq;
+    pFree->Total = pHdr->Total;
+    pFree->SegNum = (pHdr->Total + SEG_PAYLOAD - 1) / SEG_PAYLOAD;
+    pFree->Received = 0;
+    pFree->Copying = 0;
+    ZeroMemory(pFree->Map, sizeof(pFree->Map));
+
+    return pFree;
+}
+
+VOID
+tsi721_seg_rx_msg(
+    PVOID pCtx,
+    DWORD dwMbox,
+    DWORD dwSrc,
+    PVOID pMsg,
+    DWORD dwSize
+    )
+/*++
+
+Routine Description:
+
+    Places one segment into its payload. The segment bit is claimed under
+    the lock, the data is copied without it, and the worker completing the
+    last segment takes the payload out of its slot and calls the handler.
+
+Arguments:
+
+    as PFN_MSGRX_HANDLER
+
+Return Value:
+
+    None
+
+--*/
+{
+    PSEG_RX   pRx = (PSEG_RX)pCtx;
+    PSEG_HDR  pHdr = (PSEG_HDR)pMsg;
+    PSEG_SLOT pSlot;
+    PUCHAR    pDone = NULL;
+    ULONGLONG offset;
+    DWORD     len, bit;
+
+    if (dwSize < sizeof(SEG_HDR) || pHdr->Magic != SEG_MAGIC) {
+        InterlockedIncrement64((LONGLONG *)&pRx->Stats.Foreign);
+        if (pRx->Cfg.RawHandler)
+            pRx->Cfg.RawHandler(pRx->Cfg.RawCtx, dwMbox, dwSrc, pMsg, dwSize);
+        return;
+    }
+
+    // The index selects a bit of the segment map: check it before use
+    if (pHdr->Total == 0 || pHdr->Total > SEG_MAX_SIZE ||
+        pHdr->Index >= (pHdr->Total + SEG_PAYLOAD - 1) / SEG_PAYLOAD) {
+        InterlockedIncrement64((LONGLONG *)&pRx->Stats.Bad);
+        return;
+    }
+
+    offset = (ULONGLONG)pHdr->Index * SEG_PAYLOAD;
+    len = (DWORD)min(pHdr->Total - offset, (ULONGLONG)SEG_PAYLOAD);
+
+    if (dwSize < sizeof(SEG_HDR) + len) {
+        InterlockedIncrement64((LONGLONG *)&pRx->Stats.Bad);
+        return;
+    }
+
+    bit = 1u << (pHdr->Index % 32);
+
+    EnterCriticalSection(&pRx->Lock);
+
+    pSlot = seg_rx_slot(pRx, dwSrc, pHdr);
+    if (pSlot == NULL) {
+        LeaveCriticalSection(&pRx->Lock);
+        return;
+    }
+
+    if (pSlot->Total != pHdr->Total) {
+        LeaveCriticalSection(&pRx->Lock);
+        InterlockedIncrement64((LONGLONG *)&pRx->Stats.Bad);
+        return;
+    }
+
+    if (pSlot->Map[pHdr->Index / 32] & bit) {
+        pRx->Stats.Duplicates++;
+        LeaveCriticalSection(&pRx->Lock);
+        return;
+    }
+
+    pSlot->Map[pHdr->Index / 32] |= bit;
+    pSlot->Copying++;
+    pSlot->Stamp = ++pRx->Clock;
+
+    LeaveCriticalSection(&pRx->Lock);
+
+    CopyMemory(pSlot->Buf + offset, pHdr + 1, len);
+
+    EnterCriticalSection(&pRx->Lock);
+
+    pSlot->Copying--;
+    pSlot->Received++;
+    pRx->Stats.Segments++;
+
+    if (pSlot->Received == pSlot->SegNum) {
+        pDone = pSlot->Buf;
+        pSlot->Buf = NULL;
+        pSlot->InUse = FALSE;
+        pRx->Stats.Payloads++;
+        pRx->Stats.Bytes += pHdr->Total;
+    }
+
+    LeaveCriticalSection(&pRx->Lock);
+
+    if (pDone) {
+        if (pRx->Cfg.Handler)
+            pRx->Cfg.Handler(pRx->Cfg.HandlerCtx, dwSrc, pHdr->StreamId, pHdr->Seq, pDone, pHdr->Total);
+        tsi721_pool_free(pDone);
+    }
+}
+
+VOID
+tsi721_seg_rx_stats(
+    PSEG_RX       pRx,
+    PSEG_RX_STATS pStats
+    )
+{
+    DWORD i;
+
+    EnterCriticalSection(&pRx->Lock);
+
+    *pStats = pRx->Stats;
+    pStats->Active = 0;
+    for (i = 0; i < SEG_RX_SLOTS; i++)
+        if (pRx->Slot[i].InUse)
+            pStats->Active++;
+
+    LeaveCriticalSection(&pRx->Lock);
+}
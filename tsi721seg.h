@@ -0,0 +1,234 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721seg.h
+
+Description:
+
+    Segmentation of payloads larger than one mailbox message into a
+    sequence of messages spread over several mailboxes, and their
+    reassembly at the receiver.
+
+--*/
+
+#ifndef _TSI721SEG_H_
+#define _TSI721SEG_H_
+
+//
+// Every segment is one message: a SEG_HDR followed by up to SEG_PAYLOAD
+// bytes of the payload. Segment N carries payload bytes starting at
+// N * SEG_PAYLOAD; all but the last segment are full. Segments of one
+// payload may take different mailboxes and arrive in any order. A segment
+// leaves room for a CRC trailer, so sealed and plain payloads are split
+// alike.
+//
+#define SEG_MAGIC           0x4753      // "SG"
+#define SEG_PAYLOAD         (MSG_MAX_SIZE - sizeof(SEG_HDR) - sizeof(CRC_TRAILER))
+#define SEG_MAX_SIZE        (1024 * 1024)   // largest payload
+#define SEG_MAX_SEGS        ((SEG_MAX_SIZE + SEG_PAYLOAD - 1) / SEG_PAYLOAD)
+#define SEG_RX_SLOTS        64          // payloads reassembled at the same time
+#define SEG_TX_TIMEOUT      10000       // ms without any completion before pending segments are cancelled
+
+//
+// Pattern seed of the test payloads sent by the master's seg mode, so that
+// the target can verify them without a reference.
+//
+#define SEG_TEST_SEED(stream, seq)  (((DWORD)(stream) << 16) ^ (DWORD)(seq))
+
+typedef struct _SEG_HDR {
+    USHORT Magic;       // SEG_MAGIC
+    USHORT StreamId;    // sender's stream, payloads of a source are told apart by (StreamId, Seq)
+    DWORD  Seq;         // payload number within the stream
+    DWORD  Total;       // payload bytes
+    DWORD  Index;       // segment number within the payload
+} SEG_HDR, *PSEG_HDR;
+
+typedef struct _SEG_TX_CFG {
+    DWORD  DestId;      // destID of the receiver
+    DWORD  MboxMask;    // bit N set = segments may use MBOX N (0 = MBOX0-3)
+    DWORD  Depth;       // segments in flight per MBOX (0 = MSG_DEF_DEPTH)
+    DWORD  Credits;     // receive buffers per MBOX at the receiver (0 = no flow control)
+    BOOL   bCrc;        // seal every segment with a CRC trailer
+    USHORT StreamId;    // stream id put in the segment headers
+} SEG_TX_CFG, *PSEG_TX_CFG;
+
+typedef struct _SEG_TX_STATS {
+    ULONGLONG Payloads;                     // payloads submitted
+    ULONGLONG Bytes;                        // payload bytes submitted
+    ULONGLONG Segments[RIO_MSG_MAX_MBOX];   // segments completed successfully per MBOX
+    ULONGLONG Errors;                       // failed or cancelled segments
+    ULONGLONG CreditDbs;                    // credit doorbells received
+    ULONGLONG CreditWaits;                  // mailboxes skipped for lack of a credit
+} SEG_TX_STATS, *PSEG_TX_STATS;
+
+//
+// Payload callback. Called from a receive worker thread once the last
+// segment of a payload has arrived; the buffer returns to the pool when
+// the callback returns.
+//
+//  pCtx       - HandlerCtx from SEG_RX_CFG
+//  dwSrc      - destID of the sender
+//  wStreamId  - stream id from the segment headers
+//  dwSeq      - payload number within the stream
+//  pData      - payload
+//  dwSize     - payload size in bytes
+//
+typedef VOID (*PFN_SEG_HANDLER)(PVOID pCtx, DWORD dwSrc, USHORT wStreamId, DWORD dwSeq,
+                                PVOID pData, DWORD dwSize);
+
+typedef struct _SEG_RX_CFG {
+    PFN_SEG_HANDLER   Handler;      // NULL = count payloads only
+    PVOID             HandlerCtx;
+    PFN_MSGRX_HANDLER RawHandler;   // messages without a segment header (NULL = count only)
+    PVOID             RawCtx;
+} SEG_RX_CFG, *PSEG_RX_CFG;
+
+typedef struct _SEG_RX_STATS {
+    ULONGLONG Payloads;     // payloads reassembled
+    ULONGLONG Bytes;        // payload bytes reassembled
+    ULONGLONG Segments;     // segments accepted
+    ULONGLONG Duplicates;   // segments received twice
+    ULONGLONG Dropped;      // incomplete payloads evicted or discarded
+    ULONGLONG Bad;          // segments with an inconsistent header
+    ULONGLONG Foreign;      // messages without a segment header
+    DWORD     Active;       // payloads currently being reassembled
+} SEG_RX_STATS, *PSEG_RX_STATS;
+
+typedef struct _SEG_TX *PSEG_TX;
+typedef struct _SEG_RX *PSEG_RX;
+
+/*
+ * tsi721_seg_tx_create()
+ *
+ *  Creates a segmenting sender. It opens its own device handle and
+ *  completion port and allocates Depth message buffers per MBOX, which
+ *  are recycled for all payloads. A sender must be used by one thread
+ *  at a time. With Credits set, it collects the receiver's credit
+ *  doorbells (see tsi721_msg_credit_start()).
+ *
+ * Arguments:
+ *  dwDevNum - Tsi721 device index
+ *  pCfg     - sender configuration
+ *  ppTx     - pointer to variable to save the created sender
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the sender was created, otherwise an error code.
+ */
+DWORD
+tsi721_seg_tx_create(
+    __in  DWORD       dwDevNum,
+    __in  PSEG_TX_CFG pCfg,
+    __out PSEG_TX    *ppTx
+    );
+
+/*
+ * tsi721_seg_tx_destroy()
+ *
+ *  Cancels the segments still in flight and frees the sender.
+ */
+VOID tsi721_seg_tx_destroy(__in PSEG_TX pTx);
+
+/*
+ * tsi721_seg_send()
+ *
+ *  Splits a payload into segments and submits them round robin over the
+ *  selected mailboxes, skipping those without a free buffer or credit.
+ *  The payload is copied into the message buffers, so the caller's buffer
+ *  is free when the call returns; the last segments may still be in
+ *  flight (see tsi721_seg_flush()). Payloads get consecutive sequence
+ *  numbers starting at 0.
+ *
+ * Arguments:
+ *  pTx    - sender
+ *  pData  - payload
+ *  dwSize - payload size, 1...SEG_MAX_SIZE bytes
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if all segments were submitted,
+ *                  otherwise the first error of the sender.
+ */
+DWORD
+tsi721_seg_send(
+    __in PSEG_TX pTx,
+    __in PVOID   pData,
+    __in DWORD   dwSize
+    );
+
+/*
+ * tsi721_seg_flush()
+ *
+ *  Waits until every submitted segment has completed.
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if all segments were sent successfully,
+ *                  otherwise the first error of the sender.
+ */
+DWORD tsi721_seg_flush(__in PSEG_TX pTx);
+
+/*
+ * tsi721_seg_tx_stats()
+ */
+VOID
+tsi721_seg_tx_stats(
+    __in  PSEG_TX       pTx,
+    __out PSEG_TX_STATS pStats
+    );
+
+/*
+ * tsi721_seg_rx_create()
+ *
+ *  Creates a reassembler. It does not receive by itself: pass
+ *  tsi721_seg_rx_msg() as the Handler of a message receive engine with the
+ *  reassembler as HandlerCtx. Payloads are collected in pool buffers; when
+ *  SEG_RX_SLOTS payloads are incomplete, the one idle longest is dropped
+ *  to make room.
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the reassembler was created, otherwise an error code.
+ */
+DWORD
+tsi721_seg_rx_create(
+    __in  PSEG_RX_CFG pCfg,
+    __out PSEG_RX    *ppRx
+    );
+
+/*
+ * tsi721_seg_rx_destroy()
+ *
+ *  Discards incomplete payloads and frees the reassembler. The receive
+ *  engine feeding it must be stopped first.
+ */
+VOID tsi721_seg_rx_destroy(__in PSEG_RX pRx);
+
+/*
+ * tsi721_seg_rx_msg()
+ *
+ *  Message receive engine handler (PFN_MSGRX_HANDLER, pCtx = reassembler).
+ *  May be called by several workers at once.
+ */
+VOID
+tsi721_seg_rx_msg(
+    __in PVOID pCtx,
+    __in DWORD dwMbox,
+    __in DWORD dwSrc,
+    __in PVOID pMsg,
+    __in DWORD dwSize
+    );
+
+/*
+ * tsi721_seg_rx_stats()
+ */
+VOID
+tsi721_seg_rx_stats(
+    __in  PSEG_RX       pRx,
+    __out PSEG_RX_STATS pStats
+    );
+
+#endif // _TSI721SEG_H_
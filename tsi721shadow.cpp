@@ -0,0 +1,481 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721shadow.cpp
+
+Description:
+
+    CSR shadow.
+
+    The shadow is a direct-mapped table keyed by (destID, hop count,
+    offset): a new entry simply replaces the one in its slot, so there is
+    nothing to clean up when entries are dropped. One lock protects the
+    table; it is never held while a request is in progress, and two threads
+    missing on the same register both read it. Every slot carries a
+    generation advanced by writes and invalidation events, so a read that
+    overlapped one of them does not cache what it read.
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tsi721api.h"
+#include "tsi721dev.h"
+#include "tsi721csr.h"
+#include "tsi721trace.h"
+#include "tsi721stat.h"
+#include "tsi721shadow.h"
+
+#define SHADOW_MAX_OVERRIDES    32
+
+typedef struct _SHADOW_ENT {
+    DWORD DestId;
+    DWORD Offset;
+    BYTE  HopCnt;
+    BYTE  Class;
+    BYTE  Valid;
+    DWORD Value;
+    DWORD Gen;          // advanced whenever the slot may become stale
+} SHADOW_ENT, *PSHADOW_ENT;
+
+typedef struct _CSR_SHADOW {
+    HANDLE           hDev;
+    CRITICAL_SECTION Lock;
+    SHADOW_ENT       Ent[SHADOW_SLOTS];
+    struct {
+        DWORD     Offset;
+        CSR_CLASS Class;
+    }                Override[SHADOW_MAX_OVERRIDES];
+    DWORD            OverrideNum;
+    DWORD            PortStat;      // link state bits seen by the last check
+    BOOL             bPortStat;     // PortStat is valid
+    SHADOW_STATS     Stats;
+} CSR_SHADOW;
+
+//
+// Default classes. The capability registers (CARs) are read-only and fixed
+// by the device; the others listed hold configuration that changes only
+// when written or when the device is reset.
+//
+static const struct {
+    DWORD     Offset;
+    CSR_CLASS Class;
+} g_shadowClass[] = {
+    { RIO_DEV_ID_CAR,           CSR_IMMUTABLE },
+    { 0x000004,                 CSR_IMMUTABLE },    // device information CAR
+    { 0x000008,                 CSR_IMMUTABLE },    // assembly identity CAR
+    { RIO_ASM_INFO_CAR,         CSR_IMMUTABLE },
+    { RIO_PE_FEAT,              CSR_IMMUTABLE },
+    { RIO_SWP_INFO_CAR,         CSR_IMMUTABLE },
+    { 0x000018,                 CSR_IMMUTABLE },    // source operations CAR
+    { 0x00001C,                 CSR_IMMUTABLE },    // destination operations CAR
+    { RIO_SR_XADDR,             CSR_STICKY },
+    { RIO_BASE_ID_CSR,          CSR_STICKY },
+    { RIO_HOST_BASE_ID_LOCK,    CSR_STICKY },
+    { RIO_COMPONENT_TAG_CSR,    CSR_STICKY },
+    { RIO_PORT_GEN_CTRL_CSR,    CSR_STICKY },
+    { RIO_SP_CTL2,              CSR_STICKY },
+    { RIO_SP_CTL,               CSR_STICKY },
+    { RIO_SP_RATE_EN,           CSR_STICKY },
+};
+
+static CSR_CLASS
+shadow_class(
+    PCSR_SHADOW pShadow,
+    DWORD       dwOffset
+    )
+{
+    DWORD i;
+
+    for (i = 0; i < pShadow->OverrideNum; i++)
+        if (pShadow->Override[i].Offset == dwOffset)
+            return pShadow->Override[i].Class;
+
+    for (i = 0; i < sizeof(g_shadowClass) / sizeof(g_shadowClass[0]); i++)
+        if (g_shadowClass[i].Offset == dwOffset)
+            return g_shadowClass[i].Class;
+
+    return CSR_VOLATILE;
+}
+
+static PSHADOW_ENT
+shadow_slot(
+    PCSR_SHADOW pShadow,
+    DWORD       dwDestId,
+    DWORD       dwHopCnt,
+    DWORD       dwOffset
+    )
+{
+    DWORD h = (dwOffset >> 2) * 0x9e3779b1 ^ dwDestId * 0x85ebca6b ^ dwHopCnt;
+
+    return &pShadow->Ent[(h ^ (h >> 15)) & (SHADOW_SLOTS - 1)];
+}
+
+static BOOL
+shadow_lookup(
+    PCSR_SHADOW pShadow,
+    DWORD       dwDestId,
+    DWORD       dwHopCnt,
+    DWORD       dwOffset,
+    PDWORD      pValue,
+    PDWORD      pdwGen
+    )
+{
+    PSHADOW_ENT pEnt = shadow_slot(pShadow, dwDestId, dwHopCnt, dwOffset);
+    BOOL        bHit;
+
+    EnterCriticalSection(&pShadow->Lock);
+
+    bHit = pEnt->Valid && pEnt->DestId == dwDestId && pEnt->HopCnt == dwHopCnt &&
+           pEnt->Offset == dwOffset;
+    if (bHit) {
+        *pValue = pEnt->Value;
+        pShadow->Stats.Hits++;
+    }
+    else {
+        *pdwGen = pEnt->Gen;
+        pShadow->Stats.Misses++;
+    }
+
+    LeaveCriticalSection(&pShadow->Lock);
+
+    return bHit;
+}
+
+static VOID
+shadow_fill(
+    PCSR_SHADOW pShadow,
+    DWORD       dwDestId,
+    DWORD       dwHopCnt,
+    DWORD       dwOffset,
+    CSR_CLASS   Class,
+    DWORD       dwValue,
+    DWORD       dwGen
+    )
+/*++
+
+Routine Description:
+
+    Caches a value read from the device. dwGen is the generation of the
+    slot seen by the lookup that missed; if the slot was invalidated since
+    then, the value may predate a write and is not cached.
+
+--*/
+{
+    PSHADOW_ENT pEnt = shadow_slot(pShadow, dwDestId, dwHopCnt, dwOffset);
+
+    EnterCriticalSection(&pShadow->Lock);
+
+    if (pEnt->Gen != dwGen) {
+        LeaveCriticalSection(&pShadow->Lock);
+        return;
+    }
+
+    if (!pEnt->Valid)
+        pShadow->Stats.Entries++;
+
+    pEnt->DestId = dwDestId;
+    pEnt->HopCnt = (BYTE)dwHopCnt;
+    pEnt->Offset = dwOffset;
+    pEnt->Class = (BYTE)Class;
+    pEnt->Value = dwValue;
+    pEnt->Valid = TRUE;
+
+    LeaveCriticalSection(&pShadow->Lock);
+}
+
+static VOID
+shadow_drop(
+    PCSR_SHADOW pShadow,
+    DWORD       dwDestId,
+    DWORD       dwHopCnt,
+    DWORD       dwOffset
+    )
+{
+    PSHADOW_ENT pEnt = shadow_slot(pShadow, dwDestId, dwHopCnt, dwOffset);
+
+    EnterCriticalSection(&pShadow->Lock);
+
+    pShadow->Stats.Writes++;
+    pEnt->Gen++;
+
+    if (pEnt->Valid && pEnt->DestId == dwDestId && pEnt->HopCnt == dwHopCnt &&
+        pEnt->Offset == dwOffset) {
+        pEnt->Valid = FALSE;
+        pShadow->Stats.Entries--;
+        pShadow->Stats.Invalidated++;
+    }
+
+    LeaveCriticalSection(&pShadow->Lock);
+}
+
+DWORD
+tsi721_shadow_create(
+    HANDLE       hDev,
+    PCSR_SHADOW *ppShadow
+    )
+{
+    PCSR_SHADOW pShadow;
+
+    if (ppShadow == NULL)
+        return ERROR_INVALID_PARAMETER;
+
+    pShadow = (PCSR_SHADOW)calloc(1, sizeof(CSR_SHADOW));
+    if (pShadow == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    pShadow->hDev = hDev;
+    InitializeCriticalSection(&pShadow->Lock);
+
+    *ppShadow = pShadow;
+    return ERROR_SUCCESS;
+}
+
+VOID
+tsi721_shadow_destroy(
+    PCSR_SHADOW pShadow
+    )
+{
+    if (pShadow == NULL)
+        return;
+
+    DeleteCriticalSection(&pShadow->Lock);
+    free(pShadow);
+}
+
+VOID
+tsi721_shadow_set_class(
+    PCSR_SHADOW pShadow,
+    DWORD       dwOffset,
+    CSR_CLASS   Class
+    )
+{
+    DWORD i;
+
+    EnterCriticalSection(&pShadow->Lock);
+
+    for (i = 0; i < pShadow->OverrideNum && pShadow->Override[i].Offset != dwOffset; i++)
+        ;
+
+    if (i < SHADOW_MAX_OVERRIDES) {
+        pShadow->Override[i].Offset = dwOffset;
+        pShadow->Override[i].Class = Class;
+        if (i == pShadow->OverrideNum)
+            pShadow->OverrideNum++;
+    }
+
+    //
+    // Entries cached under the old class would outlive events that now
+    // invalidate them
+    //
+    for (i = 0; i < SHADOW_SLOTS; i++) {
+        pShadow->Ent[i].Gen++;
+        if (pShadow->Ent[i].Valid && pShadow->Ent[i].Offset == dwOffset) {
+            pShadow->Ent[i].Valid = FALSE;
+            pShadow->Stats.Entries--;
+            pShadow->Stats.Invalidated++;
+        }
+    }
+
+    LeaveCriticalSection(&pShadow->Lock);
+}
+
+DWORD
+tsi721_shadow_maint_read(
+    PCSR_SHADOW pShadow,
+    DWORD       dwDestId,
+    DWORD       dwHopCnt,
+    DWORD       dwOffset,
+    PDWORD      pValue
+    )
+{
+    CSR_CLASS cls = shadow_class(pShadow, dwOffset);
+    ULONGLONG t0;
+    DWORD     dwErr, dwGen = 0;
+
+    if (cls == CSR_VOLATILE)
+        InterlockedIncrement64((LONGLONG volatile *)&pShadow->Stats.Volatile);
+    else if (shadow_lookup(pShadow, dwDestId, dwHopCnt, dwOffset, pValue, &dwGen))
+        return ERROR_SUCCESS;
+
+    t0 = lat_ticks();
+    dwErr = g_devOps->SrioMaintRead(pShadow->hDev, dwDestId, dwHopCnt, dwOffset, pValue);
+    tsi721_trace(TRACE_EV_MAINT_READ, dwErr, dwDestId, dwOffset, *pValue, t0);
+
+    if (dwErr == ERROR_SUCCESS && cls != CSR_VOLATILE)
+        shadow_fill(pShadow, dwDestId, dwHopCnt, dwOffset, cls, *pValue, dwGen);
+
+    return dwErr;
+}
+
+DWORD
+tsi721_shadow_maint_write(
+    PCSR_SHADOW pShadow,
+    DWORD       dwDestId,
+    DWORD       dwHopCnt,
+    DWORD       dwOffset,
+    DWORD       dwValue
+    )
+{
+    ULONGLONG t0;
+    DWORD     dwErr;
+
+    t0 = lat_ticks();
+    dwErr = g_devOps->SrioMaintWrite(pShadow->hDev, dwDestId, dwHopCnt, dwOffset, dwValue);
+    tsi721_trace(TRACE_EV_MAINT_WRITE, dwErr, dwDestId, dwOffset, dwValue, t0);
+
+    //
+    // Read-only and write-1-to-clear bits make the written value a poor
+    // guess of what a read returns, so the entry is dropped, not updated.
+    // Dropping after the write also stops a read that raced with it from
+    // caching the old value.
+    //
+    shadow_drop(pShadow, dwDestId, dwHopCnt, dwOffset);
+
+    return dwErr;
+}
+
+DWORD
+tsi721_shadow_reg_read(
+    PCSR_SHADOW pShadow,
+    DWORD       dwOffset,
+    PDWORD      pValue
+    )
+{
+    CSR_CLASS cls = shadow_class(pShadow, dwOffset);
+    DWORD     dwErr, dwGen = 0;
+
+    if (cls == CSR_VOLATILE)
+        InterlockedIncrement64((LONGLONG volatile *)&pShadow->Stats.Volatile);
+    else if (shadow_lookup(pShadow, SHADOW_LOCAL, 0, dwOffset, pValue, &dwGen))
+        return ERROR_SUCCESS;
+
+    dwErr = tsi721_csr_read(pShadow->hDev, dwOffset, pValue);
+
+    if (dwErr == ERROR_SUCCESS && cls != CSR_VOLATILE)
+        shadow_fill(pShadow, SHADOW_LOCAL, 0, dwOffset, cls, *pValue, dwGen);
+
+    return dwErr;
+}
+
+DWORD
+tsi721_shadow_reg_write(
+    PCSR_SHADOW pShadow,
+    DWORD       dwOffset,
+    DWORD       dwValue
+    )
+{
+    DWORD dwErr;
+
+    dwErr = g_devOps->RegisterWrite(pShadow->hDev, dwOffset, dwValue);
+    tsi721_trace(TRACE_EV_REG_WRITE, dwErr, 0, dwOffset, dwValue, 0);
+
+    shadow_drop(pShadow, SHADOW_LOCAL, 0, dwOffset);
+
+    return dwErr;
+}
+
+VOID
+tsi721_shadow_port_write(
+    PCSR_SHADOW pShadow,
+    DWORD       dwSrcDestId
+    )
+{
+    PSHADOW_ENT pEnt;
+    DWORD       i;
+
+    EnterCriticalSection(&pShadow->Lock);
+
+    pShadow->Stats.PortWrites++;
+
+    for (i = 0; i < SHADOW_SLOTS; i++) {
+        pEnt = &pShadow->Ent[i];
+        pEnt->Gen++;
+        if (pEnt->Valid && pEnt->DestId == dwSrcDestId && pEnt->Class == CSR_STICKY) {
+            pEnt->Valid = FALSE;
+            pShadow->Stats.Entries--;
+            pShadow->Stats.Invalidated++;
+        }
+    }
+
+    LeaveCriticalSection(&pShadow->Lock);
+}
+
+VOID
+tsi721_shadow_link_event(
+    PCSR_SHADOW pShadow
+    )
+{
+    PSHADOW_ENT pEnt;
+    DWORD       i;
+
+    EnterCriticalSection(&pShadow->Lock);
+
+    pShadow->Stats.LinkEvents++;
+
+    for (i = 0; i < SHADOW_SLOTS; i++) {
+        pEnt = &pShadow->Ent[i];
+        pEnt->Gen++;
+        if (pEnt->Valid && (pEnt->DestId != SHADOW_LOCAL || pEnt->Class == CSR_STICKY)) {
+            pEnt->Valid = FALSE;
+            pShadow->Stats.Entries--;
+            pShadow->Stats.Invalidated++;
+        }
+    }
+
+    LeaveCriticalSection(&pShadow->Lock);
+}
+
+DWORD
+tsi721_shadow_link_check(
+    PCSR_SHADOW pShadow
+    )
+/*++
+
+Routine Description:
+
+    Compares the PORT_OK and error-stopped bits of the local port with the
+    previous check. The first check only records the state.
+
+--*/
+{
+    DWORD stat, dwErr;
+    BOOL  bChanged;
+
+    dwErr = tsi721_csr_read(pShadow->hDev, RIO_PORT_N_ERR_STAT_CSR, &stat);
+    if (dwErr != ERROR_SUCCESS)
+        return dwErr;
+
+    stat &= RIO_PORT_N_ERR_STAT_PORT_OK | RIO_PORT_N_ERR_STAT_STOPPED;
+
+    EnterCriticalSection(&pShadow->Lock);
+    bChanged = pShadow->bPortStat && stat != pShadow->PortStat;
+    pShadow->PortStat = stat;
+    pShadow->bPortStat = TRUE;
+    LeaveCriticalSection(&pShadow->Lock);
+
+    if (bChanged)
+        tsi721_shadow_link_event(pShadow);
+
+    return ERROR_SUCCESS;
+}
+
+VOID
+tsi721_shadow_stats(
+    PCSR_SHADOW   pShadow,
+    PSHADOW_STATS pStats
+    )
+{
+    EnterCriticalSection(&pShadow->Lock);
+    *pStats = pShadow->Stats;
+    LeaveCriticalSection(&pShadow->Lock);
+}
@@ -0,0 +1,167 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721shadow.h
+
+Description:
+
+    CSR shadow: serves reads of registers that do not change from memory
+    instead of issuing maintenance requests or register IOCTLs.
+
+--*/
+
+#ifndef _TSI721SHADOW_H_
+#define _TSI721SHADOW_H_
+
+#define SHADOW_SLOTS        1024        // cached registers, power of two
+#define SHADOW_LOCAL        0xffffffff  // destID of the local Tsi721 CSR space
+
+typedef enum _CSR_CLASS {
+    CSR_VOLATILE = 0,   // status and counters: always read
+    CSR_STICKY,         // configuration: cached until written, a port-write or a link event
+    CSR_IMMUTABLE,      // capability registers: cached until the device may have been replaced
+    CSR_CLASS_NUM
+} CSR_CLASS;
+
+typedef struct _SHADOW_STATS {
+    ULONGLONG Hits;         // reads served from memory
+    ULONGLONG Misses;       // cacheable reads sent to the device
+    ULONGLONG Volatile;     // reads of volatile registers (never cached)
+    ULONGLONG Writes;       // writes (always sent to the device)
+    ULONGLONG Invalidated;  // entries dropped by writes and events
+    ULONGLONG LinkEvents;
+    ULONGLONG PortWrites;
+    DWORD     Entries;      // entries currently cached
+} SHADOW_STATS, *PSHADOW_STATS;
+
+typedef struct _CSR_SHADOW *PCSR_SHADOW;
+
+/*
+ * tsi721_shadow_create()
+ *
+ *  Creates an empty shadow of the registers accessed through a device
+ *  handle. The shadow may be used by several threads.
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the shadow was created, otherwise an error code.
+ */
+DWORD
+tsi721_shadow_create(
+    __in  HANDLE       hDev,
+    __out PCSR_SHADOW *ppShadow
+    );
+
+/*
+ * tsi721_shadow_destroy()
+ */
+VOID tsi721_shadow_destroy(__in PCSR_SHADOW pShadow);
+
+/*
+ * tsi721_shadow_set_class()
+ *
+ *  Overrides the class of a register offset. The RapidIO capability
+ *  registers are immutable, the base destID, lock, component tag and port
+ *  control registers sticky and all others volatile by default.
+ */
+VOID
+tsi721_shadow_set_class(
+    __in PCSR_SHADOW pShadow,
+    __in DWORD       dwOffset,
+    __in CSR_CLASS   Class
+    );
+
+/*
+ * tsi721_shadow_maint_read()/tsi721_shadow_maint_write()
+ *
+ *  Maintenance read and write of the register at (destID, hop count,
+ *  offset). A cached value is returned without a request; a write is always
+ *  sent and drops the cached value.
+ */
+DWORD
+tsi721_shadow_maint_read(
+    __in  PCSR_SHADOW pShadow,
+    __in  DWORD       dwDestId,
+    __in  DWORD       dwHopCnt,
+    __in  DWORD       dwOffset,
+    __out PDWORD      pValue
+    );
+
+DWORD
+tsi721_shadow_maint_write(
+    __in PCSR_SHADOW pShadow,
+    __in DWORD       dwDestId,
+    __in DWORD       dwHopCnt,
+    __in DWORD       dwOffset,
+    __in DWORD       dwValue
+    );
+
+/*
+ * tsi721_shadow_reg_read()/tsi721_shadow_reg_write()
+ *
+ *  Same for the local Tsi721 registers (cached under SHADOW_LOCAL).
+ */
+DWORD
+tsi721_shadow_reg_read(
+    __in  PCSR_SHADOW pShadow,
+    __in  DWORD       dwOffset,
+    __out PDWORD      pValue
+    );
+
+DWORD
+tsi721_shadow_reg_write(
+    __in PCSR_SHADOW pShadow,
+    __in DWORD       dwOffset,
+    __in DWORD       dwValue
+    );
+
+/*
+ * tsi721_shadow_port_write()
+ *
+ *  Reports a port-write received from a device: its sticky registers are
+ *  dropped, at any hop count.
+ */
+VOID
+tsi721_shadow_port_write(
+    __in PCSR_SHADOW pShadow,
+    __in DWORD       dwSrcDestId
+    );
+
+/*
+ * tsi721_shadow_link_event()
+ *
+ *  Reports that the link of the local port went down or was retrained.
+ *  All remote registers are dropped (the partner may have been replaced)
+ *  along with the local sticky ones.
+ */
+VOID tsi721_shadow_link_event(__in PCSR_SHADOW pShadow);
+
+/*
+ * tsi721_shadow_link_check()
+ *
+ *  Reads the local port status (a register IOCTL, no maintenance request)
+ *  and reports a link event if the port's state has changed since the
+ *  last check. A link that went down and up again between two checks is
+ *  not noticed.
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the status was read, otherwise an error code.
+ */
+DWORD tsi721_shadow_link_check(__in PCSR_SHADOW pShadow);
+
+/*
+ * tsi721_shadow_stats()
+ */
+VOID
+tsi721_shadow_stats(
+    __in  PCSR_SHADOW   pShadow,
+    __out PSHADOW_STATS pStats
+    );
+
+#endif // _TSI721SHADOW_H_
@@ -0,0 +1,195 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721stat.cpp
+
+Description:
+
+    High-resolution timestamps and log-linear latency histograms.
+
+--*/
+
+#include <windows.h>
+
+#include "tsi721stat.h"
+
+static ULONGLONG g_qpcFreq = 0;
+
+ULONGLONG
+lat_ticks(
+    VOID
+    )
+{
+    LARGE_INTEGER t;
+
+    QueryPerformanceCounter(&t);
+    return (ULONGLONG)t.QuadPart;
+}
+
+ULONGLONG
+lat_ticks_to_ns(
+    ULONGLONG ticks
+    )
+{
+    if (g_qpcFreq == 0) {
+        LARGE_INTEGER f;
+
+        QueryPerformanceFrequency(&f);
+        g_qpcFreq = (ULONGLONG)f.QuadPart;
+    }
+
+    // Split to avoid overflow of ticks * 10^9
+    return (ticks / g_qpcFreq) * 1000000000ULL +
+           ((ticks % g_qpcFreq) * 1000000000ULL) / g_qpcFreq;
+}
+
+static DWORD
+lat_hist_index(
+    ULONGLONG value
+    )
+{
+    DWORD msb = 0;
+
+    if (value < LAT_HIST_SUB)
+        return (DWORD)value;
+
+    while ((value >> msb) > 1)
+        msb++;
+
+    // value >> (msb - SUB_BITS) is in [SUB, 2*SUB)
+    return LAT_HIST_SUB + (msb - LAT_HIST_SUB_BITS) * LAT_HIST_SUB +
+           (DWORD)((value >> (msb - LAT_HIST_SUB_BITS)) - LAT_HIST_SUB);
+}
+
+static ULONGLONG
+lat_hist_value(
+    DWORD index
+    )
+{
+    DWORD     shift, sub;
+    ULONGLONG low;
+
+    if (index < LAT_HIST_SUB)
+        return index;
+
+    shift = (index - LAT_HIST_SUB) / LAT_HIST_SUB;
+    sub = (index - LAT_HIST_SUB) % LAT_HIST_SUB;
+    low = (ULONGLONG)(LAT_HIST_SUB + sub) << shift;
+
+    // middle of the bucket
+    return low + (((ULONGLONG)1 << shift) >> 1);
+}
+
+VOID
+lat_hist_init(
+    PLAT_HIST pHist
+    )
+{
+    ZeroMemory(pHist, sizeof(LAT_HIST));
+    pHist->Min = ~0ULL;
+}
+
+VOID
+lat_hist_add(
+    PLAT_HIST pHist,
+    ULONGLONG value
+    )
+{
+    pHist->Bucket[lat_hist_index(value)]++;
+    pHist->Count++;
+    pHist->Sum += value;
+
+    if (value < pHist->Min)
+        pHist->Min = value;
+    if (value > pHist->Max)
+        pHist->Max = value;
+}
+
+VOID
+lat_hist_merge(
+    PLAT_HIST pDst,
+    PLAT_HIST pSrc
+    )
+{
+    DWORD i;
+
+    if (pSrc->Count == 0)
+        return;
+
+    for (i = 0; i < LAT_HIST_BUCKETS; i++)
+        pDst->Bucket[i] += pSrc->Bucket[i];
+
+    pDst->Count += pSrc->Count;
+    pDst->Sum += pSrc->Sum;
+
+    if (pSrc->Min < pDst->Min)
+        pDst->Min = pSrc->Min;
+    if (pSrc->Max > pDst->Max)
+        pDst->Max = pSrc->Max;
+}
+
+ULONGLONG
+lat_hist_percentile(
+    PLAT_HIST pHist,
+    double    pct
+    )
+/*++
+
+Routine Description:
+
+    Walks the buckets until the cumulative count reaches the requested rank.
+    The result is clamped to the exact recorded minimum and maximum.
+
+Arguments:
+
+    pHist - histogram
+    pct   - percentile (0.0 - 100.0)
+
+Return Value:
+
+    Value at the requested percentile.
+
+--*/
+{
+    ULONGLONG rank, sum = 0, value;
+    DWORD     i;
+
+    if (pHist->Count == 0)
+        return 0;
+
+    rank = (ULONGLONG)(pct / 100.0 * (double)pHist->Count + 0.5);
+    if (rank == 0)
+        rank = 1;
+    if (rank > pHist->Count)
+        rank = pHist->Count;
+
+    for (i = 0; i < LAT_HIST_BUCKETS; i++) {
+        sum += pHist->Bucket[i];
+        if (sum >= rank)
+            break;
+    }
+
+    value = lat_hist_value(i);
+
+    if (value < pHist->Min)
+        value = pHist->Min;
+    if (value > pHist->Max)
+        value = pHist->Max;
+
+    return value;
+}
+
+double
+lat_hist_mean(
+    PLAT_HIST pHist
+    )
+{
+    return pHist->Count ? (double)pHist->Sum / (double)pHist->Count : 0.0;
+}
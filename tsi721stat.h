@@ -0,0 +1,80 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721stat.h
+
+Description:
+
+    High-resolution timestamps and constant-size latency histograms used by
+    the benchmark modes.
+
+--*/
+
+#ifndef _TSI721STAT_H_
+#define _TSI721STAT_H_
+
+//
+// Log-linear histogram: values below LAT_HIST_SUB are counted exactly, every
+// following power of two is split into LAT_HIST_SUB buckets (relative error
+// of a reported percentile is below 1/LAT_HIST_SUB).
+//
+#define LAT_HIST_SUB_BITS   6
+#define LAT_HIST_SUB        (1 << LAT_HIST_SUB_BITS)
+#define LAT_HIST_BUCKETS    (LAT_HIST_SUB + (64 - LAT_HIST_SUB_BITS) * LAT_HIST_SUB)
+
+typedef struct _LAT_HIST {
+    ULONGLONG Count;
+    ULONGLONG Sum;
+    ULONGLONG Min;
+    ULONGLONG Max;
+    ULONGLONG Bucket[LAT_HIST_BUCKETS];
+} LAT_HIST, *PLAT_HIST;
+
+/*
+ * lat_ticks()
+ *
+ *  Returns current value of the high-resolution performance counter.
+ */
+ULONGLONG lat_ticks(VOID);
+
+/*
+ * lat_ticks_to_ns()
+ *
+ *  Converts a performance counter interval into nanoseconds.
+ */
+ULONGLONG lat_ticks_to_ns(__in ULONGLONG ticks);
+
+/*
+ * lat_hist_init()/lat_hist_add()/lat_hist_merge()
+ *
+ *  Resets a histogram, records one value, adds all values of another histogram.
+ */
+VOID lat_hist_init(__out PLAT_HIST pHist);
+VOID lat_hist_add(__inout PLAT_HIST pHist, __in ULONGLONG value);
+VOID lat_hist_merge(__inout PLAT_HIST pDst, __in PLAT_HIST pSrc);
+
+/*
+ * lat_hist_percentile()
+ *
+ *  Returns the value below which the given percentage (0.0 - 100.0) of
+ *  recorded values fall. Returns 0 for an empty histogram.
+ */
+ULONGLONG
+lat_hist_percentile(
+    __in PLAT_HIST pHist,
+    __in double    pct
+    );
+
+/*
+ * lat_hist_mean()
+ */
+double lat_hist_mean(__in PLAT_HIST pHist);
+
+#endif // _TSI721STAT_H_
@@ -0,0 +1,472 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721stream.cpp
+
+Description:
+
+    Pipelined chunked large-transfer mode.
+
+    The payload is split into chunks which travel through a ring of slots.
+    Each slot holds an outbound (generated) and an inbound (read back) buffer
+    and passes three stages:
+
+      generator thread -> transfer (caller thread, BDMA engine) -> verifier thread
+
+    Stages work on different slots at the same time, so pattern generation,
+    the wire transfer and verification overlap. Chunks are written into the
+    target inbound window in a circular way; the number of slots never
+    exceeds the number of chunks the window holds, so chunks in flight never
+    share a window region.
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <process.h>
+
+#include "tsi721api.h"
+#include "tsi721dma.h"
+#include "tsi721stream.h"
+#include "tsi721pattern.h"
+#include "tsi721pool.h"
+
+typedef struct _STREAM_SLOT {
+    PUCHAR    ObBuf;        // generated data
+    PUCHAR    IbBuf;        // data read back from the target
+    ULONGLONG Offset;       // payload offset of the chunk in this slot
+    DWORD     Size;         // chunk size
+    DWORD     WinOffset;    // offset of the chunk in the target window
+    DWORD     Status;       // transfer status
+    HANDLE    hDone;        // transfer of the chunk finished
+    DMA_REQ   Req;
+} STREAM_SLOT, *PSTREAM_SLOT;
+
+typedef struct _STREAM_CTX {
+    PSTREAM_CFG   Cfg;
+    DWORD         SlotNum;
+    DWORD         ChunkSize;
+    ULONGLONG     ChunkNum;
+    STREAM_SLOT   Slot[STREAM_MAX_SLOTS];
+    HANDLE        hFree;    // semaphore: slots available to the generator
+    HANDLE        hFilled;  // semaphore: slots ready for transfer
+    HANDLE        hAbort;   // manual-reset event: stop all stages
+    ULONGLONG     BadChunks;
+    LONGLONG      GenTicks;
+    LONGLONG      VerifyTicks;
+    DWORD         VerifyStatus;
+} STREAM_CTX, *PSTREAM_CTX;
+
+static unsigned __stdcall stream_gen_thread(PVOID params);
+static unsigned __stdcall stream_verify_thread(PVOID params);
+
+static LONGLONG
+stream_ticks(VOID)
+{
+    LARGE_INTEGER t;
+
+    QueryPerformanceCounter(&t);
+    return t.QuadPart;
+}
+
+static VOID
+stream_fill(
+    PSTREAM_CTX  pCtx,
+    PSTREAM_SLOT pSlot
+    )
+{
+    tsi721_pattern_fill(pSlot->ObBuf, pSlot->Size, pCtx->Cfg->Seed, pSlot->Offset);
+}
+
+DWORD
+tsi721_stream_run(
+    PDMA_ENGINE   pEng,
+    PSTREAM_CFG   pCfg,
+    PSTREAM_STATS pStats
+    )
+/*++
+
+Routine Description:
+
+    Runs the streaming pipeline. The calling thread acts as the transfer
+    stage: it submits writes for generated chunks, chains a read back when
+    verification is enabled and signals chunk completion to the verifier.
+
+Arguments:
+
+    pEng   - BDMA transfer engine
+    pCfg   - stream configuration
+    pStats - pointer to structure receiving results
+
+Return Value:
+
+    ERROR_SUCCESS, ERROR_CRC or an error code.
+
+--*/
+{
+    STREAM_CTX ctx;
+    HANDLE     hThread[2] = { NULL, NULL };
+    HANDLE     hWait[2];
+    PDMA_REQ   done[DMA_ENG_MAX_BATCH];
+    PSTREAM_SLOT retry[STREAM_MAX_SLOTS]; // read backs refused by full queues
+    DWORD      dwRetryNum = 0;
+    ULONGLONG  xfer = 0;        // next chunk to submit
+    DWORD      dwInFlight = 0;
+    DWORD      dwErr, dwStatus = ERROR_SUCCESS;
+    DWORD      dwCount, i;
+    LARGE_INTEGER freq;
+    LONGLONG   tStart, tEnd, tReport;
+    ULONGLONG  reported = 0;
+
+    if (pEng == NULL || pCfg == NULL || pStats == NULL || pCfg->TotalBytes == 0)
+        return ERROR_INVALID_PARAMETER;
+
+    ZeroMemory(pStats, sizeof(STREAM_STATS));
+    ZeroMemory(&ctx, sizeof(ctx));
+    ctx.Cfg = pCfg;
+    ctx.ChunkSize = pCfg->ChunkSize ? pCfg->ChunkSize : STREAM_DEF_CHUNK;
+
+    if (ctx.ChunkSize > pCfg->WinSize)
+        ctx.ChunkSize = pCfg->WinSize;
+
+    ctx.SlotNum = pCfg->WinSize / ctx.ChunkSize;
+    if (pCfg->SlotNum && pCfg->SlotNum < ctx.SlotNum)
+        ctx.SlotNum = pCfg->SlotNum;
+    if (ctx.SlotNum > STREAM_MAX_SLOTS)
+        ctx.SlotNum = STREAM_MAX_SLOTS;
+
+    if (ctx.SlotNum < STREAM_MIN_SLOTS) {
+        printf_s("STREAM: window of %d bytes holds less than %d chunks of %d bytes\n",
+                 pCfg->WinSize, STREAM_MIN_SLOTS, ctx.ChunkSize);
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    ctx.ChunkNum = (pCfg->TotalBytes + ctx.ChunkSize - 1) / ctx.ChunkSize;
+
+    ctx.hFree = CreateSemaphore(NULL, ctx.SlotNum, ctx.SlotNum, NULL);
+    ctx.hFilled = CreateSemaphore(NULL, 0, ctx.SlotNum, NULL);
+    ctx.hAbort = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (ctx.hFree == NULL || ctx.hFilled == NULL || ctx.hAbort == NULL) {
+        dwStatus = GetLastError();
+        goto exit;
+    }
+
+    for (i = 0; i < ctx.SlotNum; i++) {
+        PSTREAM_SLOT pSlot = &ctx.Slot[i];
+
+        pSlot->ObBuf = (PUCHAR)tsi721_pool_alloc(ctx.ChunkSize);
+        pSlot->IbBuf = (PUCHAR)tsi721_pool_alloc(ctx.ChunkSize);
+        pSlot->hDone = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if (pSlot->ObBuf == NULL || pSlot->IbBuf == NULL || pSlot->hDone == NULL) {
+            printf_s("STREAM: Unable to allocate chunk buffers\n");
+            dwStatus = ERROR_NOT_ENOUGH_MEMORY;
+            goto exit;
+        }
+    }
+
+    QueryPerformanceFrequency(&freq);
+    tStart = stream_ticks();
+    tReport = tStart;
+
+    hThread[0] = (HANDLE)_beginthreadex(NULL, 0, stream_gen_thread, &ctx, 0, NULL);
+    hThread[1] = (HANDLE)_beginthreadex(NULL, 0, stream_verify_thread, &ctx, 0, NULL);
+    if (hThread[0] == NULL || hThread[1] == NULL) {
+        dwStatus = GetLastError();
+        SetEvent(ctx.hAbort);
+        goto join;
+    }
+
+    hWait[0] = ctx.hFilled;
+    hWait[1] = ctx.hAbort;
+
+    while (xfer < ctx.ChunkNum || dwInFlight) {
+
+        //
+        // Read backs of chunks already written go first
+        //
+        while (dwRetryNum) {
+            PSTREAM_SLOT pSlot = retry[dwRetryNum - 1];
+
+            dwErr = tsi721_dma_submit(pEng, &pSlot->Req);
+            if (dwErr == ERROR_BUSY)
+                break;
+
+            dwRetryNum--;
+            if (dwErr != ERROR_IO_PENDING) {
+                pSlot->Status = dwErr;
+                if (dwStatus == ERROR_SUCCESS)
+                    dwStatus = dwErr;
+                dwInFlight--;
+                SetEvent(pSlot->hDone);
+            }
+        }
+
+        //
+        // Submit every chunk the generator has finished, wait for one only
+        // if nothing is in flight.
+        //
+        while (xfer < ctx.ChunkNum && dwStatus == ERROR_SUCCESS && dwRetryNum == 0) {
+            PSTREAM_SLOT pSlot = &ctx.Slot[xfer % ctx.SlotNum];
+            DWORD dwRet;
+
+            dwRet = WaitForMultipleObjects(2, hWait, FALSE, dwInFlight ? 0 : INFINITE);
+            if (dwRet != WAIT_OBJECT_0) {
+                if (dwRet != WAIT_TIMEOUT)
+                    dwStatus = ERROR_OPERATION_ABORTED;
+                break;
+            }
+
+            pSlot->Req.Dir = DMA_DIR_WRITE;
+            pSlot->Req.DestId = pCfg->DestId;
+            pSlot->Req.AddrHi = pCfg->WinAddrHi;
+            pSlot->Req.AddrLo = pCfg->WinAddrLo + pSlot->WinOffset;
+            pSlot->Req.Buffer = pSlot->ObBuf;
+            pSlot->Req.Size = pSlot->Size;
+            pSlot->Req.Ctrl.dword = 0;
+            pSlot->Req.Ctrl.bits.Rtype = LAST_NWRITE_R;
+            pSlot->Req.Context = (ULONG_PTR)pSlot;
+
+            dwErr = tsi721_dma_submit(pEng, &pSlot->Req);
+            if (dwErr == ERROR_BUSY) {
+                // Queues are full, give the slot back and retry after reaping
+                ReleaseSemaphore(ctx.hFilled, 1, NULL);
+                break;
+            }
+            if (dwErr != ERROR_IO_PENDING) {
+                dwStatus = dwErr;
+                break;
+            }
+
+            dwInFlight++;
+            xfer++;
+        }
+
+        if (dwStatus != ERROR_SUCCESS) {
+            SetEvent(ctx.hAbort);
+            xfer = ctx.ChunkNum; // stop issuing, drain what is in flight
+        }
+
+        if (dwInFlight == 0)
+            break;
+
+        if (dwRetryNum == dwInFlight)
+            continue; // nothing queued in the engine yet
+
+        dwErr = tsi721_dma_complete(pEng, done, DMA_ENG_MAX_BATCH, INFINITE, &dwCount);
+        if (dwErr != ERROR_SUCCESS) {
+            dwStatus = dwErr;
+            SetEvent(ctx.hAbort);
+            break;
+        }
+
+        for (i = 0; i < dwCount; i++) {
+            PSTREAM_SLOT pSlot = (PSTREAM_SLOT)done[i]->Context;
+
+            if (pSlot->Req.Status == ERROR_SUCCESS && pSlot->Req.Dir == DMA_DIR_WRITE &&
+                pCfg->bVerify) {
+                //
+                // Chain the read back of the chunk just written
+                //
+                pSlot->Req.Dir = DMA_DIR_READ;
+                pSlot->Req.Buffer = pSlot->IbBuf;
+                pSlot->Req.Size = pSlot->Size;
+                pSlot->Req.Ctrl.bits.Rtype = NREAD;
+
+                dwErr = tsi721_dma_submit(pEng, &pSlot->Req);
+                if (dwErr == ERROR_IO_PENDING)
+                    continue;
+
+                if (dwErr == ERROR_BUSY) {
+                    retry[dwRetryNum++] = pSlot;
+                    continue;
+                }
+
+                pSlot->Req.Status = dwErr;
+            }
+
+            if (pSlot->Req.Status != ERROR_SUCCESS && dwStatus == ERROR_SUCCESS) {
+                printf_s("STREAM: %s of chunk at 0x%llx failed, err = 0x%x\n",
+                         pSlot->Req.Dir == DMA_DIR_WRITE ? "write" : "read back",
+                         pSlot->Offset, pSlot->Req.Status);
+                dwStatus = pSlot->Req.Status;
+            }
+
+            pSlot->Status = pSlot->Req.Status;
+            dwInFlight--;
+            SetEvent(pSlot->hDone);
+        }
+
+        if (pCfg->bProgress) {
+            LONGLONG tNow = stream_ticks();
+
+            if (tNow - tReport >= freq.QuadPart) {
+                ULONGLONG sent = xfer * ctx.ChunkSize;
+
+                printf_s("STREAM: %llu MB, %.1f MB/s\n", sent >> 20,
+                         (double)(sent - reported) / (1024.0 * 1024.0) /
+                         ((double)(tNow - tReport) / freq.QuadPart));
+                reported = sent;
+                tReport = tNow;
+            }
+        }
+    }
+
+join:
+
+    WaitForMultipleObjects(2, hThread, TRUE, INFINITE);
+    tEnd = stream_ticks();
+
+    if (dwStatus == ERROR_SUCCESS && ctx.VerifyStatus != ERROR_SUCCESS)
+        dwStatus = ctx.VerifyStatus;
+
+    pStats->Chunks = ctx.ChunkNum;
+    pStats->Bytes = pCfg->TotalBytes;
+    pStats->BadChunks = ctx.BadChunks;
+    pStats->Seconds = (double)(tEnd - tStart) / freq.QuadPart;
+    pStats->GenSeconds = (double)ctx.GenTicks / freq.QuadPart;
+    pStats->VerifySeconds = (double)ctx.VerifyTicks / freq.QuadPart;
+    if (pStats->Seconds > 0)
+        pStats->MBps = (double)pStats->Bytes / (1024.0 * 1024.0) / pStats->Seconds;
+
+exit:
+
+    for (i = 0; i < 2; i++) {
+        if (hThread[i])
+            CloseHandle(hThread[i]);
+    }
+
+    for (i = 0; i < ctx.SlotNum; i++) {
+        tsi721_pool_free(ctx.Slot[i].ObBuf);
+        tsi721_pool_free(ctx.Slot[i].IbBuf);
+        if (ctx.Slot[i].hDone)
+            CloseHandle(ctx.Slot[i].hDone);
+    }
+
+    if (ctx.hFree)
+        CloseHandle(ctx.hFree);
+    if (ctx.hFilled)
+        CloseHandle(ctx.hFilled);
+    if (ctx.hAbort)
+        CloseHandle(ctx.hAbort);
+
+    return dwStatus;
+}
+
+static unsigned __stdcall
+stream_gen_thread(
+    PVOID params
+    )
+/*++
+
+Routine Description:
+
+    Generator stage: fills free slots with the pattern for consecutive chunks.
+
+Arguments:
+
+    params - pointer to stream context
+
+Return Value:
+
+    0
+
+--*/
+{
+    PSTREAM_CTX pCtx = (PSTREAM_CTX)params;
+    HANDLE      hWait[2];
+    ULONGLONG   gen;
+    DWORD       dwWinChunks = pCtx->Cfg->WinSize / pCtx->ChunkSize;
+
+    hWait[0] = pCtx->hFree;
+    hWait[1] = pCtx->hAbort;
+
+    for (gen = 0; gen < pCtx->ChunkNum; gen++) {
+        PSTREAM_SLOT pSlot = &pCtx->Slot[gen % pCtx->SlotNum];
+        LONGLONG     t0;
+
+        if (WaitForMultipleObjects(2, hWait, FALSE, INFINITE) != WAIT_OBJECT_0)
+            break;
+
+        t0 = stream_ticks();
+
+        pSlot->Offset = gen * pCtx->ChunkSize;
+        pSlot->Size = (DWORD)min((ULONGLONG)pCtx->ChunkSize,
+                                 pCtx->Cfg->TotalBytes - pSlot->Offset);
+        pSlot->WinOffset = (DWORD)(gen % dwWinChunks) * pCtx->ChunkSize;
+        stream_fill(pCtx, pSlot);
+
+        pCtx->GenTicks += stream_ticks() - t0;
+
+        ReleaseSemaphore(pCtx->hFilled, 1, NULL);
+    }
+
+    return 0;
+}
+
+static unsigned __stdcall
+stream_verify_thread(
+    PVOID params
+    )
+/*++
+
+Routine Description:
+
+    Verifier stage: waits for chunks in payload order, checks read back data
+    and returns slots to the generator.
+
+Arguments:
+
+    params - pointer to stream context
+
+Return Value:
+
+    0
+
+--*/
+{
+    PSTREAM_CTX pCtx = (PSTREAM_CTX)params;
+    HANDLE      hWait[2];
+    ULONGLONG   ver;
+
+    hWait[1] = pCtx->hAbort;
+
+    for (ver = 0; ver < pCtx->ChunkNum; ver++) {
+        PSTREAM_SLOT pSlot = &pCtx->Slot[ver % pCtx->SlotNum];
+
+        hWait[0] = pSlot->hDone;
+        if (WaitForMultipleObjects(2, hWait, FALSE, INFINITE) != WAIT_OBJECT_0)
+            break;
+
+        if (pSlot->Status != ERROR_SUCCESS)
+            break;
+
+        if (pCtx->Cfg->bVerify) {
+            LONGLONG t0 = stream_ticks();
+
+            PATTERN_ERR patErr;
+
+            if (tsi721_pattern_verify(pSlot->IbBuf, pSlot->Size, pCtx->Cfg->Seed,
+                                      pSlot->Offset, &patErr) != ERROR_SUCCESS) {
+                pCtx->BadChunks++;
+                if (pCtx->VerifyStatus == ERROR_SUCCESS) {
+                    printf_s("STREAM: %llu bad bytes in chunk at offset 0x%llx, first at 0x%llx\n",
+                             patErr.BadCount, pSlot->Offset, patErr.FirstBad);
+                    pCtx->VerifyStatus = ERROR_CRC;
+                }
+            }
+
+            pCtx->VerifyTicks += stream_ticks() - t0;
+        }
+
+        ReleaseSemaphore(pCtx->hFree, 1, NULL);
+    }
+
+    return 0;
+}
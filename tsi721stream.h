@@ -0,0 +1,74 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721stream.h
+
+Description:
+
+    Pipelined chunked large-transfer (streaming) test mode.
+
+--*/
+
+#ifndef _TSI721STREAM_H_
+#define _TSI721STREAM_H_
+
+#define STREAM_MIN_SLOTS    3           // generate / transfer / verify
+#define STREAM_MAX_SLOTS    64
+#define STREAM_DEF_CHUNK    (256 * 1024)
+
+typedef struct _STREAM_CFG {
+    DWORD     DestId;       // destID of target SRIO device
+    DWORD     WinAddrHi;    // bits 63:32 of target inbound window base address
+    DWORD     WinAddrLo;    // bits 31:00 of target inbound window base address
+    DWORD     WinSize;      // size of target inbound window in bytes
+    ULONGLONG TotalBytes;   // payload size (may exceed the window size)
+    DWORD     ChunkSize;    // size of one chunk (0 = STREAM_DEF_CHUNK)
+    DWORD     SlotNum;      // number of chunk buffers in the pipeline (0 = max for window)
+    BOOL      bVerify;      // read each chunk back and verify it
+    DWORD     Seed;         // pattern seed
+    BOOL      bProgress;    // print progress once per second
+} STREAM_CFG, *PSTREAM_CFG;
+
+typedef struct _STREAM_STATS {
+    ULONGLONG Bytes;        // payload bytes written (and verified if enabled)
+    ULONGLONG Chunks;       // number of chunks
+    ULONGLONG BadChunks;    // number of chunks which failed verification
+    double    Seconds;      // wall time from first submit to last verify
+    double    MBps;         // sustained throughput (MB = 2^20 bytes)
+    double    GenSeconds;   // time spent generating data
+    double    VerifySeconds;// time spent verifying data
+} STREAM_STATS, *PSTREAM_STATS;
+
+/*
+ * tsi721_stream_run()
+ *
+ *  Streams TotalBytes of generated data into the target inbound window,
+ *  overlapping generation of chunk N+1, DMA of chunk N and verification of
+ *  chunk N-1. Chunks wrap around the window, a window region is reused only
+ *  after the chunk previously placed there was verified.
+ *
+ * Arguments:
+ *  pEng   - BDMA transfer engine
+ *  pCfg   - stream configuration
+ *  pStats - pointer to structure receiving results
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the whole payload was transferred (and verified),
+ *  ERROR_CRC     - if data verification failed,
+ *                  otherwise an error code.
+ */
+DWORD
+tsi721_stream_run(
+    __in  PDMA_ENGINE   pEng,
+    __in  PSTREAM_CFG   pCfg,
+    __out PSTREAM_STATS pStats
+    );
+
+#endif // _TSI721STREAM_H_
@@ -0,0 +1,353 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721trace.cpp
+
+Description:
+
+    Lock-free per-thread event trace rings.
+
+    Every thread records into its own ring, found through a thread-local
+    pointer. Only the owner writes the ring: the record goes in first, then
+    the head counter is published. Recording an event costs a timestamp, a
+    32-byte store and one counter update, with no locks, no atomics and no
+    shared cache lines. A new ring is registered in the global table with a
+    single interlocked increment.
+
+    The flush copies each ring without stopping the owner. The head is read
+    before and after the copy, and any record the owner may have overwritten
+    in between is dropped.
+
+--*/
+
+#include <windows.h>
+#include <string.h>
+
+#include "tsi721trace.h"
+#include "tsi721stat.h"
+
+typedef struct _TRACE_RING {
+    volatile ULONGLONG Head;    // records written since the ring was created
+    ULONGLONG          Mask;    // ring size - 1
+    DWORD              ThreadId;
+    DWORD              Index;
+    TRACE_REC          Rec[1];  // ring size entries
+} TRACE_RING, *PTRACE_RING;
+
+static volatile BOOL  g_bTraceOn = FALSE;
+static volatile LONG  g_traceFlush = 0;
+static DWORD          g_traceRecNum = 0;
+static ULONGLONG      g_traceStart = 0;
+static CHAR           g_tracePath[MAX_PATH];
+static PTRACE_RING volatile g_traceRing[TRACE_MAX_RINGS];
+static volatile LONG  g_traceRingNum = 0;
+
+static __declspec(thread) PTRACE_RING t_pRing = NULL;
+static __declspec(thread) BOOL        t_bNoRing = FALSE;
+
+static PTRACE_RING
+trace_ring_alloc(
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Allocates and registers the calling thread's ring. A thread that cannot
+    get a ring (table full or out of memory) is not traced.
+
+--*/
+{
+    PTRACE_RING pRing;
+    LONG idx;
+
+    if (t_bNoRing)
+        return NULL;
+
+    t_bNoRing = TRUE;
+
+    idx = InterlockedIncrement(&g_traceRingNum) - 1;
+    if (idx >= TRACE_MAX_RINGS)
+        return NULL;
+
+    // Physical pages are assigned on first touch, a quiet thread costs little
+    pRing = (PTRACE_RING)VirtualAlloc(NULL, sizeof(TRACE_RING) +
+                                      (SIZE_T)(g_traceRecNum - 1) * sizeof(TRACE_REC),
+                                      MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (pRing == NULL)
+        return NULL;
+
+    pRing->Head = 0;
+    pRing->Mask = g_traceRecNum - 1;
+    pRing->ThreadId = GetCurrentThreadId();
+    pRing->Index = (DWORD)idx;
+
+    g_traceRing[idx] = pRing;
+    t_pRing = pRing;
+    t_bNoRing = FALSE;
+
+    return pRing;
+}
+
+DWORD
+tsi721_trace_open(
+    PCSTR pPath,
+    DWORD dwRecNum
+    )
+{
+    DWORD n = 1;
+
+    if (pPath == NULL || strlen(pPath) >= MAX_PATH)
+        return ERROR_INVALID_PARAMETER;
+
+    if (g_traceRecNum != 0)
+        return ERROR_ALREADY_EXISTS;
+
+    if (dwRecNum == 0)
+        dwRecNum = TRACE_DEF_RECS;
+    if (dwRecNum > 0x10000000)
+        return ERROR_INVALID_PARAMETER;
+
+    while (n < dwRecNum)
+        n <<= 1;
+
+    strcpy_s(g_tracePath, MAX_PATH, pPath);
+    g_traceRecNum = n;
+    g_traceStart = lat_ticks();
+    g_bTraceOn = TRUE;
+
+    return ERROR_SUCCESS;
+}
+
+BOOL
+tsi721_trace_on(
+    VOID
+    )
+{
+    return g_bTraceOn;
+}
+
+VOID
+tsi721_trace(
+    USHORT    wEvent,
+    DWORD     dwStatus,
+    DWORD     dwArg0,
+    DWORD     dwArg1,
+    ULONGLONG Arg2,
+    ULONGLONG StartTicks
+    )
+{
+    PTRACE_RING pRing;
+    PTRACE_REC  pRec;
+    ULONGLONG   head, now;
+
+    if (!g_bTraceOn)
+        return;
+
+    pRing = t_pRing;
+    if (pRing == NULL) {
+        pRing = trace_ring_alloc();
+        if (pRing == NULL)
+            return;
+    }
+
+    now = lat_ticks();
+    head = pRing->Head;
+    pRec = &pRing->Rec[head & pRing->Mask];
+
+    pRec->Ticks = now;
+    pRec->Arg2 = Arg2;
+    pRec->Duration = StartTicks ? (DWORD)min(now - StartTicks, 0xffffffffULL) : 0;
+    pRec->Arg0 = dwArg0;
+    pRec->Arg1 = dwArg1;
+    pRec->Event = wEvent;
+    pRec->Status = (USHORT)dwStatus;
+
+    // Publish the completed record before the new head (stores are not
+    // reordered on x86, only the compiler has to be kept from doing so)
+    _ReadWriteBarrier();
+    pRing->Head = head + 1;
+}
+
+static ULONGLONG
+trace_ring_copy(
+    PTRACE_RING     pRing,
+    PTRACE_RING_HDR pHdr
+    )
+/*++
+
+Routine Description:
+
+    Copies the valid part of a ring behind its block header.
+
+Arguments:
+
+    pRing - ring
+    pHdr  - block header in the mapped file, records follow it
+
+Return Value:
+
+    Number of records copied.
+
+--*/
+{
+    PTRACE_REC pDst = (PTRACE_REC)(pHdr + 1);
+    ULONGLONG  size = pRing->Mask + 1;
+    ULONGLONG  h1, h2, n, first, valid, i;
+
+    h1 = pRing->Head;
+    _ReadWriteBarrier();
+    n = min(h1, size);
+    first = h1 - n;
+
+    for (i = 0; i < n; i++)
+        pDst[i] = pRing->Rec[(first + i) & pRing->Mask];
+
+    //
+    // Records with index below h2 + 1 - size may have been overwritten while
+    // copying (h2 is the slot being written right now).
+    //
+    _ReadWriteBarrier();
+    h2 = pRing->Head;
+    valid = (h2 + 1 > size) ? h2 + 1 - size : 0;
+    if (valid > first) {
+        ULONGLONG drop = min(valid - first, n);
+
+        MoveMemory(pDst, pDst + drop, (SIZE_T)(n - drop) * sizeof(TRACE_REC));
+        n -= drop;
+        first += drop;
+    }
+
+    pHdr->ThreadId = pRing->ThreadId;
+    pHdr->Index = pRing->Index;
+    pHdr->RecNum = n;
+    pHdr->Lost = first;
+
+    return n;
+}
+
+DWORD
+tsi721_trace_flush(
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Sizes the file for full rings, copies the rings through a writable
+    file mapping and truncates the file to the data actually written.
+
+Return Value:
+
+    ERROR_SUCCESS, ERROR_BUSY if another flush is running or an error code.
+
+--*/
+{
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    HANDLE hMap = NULL;
+    PUCHAR pView = NULL;
+    PTRACE_FILE_HDR pFile;
+    ULONGLONG maxSize, used = 0;
+    LARGE_INTEGER liSize, freq;
+    DWORD ringNum, i, dwErr = ERROR_SUCCESS;
+
+    if (g_traceRecNum == 0)
+        return ERROR_INVALID_PARAMETER;
+
+    if (InterlockedCompareExchange(&g_traceFlush, 1, 0) != 0)
+        return ERROR_BUSY;
+
+    ringNum = (DWORD)min(g_traceRingNum, TRACE_MAX_RINGS);
+    maxSize = sizeof(TRACE_FILE_HDR) +
+              ringNum * (sizeof(TRACE_RING_HDR) + (ULONGLONG)g_traceRecNum * sizeof(TRACE_REC));
+
+    hFile = CreateFileA(g_tracePath, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        dwErr = GetLastError();
+        goto exit;
+    }
+
+    hMap = CreateFileMappingA(hFile, NULL, PAGE_READWRITE, (DWORD)(maxSize >> 32),
+                              (DWORD)maxSize, NULL);
+    if (hMap == NULL) {
+        dwErr = GetLastError();
+        goto exit;
+    }
+
+    pView = (PUCHAR)MapViewOfFile(hMap, FILE_MAP_WRITE, 0, 0, 0);
+    if (pView == NULL) {
+        dwErr = GetLastError();
+        goto exit;
+    }
+
+    QueryPerformanceFrequency(&freq);
+
+    pFile = (PTRACE_FILE_HDR)pView;
+    pFile->Magic = TRACE_FILE_MAGIC;
+    pFile->Version = TRACE_FILE_VERSION;
+    pFile->RecSize = sizeof(TRACE_REC);
+    pFile->RingNum = 0;
+    pFile->Frequency = (ULONGLONG)freq.QuadPart;
+    pFile->StartTicks = g_traceStart;
+
+    used = sizeof(TRACE_FILE_HDR);
+
+    for (i = 0; i < ringNum; i++) {
+        PTRACE_RING pRing = g_traceRing[i];
+        ULONGLONG   n;
+
+        // Registered but not yet published, or allocation failed
+        if (pRing == NULL)
+            continue;
+
+        n = trace_ring_copy(pRing, (PTRACE_RING_HDR)(pView + used));
+        used += sizeof(TRACE_RING_HDR) + n * sizeof(TRACE_REC);
+        pFile->RingNum++;
+    }
+
+exit:
+
+    if (pView) {
+        FlushViewOfFile(pView, 0);
+        UnmapViewOfFile(pView);
+    }
+    if (hMap)
+        CloseHandle(hMap);
+
+    if (hFile != INVALID_HANDLE_VALUE) {
+        if (dwErr == ERROR_SUCCESS) {
+            liSize.QuadPart = (LONGLONG)used;
+            SetFilePointerEx(hFile, liSize, NULL, FILE_BEGIN);
+            SetEndOfFile(hFile);
+        }
+        CloseHandle(hFile);
+    }
+
+    InterlockedExchange(&g_traceFlush, 0);
+
+    return dwErr;
+}
+
+DWORD
+tsi721_trace_close(
+    VOID
+    )
+{
+    DWORD dwErr;
+
+    if (g_traceRecNum == 0)
+        return ERROR_SUCCESS;
+
+    dwErr = tsi721_trace_flush();
+    g_bTraceOn = FALSE;
+
+    return dwErr;
+}
@@ -0,0 +1,151 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721trace.h
+
+Description:
+
+    Lock-free per-thread event trace rings and the binary trace file format.
+
+--*/
+
+#ifndef _TSI721TRACE_H_
+#define _TSI721TRACE_H_
+
+//
+// Trace events
+//
+#define TRACE_EV_DMA_SUBMIT     1   // Arg0 = direction, Arg1 = size, Arg2 = request
+#define TRACE_EV_DMA_COMPLETE   2   // Arg0 = BDMA channel (-1 = direct call), Arg1 = size, Arg2 = request
+#define TRACE_EV_MAINT_READ     3   // Arg0 = destID, Arg1 = offset, Arg2 = value
+#define TRACE_EV_MAINT_WRITE    4   // Arg0 = destID, Arg1 = offset, Arg2 = value
+#define TRACE_EV_DB_SEND        5   // Arg0 = destID, Arg1 = info
+#define TRACE_EV_DB_RECV        6   // Arg0 = source destID, Arg1 = info
+#define TRACE_EV_MSG_SEND       7   // Arg0 = MBOX, Arg1 = size, Arg2 = destID
+#define TRACE_EV_MSG_RECV       8   // Arg0 = MBOX, Arg1 = size, Arg2 = source destID
+#define TRACE_EV_REG_READ       9   // Arg0 = registers read, Arg1 = offset, Arg2 = first value
+#define TRACE_EV_REG_WRITE      10  // Arg0 = 0, Arg1 = offset, Arg2 = value
+#define TRACE_EV_ERROR          11  // Arg0 = source line, Arg1/Arg2 = caller defined
+#define TRACE_EV_MARK           12  // Arg0/Arg1/Arg2 = caller defined
+#define TRACE_EV_NUM            13
+
+#define TRACE_DEF_RECS      65536   // default records per thread ring (power of 2)
+#define TRACE_MAX_RINGS     256     // maximum number of traced threads
+
+//
+// Fixed-size binary record (32 bytes). Durations are in performance counter
+// ticks: for synchronous operations the time spent in the call, for
+// TRACE_EV_DMA_COMPLETE the time from submission to completion.
+//
+typedef struct _TRACE_REC {
+    ULONGLONG Ticks;        // performance counter at the end of the event
+    ULONGLONG Arg2;
+    DWORD     Duration;     // ticks (0 = not applicable)
+    DWORD     Arg0;
+    DWORD     Arg1;
+    USHORT    Event;        // TRACE_EV_xxx
+    USHORT    Status;       // low 16 bits of the error code
+} TRACE_REC, *PTRACE_REC;
+
+//
+// Trace file layout: TRACE_FILE_HDR followed by RingNum blocks, each a
+// TRACE_RING_HDR followed by RecNum records in time order.
+//
+#define TRACE_FILE_MAGIC    0x54373231  // "T721"
+#define TRACE_FILE_VERSION  1
+
+typedef struct _TRACE_FILE_HDR {
+    DWORD     Magic;
+    DWORD     Version;
+    DWORD     RecSize;      // sizeof(TRACE_REC)
+    DWORD     RingNum;
+    ULONGLONG Frequency;    // performance counter ticks per second
+    ULONGLONG StartTicks;   // performance counter when tracing was enabled
+} TRACE_FILE_HDR, *PTRACE_FILE_HDR;
+
+typedef struct _TRACE_RING_HDR {
+    DWORD     ThreadId;
+    DWORD     Index;        // ring registration order
+    ULONGLONG RecNum;       // records that follow
+    ULONGLONG Lost;         // older records overwritten before the flush
+} TRACE_RING_HDR, *PTRACE_RING_HDR;
+
+/*
+ * tsi721_trace_open()
+ *
+ *  Enables tracing. Each thread that records an event gets its own ring on
+ *  first use, so producers never share a cache line or take a lock. When a
+ *  ring is full the oldest records are overwritten.
+ *
+ * Arguments:
+ *  pPath     - trace file written by tsi721_trace_flush()
+ *  dwRecNum  - records per thread ring, rounded up to a power of 2 (0 = TRACE_DEF_RECS)
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if tracing was enabled, otherwise an error code.
+ */
+DWORD
+tsi721_trace_open(
+    __in PCSTR pPath,
+    __in DWORD dwRecNum
+    );
+
+/*
+ * tsi721_trace_flush()
+ *
+ *  Writes the current content of all rings to the trace file through a file
+ *  mapping. May be called while other threads keep recording; records
+ *  overwritten during the copy are dropped and counted as lost.
+ *
+ * Return Value:
+ *  ERROR_SUCCESS - if the file was written, otherwise an error code.
+ */
+DWORD tsi721_trace_flush(VOID);
+
+/*
+ * tsi721_trace_close()
+ *
+ *  Flushes the rings and disables tracing. Ring memory is kept until the
+ *  process exits since other threads may still hold a reference to it.
+ */
+DWORD tsi721_trace_close(VOID);
+
+/*
+ * tsi721_trace()
+ *
+ *  Records one event in the calling thread's ring. Does nothing when tracing
+ *  is disabled.
+ *
+ * Arguments:
+ *  wEvent    - TRACE_EV_xxx
+ *  dwStatus  - operation status
+ *  dwArg0    - event specific
+ *  dwArg1    - event specific
+ *  Arg2      - event specific
+ *  StartTicks- performance counter at the start of the operation (0 = no duration)
+ */
+VOID
+tsi721_trace(
+    __in USHORT    wEvent,
+    __in DWORD     dwStatus,
+    __in DWORD     dwArg0,
+    __in DWORD     dwArg1,
+    __in ULONGLONG Arg2,
+    __in ULONGLONG StartTicks
+    );
+
+/*
+ * tsi721_trace_on()
+ *
+ *  TRUE if tracing is enabled; lets callers skip taking a start timestamp.
+ */
+BOOL tsi721_trace_on(VOID);
+
+#endif // _TSI721TRACE_H_
@@ -0,0 +1,244 @@
+/*++
+Copyright (c) Integrated Device Technology, Inc.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+File Name:
+
+    tsi721tracedump.cpp
+
+Description:
+
+    Offline decoder for trace files written by tsi721_trace_flush().
+    Merges the per-thread rings into one timeline and prints per-event
+    statistics (count, errors, bytes, rate and duration percentiles).
+
+    Usage: tracedump <trace_file> [timeline]
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tsi721trace.h"
+#include "tsi721stat.h"
+
+typedef struct _DUMP_REC {
+    TRACE_REC Rec;
+    DWORD     Ring;     // ring registration index
+} DUMP_REC, *PDUMP_REC;
+
+static const char *g_evName[TRACE_EV_NUM] = {
+    "?", "DMA_SUBMIT", "DMA_DONE", "MAINT_RD", "MAINT_WR", "DB_SEND", "DB_RECV",
+    "MSG_SEND", "MSG_RECV", "REG_RD", "REG_WR", "ERROR", "MARK"
+};
+
+static int
+dump_cmp(
+    const void *a,
+    const void *b
+    )
+{
+    ULONGLONG ta = ((PDUMP_REC)a)->Rec.Ticks;
+    ULONGLONG tb = ((PDUMP_REC)b)->Rec.Ticks;
+
+    return (ta < tb) ? -1 : (ta > tb) ? 1 : 0;
+}
+
+static const char *
+dump_ev_name(
+    USHORT ev
+    )
+{
+    return (ev < TRACE_EV_NUM) ? g_evName[ev] : "?";
+}
+
+static BOOL
+dump_ev_has_bytes(
+    USHORT ev
+    )
+{
+    return ev == TRACE_EV_DMA_COMPLETE || ev == TRACE_EV_MSG_SEND || ev == TRACE_EV_MSG_RECV;
+}
+
+int main(int argc, char* argv[])
+{
+    FILE          *fp = NULL;
+    PUCHAR         pData = NULL;
+    PDUMP_REC      pAll = NULL;
+    PLAT_HIST      pHist = NULL;
+    PTRACE_FILE_HDR pFile;
+    ULONGLONG      errors[TRACE_EV_NUM], bytes[TRACE_EV_NUM];
+    ULONGLONG      total = 0, lost = 0, off, n, i;
+    ULONGLONG      tFirst, tLast;
+    long           fileSize;
+    double         span, freq;
+    DWORD          r;
+    BOOL           bTimeline = FALSE;
+    int            ret = 1;
+
+    if (argc < 2) {
+        printf_s("Usage:\n");
+        printf_s("   tracedump <trace_file> [timeline]\n");
+        return 0;
+    }
+
+    if (argc > 2 && _stricmp(argv[2], "timeline") == 0)
+        bTimeline = TRUE;
+
+    if (fopen_s(&fp, argv[1], "rb") != 0 || fp == NULL) {
+        printf_s("Unable to open %s\n", argv[1]);
+        return 1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    fileSize = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    if (fileSize < (long)sizeof(TRACE_FILE_HDR)) {
+        printf_s("%s: file too short\n", argv[1]);
+        goto exit;
+    }
+
+    pData = (PUCHAR)malloc(fileSize);
+    if (pData == NULL || fread(pData, 1, fileSize, fp) != (size_t)fileSize) {
+        printf_s("%s: read failed\n", argv[1]);
+        goto exit;
+    }
+
+    pFile = (PTRACE_FILE_HDR)pData;
+    if (pFile->Magic != TRACE_FILE_MAGIC || pFile->Version != TRACE_FILE_VERSION ||
+        pFile->RecSize != sizeof(TRACE_REC)) {
+        printf_s("%s: not a trace file (or unsupported version)\n", argv[1]);
+        goto exit;
+    }
+
+    //
+    // First pass: validate ring blocks and count records
+    //
+    off = sizeof(TRACE_FILE_HDR);
+    for (r = 0; r < pFile->RingNum; r++) {
+        PTRACE_RING_HDR pRing = (PTRACE_RING_HDR)(pData + off);
+
+        if (off + sizeof(TRACE_RING_HDR) > (ULONGLONG)fileSize ||
+            off + sizeof(TRACE_RING_HDR) + pRing->RecNum * sizeof(TRACE_REC) > (ULONGLONG)fileSize) {
+            printf_s("%s: truncated ring %d\n", argv[1], r);
+            goto exit;
+        }
+
+        total += pRing->RecNum;
+        lost += pRing->Lost;
+        off += sizeof(TRACE_RING_HDR) + pRing->RecNum * sizeof(TRACE_REC);
+    }
+
+    printf_s("%s: %d threads, %llu records, %llu overwritten\n", argv[1], pFile->RingNum, total, lost);
+
+    if (total == 0) {
+        ret = 0;
+        goto exit;
+    }
+
+    pAll = (PDUMP_REC)malloc((size_t)total * sizeof(DUMP_REC));
+    pHist = (PLAT_HIST)malloc(TRACE_EV_NUM * sizeof(LAT_HIST));
+    if (pAll == NULL || pHist == NULL) {
+        printf_s("Out of memory\n");
+        goto exit;
+    }
+
+    //
+    // Second pass: gather all records and merge them by time stamp
+    //
+    off = sizeof(TRACE_FILE_HDR);
+    for (n = 0, r = 0; r < pFile->RingNum; r++) {
+        PTRACE_RING_HDR pRing = (PTRACE_RING_HDR)(pData + off);
+        PTRACE_REC      pRec = (PTRACE_REC)(pRing + 1);
+
+        printf_s("  ring %d: thread %d, %llu records\n", pRing->Index, pRing->ThreadId, pRing->RecNum);
+
+        for (i = 0; i < pRing->RecNum; i++, n++) {
+            pAll[n].Rec = pRec[i];
+            pAll[n].Ring = pRing->Index;
+        }
+
+        off += sizeof(TRACE_RING_HDR) + pRing->RecNum * sizeof(TRACE_REC);
+    }
+
+    qsort(pAll, (size_t)total, sizeof(DUMP_REC), dump_cmp);
+
+    freq = (double)pFile->Frequency;
+    tFirst = pAll[0].Rec.Ticks;
+    tLast = pAll[total - 1].Rec.Ticks;
+    span = (double)(tLast - tFirst) / freq;
+
+    if (bTimeline) {
+        printf_s("\n%12s %4s %-10s %6s %10s %10s %18s %10s\n",
+                 "time_us", "thr", "event", "status", "arg0", "arg1", "arg2", "dur_us");
+
+        for (i = 0; i < total; i++) {
+            PTRACE_REC pRec = &pAll[i].Rec;
+
+            printf_s("%12.3f %4d %-10s %6d %10u %10u %18llx %10.3f\n",
+                     (double)(pRec->Ticks - tFirst) * 1e6 / freq, pAll[i].Ring,
+                     dump_ev_name(pRec->Event), pRec->Status, pRec->Arg0, pRec->Arg1,
+                     pRec->Arg2, (double)pRec->Duration * 1e6 / freq);
+        }
+    }
+
+    //
+    // Per-event statistics
+    //
+    for (r = 0; r < TRACE_EV_NUM; r++) {
+        lat_hist_init(&pHist[r]);
+        errors[r] = 0;
+        bytes[r] = 0;
+    }
+
+    for (i = 0; i < total; i++) {
+        PTRACE_REC pRec = &pAll[i].Rec;
+        USHORT     ev = (pRec->Event < TRACE_EV_NUM) ? pRec->Event : 0;
+
+        lat_hist_add(&pHist[ev], (ULONGLONG)((double)pRec->Duration * 1e9 / freq));
+        if (pRec->Status)
+            errors[ev]++;
+        if (dump_ev_has_bytes(ev) && pRec->Status == 0)
+            bytes[ev] += pRec->Arg1;
+    }
+
+    printf_s("\nTrace span %.6f s\n", span);
+    printf_s("%-10s %10s %8s %12s %12s %10s %10s %10s %10s\n",
+             "event", "count", "errors", "ops/s", "MB/s", "p50_us", "p99_us", "max_us", "mean_us");
+
+    for (r = 1; r < TRACE_EV_NUM; r++) {
+        PLAT_HIST pH = &pHist[r];
+
+        if (pH->Count == 0)
+            continue;
+
+        printf_s("%-10s %10llu %8llu %12.0f %12.2f %10.3f %10.3f %10.3f %10.3f\n",
+                 dump_ev_name((USHORT)r), pH->Count, errors[r],
+                 span > 0.0 ? (double)pH->Count / span : 0.0,
+                 span > 0.0 ? (double)bytes[r] / (1024.0 * 1024.0) / span : 0.0,
+                 (double)lat_hist_percentile(pH, 50.0) / 1e3,
+                 (double)lat_hist_percentile(pH, 99.0) / 1e3,
+                 (double)pH->Max / 1e3, lat_hist_mean(pH) / 1e3);
+    }
+
+    ret = 0;
+
+exit:
+
+    if (pHist)
+        free(pHist);
+    if (pAll)
+        free(pAll);
+    if (pData)
+        free(pData);
+    if (fp)
+        fclose(fp);
+
+    return ret;
+}